@@ -0,0 +1,91 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+/// Pool of reusable buffers
+/**
+ * Buffers are handed out as shared_ptr. When the last reference is gone, the
+ * buffer goes back into the pool instead of being freed, so that buffers that
+ * are shared with other threads (e.g. messages referencing a receive buffer)
+ * don't cause an allocation per use.
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+public:
+    using Buffer = std::vector<char>;
+
+    /// @param max_pooled maximum number of unused buffers that are kept
+    explicit BufferPool(size_t max_pooled) : max_pooled_(max_pooled)
+    {
+    }
+
+    /// @return a buffer of at least @p size bytes
+    std::shared_ptr<Buffer> get(size_t size)
+    {
+        std::unique_ptr<Buffer> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!pool_.empty())
+            {
+                buffer = std::move(pool_.back());
+                pool_.pop_back();
+            }
+        }
+        if (!buffer)
+            buffer = std::make_unique<Buffer>();
+        if (buffer->size() < size)
+            buffer->resize(size);
+
+        std::weak_ptr<BufferPool> pool = shared_from_this();
+        return std::shared_ptr<Buffer>(buffer.release(), [pool](Buffer* buffer) {
+            if (auto self = pool.lock())
+                self->put(std::unique_ptr<Buffer>(buffer));
+            else
+                delete buffer;
+        });
+    }
+
+    /// @return number of unused buffers in the pool
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pool_.size();
+    }
+
+private:
+    void put(std::unique_ptr<Buffer> buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pool_.size() < max_pooled_)
+            pool_.push_back(std::move(buffer));
+    }
+
+    size_t max_pooled_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> pool_;
+};
+
+
+#endif
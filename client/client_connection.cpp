@@ -20,20 +20,42 @@
 #include "common/aixlog.hpp"
 #include "common/snap_exception.hpp"
 #include "common/str_compat.hpp"
+#include "common/utils/timestamping.hpp"
 #include "message/hello.hpp"
+#include "message/pcm_chunk.hpp"
+#include "message/time.hpp"
+#include "time_provider.hpp"
+#include <algorithm>
 #include <iostream>
 #include <mutex>
+#include <sstream>
 
 
 using namespace std;
 
 static constexpr auto LOG_TAG = "Connection";
+/// Max number of time requests waiting for a TX timestamp
+static constexpr size_t kMaxTimeRequests = 16;
+/// Delay before starting the next parallel connection attempt ("Connection Attempt Delay", RFC 8305)
+static constexpr auto kConnectionAttemptDelay = std::chrono::milliseconds(250);
+/// Timeout for all connection attempts together
+static constexpr auto kConnectTimeout = std::chrono::seconds(5);
+/// Size of the receive buffers, to receive many messages with one read
+static constexpr size_t kReceiveBufferSize = 32 * 1024;
+/// Minimum free space in the receive buffer for a read
+static constexpr size_t kMinReceiveSpace = 4 * 1024;
+/// Unused receive buffers that are kept for reuse
+static constexpr size_t kMaxPooledBuffers = 16;
+/// Timeout for time requests over UDP, before resending them on the stream connection
+static constexpr chronos::usec kUdpTimeout = std::chrono::milliseconds(500);
+/// Consecutive UDP time requests without response before falling back to the stream connection
+static constexpr size_t kMaxUdpFailures = 3;
 
 ClientConnection::ClientConnection(boost::asio::io_context& io_context, const ClientSettings::Server& server)
-    : io_context_(io_context), resolver_(io_context_), socket_(io_context_), reqId_(1), server_(server), strand_(io_context_)
+    : io_context_(io_context), resolver_(io_context_), socket_(io_context_), reqId_(1), server_(server), strand_(io_context_),
+      bufferPool_(std::make_shared<BufferPool>(kMaxPooledBuffers)), rx_begin_(0), rx_end_(0), timestamping_(false), txTimestamping_(false), tx_bytes_(0), udpSocket_(io_context_),
+      timeSyncPort_(0), udpFailures_(0)
 {
-    base_msg_size_ = base_message_.getSize();
-    buffer_.resize(base_msg_size_);
 }
 
 
@@ -60,58 +82,174 @@ std::string ClientConnection::getMacAddress()
 
 void ClientConnection::connect(const ResultHandler& handler)
 {
-    tcp::resolver::query query(server_.host, cpt::to_string(server_.port), boost::asio::ip::resolver_query_base::numeric_service);
-    boost::system::error_code ec;
-    LOG(INFO, LOG_TAG) << "Resolving host IP for: " << server_.host << "\n";
-    auto iterator = resolver_.resolve(query, ec);
-    if (ec)
-    {
-        LOG(ERROR, LOG_TAG) << "Failed to resolve host '" << server_.host << "', error: " << ec.message() << "\n";
-        handler(ec);
-        return;
-    }
+    boost::asio::post(strand_, [this, handler]() {
+        if (connect_)
+            stopConnect(connect_, nullptr);
+        auto connect = make_shared<Connect>(io_context_);
+        connect->handler = handler;
+        connect_ = connect;
+
+        connect->timeout.expires_after(kConnectTimeout);
+        connect->timeout.async_wait(boost::asio::bind_executor(strand_, [this, connect](const boost::system::error_code& ec) {
+            if (!ec && !connect->done)
+                finishConnect(connect, boost::asio::error::timed_out, nullptr);
+        }));
+
+        // the last server address is tried while resolving the host
+        if (lastEndpoint_.port() != 0)
+        {
+            connect->endpoints.push_back(lastEndpoint_);
+            startConnectAttempt(connect);
+        }
 
-    LOG(INFO, LOG_TAG) << "Connecting\n";
-    socket_.connect(*iterator, ec);
-    if (ec)
+        LOG(DEBUG, LOG_TAG) << "Resolving host IP for: " << server_.host << "\n";
+        resolver_.async_resolve(
+            server_.host, cpt::to_string(server_.port), boost::asio::ip::resolver_query_base::numeric_service,
+            boost::asio::bind_executor(strand_, [this, connect](const boost::system::error_code& ec, tcp::resolver::results_type results) {
+                if (connect->done)
+                    return;
+                connect->resolved = true;
+                if (ec)
+                {
+                    LOG(DEBUG, LOG_TAG) << "Failed to resolve host '" << server_.host << "', error: " << ec.message() << "\n";
+                    connect->ec = ec;
+                }
+                else
+                {
+                    // alternate between the address families, starting with the preferred one (RFC 8305)
+                    std::deque<tcp::endpoint> preferred;
+                    std::deque<tcp::endpoint> other;
+                    for (const auto& entry : results)
+                    {
+                        const auto& endpoint = entry.endpoint();
+                        if (std::find(connect->endpoints.begin(), connect->endpoints.end(), endpoint) != connect->endpoints.end())
+                            continue;
+                        if (preferred.empty() || (preferred.front().protocol() == endpoint.protocol()))
+                            preferred.push_back(endpoint);
+                        else
+                            other.push_back(endpoint);
+                    }
+                    while (!preferred.empty() || !other.empty())
+                    {
+                        for (auto* endpoints : {&preferred, &other})
+                        {
+                            if (endpoints->empty())
+                                continue;
+                            connect->endpoints.push_back(endpoints->front());
+                            endpoints->pop_front();
+                        }
+                    }
+                }
+                if (!connect->delayed)
+                    startConnectAttempt(connect);
+            }));
+    });
+}
+
+
+void ClientConnection::setServer(const ClientSettings::Server& server)
+{
+    server_ = server;
+    lastEndpoint_ = tcp::endpoint();
+}
+
+
+void ClientConnection::startConnectAttempt(const std::shared_ptr<Connect>& connect)
+{
+    if (connect->done)
+        return;
+    if (connect->next >= connect->endpoints.size())
     {
-        LOG(ERROR, LOG_TAG) << "Failed to connect to host '" << server_.host << "', error: " << ec.message() << "\n";
-        handler(ec);
+        if (connect->resolved && (connect->running == 0))
+            finishConnect(connect, connect->ec ? connect->ec : boost::asio::error::host_not_found, nullptr);
         return;
     }
-    LOG(NOTICE, LOG_TAG) << "Connected to " << socket_.remote_endpoint().address().to_string() << endl;
-    handler(ec);
 
-#if 0
-    resolver_.async_resolve(query, host_, cpt::to_string(port_), [this, handler](const boost::system::error_code& ec, tcp::resolver::results_type results) {
-        if (ec)
+    tcp::endpoint endpoint = connect->endpoints[connect->next++];
+    LOG(DEBUG, LOG_TAG) << "Connecting to " << endpoint << "\n";
+    connect->sockets.push_back(make_unique<tcp::socket>(io_context_));
+    auto* socket = connect->sockets.back().get();
+    ++connect->running;
+    socket->async_connect(endpoint, boost::asio::bind_executor(strand_, [this, connect, socket, endpoint](const boost::system::error_code& ec) {
+        --connect->running;
+        if (connect->done)
+            return;
+        if (!ec)
         {
-            LOG(ERROR, LOG_TAG) << "Failed to resolve host '" << host_ << "', error: " << ec.message() << "\n";
-            handler(ec);
+            finishConnect(connect, ec, socket);
             return;
         }
+        LOG(DEBUG, LOG_TAG) << "Failed to connect to " << endpoint << ", error: " << ec.message() << "\n";
+        connect->ec = ec;
+        // no need to wait for the delay if the attempt failed
+        connect->delay.cancel();
+        connect->delayed = false;
+        startConnectAttempt(connect);
+    }));
+
+    connect->delayed = true;
+    connect->delay.expires_after(kConnectionAttemptDelay);
+    connect->delay.async_wait(boost::asio::bind_executor(strand_, [this, connect](const boost::system::error_code& ec) {
+        if (ec || connect->done)
+            return;
+        connect->delayed = false;
+        startConnectAttempt(connect);
+    }));
+}
+
 
+void ClientConnection::stopConnect(const std::shared_ptr<Connect>& connect, const tcp::socket* socket)
+{
+    connect->done = true;
+    connect->delay.cancel();
+    connect->timeout.cancel();
+    if (!connect->resolved)
         resolver_.cancel();
-        socket_.async_connect(*results, [this, handler](const boost::system::error_code& ec) {
-            if (ec)
-            {
-                LOG(ERROR, LOG_TAG) << "Failed to connect to host '" << host_ << "', error: " << ec.message() << "\n";
-                handler(ec);
-                return;
-            }
+    boost::system::error_code ec;
+    for (auto& attempt : connect->sockets)
+    {
+        if (attempt.get() != socket)
+            attempt->close(ec);
+    }
+    if (connect_ == connect)
+        connect_ = nullptr;
+}
 
-            LOG(NOTICE, LOG_TAG) << "Connected to " << socket_.remote_endpoint().address().to_string() << endl;
-            handler(ec);
-            getNextMessage();
-        });
-    });
-#endif
+
+void ClientConnection::finishConnect(const std::shared_ptr<Connect>& connect, const boost::system::error_code& ec, tcp::socket* socket)
+{
+    stopConnect(connect, socket);
+    if (ec || (socket == nullptr))
+    {
+        LOG(DEBUG, LOG_TAG) << "Failed to connect to host '" << server_.host << "', error: " << ec.message() << "\n";
+        connect->handler(ec);
+        return;
+    }
+
+    socket_ = std::move(*socket);
+    rx_buffer_ = nullptr;
+    rx_begin_ = 0;
+    rx_end_ = 0;
+    timeResponseDue_ = chronos::time_point_clk::min();
+    boost::system::error_code error;
+    lastEndpoint_ = socket_.remote_endpoint(error);
+    LOG(NOTICE, LOG_TAG) << "Connected to " << lastEndpoint_.address().to_string() << endl;
+    timestamping_ = utils::timestamping::enable(socket_.native_handle(), true);
+    txTimestamping_ = timestamping_;
+    tx_bytes_ = 0;
+    timeRequests_.clear();
+    LOG(DEBUG, LOG_TAG) << "Kernel timestamps: " << (timestamping_ ? "enabled" : "not available") << "\n";
+    connect->handler(ec);
 }
 
 
 void ClientConnection::disconnect()
 {
     LOG(DEBUG, LOG_TAG) << "Disconnecting\n";
+    if (connect_)
+        stopConnect(connect_, nullptr);
+    closeTimeSocket();
+    timeSyncPort_ = 0;
     if (!socket_.is_open())
     {
         LOG(DEBUG, LOG_TAG) << "Not connected\n";
@@ -132,19 +270,27 @@ void ClientConnection::disconnect()
 void ClientConnection::sendNext()
 {
     auto& message = messages_.front();
-    static boost::asio::streambuf streambuf;
-    std::ostream stream(&streambuf);
+    std::ostream stream(&tx_streambuf_);
     tv t;
     message.msg->sent = t;
     message.msg->serialize(stream);
     auto handler = message.handler;
+    auto msg = message.msg;
 
-    boost::asio::async_write(socket_, streambuf, boost::asio::bind_executor(strand_, [this, handler](boost::system::error_code ec, std::size_t length) {
+    boost::asio::async_write(socket_, tx_streambuf_, boost::asio::bind_executor(strand_, [this, handler, msg](boost::system::error_code ec, std::size_t length) {
                                  if (ec)
                                      LOG(ERROR, LOG_TAG) << "Failed to send message, error: " << ec.message() << "\n";
                                  else
                                      LOG(TRACE, LOG_TAG) << "Wrote " << length << " bytes to socket\n";
 
+                                 if (!ec && txTimestamping_ && (msg->type == message_type::kTime))
+                                 {
+                                     timeRequests_.push_back({msg->id, TimeProvider::toTimePoint(msg->sent), tx_bytes_ + static_cast<uint32_t>(length) - 1});
+                                     if (timeRequests_.size() > kMaxTimeRequests)
+                                         timeRequests_.pop_front();
+                                 }
+                                 tx_bytes_ += static_cast<uint32_t>(length);
+
                                  messages_.pop_front();
                                  if (handler)
                                      handler(ec);
@@ -172,88 +318,316 @@ void ClientConnection::send(const msg::message_ptr& message, const ResultHandler
 void ClientConnection::sendRequest(const msg::message_ptr& message, const chronos::usec& timeout, const MessageHandler<msg::BaseMessage>& handler)
 {
     boost::asio::post(strand_, [this, message, timeout, handler]() {
-        pendingRequests_.erase(
-            std::remove_if(pendingRequests_.begin(), pendingRequests_.end(), [](std::weak_ptr<PendingRequest> request) { return request.expired(); }),
-            pendingRequests_.end());
-        unique_ptr<msg::BaseMessage> response(nullptr);
-        if (++reqId_ >= 10000)
-            reqId_ = 1;
-        message->id = reqId_;
-        auto request = make_shared<PendingRequest>(io_context_, strand_, reqId_, handler);
-        pendingRequests_.push_back(request);
-        request->startTimer(timeout);
-        send(message, [handler](const boost::system::error_code& ec) {
+        if ((message->type == message_type::kTime) && udpSocket_.is_open())
+            sendTimeRequest(message, timeout, handler);
+        else
+            sendStreamRequest(message, timeout, handler);
+    });
+}
+
+
+std::shared_ptr<PendingRequest> ClientConnection::addPendingRequest(const msg::message_ptr& message, const chronos::usec& timeout,
+                                                                    const MessageHandler<msg::BaseMessage>& handler)
+{
+    pendingRequests_.erase(
+        std::remove_if(pendingRequests_.begin(), pendingRequests_.end(), [](std::weak_ptr<PendingRequest> request) { return request.expired(); }),
+        pendingRequests_.end());
+    if (++reqId_ >= 10000)
+        reqId_ = 1;
+    message->id = reqId_;
+    auto request = make_shared<PendingRequest>(io_context_, strand_, reqId_, handler);
+    pendingRequests_.push_back(request);
+    request->startTimer(timeout);
+    return request;
+}
+
+
+void ClientConnection::sendStreamRequest(const msg::message_ptr& message, const chronos::usec& timeout, const MessageHandler<msg::BaseMessage>& handler)
+{
+    if (message->type == message_type::kTime)
+        timeResponseDue_ = chronos::clk::now() + timeout;
+    addPendingRequest(message, timeout, handler);
+    send(message, [handler](const boost::system::error_code& ec) {
+        if (ec)
+            handler(ec, nullptr);
+    });
+}
+
+
+void ClientConnection::sendTimeRequest(const msg::message_ptr& message, const chronos::usec& timeout, const MessageHandler<msg::BaseMessage>& handler)
+{
+    addPendingRequest(message, std::min(timeout, kUdpTimeout),
+                      [this, message, timeout, handler](const boost::system::error_code& ec, std::unique_ptr<msg::BaseMessage> response) {
+                          if (ec == boost::asio::error::timed_out)
+                          {
+                              if ((++udpFailures_ >= kMaxUdpFailures) && udpSocket_.is_open())
+                              {
+                                  LOG(WARNING, LOG_TAG) << "No time sync response on UDP port " << timeSyncPort_
+                                                        << ", falling back to the stream connection\n";
+                                  closeTimeSocket();
+                              }
+                              sendStreamRequest(message, timeout, handler);
+                              return;
+                          }
+                          if (!ec)
+                              udpFailures_ = 0;
+                          handler(ec, std::move(response));
+                      });
+
+    std::ostringstream oss;
+    message->sent = tv();
+    message->serialize(oss);
+    std::string data = oss.str();
+    boost::system::error_code ec;
+    udpSocket_.send(boost::asio::buffer(data), 0, ec);
+    // a failed send is handled like a lost response
+    if (ec)
+        LOG(DEBUG, LOG_TAG) << "Failed to send time request over UDP: " << ec.message() << "\n";
+}
+
+
+void ClientConnection::setTimeSyncPort(uint16_t port)
+{
+    boost::asio::post(strand_, [this, port]() {
+        // the socket stays closed after falling back to the stream connection
+        if (port == timeSyncPort_)
+            return;
+        closeTimeSocket();
+        timeSyncPort_ = port;
+        if (port == 0)
+            return;
+
+        boost::system::error_code ec;
+        udp::endpoint endpoint(socket_.remote_endpoint(ec).address(), port);
+        if (!ec)
+            udpSocket_.open(endpoint.protocol(), ec);
+        if (!ec)
+            udpSocket_.connect(endpoint, ec);
+        if (ec)
+        {
+            LOG(WARNING, LOG_TAG) << "Failed to open time sync socket: " << ec.message() << "\n";
+            closeTimeSocket();
+            return;
+        }
+        utils::timestamping::enable(udpSocket_.native_handle(), false);
+        setTxTimestamping(false);
+        udpFailures_ = 0;
+        LOG(INFO, LOG_TAG) << "Time sync over UDP port " << port << "\n";
+        receiveTime();
+    });
+}
+
+
+void ClientConnection::closeTimeSocket()
+{
+    if (!udpSocket_.is_open())
+        return;
+    boost::system::error_code ec;
+    udpSocket_.close(ec);
+    setTxTimestamping(true);
+}
+
+
+void ClientConnection::setTxTimestamping(bool enable)
+{
+    if (!timestamping_ || (enable == txTimestamping_) || !socket_.is_open())
+        return;
+    // without time requests on the stream connection nobody reads the TX timestamps, they would fill the error queue
+    txTimestamping_ = utils::timestamping::enable(socket_.native_handle(), enable) && enable;
+    utils::timestamping::readTxTimestamps(socket_.native_handle(), [](uint32_t, const chronos::time_point_clk&) {});
+    // the TX timestamp ids restart with the unacknowledged data, which is nothing, as long as the server acknowledges our sends
+    tx_bytes_ = 0;
+    timeRequests_.clear();
+}
+
+
+void ClientConnection::receiveTime()
+{
+    utils::timestamping::async_receive_from(
+        udpSocket_, strand_, udpBuffer_.data(), udpBuffer_.size(), udpSender_,
+        [this](const boost::system::error_code& ec, std::size_t length, const chronos::time_point_clk& received) {
+            if (ec == boost::asio::error::operation_aborted || !udpSocket_.is_open())
+                return;
             if (ec)
-                handler(ec, nullptr);
+            {
+                // e.g. connection refused, if the port is not reachable
+                LOG(DEBUG, LOG_TAG) << "Error receiving time response: " << ec.message() << "\n";
+                receiveTime();
+                return;
+            }
+
+            msg::BaseMessage base;
+            if (length >= base.getSize())
+            {
+                base.deserialize(udpBuffer_.data());
+                if ((base.type == message_type::kTime) && (length == base.getSize() + base.size))
+                {
+                    base.received = received;
+                    auto response = msg::factory::createMessage(base, udpBuffer_.data() + base.getSize());
+                    if (!setResponse(response))
+                        LOG(DEBUG, LOG_TAG) << "No pending request for time response " << base.refersTo << "\n";
+                }
+            }
+            receiveTime();
         });
+}
+
+
+bool ClientConnection::setResponse(std::unique_ptr<msg::BaseMessage>& response)
+{
+    for (auto iter = pendingRequests_.begin(); iter != pendingRequests_.end(); ++iter)
+    {
+        if (auto req = iter->lock())
+        {
+            if (req->id() == response->refersTo)
+            {
+                req->setValue(std::move(response));
+                pendingRequests_.erase(iter);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+void ClientConnection::applyTxTimestamp(msg::BaseMessage& response)
+{
+    utils::timestamping::readTxTimestamps(socket_.native_handle(), [this, &response](uint32_t key, const chronos::time_point_clk& timestamp) {
+        for (const auto& request : timeRequests_)
+        {
+            if ((request.key != key) || (request.id != response.refersTo))
+                continue;
+            // the server measured the latency from the user space send time
+            auto correction = std::chrono::duration_cast<chronos::usec>(timestamp - request.sent).count();
+            if (correction > 0)
+            {
+                auto& time = static_cast<msg::Time&>(response);
+                time.latency = time.latency - tv(static_cast<int32_t>(correction / 1000000), static_cast<int32_t>(correction % 1000000));
+            }
+        }
     });
+    timeRequests_.erase(std::remove_if(timeRequests_.begin(), timeRequests_.end(), [&response](const TimeRequest& request) { return request.id == response.refersTo; }),
+                        timeRequests_.end());
+}
+
+
+std::unique_ptr<msg::BaseMessage> ClientConnection::parseMessage(boost::system::error_code& ec)
+{
+    msg::BaseMessage base;
+    if (!rx_buffer_ || (rx_end_ - rx_begin_ < base.getSize()))
+        return nullptr;
+
+    char* data = rx_buffer_->data() + rx_begin_;
+    base.deserialize(data);
+    // LOG(TRACE, LOG_TAG) << "getNextMessage: " << base.type << ", size: " << base.size << ", id: " << base.id << ", refers: " << base.refersTo << "\n";
+    if (base.type > message_type::kLast)
+    {
+        LOG(ERROR, LOG_TAG) << "unknown message type received: " << base.type << ", size: " << base.size << "\n";
+        ec = boost::asio::error::invalid_argument;
+        return nullptr;
+    }
+    else if (base.size > msg::max_size)
+    {
+        LOG(ERROR, LOG_TAG) << "received message of type " << base.type << " to large: " << base.size << "\n";
+        ec = boost::asio::error::invalid_argument;
+        return nullptr;
+    }
+    if (rx_end_ - rx_begin_ < base.getSize() + base.size)
+        return nullptr;
+
+    rx_begin_ += base.getSize() + base.size;
+    base.received = rx_received_;
+    if (base.type == message_type::kTime)
+        timeResponseDue_ = chronos::time_point_clk::min();
+    char* payload = data + base.getSize();
+    if (base.type == message_type::kWireChunk)
+    {
+        // the chunk's payload points into the receive buffer
+        auto chunk = std::make_unique<msg::PcmChunk>();
+        chunk->deserialize(base, payload, rx_buffer_);
+        return chunk;
+    }
+    return msg::factory::createMessage(base, payload);
+}
+
+
+size_t ClientConnection::prepareReceiveBuffer()
+{
+    msg::BaseMessage base;
+    size_t available = rx_buffer_ ? (rx_end_ - rx_begin_) : 0;
+    // size of the message that is currently received
+    size_t message_size = base.getSize();
+    if (available >= base.getSize())
+    {
+        base.deserialize(rx_buffer_->data() + rx_begin_);
+        message_size += base.size;
+    }
+    size_t missing = (message_size > available) ? (message_size - available) : 0;
+    if (rx_buffer_ && (rx_buffer_->size() - rx_end_ >= std::max(missing, kMinReceiveSpace)))
+        return missing;
+
+    // the old buffer goes back into the pool, when the last message referencing it is gone
+    auto buffer = bufferPool_->get(std::max(kReceiveBufferSize, message_size));
+    if (available > 0)
+        memcpy(buffer->data(), rx_buffer_->data() + rx_begin_, available);
+    rx_buffer_ = buffer;
+    rx_begin_ = 0;
+    rx_end_ = available;
+    return missing;
 }
 
 
 void ClientConnection::getNextMessage(const MessageHandler<msg::BaseMessage>& handler)
 {
-    boost::asio::async_read(socket_, boost::asio::buffer(buffer_, base_msg_size_),
-                            boost::asio::bind_executor(strand_, [this, handler](boost::system::error_code ec, std::size_t length) mutable {
-                                if (ec)
-                                {
-                                    LOG(ERROR, LOG_TAG) << "Error reading message header of length " << length << ": " << ec.message() << "\n";
-                                    if (handler)
-                                        handler(ec, nullptr);
-                                    return;
-                                }
-
-                                base_message_.deserialize(buffer_.data());
-                                tv t;
-                                base_message_.received = t;
-                                // LOG(TRACE, LOG_TAG) << "getNextMessage: " << base_message_.type << ", size: " << base_message_.size << ", id: " <<
-                                // base_message_.id << ", refers: " << base_message_.refersTo << "\n";
-                                if (base_message_.type > message_type::kLast)
-                                {
-                                    LOG(ERROR, LOG_TAG) << "unknown message type received: " << base_message_.type << ", size: " << base_message_.size << "\n";
-                                    if (handler)
-                                        handler(boost::asio::error::invalid_argument, nullptr);
-                                    return;
-                                }
-                                else if (base_message_.size > msg::max_size)
-                                {
-                                    LOG(ERROR, LOG_TAG) << "received message of type " << base_message_.type << " to large: " << base_message_.size << "\n";
-                                    if (handler)
-                                        handler(boost::asio::error::invalid_argument, nullptr);
-                                    return;
-                                }
-
-                                if (base_message_.size > buffer_.size())
-                                    buffer_.resize(base_message_.size);
-
-                                boost::asio::async_read(
-                                    socket_, boost::asio::buffer(buffer_, base_message_.size),
-                                    boost::asio::bind_executor(strand_, [this, handler](boost::system::error_code ec, std::size_t length) mutable {
-                                        if (ec)
-                                        {
-                                            LOG(ERROR, LOG_TAG) << "Error reading message body of length " << length << ": " << ec.message() << "\n";
-                                            if (handler)
-                                                handler(ec, nullptr);
-                                            return;
-                                        }
-
-                                        auto response = msg::factory::createMessage(base_message_, buffer_.data());
-                                        for (auto iter = pendingRequests_.begin(); iter != pendingRequests_.end(); ++iter)
-                                        {
-                                            auto request = *iter;
-                                            if (auto req = request.lock())
-                                            {
-                                                if (req->id() == base_message_.refersTo)
-                                                {
-                                                    req->setValue(std::move(response));
-                                                    pendingRequests_.erase(iter);
-                                                    getNextMessage(handler);
-                                                    return;
-                                                }
-                                            }
-                                        }
-
-                                        if (handler)
-                                            handler(ec, std::move(response));
-                                    }));
-                            }));
+    // a single read can contain many messages, parse the buffered ones first
+    boost::system::error_code ec;
+    std::unique_ptr<msg::BaseMessage> message;
+    while ((message = parseMessage(ec)) != nullptr)
+    {
+        if (txTimestamping_ && (message->type == message_type::kTime))
+            applyTxTimestamp(*message);
+        if (!setResponse(message))
+            break;
+    }
+
+    if (ec)
+    {
+        if (handler)
+            handler(ec, nullptr);
+        return;
+    }
+
+    if (message)
+    {
+        boost::asio::post(strand_, [handler, message = std::move(message)]() mutable {
+            if (handler)
+                handler({}, std::move(message));
+        });
+        return;
+    }
+
+    size_t missing = prepareReceiveBuffer();
+    auto buffer = rx_buffer_;
+    size_t size = buffer->size() - rx_end_;
+    // A read returns the RX timestamp of the last segment only. While a time response is expected,
+    // read one message (header and payload) at a time, so that the response gets the arrival time of its header.
+    if (chronos::clk::now() < timeResponseDue_)
+        size = std::min(size, missing);
+    utils::timestamping::async_read_some(socket_, strand_, buffer->data() + rx_end_, size,
+                                         [this, handler, buffer](const boost::system::error_code& ec, std::size_t length, const chronos::time_point_clk& received) {
+                                             if (ec)
+                                             {
+                                                 LOG(ERROR, LOG_TAG) << "Error reading from socket: " << ec.message() << "\n";
+                                                 if (handler)
+                                                     handler(ec, nullptr);
+                                                 return;
+                                             }
+                                             // the header of the current message completes with this read
+                                             msg::BaseMessage base;
+                                             if (rx_end_ - rx_begin_ < base.getSize())
+                                                 rx_received_ = received;
+                                             rx_end_ += length;
+                                             getNextMessage(handler);
+                                         });
 }
@@ -19,11 +19,13 @@
 #ifndef CLIENT_CONNECTION_H
 #define CLIENT_CONNECTION_H
 
+#include "buffer_pool.hpp"
 #include "client_settings.hpp"
 #include "common/time_defs.hpp"
 #include "message/factory.hpp"
 #include "message/message.hpp"
 
+#include <array>
 #include <atomic>
 #include <boost/asio.hpp>
 #include <condition_variable>
@@ -36,6 +38,7 @@
 
 
 using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
 
 
 class ClientConnection;
@@ -130,8 +133,11 @@ public:
     virtual ~ClientConnection();
 
     /// async connect
+    /// Tries the last connected endpoint and all resolved addresses of the server in parallel, staggered by a short delay
     /// @param handler async result handler
     void connect(const ResultHandler& handler);
+    /// Set the server to connect to, e.g. after it has been found again with mDNS
+    void setServer(const ClientSettings::Server& server);
     /// disconnect the socket
     void disconnect();
 
@@ -160,6 +166,10 @@ public:
         });
     }
 
+    /// Send time requests over UDP to this port of the server, falls back to the stream connection if not reachable
+    /// @param port the server's time sync port, 0 to disable
+    void setTimeSyncPort(uint16_t port);
+
     std::string getMacAddress();
 
     /// async get the next message
@@ -167,11 +177,63 @@ public:
     void getNextMessage(const MessageHandler<msg::BaseMessage>& handler);
 
 protected:
-    void sendNext();
+    /// An ongoing connect with parallel connection attempts
+    struct Connect
+    {
+        explicit Connect(boost::asio::io_context& io_context) : delay(io_context), timeout(io_context)
+        {
+        }
+        ResultHandler handler;
+        /// endpoints to connect to, alternating address families
+        std::vector<tcp::endpoint> endpoints;
+        std::vector<std::unique_ptr<tcp::socket>> sockets;
+        /// index of the next endpoint to try
+        size_t next{0};
+        /// number of pending connection attempts
+        size_t running{0};
+        bool resolved{false};
+        /// waiting for the connection attempt delay
+        bool delayed{false};
+        bool done{false};
+        /// last error
+        boost::system::error_code ec;
+        boost::asio::steady_timer delay;
+        boost::asio::steady_timer timeout;
+    };
 
-    msg::BaseMessage base_message_;
-    std::vector<char> buffer_;
-    size_t base_msg_size_;
+    /// Start the connection attempt to the next endpoint
+    void startConnectAttempt(const std::shared_ptr<Connect>& connect);
+    /// Stop all connection attempts, except for @p socket
+    void stopConnect(const std::shared_ptr<Connect>& connect, const tcp::socket* socket);
+    /// Stop the connect and pass the result to the connect handler
+    void finishConnect(const std::shared_ptr<Connect>& connect, const boost::system::error_code& ec, tcp::socket* socket);
+
+    void sendNext();
+    /// Parse the next complete message from the receive buffer
+    /// @param ec set on invalid messages
+    /// @return the message, or nullptr if it's not yet completely received
+    std::unique_ptr<msg::BaseMessage> parseMessage(boost::system::error_code& ec);
+    /// Make sure there is space in the receive buffer for the rest of the current message
+    /// @return number of bytes that are missing to complete the current message (or its header)
+    size_t prepareReceiveBuffer();
+    /// Correct the client to server latency of a time response with the kernel's TX timestamp of the request
+    void applyTxTimestamp(msg::BaseMessage& response);
+    /// Create a pending request with a new request id for the message
+    std::shared_ptr<PendingRequest> addPendingRequest(const msg::message_ptr& message, const chronos::usec& timeout,
+                                                      const MessageHandler<msg::BaseMessage>& handler);
+    /// Send a request on the stream connection
+    void sendStreamRequest(const msg::message_ptr& message, const chronos::usec& timeout, const MessageHandler<msg::BaseMessage>& handler);
+    /// Send a time request over the UDP socket, resend it on the stream connection on timeout
+    void sendTimeRequest(const msg::message_ptr& message, const chronos::usec& timeout, const MessageHandler<msg::BaseMessage>& handler);
+    /// Receive loop for time responses on the UDP socket
+    void receiveTime();
+    /// Close the UDP time sync socket, time requests are sent on the stream connection afterwards
+    void closeTimeSocket();
+    /// Enable or disable the TX timestamps of the stream connection, they are only needed for time requests sent on it
+    void setTxTimestamping(bool enable);
+    /// Pass the response to the pending request
+    /// @return false if there is no pending request for the response
+    bool setResponse(std::unique_ptr<msg::BaseMessage>& response);
 
     boost::asio::io_context& io_context_;
     tcp::resolver resolver_;
@@ -179,8 +241,23 @@ protected:
     std::vector<std::weak_ptr<PendingRequest>> pendingRequests_;
     uint16_t reqId_;
     ClientSettings::Server server_;
+    std::shared_ptr<Connect> connect_;
+    /// endpoint of the last successful connection, tried first on reconnect
+    tcp::endpoint lastEndpoint_;
 
     boost::asio::io_context::strand strand_;
+
+    /// pool of receive buffers, received chunks reference them instead of copying their payload
+    std::shared_ptr<BufferPool> bufferPool_;
+    /// current receive buffer, the received, not yet parsed data is in [rx_begin_, rx_end_)
+    std::shared_ptr<BufferPool::Buffer> rx_buffer_;
+    size_t rx_begin_;
+    size_t rx_end_;
+    /// receive time of the read that received the header of the current message
+    chronos::time_point_clk rx_received_;
+    /// a time response on the stream connection is expected until then, reads stop at message boundaries meanwhile
+    chronos::time_point_clk timeResponseDue_;
+
     struct PendingMessage
     {
         PendingMessage(const msg::message_ptr& msg, ResultHandler handler) : msg(msg), handler(handler)
@@ -190,6 +267,32 @@ protected:
         ResultHandler handler;
     };
     std::deque<PendingMessage> messages_;
+    /// serialized message being written, per connection
+    boost::asio::streambuf tx_streambuf_;
+
+    /// kernel timestamps are enabled on the socket
+    bool timestamping_;
+    /// kernel TX timestamps are enabled on the socket
+    bool txTimestamping_;
+    /// bytes written since enabling the TX timestamps, to match the TX timestamps with the time requests
+    uint32_t tx_bytes_;
+    struct TimeRequest
+    {
+        uint16_t id;
+        /// user space send time, as sent to the server
+        chronos::time_point_clk sent;
+        /// TX timestamp id: offset of the request's last byte
+        uint32_t key;
+    };
+    std::deque<TimeRequest> timeRequests_;
+
+    /// UDP socket for time sync, connected to the server's time sync port
+    udp::socket udpSocket_;
+    udp::endpoint udpSender_;
+    std::array<char, 128> udpBuffer_;
+    uint16_t timeSyncPort_;
+    /// consecutive time requests without response over UDP
+    size_t udpFailures_;
 };
 
 
@@ -19,10 +19,12 @@
 #ifndef CLIENT_SETTINGS_HPP
 #define CLIENT_SETTINGS_HPP
 
+#include <chrono>
 #include <string>
 #include <vector>
 
 #include "common/sample_format.hpp"
+#include "common/utils/thread_utils.hpp"
 #include "player/pcm_device.hpp"
 
 
@@ -35,6 +37,12 @@ struct ClientSettings
         shared
     };
 
+    enum class SyncMode
+    {
+        drop,
+        resample
+    };
+
     struct Mixer
     {
         enum class Mode
@@ -47,6 +55,10 @@ struct ClientSettings
 
         Mode mode{Mode::software};
         std::string parameter{""};
+        /// duration of volume changes
+        std::chrono::milliseconds ramp_time{50};
+        /// ramp linear in dB instead of linear in amplitude
+        bool ramp_exponential{false};
     };
 
     struct Server
@@ -63,7 +75,12 @@ struct ClientSettings
         player::PcmDevice pcm_device;
         SampleFormat sample_format;
         SharingMode sharing_mode{SharingMode::unspecified};
+        SyncMode sync_mode{SyncMode::drop};
         Mixer mixer;
+        /// DSP chain, see DspChain
+        std::string dsp{""};
+        /// scheduling of the player thread
+        utils::thread::Settings thread;
     };
 
     struct Logging
@@ -74,6 +91,10 @@ struct ClientSettings
 
     size_t instance{1};
     std::string host_id;
+    /// lock the process memory into RAM
+    bool lock_memory{false};
+    /// scheduling of the network (io_context) thread, inherited by the decoder thread
+    utils::thread::Settings io_thread;
 
     Server server;
     Player player;
@@ -21,6 +21,7 @@
 #endif // NOMINMAX
 
 #include "controller.hpp"
+#include "decoder/bitpack_decoder.hpp"
 #include "decoder/pcm_decoder.hpp"
 #if defined(HAS_OGG) && (defined(HAS_TREMOR) || defined(HAS_VORBIS))
 #include "decoder/ogg_decoder.hpp"
@@ -56,11 +57,14 @@
 #include "common/aixlog.hpp"
 #include "common/snap_exception.hpp"
 #include "message/client_info.hpp"
+#include "message/client_stats.hpp"
 #include "message/hello.hpp"
 #include "message/time.hpp"
+#include "startup_timeline.hpp"
 #include "time_provider.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -69,15 +73,30 @@ using namespace std;
 using namespace player;
 
 static constexpr auto LOG_TAG = "Controller";
-static constexpr auto TIME_SYNC_INTERVAL = 1s;
+/// Delay before the first reconnect, doubled for each failed connect
+static constexpr std::chrono::milliseconds kMinReconnectDelay = 50ms;
+/// Delay between connect attempts while the server is not reachable
+static constexpr std::chrono::milliseconds kMaxReconnectDelay = 3s;
+/// Failed connects before browsing mDNS again for the server
+static constexpr size_t kMdnsBrowseFailures = 10;
+
+std::atomic<Controller*> Controller::timeSyncOwner_{nullptr};
 
 Controller::Controller(boost::asio::io_context& io_context, const ClientSettings& settings, std::unique_ptr<MetadataAdapter> meta)
-    : io_context_(io_context), timer_(io_context), settings_(settings), stream_(nullptr), decoder_(nullptr), player_(nullptr), meta_(std::move(meta)),
-      serverSettings_(nullptr)
+    : io_context_(io_context), timer_(io_context), statsTimer_(io_context), settings_(settings), useMdns_(settings.server.host.empty()), connectFailures_(0), stream_(nullptr),
+      player_(nullptr), meta_(std::move(meta)), serverSettings_(nullptr)
 {
 }
 
 
+Controller::~Controller()
+{
+    // the browsing thread must not outlive the io_context handlers it posts
+    if (mdnsBrowse_.valid())
+        mdnsBrowse_.wait();
+}
+
+
 template <typename PlayerType>
 std::unique_ptr<Player> Controller::createPlayer(ClientSettings::Player& settings, const std::string& player_name)
 {
@@ -124,23 +143,11 @@ void Controller::getNextMessage()
             return;
         }
 
-        if (response->type == message_type::kWireChunk)
+        if ((response->type == message_type::kWireChunk) || (response->type == message_type::kSilence))
         {
-            if (stream_ && decoder_)
-            {
-                // execute on the io_context to do the (costly) decoding on another thread (if more than one thread is used)
-                // boost::asio::post(io_context_, [this, response = std::move(response)]() mutable {
-                auto pcmChunk = msg::message_cast<msg::PcmChunk>(std::move(response));
-                pcmChunk->format = sampleFormat_;
-                // LOG(TRACE, LOG_TAG) << "chunk: " << pcmChunk->payloadSize << ", sampleFormat: " << sampleFormat_.toString() << "\n";
-                if (decoder_->decode(pcmChunk.get()))
-                {
-                    // LOG(TRACE, LOG_TAG) << ", decoded: " << pcmChunk->payloadSize << ", Duration: " << pcmChunk->durationMs() << ", sec: " <<
-                    // pcmChunk->timestamp.sec << ", usec: " << pcmChunk->timestamp.usec / 1000 << ", type: " << pcmChunk->type << "\n";
-                    stream_->addChunk(std::move(pcmChunk));
-                }
-                // });
-            }
+            // decoding is done on the decoder worker, to keep the connection responsive
+            if (stream_ && decoderWorker_)
+                decoderWorker_->push(std::move(response));
         }
         else if (response->type == message_type::kServerSettings)
         {
@@ -156,32 +163,50 @@ void Controller::getNextMessage()
         else if (response->type == message_type::kCodecHeader)
         {
             headerChunk_ = msg::message_cast<msg::CodecHeader>(std::move(response));
-            decoder_.reset(nullptr);
-            stream_ = nullptr;
-            player_.reset(nullptr);
+            detachDecoder();
 
+            std::unique_ptr<decoder::Decoder> decoder;
             if (headerChunk_->codec == "pcm")
-                decoder_ = make_unique<decoder::PcmDecoder>();
+                decoder = make_unique<decoder::PcmDecoder>();
+            else if (headerChunk_->codec == "bitpack")
+                decoder = make_unique<decoder::BitpackDecoder>();
 #if defined(HAS_OGG) && (defined(HAS_TREMOR) || defined(HAS_VORBIS))
             else if (headerChunk_->codec == "ogg")
-                decoder_ = make_unique<decoder::OggDecoder>();
+                decoder = make_unique<decoder::OggDecoder>();
 #endif
 #if defined(HAS_FLAC)
             else if (headerChunk_->codec == "flac")
-                decoder_ = make_unique<decoder::FlacDecoder>();
+                decoder = make_unique<decoder::FlacDecoder>();
 #endif
 #if defined(HAS_OPUS)
             else if (headerChunk_->codec == "opus")
-                decoder_ = make_unique<decoder::OpusDecoder>();
+                decoder = make_unique<decoder::OpusDecoder>();
 #endif
             else
                 throw SnapException("codec not supported: \"" + headerChunk_->codec + "\"");
 
-            sampleFormat_ = decoder_->setHeader(headerChunk_.get());
+            sampleFormat_ = decoder->setHeader(headerChunk_.get());
             LOG(INFO, LOG_TAG) << "Codec: " << headerChunk_->codec << ", sampleformat: " << sampleFormat_.toString() << "\n";
 
-            stream_ = make_shared<Stream>(sampleFormat_, settings_.player.sample_format);
+            if (player_ && stream_ && (stream_->getInputFormat() == sampleFormat_))
+            {
+                // keep the audio device open and only swap the decoder
+                LOG(INFO, LOG_TAG) << "Sample format unchanged, keeping the player\n";
+                stream_->flush();
+                stream_->setBufferLen(std::max(0, serverSettings_->getBufferMs() - serverSettings_->getLatency() - settings_.player.latency));
+                attachDecoder(std::move(decoder));
+                StartupTimeline::getInstance().mark(StartupTimeline::Event::codec_header);
+                // the volume might have been changed on the server while we were disconnected
+                player_->setVolume(serverSettings_->getVolume() / 100., serverSettings_->isMuted());
+                getNextMessage();
+                return;
+            }
+
+            stream_ = nullptr;
+            player_.reset(nullptr);
+            stream_ = make_shared<Stream>(sampleFormat_, settings_.player.sample_format, settings_.player.sync_mode);
             stream_->setBufferLen(std::max(0, serverSettings_->getBufferMs() - serverSettings_->getLatency() - settings_.player.latency));
+            attachDecoder(std::move(decoder));
 
 #ifdef HAS_ALSA
             if (!player_)
@@ -213,27 +238,27 @@ void Controller::getNextMessage()
             if (!player_)
                 throw SnapException("No audio player support" + (settings_.player.player_name.empty() ? "" : " for: " + settings_.player.player_name));
 
-            player_->setVolumeCallback([this](double volume, bool muted) {
-                static double last_volume(-1);
-                static bool last_muted(true);
+            player_->setVolumeCallback([this, last_volume = -1., last_muted = true](double volume, bool muted) mutable {
                 if ((volume != last_volume) || (last_muted != muted))
                 {
                     last_volume = volume;
                     last_muted = muted;
-                    auto info = std::make_shared<msg::ClientInfo>();
-                    info->setVolume(static_cast<uint16_t>(volume * 100.));
-                    info->setMuted(muted);
-                    clientConnection_->send(info, [this](const boost::system::error_code& ec) {
-                        if (ec)
-                        {
-                            LOG(ERROR, LOG_TAG) << "Failed to send client info, error: " << ec.message() << "\n";
-                            reconnect();
-                            return;
-                        }
+                    boost::asio::post(io_context_, [this, volume, muted]() {
+                        // keep the settings in sync with the server, they are sent again with latency changes
+                        serverSettings_->setVolume(static_cast<uint16_t>(volume * 100.));
+                        serverSettings_->setMuted(muted);
+                        sendClientInfo();
                     });
                 }
             });
+            player_->setLatencyCallback([this](std::chrono::microseconds latency) {
+                boost::asio::post(io_context_, [this, latency]() {
+                    LOG(INFO, LOG_TAG) << "Output buffer latency: " << latency.count() / 1000 << " ms\n";
+                    sendClientInfo();
+                });
+            });
             player_->start();
+            StartupTimeline::getInstance().mark(StartupTimeline::Event::codec_header);
             // Don't change the initial hardware mixer volume on the user's device.
             // The player class will send the device's volume to the server instead
             // if (settings_.player.mixer.mode != ClientSettings::Mixer::Mode::hardware)
@@ -243,11 +268,11 @@ void Controller::getNextMessage()
         }
         else if (response->type == message_type::kStreamTags)
         {
+            auto stream_tags = msg::message_cast<msg::StreamTags>(std::move(response));
+            // sent before the codec header, identifies the stream for sharing the decoder
+            streamId_ = stream_tags->msg.value("STREAM", std::string());
             if (meta_)
-            {
-                auto stream_tags = msg::message_cast<msg::StreamTags>(std::move(response));
                 meta_->push(stream_tags->msg);
-            }
         }
         else
         {
@@ -258,8 +283,40 @@ void Controller::getNextMessage()
 }
 
 
+void Controller::attachDecoder(std::unique_ptr<decoder::Decoder> decoder)
+{
+    decoderWorker_ = DecoderPool::getInstance().get(streamId_, *headerChunk_, [this, &decoder]() {
+        auto worker = std::make_shared<DecoderWorker>();
+        worker->start(std::move(decoder), sampleFormat_);
+        return worker;
+    });
+    decoderWorker_->addStream(stream_);
+}
+
+
+void Controller::detachDecoder()
+{
+    if (!decoderWorker_)
+        return;
+    decoderWorker_->removeStream(stream_);
+    decoderWorker_ = nullptr;
+}
+
+
 void Controller::sendTimeSyncMessage(int quick_syncs)
 {
+    // the outputs of the process share the TimeProvider, only one of them syncs with the server
+    Controller* owner = nullptr;
+    if (!timeSyncOwner_.compare_exchange_strong(owner, this) && (owner != this))
+    {
+        timer_.expires_after(TimeProvider::getInstance().getSyncInterval());
+        timer_.async_wait([this, quick_syncs](const boost::system::error_code& ec) {
+            if (!ec)
+                sendTimeSyncMessage(quick_syncs);
+        });
+        return;
+    }
+
     auto timeReq = std::make_shared<msg::Time>();
     clientConnection_->sendRequest<msg::Time>(
         timeReq, 2s, [this, quick_syncs](const boost::system::error_code& ec, const std::unique_ptr<msg::Time>& response) mutable {
@@ -271,10 +328,12 @@ void Controller::sendTimeSyncMessage(int quick_syncs)
             }
             else
             {
-                TimeProvider::getInstance().setDiff(response->latency, response->received - response->sent);
+                TimeProvider::getInstance().setDiff(response->latency, response->received - response->sent, TimeProvider::toTimePoint(response->received));
+                if (TimeProvider::getInstance().converged())
+                    StartupTimeline::getInstance().mark(StartupTimeline::Event::time_synced);
             }
 
-            std::chrono::microseconds next = TIME_SYNC_INTERVAL;
+            std::chrono::microseconds next = TimeProvider::getInstance().getSyncInterval();
             if (quick_syncs > 0)
             {
                 if (--quick_syncs == 0)
@@ -295,35 +354,46 @@ void Controller::sendTimeSyncMessage(int quick_syncs)
 void Controller::browseMdns(const MdnsHandler& handler)
 {
 #if defined(HAS_AVAHI) || defined(HAS_BONJOUR)
-    try
-    {
-        BrowseZeroConf browser;
-        mDNSResult avahiResult;
-        if (browser.browse("_snapcast._tcp", avahiResult, 1000))
+    // browse on a separate thread, to not block the io_context
+    std::weak_ptr<Controller> self = shared_from_this();
+    mdnsBrowse_ = std::async(std::launch::async, [this, self, handler]() {
+        mDNSResult avahiResult{};
+        bool found = false;
+        try
         {
-            string host = avahiResult.ip;
-            uint16_t port = avahiResult.port;
-            if (avahiResult.ip_version == IPVersion::IPv6)
-                host += "%" + cpt::to_string(avahiResult.iface_idx);
-            handler({}, host, port);
-            return;
+            BrowseZeroConf browser;
+            found = browser.browse("_snapcast._tcp", avahiResult, 1000);
         }
-    }
-    catch (const std::exception& e)
-    {
-        LOG(ERROR, LOG_TAG) << "Exception: " << e.what() << std::endl;
-    }
-
-    timer_.expires_after(500ms);
-    timer_.async_wait([this, handler](const boost::system::error_code& ec) {
-        if (!ec)
-        {
-            browseMdns(handler);
-        }
-        else
+        catch (const std::exception& e)
         {
-            handler(ec, "", 0);
+            LOG(ERROR, LOG_TAG) << "Exception: " << e.what() << std::endl;
         }
+
+        boost::asio::post(io_context_, [this, self, handler, found, avahiResult]() {
+            if (self.expired())
+                return;
+            if (found)
+            {
+                string host = avahiResult.ip;
+                uint16_t port = avahiResult.port;
+                if (avahiResult.ip_version == IPVersion::IPv6)
+                    host += "%" + cpt::to_string(avahiResult.iface_idx);
+                handler({}, host, port);
+                return;
+            }
+
+            timer_.expires_after(500ms);
+            timer_.async_wait([this, handler](const boost::system::error_code& ec) {
+                if (!ec)
+                {
+                    browseMdns(handler);
+                }
+                else
+                {
+                    handler(ec, "", 0);
+                }
+            });
+        });
     });
 #else
     handler(boost::asio::error::operation_not_supported, "", 0);
@@ -363,19 +433,106 @@ void Controller::start()
 //     timer_.cancel();
 // }
 
+void Controller::sendClientInfo()
+{
+    if (!serverSettings_ || !player_)
+        return;
+    auto info = std::make_shared<msg::ClientInfo>();
+    info->setVolume(serverSettings_->getVolume());
+    info->setMuted(serverSettings_->isMuted());
+    if (player_->bufferLatency().count() > 0)
+        info->setBufferLatency(static_cast<int32_t>(player_->bufferLatency().count() / 1000));
+    clientConnection_->send(info, [this](const boost::system::error_code& ec) {
+        if (ec)
+        {
+            LOG(ERROR, LOG_TAG) << "Failed to send client info, error: " << ec.message() << "\n";
+            reconnect();
+            return;
+        }
+    });
+}
+
+
+void Controller::sendClientStats(std::chrono::milliseconds interval)
+{
+    statsTimer_.expires_after(interval);
+    statsTimer_.async_wait([this, interval](const boost::system::error_code& ec) {
+        if (ec)
+            return;
+        auto stats = std::make_shared<msg::ClientStats>();
+        stats->period = static_cast<uint32_t>(interval.count());
+        if (stream_)
+        {
+            auto sync = stream_->getSyncStats();
+            stats->sync_error_p50 = static_cast<uint32_t>(sync.error.p50.count());
+            stats->sync_error_p95 = static_cast<uint32_t>(sync.error.p95.count());
+            stats->sync_error_p99 = static_cast<uint32_t>(sync.error.p99.count());
+            stats->sync_error_max = static_cast<uint32_t>(sync.error.max.count());
+            stats->hard_syncs = sync.hard_syncs;
+            stats->correction = static_cast<int32_t>(std::lround(sync.correction_ppm * 1000.));
+            stats->queue_depth = static_cast<uint32_t>(std::chrono::duration_cast<chronos::msec>(sync.queued).count());
+        }
+        if (player_)
+            stats->xruns = player_->xruns();
+        // a shared decoder's time is reported by the first output that takes it
+        if (decoderWorker_)
+            stats->decode_time = static_cast<uint32_t>(std::chrono::duration_cast<chronos::usec>(decoderWorker_->takeDecodeTime()).count());
+        stats->time_jitter = static_cast<uint32_t>(TimeProvider::getInstance().getJitter().count());
+        auto first_audio = StartupTimeline::getInstance().get(StartupTimeline::Event::first_audio);
+        if (first_audio.count() >= 0)
+            stats->time_to_first_audio = static_cast<uint32_t>(std::chrono::duration_cast<chronos::msec>(first_audio).count());
+        clientConnection_->send(stats, [this](const boost::system::error_code& ec) {
+            if (ec)
+            {
+                LOG(ERROR, LOG_TAG) << "Failed to send client stats, error: " << ec.message() << "\n";
+                reconnect();
+                return;
+            }
+        });
+        sendClientStats(interval);
+    });
+}
+
+
 void Controller::reconnect()
 {
     timer_.cancel();
+    statsTimer_.cancel();
     clientConnection_->disconnect();
-    player_.reset();
-    stream_.reset();
-    decoder_.reset();
-    timer_.expires_after(1s);
+    // the player and the audio device are kept open, if the sample format doesn't change after reconnecting
+    detachDecoder();
+    // another output can take over the time sync
+    Controller* self = this;
+    timeSyncOwner_.compare_exchange_strong(self, nullptr);
+    if (stream_)
+        stream_->flush();
+    // reconnect quickly, e.g. after a server restart, and back off while the server is not reachable
+    auto delay = std::min<std::chrono::milliseconds>(kMinReconnectDelay * (1 << std::min<size_t>(connectFailures_, 6)), kMaxReconnectDelay);
+    timer_.expires_after(delay);
     timer_.async_wait([this](const boost::system::error_code& ec) {
-        if (!ec)
+        if (ec)
+            return;
+        if (!useMdns_ || (connectFailures_ < kMdnsBrowseFailures))
         {
             worker();
+            return;
         }
+        // the server might have a new address
+        browseMdns([this](const boost::system::error_code& ec, const std::string& host, uint16_t port) {
+            if (ec)
+            {
+                LOG(ERROR, LOG_TAG) << "Failed to browse MDNS, error: " << ec.message() << "\n";
+                return;
+            }
+            if ((host != settings_.server.host) || (port != settings_.server.port))
+            {
+                settings_.server.host = host;
+                settings_.server.port = port;
+                LOG(INFO, LOG_TAG) << "Found server " << settings_.server.host << ":" << settings_.server.port << "\n";
+                clientConnection_->setServer(settings_.server);
+            }
+            worker();
+        });
     });
 }
 
@@ -384,6 +541,8 @@ void Controller::worker()
     clientConnection_->connect([this](const boost::system::error_code& ec) {
         if (!ec)
         {
+            connectFailures_ = 0;
+            StartupTimeline::getInstance().mark(StartupTimeline::Event::connected);
             // LOG(INFO, LOG_TAG) << "Connected!\n";
             string macAddress = clientConnection_->getMacAddress();
             if (settings_.host_id.empty())
@@ -402,8 +561,12 @@ void Controller::worker()
                     else
                     {
                         serverSettings_ = std::move(response);
+                        StartupTimeline::getInstance().mark(StartupTimeline::Event::hello);
                         LOG(INFO, LOG_TAG) << "ServerSettings - buffer: " << serverSettings_->getBufferMs() << ", latency: " << serverSettings_->getLatency()
                                            << ", volume: " << serverSettings_->getVolume() << ", muted: " << serverSettings_->isMuted() << "\n";
+                        clientConnection_->setTimeSyncPort(serverSettings_->getTimeSyncPort());
+                        if (serverSettings_->getStatsInterval() > 0)
+                            sendClientStats(std::chrono::milliseconds(serverSettings_->getStatsInterval()));
                     }
                 });
 
@@ -414,7 +577,10 @@ void Controller::worker()
         }
         else
         {
-            LOG(ERROR, LOG_TAG) << "Error: " << ec.message() << "\n";
+            // log only the first of the repeated failures while the server is down
+            LOG((connectFailures_ == 0) ? ERROR : DEBUG, LOG_TAG) << "Failed to connect to " << settings_.server.host << ":" << settings_.server.port
+                                                                  << ", error: " << ec.message() << "\n";
+            ++connectFailures_;
             reconnect();
         }
     });
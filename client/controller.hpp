@@ -21,7 +21,7 @@
 
 #include "client_connection.hpp"
 #include "client_settings.hpp"
-#include "decoder/decoder.hpp"
+#include "decoder_worker.hpp"
 #include "message/message.hpp"
 #include "message/server_settings.hpp"
 #include "message/stream_tags.hpp"
@@ -29,6 +29,8 @@
 #include "player/player.hpp"
 #include "stream.hpp"
 #include <atomic>
+#include <future>
+#include <memory>
 #include <thread>
 
 using namespace std::chrono_literals;
@@ -37,13 +39,15 @@ using namespace std::chrono_literals;
 /**
  * Sets up a connection to the server (using ClientConnection)
  * Sets up the audio decoder and player.
- * Decodes audio (message_type::kWireChunk) and feeds PCM to the audio stream buffer
+ * Passes audio (message_type::kWireChunk) to the DecoderWorker, that feeds PCM to the audio stream buffer
  * Does timesync with the server
+ * Several controllers (outputs) can run in one process, they share the time sync and the decoders of the streams they play
  */
-class Controller
+class Controller : public std::enable_shared_from_this<Controller>
 {
 public:
     Controller(boost::asio::io_context& io_context, const ClientSettings& settings, std::unique_ptr<MetadataAdapter> meta);
+    ~Controller();
     void start();
     // void stop();
     static std::vector<std::string> getSupportedPlayerNames();
@@ -58,20 +62,39 @@ private:
     std::unique_ptr<player::Player> createPlayer(ClientSettings::Player& settings, const std::string& player_name);
 
     void getNextMessage();
+    /// Decode the stream with a new @p decoder, or with the decoder of another output that plays the same stream
+    void attachDecoder(std::unique_ptr<decoder::Decoder> decoder);
+    /// Stop feeding stream_ from the decoder
+    void detachDecoder();
     void sendTimeSyncMessage(int quick_syncs);
+    /// Send the volume and the player's buffer latency to the server
+    void sendClientInfo();
+    /// Send sync and performance statistics every @p interval, while connected
+    void sendClientStats(std::chrono::milliseconds interval);
 
     boost::asio::io_context& io_context_;
     boost::asio::steady_timer timer_;
+    boost::asio::steady_timer statsTimer_;
     ClientSettings settings_;
+    /// the server is discovered with mDNS
+    bool useMdns_;
+    /// consecutive failed connects, for the reconnect backoff
+    size_t connectFailures_;
     std::string meta_callback_;
     SampleFormat sampleFormat_;
     std::unique_ptr<ClientConnection> clientConnection_;
     std::shared_ptr<Stream> stream_;
-    std::unique_ptr<decoder::Decoder> decoder_;
     std::unique_ptr<player::Player> player_;
+    std::shared_ptr<DecoderWorker> decoderWorker_;
+    /// id of the stream as announced in the stream tags, empty if unknown
+    std::string streamId_;
     std::unique_ptr<MetadataAdapter> meta_;
     std::unique_ptr<msg::ServerSettings> serverSettings_;
     std::unique_ptr<msg::CodecHeader> headerChunk_;
+    /// mDNS browsing blocks, it's running asynchronously
+    std::future<void> mdnsBrowse_;
+    /// output that does the time sync for all outputs of the process
+    static std::atomic<Controller*> timeSyncOwner_;
 };
 
 
@@ -0,0 +1,182 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "bitpack_decoder.hpp"
+#include "common/aixlog.hpp"
+#include "common/endian.hpp"
+#include "common/snap_exception.hpp"
+#include "common/str_compat.hpp"
+#include <cstring>
+#include <limits>
+
+namespace decoder
+{
+
+#define ID_BITPACK 0x4250434B
+
+static constexpr auto LOG_TAG = "BitpackDecoder";
+
+
+BitpackDecoder::BitpackDecoder() : Decoder(), block_size_(0)
+{
+}
+
+
+template <typename T>
+bool BitpackDecoder::decodeBlocks(const uint8_t* src, const uint8_t* end, uint32_t frames, T* out)
+{
+    const uint16_t channels = sample_format_.channels();
+    std::vector<int64_t> hist1(channels, 0);
+    std::vector<int64_t> hist2(channels, 0);
+    uint64_t* residuals = residuals_.data();
+
+    for (uint32_t block_start = 0; block_start < frames; block_start += block_size_)
+    {
+        const uint32_t n = std::min<uint32_t>(block_size_, frames - block_start);
+        for (uint16_t c = 0; c < channels; ++c)
+        {
+            if (src >= end)
+                return false;
+            const uint8_t order = *src >> 6;
+            const uint8_t width = *src & 0x3f;
+            ++src;
+            if ((order > 2) || (width > 35))
+                return false;
+
+            // unpack the residuals into a planar buffer
+            if (width == 0)
+            {
+                std::fill_n(residuals, n, 0);
+            }
+            else
+            {
+                if (static_cast<size_t>(end - src) < (static_cast<size_t>(n) * width + 7) / 8)
+                    return false;
+                const uint64_t mask = (uint64_t(1) << width) - 1;
+                uint64_t acc = 0;
+                uint8_t bits = 0;
+                for (uint32_t i = 0; i < n; ++i)
+                {
+                    while (bits < width)
+                    {
+                        acc |= static_cast<uint64_t>(*src++) << bits;
+                        bits += 8;
+                    }
+                    residuals[i] = acc & mask;
+                    acc >>= width;
+                    bits -= width;
+                }
+            }
+
+            // undo zigzag and prediction, interleave into the output
+            int64_t x1 = hist1[c];
+            int64_t x2 = hist2[c];
+            T* dst = out + static_cast<size_t>(block_start) * channels + c;
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                int64_t r = static_cast<int64_t>(residuals[i] >> 1) ^ -static_cast<int64_t>(residuals[i] & 1);
+                int64_t x;
+                if (order == 0)
+                    x = r;
+                else if (order == 1)
+                    x = r + x1;
+                else
+                    x = r + 2 * x1 - x2;
+                dst[static_cast<size_t>(i) * channels] = static_cast<T>(x);
+                x2 = x1;
+                x1 = x;
+            }
+            hist1[c] = x1;
+            hist2[c] = x2;
+        }
+    }
+    return true;
+}
+
+
+bool BitpackDecoder::decode(msg::PcmChunk* chunk)
+{
+    if (chunk->payloadSize < 4)
+        return false;
+
+    uint32_t frames;
+    memcpy(&frames, chunk->payload, sizeof(frames));
+    frames = SWAP_32(frames);
+    // every block carries at least one header byte per channel; computed in 64 bit, the frame count comes off the wire
+    const uint64_t blocks = (static_cast<uint64_t>(frames) + block_size_ - 1) / block_size_;
+    const uint64_t pcm_size = static_cast<uint64_t>(frames) * sample_format_.frameSize();
+    if ((blocks * sample_format_.channels() > chunk->payloadSize - 4) || (pcm_size > std::numeric_limits<uint32_t>::max()))
+        return false;
+
+    // decode directly into the chunk, the encoded payload is kept alive until done
+    const uint32_t encoded_size = chunk->payloadSize;
+    auto encoded = chunk->releasePayload();
+    chunk->resizePayload(static_cast<uint32_t>(pcm_size));
+    const auto* src = reinterpret_cast<const uint8_t*>(encoded.get() + 4);
+    const auto* end = reinterpret_cast<const uint8_t*>(encoded.get() + encoded_size);
+
+    bool ok;
+    if (sample_format_.sampleSize() == 1)
+        ok = decodeBlocks(src, end, frames, reinterpret_cast<int8_t*>(chunk->payload));
+    else if (sample_format_.sampleSize() == 2)
+        ok = decodeBlocks(src, end, frames, reinterpret_cast<int16_t*>(chunk->payload));
+    else
+        ok = decodeBlocks(src, end, frames, reinterpret_cast<int32_t*>(chunk->payload));
+
+    if (!ok)
+    {
+        LOG(ERROR, LOG_TAG) << "Failed to decode chunk, size: " << encoded_size << ", frames: " << frames << "\n";
+        return false;
+    }
+    return true;
+}
+
+
+SampleFormat BitpackDecoder::setHeader(msg::CodecHeader* chunk)
+{
+    // decode the bitpack pseudo header
+    if (chunk->payloadSize < 14)
+        throw SnapException("Bitpack header too small");
+
+    uint32_t id_bitpack;
+    memcpy(&id_bitpack, chunk->payload, sizeof(id_bitpack));
+    if (SWAP_32(id_bitpack) != ID_BITPACK)
+        throw SnapException("Not a bitpack pseudo header");
+
+    uint32_t rate;
+    memcpy(&rate, chunk->payload + 4, sizeof(rate));
+    uint16_t bits;
+    memcpy(&bits, chunk->payload + 8, sizeof(bits));
+    uint16_t channels;
+    memcpy(&channels, chunk->payload + 10, sizeof(channels));
+    uint16_t block_size;
+    memcpy(&block_size, chunk->payload + 12, sizeof(block_size));
+
+    sample_format_.setFormat(SWAP_32(rate), SWAP_16(bits), SWAP_16(channels));
+    block_size_ = SWAP_16(block_size);
+    if ((block_size_ == 0) || (sample_format_.channels() == 0))
+        throw SnapException("Invalid bitpack header");
+    if ((sample_format_.sampleSize() != 1) && (sample_format_.sampleSize() != 2) && (sample_format_.sampleSize() != 4))
+        throw SnapException("Unsupported sample size: " + cpt::to_string(sample_format_.sampleSize()));
+
+    residuals_.resize(block_size_);
+    LOG(DEBUG, LOG_TAG) << "Bitpack sampleformat: " << sample_format_.toString() << ", block size: " << block_size_ << "\n";
+    return sample_format_;
+}
+
+} // namespace decoder
@@ -0,0 +1,47 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef BITPACK_DECODER_HPP
+#define BITPACK_DECODER_HPP
+#include "decoder.hpp"
+#include <vector>
+
+
+namespace decoder
+{
+
+/// Decoder for the "bitpack" codec, see BitpackEncoder
+class BitpackDecoder : public Decoder
+{
+public:
+    BitpackDecoder();
+    bool decode(msg::PcmChunk* chunk) override;
+    SampleFormat setHeader(msg::CodecHeader* chunk) override;
+
+private:
+    template <typename T>
+    bool decodeBlocks(const uint8_t* src, const uint8_t* end, uint32_t frames, T* out);
+
+    SampleFormat sample_format_;
+    uint16_t block_size_;
+    std::vector<uint64_t> residuals_;
+};
+
+} // namespace decoder
+
+#endif
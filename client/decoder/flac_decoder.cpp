@@ -32,36 +32,16 @@ static constexpr auto LOG_TAG = "FlacDecoder";
 namespace decoder
 {
 
-namespace callback
+FlacDecoder::FlacDecoder() : Decoder(), decoder_(nullptr), lastError_(nullptr), input_(nullptr), input_left_(0), output_(nullptr), output_capacity_(0)
 {
-FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder* decoder, FLAC__byte buffer[], size_t* bytes, void* client_data);
-FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame, const FLAC__int32* const buffer[],
-                                              void* client_data);
-void metadata_callback(const FLAC__StreamDecoder* decoder, const FLAC__StreamMetadata* metadata, void* client_data);
-void error_callback(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status, void* client_data);
-} // namespace callback
-
-namespace
-{
-msg::CodecHeader* flacHeader = nullptr;
-msg::PcmChunk* flacChunk = nullptr;
-msg::PcmChunk* pcmChunk = nullptr;
-SampleFormat sampleFormat;
-FLAC__StreamDecoder* decoder = nullptr;
-} // namespace
-
-
-FlacDecoder::FlacDecoder() : Decoder(), lastError_(nullptr)
-{
-    flacChunk = new msg::PcmChunk();
 }
 
 
 FlacDecoder::~FlacDecoder()
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    FLAC__stream_decoder_delete(decoder);
-    delete flacChunk;
+    if (decoder_ != nullptr)
+        FLAC__stream_decoder_delete(decoder_);
 }
 
 
@@ -69,27 +49,37 @@ bool FlacDecoder::decode(msg::PcmChunk* chunk)
 {
     std::lock_guard<std::mutex> lock(mutex_);
     cacheInfo_.reset();
-    pcmChunk = chunk;
-    flacChunk->payload = static_cast<char*>(realloc(flacChunk->payload, chunk->payloadSize));
-    memcpy(flacChunk->payload, chunk->payload, chunk->payloadSize);
-    flacChunk->payloadSize = chunk->payloadSize;
-
-    pcmChunk->payload = static_cast<char*>(realloc(pcmChunk->payload, 0));
-    pcmChunk->payloadSize = 0;
-    while (flacChunk->payloadSize > 0)
+
+    // take over the encoded payload and decode into a buffer of the size of the last decoded chunk
+    input_left_ = chunk->payloadSize;
+    std::shared_ptr<char> encoded = chunk->releasePayload();
+    input_ = encoded.get();
+    chunk->resizePayload(static_cast<uint32_t>(output_capacity_));
+    chunk->payloadSize = 0;
+    output_ = chunk;
+
+    bool result = true;
+    while (input_left_ > 0)
     {
-        if (FLAC__stream_decoder_process_single(decoder) == 0)
+        if (FLAC__stream_decoder_process_single(decoder_) == 0)
         {
-            return false;
+            result = false;
+            break;
         }
 
         if (lastError_)
         {
             LOG(ERROR, LOG_TAG) << "FLAC decode error: " << FLAC__StreamDecoderErrorStatusString[*lastError_] << "\n";
             lastError_ = nullptr;
-            return false;
+            result = false;
+            break;
         }
     }
+    output_ = nullptr;
+    input_ = nullptr;
+    input_left_ = 0;
+    if (!result)
+        return false;
 
     if ((cacheInfo_.cachedBlocks_ > 0) && (cacheInfo_.sampleRate_ != 0))
     {
@@ -105,118 +95,120 @@ bool FlacDecoder::decode(msg::PcmChunk* chunk)
 
 SampleFormat FlacDecoder::setHeader(msg::CodecHeader* chunk)
 {
-    flacHeader = chunk;
-    FLAC__StreamDecoderInitStatus init_status;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (decoder_ != nullptr)
+        FLAC__stream_decoder_delete(decoder_);
 
-    if ((decoder = FLAC__stream_decoder_new()) == nullptr)
+    if ((decoder_ = FLAC__stream_decoder_new()) == nullptr)
         throw SnapException("ERROR: allocating decoder");
 
-    //	(void)FLAC__stream_decoder_set_md5_checking(decoder, true);
-    init_status = FLAC__stream_decoder_init_stream(decoder, callback::read_callback, nullptr, nullptr, nullptr, nullptr, callback::write_callback,
-                                                   callback::metadata_callback, callback::error_callback, this);
+    //	(void)FLAC__stream_decoder_set_md5_checking(decoder_, true);
+    FLAC__StreamDecoderInitStatus init_status =
+        FLAC__stream_decoder_init_stream(decoder_, read_callback, nullptr, nullptr, nullptr, nullptr, write_callback, metadata_callback, error_callback, this);
     if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK)
         throw SnapException("ERROR: initializing decoder: " + string(FLAC__StreamDecoderInitStatusString[init_status]));
 
-    FLAC__stream_decoder_process_until_end_of_metadata(decoder);
-    if (sampleFormat.rate() == 0)
+    input_ = chunk->payload;
+    input_left_ = chunk->payloadSize;
+    FLAC__stream_decoder_process_until_end_of_metadata(decoder_);
+    input_ = nullptr;
+    input_left_ = 0;
+    if (sampleFormat_.rate() == 0)
         throw SnapException("Sample format not found");
 
-    return sampleFormat;
+    return sampleFormat_;
 }
 
-namespace callback
-{
-FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder* /*decoder*/, FLAC__byte buffer[], size_t* bytes, void* client_data)
+
+bool FlacDecoder::write(const FLAC__Frame* frame, const FLAC__int32* const buffer[])
 {
-    if (flacHeader != nullptr)
+    if (cacheInfo_.isCachedChunk_)
+        cacheInfo_.cachedBlocks_ += frame->header.blocksize;
+
+    size_t bytes = frame->header.blocksize * sampleFormat_.frameSize();
+    if (output_->payloadSize + bytes > output_capacity_)
     {
-        *bytes = flacHeader->payloadSize;
-        memcpy(buffer, flacHeader->payload, *bytes);
-        flacHeader = nullptr;
+        output_capacity_ = output_->payloadSize + bytes;
+        output_->payload = static_cast<char*>(realloc(output_->payload, output_capacity_));
     }
-    else if (flacChunk != nullptr)
+
+    for (size_t channel = 0; channel < sampleFormat_.channels(); ++channel)
     {
-        //		cerr << "read_callback: " << *bytes << ", avail: " << flacChunk->payloadSize << "\n";
-        static_cast<FlacDecoder*>(client_data)->cacheInfo_.isCachedChunk_ = false;
-        if (*bytes > flacChunk->payloadSize)
-            *bytes = flacChunk->payloadSize;
-
-        //		if (*bytes == 0)
-        //			return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
-
-        memcpy(buffer, flacChunk->payload, *bytes);
-        memmove(flacChunk->payload, flacChunk->payload + *bytes, flacChunk->payloadSize - *bytes);
-        flacChunk->payloadSize = flacChunk->payloadSize - static_cast<uint32_t>(*bytes);
-        flacChunk->payload = static_cast<char*>(realloc(flacChunk->payload, flacChunk->payloadSize));
+        if (buffer[channel] == nullptr)
+        {
+            LOG(ERROR, LOG_TAG) << "ERROR: buffer[" << channel << "] is NULL\n";
+            return false;
+        }
+
+        if (sampleFormat_.sampleSize() == 1)
+        {
+            auto* chunkBuffer = reinterpret_cast<int8_t*>(output_->payload + output_->payloadSize);
+            for (size_t i = 0; i < frame->header.blocksize; i++)
+                chunkBuffer[sampleFormat_.channels() * i + channel] = static_cast<int8_t>(buffer[channel][i]);
+        }
+        else if (sampleFormat_.sampleSize() == 2)
+        {
+            auto* chunkBuffer = reinterpret_cast<int16_t*>(output_->payload + output_->payloadSize);
+            for (size_t i = 0; i < frame->header.blocksize; i++)
+                chunkBuffer[sampleFormat_.channels() * i + channel] = SWAP_16((int16_t)(buffer[channel][i]));
+        }
+        else if (sampleFormat_.sampleSize() == 4)
+        {
+            auto* chunkBuffer = reinterpret_cast<int32_t*>(output_->payload + output_->payloadSize);
+            for (size_t i = 0; i < frame->header.blocksize; i++)
+                chunkBuffer[sampleFormat_.channels() * i + channel] = SWAP_32((int32_t)(buffer[channel][i]));
+        }
     }
-    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+    output_->payloadSize += static_cast<uint32_t>(bytes);
+    return true;
 }
 
 
-FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder* /*decoder*/, const FLAC__Frame* frame, const FLAC__int32* const buffer[],
-                                              void* client_data)
+FLAC__StreamDecoderReadStatus FlacDecoder::read_callback(const FLAC__StreamDecoder* /*decoder*/, FLAC__byte buffer[], size_t* bytes, void* client_data)
 {
-    if (pcmChunk != nullptr)
-    {
-        size_t bytes = frame->header.blocksize * sampleFormat.frameSize();
+    auto* flacDecoder = static_cast<FlacDecoder*>(client_data);
+    // data is read from a chunk (and not from the codec header)
+    if (flacDecoder->output_ != nullptr)
+        flacDecoder->cacheInfo_.isCachedChunk_ = false;
 
-        auto* flacDecoder = static_cast<FlacDecoder*>(client_data);
-        if (flacDecoder->cacheInfo_.isCachedChunk_)
-            flacDecoder->cacheInfo_.cachedBlocks_ += frame->header.blocksize;
+    if (*bytes > flacDecoder->input_left_)
+        *bytes = flacDecoder->input_left_;
 
-        pcmChunk->payload = static_cast<char*>(realloc(pcmChunk->payload, pcmChunk->payloadSize + bytes));
+    memcpy(buffer, flacDecoder->input_, *bytes);
+    flacDecoder->input_ += *bytes;
+    flacDecoder->input_left_ -= *bytes;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
 
-        for (size_t channel = 0; channel < sampleFormat.channels(); ++channel)
-        {
-            if (buffer[channel] == nullptr)
-            {
-                LOG(ERROR, LOG_TAG) << "ERROR: buffer[" << channel << "] is NULL\n";
-                return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
-            }
-
-            if (sampleFormat.sampleSize() == 1)
-            {
-                auto* chunkBuffer = reinterpret_cast<int8_t*>(pcmChunk->payload + pcmChunk->payloadSize);
-                for (size_t i = 0; i < frame->header.blocksize; i++)
-                    chunkBuffer[sampleFormat.channels() * i + channel] = static_cast<int8_t>(buffer[channel][i]);
-            }
-            else if (sampleFormat.sampleSize() == 2)
-            {
-                auto* chunkBuffer = reinterpret_cast<int16_t*>(pcmChunk->payload + pcmChunk->payloadSize);
-                for (size_t i = 0; i < frame->header.blocksize; i++)
-                    chunkBuffer[sampleFormat.channels() * i + channel] = SWAP_16((int16_t)(buffer[channel][i]));
-            }
-            else if (sampleFormat.sampleSize() == 4)
-            {
-                auto* chunkBuffer = reinterpret_cast<int32_t*>(pcmChunk->payload + pcmChunk->payloadSize);
-                for (size_t i = 0; i < frame->header.blocksize; i++)
-                    chunkBuffer[sampleFormat.channels() * i + channel] = SWAP_32((int32_t)(buffer[channel][i]));
-            }
-        }
-        pcmChunk->payloadSize += static_cast<uint32_t>(bytes);
-    }
+
+FLAC__StreamDecoderWriteStatus FlacDecoder::write_callback(const FLAC__StreamDecoder* /*decoder*/, const FLAC__Frame* frame, const FLAC__int32* const buffer[],
+                                                           void* client_data)
+{
+    auto* flacDecoder = static_cast<FlacDecoder*>(client_data);
+    if ((flacDecoder->output_ != nullptr) && !flacDecoder->write(frame, buffer))
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
 
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
 
-void metadata_callback(const FLAC__StreamDecoder* /*decoder*/, const FLAC__StreamMetadata* metadata, void* client_data)
+void FlacDecoder::metadata_callback(const FLAC__StreamDecoder* /*decoder*/, const FLAC__StreamMetadata* metadata, void* client_data)
 {
     /* print some stats */
     if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
     {
-        static_cast<FlacDecoder*>(client_data)->cacheInfo_.sampleRate_ = metadata->data.stream_info.sample_rate;
-        sampleFormat.setFormat(metadata->data.stream_info.sample_rate, static_cast<uint16_t>(metadata->data.stream_info.bits_per_sample),
-                               static_cast<uint16_t>(metadata->data.stream_info.channels));
+        auto* flacDecoder = static_cast<FlacDecoder*>(client_data);
+        flacDecoder->cacheInfo_.sampleRate_ = metadata->data.stream_info.sample_rate;
+        flacDecoder->sampleFormat_.setFormat(metadata->data.stream_info.sample_rate, static_cast<uint16_t>(metadata->data.stream_info.bits_per_sample),
+                                             static_cast<uint16_t>(metadata->data.stream_info.channels));
     }
 }
 
 
-void error_callback(const FLAC__StreamDecoder* /*decoder*/, FLAC__StreamDecoderErrorStatus status, void* client_data)
+void FlacDecoder::error_callback(const FLAC__StreamDecoder* /*decoder*/, FLAC__StreamDecoderErrorStatus status, void* client_data)
 {
     LOG(ERROR, LOG_TAG) << "Got error callback: " << FLAC__StreamDecoderErrorStatusString[status] << "\n";
     static_cast<FlacDecoder*>(client_data)->lastError_ = std::make_unique<FLAC__StreamDecoderErrorStatus>(status);
 }
-} // namespace callback
 
 } // namespace decoder
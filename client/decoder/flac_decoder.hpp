@@ -47,6 +47,11 @@ struct CacheInfo
 };
 
 
+/// FLAC decoder
+/**
+ * Each instance has its own libFLAC stream decoder. Encoded data is read through a
+ * cursor over the received chunk and decoded samples are written directly into the chunk.
+ */
 class FlacDecoder : public Decoder
 {
 public:
@@ -55,8 +60,28 @@ public:
     bool decode(msg::PcmChunk* chunk) override;
     SampleFormat setHeader(msg::CodecHeader* chunk) override;
 
+private:
+    static FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder* decoder, FLAC__byte buffer[], size_t* bytes, void* client_data);
+    static FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame, const FLAC__int32* const buffer[],
+                                                         void* client_data);
+    static void metadata_callback(const FLAC__StreamDecoder* decoder, const FLAC__StreamMetadata* metadata, void* client_data);
+    static void error_callback(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status, void* client_data);
+
+    /// Append a decoded frame to the current output chunk
+    bool write(const FLAC__Frame* frame, const FLAC__int32* const buffer[]);
+
+    FLAC__StreamDecoder* decoder_;
+    SampleFormat sampleFormat_;
     CacheInfo cacheInfo_;
     std::unique_ptr<FLAC__StreamDecoderErrorStatus> lastError_;
+
+    /// read cursor over the encoded data (codec header or chunk payload)
+    const char* input_;
+    size_t input_left_;
+
+    /// decoded PCM output and its allocated size
+    msg::PcmChunk* output_;
+    size_t output_capacity_;
 };
 
 } // namespace decoder
@@ -65,7 +65,7 @@ bool OggDecoder::decode(msg::PcmChunk* chunk)
     ogg_sync_wrote(&oy, size);
 
 
-    chunk->payloadSize = 0;
+    chunk->resizePayload(0);
     /* The rest is just a straight decode loop until end of stream */
     //      while(!eos){
     while (true)
@@ -76,8 +76,7 @@ bool OpusDecoder::decode(msg::PcmChunk* chunk)
                             << " bytes, decoded: " << decoded_frames * sample_format_.frameSize() << " bytes\n";
 
         // copy encoded data to chunk
-        chunk->payloadSize = decoded_frames * sample_format_.frameSize(); // decoded_frames * sample_format_.channels() * sizeof(opus_int16);
-        chunk->payload = static_cast<char*>(realloc(chunk->payload, chunk->payloadSize));
+        chunk->resizePayload(decoded_frames * sample_format_.frameSize()); // decoded_frames * sample_format_.channels() * sizeof(opus_int16);
         memcpy(chunk->payload, reinterpret_cast<char*>(pcm_.data()), chunk->payloadSize);
         return true;
     }
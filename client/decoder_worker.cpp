@@ -0,0 +1,248 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "decoder_worker.hpp"
+#include "common/aixlog.hpp"
+#include "message/factory.hpp"
+#include "time_provider.hpp"
+
+#include <algorithm>
+
+static constexpr auto LOG_TAG = "DecoderWorker";
+
+/// Number of queued timestamps that are remembered to detect copies, covers the backlog sent to a joining output
+static constexpr size_t kMaxPushed = 512;
+
+
+/// @return the server time at which the decoded chunk or silence marker @p message ends
+static chronos::time_point_clk end(const msg::BaseMessage& message)
+{
+    if (message.type == message_type::kWireChunk)
+        return static_cast<const msg::PcmChunk&>(message).end();
+    const auto& silence = static_cast<const msg::Silence&>(message);
+    return TimeProvider::toTimePoint(silence.timestamp) + silence.getDuration();
+}
+
+
+DecoderWorker::DecoderWorker(size_t max_queued)
+    : max_queued_(max_queued), streams_changed_(false), active_(false), decoded_frames_(0), decode_time_(0), unreported_decode_time_(0)
+{
+}
+
+
+DecoderWorker::~DecoderWorker()
+{
+    stop();
+}
+
+
+void DecoderWorker::start(std::unique_ptr<decoder::Decoder> decoder, const SampleFormat& format, std::shared_ptr<Stream> stream)
+{
+    stop();
+    decoder_ = std::move(decoder);
+    format_ = format;
+    if (stream)
+        streams_.push_back(std::move(stream));
+    streams_changed_ = true;
+    pushed_.clear();
+    decoded_frames_ = 0;
+    decode_time_ = std::chrono::nanoseconds(0);
+    active_ = true;
+    thread_ = std::thread(&DecoderWorker::worker, this);
+}
+
+
+void DecoderWorker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active_ = false;
+        queue_.clear();
+        streams_.clear();
+    }
+    cv_.notify_one();
+    if (thread_.joinable())
+        thread_.join();
+    history_.clear();
+    if ((decoded_frames_ > 0) && (format_.rate() > 0))
+    {
+        double audio_s = static_cast<double>(decoded_frames_) / format_.rate();
+        double decode_s = std::chrono::duration<double>(decode_time_).count();
+        LOG(INFO, LOG_TAG) << "Decoded " << audio_s << " s in " << decode_s * 1000. << " ms, " << audio_s / std::max(decode_s, 1e-9) << "x realtime\n";
+        decoded_frames_ = 0;
+    }
+    decoder_.reset();
+}
+
+
+void DecoderWorker::addStream(std::shared_ptr<Stream> stream)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        streams_.push_back(std::move(stream));
+        streams_changed_ = true;
+    }
+    // replay the history right away, the joining output's next chunks might be copies for a while
+    cv_.notify_one();
+}
+
+
+void DecoderWorker::removeStream(const std::shared_ptr<Stream>& stream)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.erase(std::remove(streams_.begin(), streams_.end(), stream), streams_.end());
+    streams_changed_ = true;
+}
+
+
+void DecoderWorker::push(std::unique_ptr<msg::BaseMessage> message)
+{
+    const tv& ts = (message->type == message_type::kSilence) ? static_cast<msg::Silence*>(message.get())->timestamp
+                                                             : static_cast<msg::WireChunk*>(message.get())->timestamp;
+    int64_t timestamp = static_cast<int64_t>(ts.sec) * 1000000 + ts.usec;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!active_)
+            return;
+        // already pushed by another output on the same stream. Timestamps can go back within a stream (e.g. when
+        // the server's source restarts), so copies are recognized by their exact timestamp, not by their order
+        if ((streams_.size() > 1) && (std::find(pushed_.rbegin(), pushed_.rend(), timestamp) != pushed_.rend()))
+            return;
+        pushed_.push_back(timestamp);
+        if (pushed_.size() > kMaxPushed)
+            pushed_.pop_front();
+        if (queue_.size() >= max_queued_)
+        {
+            LOG(WARNING, LOG_TAG) << "Decoder can't keep up, dropping oldest chunk, queued: " << queue_.size() << "\n";
+            queue_.pop_front();
+        }
+        queue_.push_back(std::move(message));
+    }
+    cv_.notify_one();
+}
+
+
+std::chrono::nanoseconds DecoderWorker::takeDecodeTime()
+{
+    return std::chrono::nanoseconds(unreported_decode_time_.exchange(0, std::memory_order_relaxed));
+}
+
+
+void DecoderWorker::worker()
+{
+    // copy of streams_, to not hold the lock while adding audio
+    std::vector<std::shared_ptr<Stream>> streams;
+    // streams that were added since the last copy
+    std::vector<std::shared_ptr<Stream>> joined;
+    while (true)
+    {
+        std::unique_ptr<msg::BaseMessage> message;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return !active_ || !queue_.empty() || streams_changed_; });
+            if (!active_)
+                return;
+            if (!queue_.empty())
+            {
+                message = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            if (streams_changed_)
+            {
+                joined.clear();
+                for (const auto& stream : streams_)
+                {
+                    if (std::find(streams.begin(), streams.end(), stream) == streams.end())
+                        joined.push_back(stream);
+                }
+                streams = streams_;
+                streams_changed_ = false;
+            }
+        }
+
+        // the joined outputs' copies of the recent chunks were dropped in push
+        for (const auto& stream : joined)
+        {
+            for (const auto& recent : history_)
+            {
+                if (recent->type == message_type::kWireChunk)
+                    stream->addChunk(std::make_unique<msg::PcmChunk>(static_cast<const msg::PcmChunk&>(*recent)));
+                else
+                    stream->addSilence(static_cast<const msg::Silence&>(*recent));
+            }
+        }
+        joined.clear();
+
+        if (!message || streams.empty())
+            continue;
+
+        if (message->type == message_type::kWireChunk)
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto pcmChunk = msg::message_cast<msg::PcmChunk>(std::move(message));
+            pcmChunk->format = format_;
+            if (decoder_->decode(pcmChunk.get()))
+            {
+                decoded_frames_ += pcmChunk->getFrameCount();
+                history_.push_back(std::make_unique<msg::PcmChunk>(*pcmChunk));
+                for (size_t n = 1; n < streams.size(); ++n)
+                    streams[n]->addChunk(std::make_unique<msg::PcmChunk>(*pcmChunk));
+                streams.front()->addChunk(std::move(pcmChunk));
+            }
+            auto duration = std::chrono::steady_clock::now() - start;
+            decode_time_ += duration;
+            unreported_decode_time_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), std::memory_order_relaxed);
+        }
+        else if (message->type == message_type::kSilence)
+        {
+            auto silence = msg::message_cast<msg::Silence>(std::move(message));
+            for (const auto& stream : streams)
+                stream->addSilence(*silence);
+            history_.push_back(std::move(silence));
+        }
+
+        // keep the audio that a joining output would still play
+        auto now = TimeProvider::serverNow();
+        while (!history_.empty() && (end(*history_.front()) < now))
+            history_.pop_front();
+    }
+}
+
+
+std::shared_ptr<DecoderWorker> DecoderPool::get(const std::string& stream_id, const msg::CodecHeader& header,
+                                                const std::function<std::shared_ptr<DecoderWorker>()>& create)
+{
+    if (stream_id.empty())
+        return create();
+
+    std::string key = stream_id + '\0' + header.codec + '\0' + std::string(header.payload, header.payloadSize);
+    std::lock_guard<std::mutex> lock(mutex_);
+    workers_.erase(std::remove_if(workers_.begin(), workers_.end(), [](const auto& worker) { return worker.second.expired(); }), workers_.end());
+    for (const auto& worker : workers_)
+    {
+        auto shared = worker.second.lock();
+        if (shared && (worker.first == key))
+        {
+            LOG(INFO, LOG_TAG) << "Sharing the decoder of stream \"" << stream_id << "\" with another output\n";
+            return shared;
+        }
+    }
+    auto worker = create();
+    workers_.emplace_back(key, worker);
+    return worker;
+}
@@ -0,0 +1,126 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef DECODER_WORKER_HPP
+#define DECODER_WORKER_HPP
+
+#include "decoder/decoder.hpp"
+#include "message/codec_header.hpp"
+#include "message/message.hpp"
+#include "stream.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/// Decodes received audio on a dedicated thread
+/**
+ * Wire chunks and silence markers are queued in a bounded queue by the network thread
+ * and are decoded and added to the Streams in reception order on the worker thread.
+ * If the decoder can't keep up, the oldest queued chunks are dropped.
+ * The worker can feed the streams of several outputs that play the same stream, each output pushes
+ * the chunks of its connection and only the first copy of a chunk (same timestamp) is decoded.
+ * The decoded audio that is not yet due is kept, and replayed to a stream that joins, because the
+ * backlog sent to the joining output's connection consists of copies.
+ */
+class DecoderWorker
+{
+public:
+    DecoderWorker(size_t max_queued = 500);
+    ~DecoderWorker();
+
+    /// Start decoding with @p decoder (the header must already be set, resulting in @p format) into @p stream
+    void start(std::unique_ptr<decoder::Decoder> decoder, const SampleFormat& format, std::shared_ptr<Stream> stream = nullptr);
+    /// Stop the worker thread, drop all queued messages and release decoder and streams
+    /// Logs the time spent decoding since start
+    void stop();
+
+    /// Add the decoded audio also to @p stream, starting with the recently decoded audio that is not yet due
+    void addStream(std::shared_ptr<Stream> stream);
+    /// Stop adding decoded audio to @p stream
+    void removeStream(const std::shared_ptr<Stream>& stream);
+
+    /// Queue a kWireChunk or kSilence message
+    /// If the worker feeds several outputs, messages with the timestamp of a recently queued one are dropped as copies
+    void push(std::unique_ptr<msg::BaseMessage> message);
+
+    /// @return the time spent decoding since the previous call, can be called from any thread
+    std::chrono::nanoseconds takeDecodeTime();
+
+private:
+    void worker();
+
+    size_t max_queued_;
+    std::unique_ptr<decoder::Decoder> decoder_;
+    SampleFormat format_;
+    std::vector<std::shared_ptr<Stream>> streams_;
+    /// streams_ changed, the worker thread must update its copy
+    bool streams_changed_;
+    std::deque<std::unique_ptr<msg::BaseMessage>> queue_;
+    /// timestamps of the recently queued messages [us]
+    std::deque<int64_t> pushed_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool active_;
+    std::thread thread_;
+    /// decoded chunks and silence markers that are not yet due, only accessed by the worker thread while running
+    std::deque<std::unique_ptr<msg::BaseMessage>> history_;
+    /// decoded frames and time spent in decode and Stream::addChunk, only accessed by the worker thread while running
+    uint64_t decoded_frames_;
+    std::chrono::nanoseconds decode_time_;
+    /// decode time that has not been taken by takeDecodeTime [ns]
+    std::atomic<std::chrono::nanoseconds::rep> unreported_decode_time_;
+};
+
+
+/// Decoder workers of the outputs of this process
+/**
+ * Outputs that play the same stream receive the same codec header and share one DecoderWorker,
+ * so that the audio is decoded only once. A worker is released when the last output detaches from it.
+ */
+class DecoderPool
+{
+public:
+    static DecoderPool& getInstance()
+    {
+        static DecoderPool instance;
+        return instance;
+    }
+
+    /// @return the worker that decodes @p header of stream @p stream_id for another output,
+    ///         or a new worker returned by @p create. Workers for an unknown (empty) stream id are not shared
+    std::shared_ptr<DecoderWorker> get(const std::string& stream_id, const msg::CodecHeader& header,
+                                       const std::function<std::shared_ptr<DecoderWorker>()>& create);
+
+private:
+    DecoderPool() = default;
+
+    std::mutex mutex_;
+    /// key: stream id, codec and codec header payload
+    std::vector<std::pair<std::string, std::weak_ptr<DecoderWorker>>> workers_;
+};
+
+
+#endif
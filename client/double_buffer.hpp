@@ -22,12 +22,15 @@
 #include <algorithm>
 #include <array>
 #include <deque>
+#include <vector>
 
 
 /// Size limited queue
 /**
  * Size limited queue with basic statistic functions:
  * median, mean, percentile
+ * The elements are additionally kept in sorted order, so that median and percentiles are O(1).
+ * add is O(n) with a small constant: a binary search, plus a memmove of the sorted array's tail.
  */
 template <class T>
 class DoubleBuffer
@@ -35,41 +38,38 @@ class DoubleBuffer
 public:
     DoubleBuffer(size_t size = 10) : bufferSize(size)
     {
+        sorted.reserve(size + 1);
     }
 
     inline void add(const T& element)
     {
         buffer.push_back(element);
-        if (buffer.size() > bufferSize)
-            buffer.pop_front();
+        sorted.insert(std::upper_bound(sorted.begin(), sorted.end(), element), element);
+        evict();
     }
 
     inline void add(T&& element)
     {
-        buffer.push_back(std::move(element));
-        if (buffer.size() > bufferSize)
-            buffer.pop_front();
+        add(static_cast<const T&>(element));
     }
 
     /// Median as mean over N values around the median
     T median(uint16_t mean = 1) const
     {
-        if (buffer.empty())
+        if (sorted.empty())
             return 0;
-        std::deque<T> tmpBuffer(buffer.begin(), buffer.end());
-        std::sort(tmpBuffer.begin(), tmpBuffer.end());
-        if ((mean <= 1) || (tmpBuffer.size() < mean))
-            return tmpBuffer[tmpBuffer.size() / 2];
+        if ((mean <= 1) || (sorted.size() < mean))
+            return sorted[sorted.size() / 2];
         else
         {
-            uint16_t low = static_cast<uint16_t>(tmpBuffer.size()) / 2;
+            uint16_t low = static_cast<uint16_t>(sorted.size()) / 2;
             uint16_t high = low;
             low -= mean / 2;
             high += mean / 2;
             T result((T)0);
             for (uint16_t i = low; i <= high; ++i)
             {
-                result += tmpBuffer[i];
+                result += sorted[i];
             }
             return result / mean;
         }
@@ -87,11 +87,9 @@ public:
 
     T percentile(unsigned int percentile) const
     {
-        if (buffer.empty())
+        if (sorted.empty())
             return 0;
-        std::deque<T> tmpBuffer(buffer.begin(), buffer.end());
-        std::sort(tmpBuffer.begin(), tmpBuffer.end());
-        return tmpBuffer[(size_t)((tmpBuffer.size() - 1) * ((float)percentile / (float)100))];
+        return sorted[(size_t)((sorted.size() - 1) * ((float)percentile / (float)100))];
     }
 
     template <std::size_t Size>
@@ -99,12 +97,10 @@ public:
     {
         std::array<T, Size> result;
         result.fill(0);
-        if (buffer.empty())
+        if (sorted.empty())
             return result;
-        std::deque<T> tmpBuffer(buffer.begin(), buffer.end());
-        std::sort(tmpBuffer.begin(), tmpBuffer.end());
         for (std::size_t i = 0; i < Size; ++i)
-            result[i] = tmpBuffer[(size_t)((tmpBuffer.size() - 1) * ((float)percentiles[i] / (float)100))];
+            result[i] = sorted[(size_t)((sorted.size() - 1) * ((float)percentiles[i] / (float)100))];
 
         return result;
     }
@@ -117,6 +113,7 @@ public:
     inline void clear()
     {
         buffer.clear();
+        sorted.clear();
     }
 
     inline size_t size() const
@@ -132,16 +129,32 @@ public:
     void setSize(size_t size)
     {
         bufferSize = size;
+        sorted.reserve(size + 1);
+        evict();
     }
 
     const std::deque<T>& getBuffer() const
     {
-        return &buffer;
+        return buffer;
     }
 
 private:
+    /// remove the oldest elements until the size limit is met
+    void evict()
+    {
+        while (buffer.size() > bufferSize)
+        {
+            // any element with the same value can be removed from the sorted array
+            sorted.erase(std::lower_bound(sorted.begin(), sorted.end(), buffer.front()));
+            buffer.pop_front();
+        }
+    }
+
     size_t bufferSize;
+    /// elements in insertion order
     std::deque<T> buffer;
+    /// elements in sorted order
+    std::vector<T> sorted;
 };
 
 
@@ -0,0 +1,469 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "dsp_chain.hpp"
+#include "common/endian.hpp"
+#include "common/snap_exception.hpp"
+#include "common/str_compat.hpp"
+#include "common/utils/string_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+
+using namespace std;
+
+
+namespace
+{
+
+constexpr double kPi = 3.14159265358979323846;
+/// Filter state below this is inaudible and flushed to zero, before it decays into slow denormal floats
+constexpr float kDenormalThreshold = 1e-20f;
+
+/// A parsed stage: <type>[@<channels>]:<param>[:<param>]*
+struct StageConfig
+{
+    string type;
+    uint16_t first_channel{0};
+    uint16_t last_channel{numeric_limits<uint16_t>::max()};
+    bool has_channels{false};
+    vector<string> params;
+
+    double param(size_t idx, double def) const
+    {
+        if (idx >= params.size())
+            return def;
+        try
+        {
+            return cpt::stod(params[idx]);
+        }
+        catch (const std::exception&)
+        {
+            throw SnapException("Invalid DSP parameter for " + type + ": " + params[idx]);
+        }
+    }
+};
+
+
+StageConfig parseStage(const string& stage)
+{
+    StageConfig config;
+    config.params = utils::string::split(stage, ':');
+    string channels;
+    config.type = utils::string::split_left(config.params.front(), '@', channels);
+    config.params.erase(config.params.begin());
+    if (!channels.empty())
+    {
+        config.has_channels = true;
+        string last;
+        try
+        {
+            config.first_channel = static_cast<uint16_t>(cpt::stoul(utils::string::split_left(channels, '-', last)));
+            config.last_channel = last.empty() ? config.first_channel : static_cast<uint16_t>(cpt::stoul(last));
+        }
+        catch (const std::exception&)
+        {
+            throw SnapException("Invalid DSP channels for " + config.type + ": " + channels);
+        }
+    }
+    return config;
+}
+
+
+vector<StageConfig> parseConfig(const string& config)
+{
+    vector<StageConfig> stages;
+    for (const auto& stage : utils::string::split(config, ','))
+    {
+        if (!utils::string::trim_copy(stage).empty())
+            stages.push_back(parseStage(utils::string::trim_copy(stage)));
+    }
+    return stages;
+}
+
+} // namespace
+
+
+class DspChain::Stage
+{
+public:
+    virtual ~Stage() = default;
+    /// Process interleaved float samples in place
+    virtual void process(float* samples, uint32_t frames, uint16_t channels) = 0;
+    /// Group delay in frames of @p channel at the normalized angular frequency @p w
+    virtual double groupDelay(uint16_t /*channel*/, double /*w*/) const
+    {
+        return 0.;
+    }
+};
+
+
+namespace
+{
+
+/// Cascade of biquad sections, transposed direct form II
+class BiquadStage : public DspChain::Stage
+{
+public:
+    struct Coefficients
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    /// RBJ audio EQ cookbook filter, a @p rate of 0 checks the parameters only
+    static Coefficients design(const StageConfig& config, double rate)
+    {
+        static const vector<string> types{"lowpass", "highpass", "bandpass", "notch", "peaking", "lowshelf", "highshelf"};
+        if (std::find(types.begin(), types.end(), config.type) == types.end())
+            throw SnapException("Unknown DSP stage: " + config.type);
+        double freq = config.param(0, -1.);
+        if ((freq <= 0) || ((rate > 0) && (freq >= rate / 2)))
+            throw SnapException("DSP frequency must be in (0, " + cpt::to_string(static_cast<int>(rate / 2)) + "): " + config.type);
+        bool has_gain = (config.type == "peaking") || (config.type == "lowshelf") || (config.type == "highshelf");
+        double gain = has_gain ? config.param(1, 0.) : 0.;
+        double q = config.param(has_gain ? 2 : 1, 1. / sqrt(2.));
+        if (q <= 0)
+            throw SnapException("DSP Q must be positive: " + config.type);
+        if (rate <= 0)
+            return {1., 0., 0., 0., 0.};
+
+        double w0 = 2 * kPi * freq / rate;
+        double cosw = cos(w0);
+        double alpha = sin(w0) / (2 * q);
+        double A = pow(10., gain / 40.);
+        double sqa = 2 * sqrt(A) * alpha;
+        double b0, b1, b2, a0, a1, a2;
+        if (config.type == "lowpass")
+        {
+            b0 = b2 = (1 - cosw) / 2;
+            b1 = 1 - cosw;
+            a0 = 1 + alpha, a1 = -2 * cosw, a2 = 1 - alpha;
+        }
+        else if (config.type == "highpass")
+        {
+            b0 = b2 = (1 + cosw) / 2;
+            b1 = -(1 + cosw);
+            a0 = 1 + alpha, a1 = -2 * cosw, a2 = 1 - alpha;
+        }
+        else if (config.type == "bandpass")
+        {
+            b0 = alpha, b1 = 0, b2 = -alpha;
+            a0 = 1 + alpha, a1 = -2 * cosw, a2 = 1 - alpha;
+        }
+        else if (config.type == "notch")
+        {
+            b0 = 1, b1 = -2 * cosw, b2 = 1;
+            a0 = 1 + alpha, a1 = -2 * cosw, a2 = 1 - alpha;
+        }
+        else if (config.type == "peaking")
+        {
+            b0 = 1 + alpha * A, b1 = -2 * cosw, b2 = 1 - alpha * A;
+            a0 = 1 + alpha / A, a1 = -2 * cosw, a2 = 1 - alpha / A;
+        }
+        else if (config.type == "lowshelf")
+        {
+            b0 = A * ((A + 1) - (A - 1) * cosw + sqa);
+            b1 = 2 * A * ((A - 1) - (A + 1) * cosw);
+            b2 = A * ((A + 1) - (A - 1) * cosw - sqa);
+            a0 = (A + 1) + (A - 1) * cosw + sqa;
+            a1 = -2 * ((A - 1) + (A + 1) * cosw);
+            a2 = (A + 1) + (A - 1) * cosw - sqa;
+        }
+        else if (config.type == "highshelf")
+        {
+            b0 = A * ((A + 1) + (A - 1) * cosw + sqa);
+            b1 = -2 * A * ((A - 1) + (A + 1) * cosw);
+            b2 = A * ((A + 1) + (A - 1) * cosw - sqa);
+            a0 = (A + 1) - (A - 1) * cosw + sqa;
+            a1 = 2 * ((A - 1) - (A + 1) * cosw);
+            a2 = (A + 1) - (A - 1) * cosw - sqa;
+        }
+        else
+            throw SnapException("Unknown DSP stage: " + config.type);
+        return {b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0};
+    }
+
+    BiquadStage(const vector<Coefficients>& sections, uint16_t first, uint16_t last, uint16_t channels)
+        : sections_(sections), first_(first), last_(last), state_(sections.size() * channels * 2, 0.f), channels_(channels)
+    {
+        for (const auto& c : sections_)
+            coeffs_.push_back({static_cast<float>(c.b0), static_cast<float>(c.b1), static_cast<float>(c.b2), static_cast<float>(c.a1), static_cast<float>(c.a2)});
+    }
+
+    void process(float* samples, uint32_t frames, uint16_t channels) override
+    {
+        for (size_t s = 0; s < coeffs_.size(); ++s)
+        {
+            const auto& c = coeffs_[s];
+            float* z1 = &state_[s * channels_ * 2];
+            float* z2 = z1 + channels_;
+            float* frame = samples;
+            for (uint32_t f = 0; f < frames; ++f, frame += channels)
+            {
+                // inner loop over the channels, independent of each other
+                for (uint16_t ch = first_; ch <= last_; ++ch)
+                {
+                    float x = frame[ch];
+                    float y = c.b0 * x + z1[ch];
+                    z1[ch] = c.b1 * x - c.a1 * y + z2[ch];
+                    z2[ch] = c.b2 * x - c.a2 * y;
+                    frame[ch] = y;
+                }
+            }
+        }
+        // once per chunk, a decaying tail reaches the threshold long before the denormal range
+        for (auto& z : state_)
+        {
+            if (std::abs(z) < kDenormalThreshold)
+                z = 0.f;
+        }
+    }
+
+    double groupDelay(uint16_t channel, double w) const override
+    {
+        if ((channel < first_) || (channel > last_))
+            return 0.;
+        // tau = Re(sum(k * c_k * z^-k) / sum(c_k * z^-k)), numerator minus denominator
+        auto tau = [w](double c0, double c1, double c2) {
+            complex<double> z1 = polar(1., -w);
+            complex<double> z2 = polar(1., -2 * w);
+            return real((c1 * z1 + 2. * c2 * z2) / (c0 + c1 * z1 + c2 * z2));
+        };
+        double delay = 0.;
+        for (const auto& c : sections_)
+            delay += tau(c.b0, c.b1, c.b2) - tau(1., c.a1, c.a2);
+        return delay;
+    }
+
+private:
+    struct FloatCoefficients
+    {
+        float b0, b1, b2, a1, a2;
+    };
+
+    vector<Coefficients> sections_;
+    vector<FloatCoefficients> coeffs_;
+    uint16_t first_;
+    uint16_t last_;
+    /// per section: z1 for all channels, followed by z2 for all channels
+    vector<float> state_;
+    uint16_t channels_;
+};
+
+
+/// Output channel n = sum of the input channels, weighted with row n
+class MatrixStage : public DspChain::Stage
+{
+public:
+    MatrixStage(const vector<float>& matrix, uint16_t channels) : matrix_(matrix), out_(channels)
+    {
+    }
+
+    void process(float* samples, uint32_t frames, uint16_t channels) override
+    {
+        float* frame = samples;
+        for (uint32_t f = 0; f < frames; ++f, frame += channels)
+        {
+            for (uint16_t row = 0; row < channels; ++row)
+            {
+                float sum = 0.f;
+                for (uint16_t col = 0; col < channels; ++col)
+                    sum += matrix_[row * channels + col] * frame[col];
+                out_[row] = sum;
+            }
+            std::copy(out_.begin(), out_.end(), frame);
+        }
+    }
+
+private:
+    vector<float> matrix_;
+    vector<float> out_;
+};
+
+
+/// Peak limiter with instant attack and exponential release, the gain is linked over the channels
+class LimiterStage : public DspChain::Stage
+{
+public:
+    LimiterStage(double threshold_db, double release_ms, double rate, uint16_t first, uint16_t last)
+        : threshold_(static_cast<float>(pow(10., threshold_db / 20.))), release_(static_cast<float>(exp(-1000. / (release_ms * rate)))), gain_(1.f), first_(first),
+          last_(last)
+    {
+    }
+
+    void process(float* samples, uint32_t frames, uint16_t channels) override
+    {
+        float* frame = samples;
+        for (uint32_t f = 0; f < frames; ++f, frame += channels)
+        {
+            float peak = 0.f;
+            for (uint16_t ch = first_; ch <= last_; ++ch)
+                peak = std::max(peak, std::abs(frame[ch]));
+            float target = (peak > threshold_) ? threshold_ / peak : 1.f;
+            gain_ = (target < gain_) ? target : target + (gain_ - target) * release_;
+            for (uint16_t ch = first_; ch <= last_; ++ch)
+                frame[ch] *= gain_;
+        }
+    }
+
+private:
+    float threshold_;
+    float release_;
+    float gain_;
+    uint16_t first_;
+    uint16_t last_;
+};
+
+
+/// Create the stage for @p config, a @p rate of 0 checks the parameters only
+unique_ptr<DspChain::Stage> createStage(const StageConfig& config, double rate, uint16_t channels)
+{
+    if (config.first_channel >= channels)
+        throw SnapException("DSP channel " + cpt::to_string(config.first_channel) + " not available: " + config.type);
+    uint16_t last = std::min<uint16_t>(config.last_channel, channels - 1);
+    if (last < config.first_channel)
+        throw SnapException("Invalid DSP channels: " + config.type);
+
+    if (config.type == "crossover")
+    {
+        string side = (config.params.size() > 1) ? config.params[1] : "";
+        if ((side != "low") && (side != "high"))
+            throw SnapException("crossover needs <freq>:<low|high>");
+        // Linkwitz-Riley: two cascaded Butterworth sections
+        StageConfig butterworth = config;
+        butterworth.type = (side == "low") ? "lowpass" : "highpass";
+        butterworth.params.resize(1);
+        auto section = BiquadStage::design(butterworth, rate);
+        return make_unique<BiquadStage>(vector<BiquadStage::Coefficients>{section, section}, config.first_channel, last, channels);
+    }
+    else if (config.type == "matrix")
+    {
+        if (config.has_channels)
+            throw SnapException("matrix applies to all channels, @<channels> is not supported");
+        if (config.params.size() != channels)
+            throw SnapException("matrix needs one row per channel (" + cpt::to_string(channels) + ")");
+        vector<float> matrix;
+        for (const auto& row : config.params)
+        {
+            auto coefficients = utils::string::split(row, '/');
+            if (coefficients.size() != channels)
+                throw SnapException("matrix row needs one coefficient per channel: " + row);
+            for (const auto& coefficient : coefficients)
+                matrix.push_back(static_cast<float>(StageConfig{"matrix", 0, 0, false, {coefficient}}.param(0, 0.)));
+        }
+        return make_unique<MatrixStage>(matrix, channels);
+    }
+    else if (config.type == "limiter")
+    {
+        double release = config.param(1, 50.);
+        if ((config.params.empty()) || (release <= 0))
+            throw SnapException("limiter needs <threshold dB>[:<release ms>]");
+        return make_unique<LimiterStage>(config.param(0, 0.), release, rate, config.first_channel, last);
+    }
+    return make_unique<BiquadStage>(vector<BiquadStage::Coefficients>{BiquadStage::design(config, rate)}, config.first_channel, last, channels);
+}
+
+} // namespace
+
+
+DspChain::DspChain(const SampleFormat& format, const std::string& config) : format_(format), scale_(static_cast<float>(1u << (format.bits() - 1)))
+{
+    if ((format_.sampleSize() != 1) && (format_.sampleSize() != 2) && (format_.sampleSize() != 4))
+        throw SnapException("DSP: unsupported sample format " + format_.toString());
+    for (const auto& stage : parseConfig(config))
+        stages_.push_back(createStage(stage, format_.rate(), format_.channels()));
+}
+
+
+DspChain::~DspChain() = default;
+
+
+void DspChain::validate(const std::string& config)
+{
+    // sample rate and channel count are checked when the sample format is known
+    for (const auto& stage : parseConfig(config))
+    {
+        uint16_t channels = (stage.type == "matrix") ? static_cast<uint16_t>(stage.params.size()) : std::max<uint16_t>(2, stage.first_channel + 1);
+        createStage(stage, 0, channels);
+    }
+}
+
+
+template <typename T>
+void DspChain::toFloat(const T* samples, size_t count)
+{
+    const float scale = 1.f / scale_;
+    for (size_t n = 0; n < count; ++n)
+        buffer_[n] = static_cast<float>(endian::swap<T>(samples[n])) * scale;
+}
+
+
+template <typename T>
+void DspChain::fromFloat(T* samples, size_t count) const
+{
+    const float min = -scale_;
+    // 2^31 - 1 is not representable as float
+    const float max = std::min(scale_ - 1.f, std::nextafter(scale_, 0.f));
+    // round to nearest, truncation would bias the samples towards zero
+    for (size_t n = 0; n < count; ++n)
+        samples[n] = endian::swap<T>(static_cast<T>(std::lrint(std::max(min, std::min(max, buffer_[n] * scale_)))));
+}
+
+
+void DspChain::process(char* buffer, uint32_t frames)
+{
+    if (stages_.empty())
+        return;
+    size_t count = static_cast<size_t>(frames) * format_.channels();
+    if (buffer_.size() < count)
+        buffer_.resize(count);
+
+    if (format_.sampleSize() == 1)
+        toFloat(reinterpret_cast<int8_t*>(buffer), count);
+    else if (format_.sampleSize() == 2)
+        toFloat(reinterpret_cast<int16_t*>(buffer), count);
+    else
+        toFloat(reinterpret_cast<int32_t*>(buffer), count);
+
+    for (auto& stage : stages_)
+        stage->process(buffer_.data(), frames, format_.channels());
+
+    if (format_.sampleSize() == 1)
+        fromFloat(reinterpret_cast<int8_t*>(buffer), count);
+    else if (format_.sampleSize() == 2)
+        fromFloat(reinterpret_cast<int16_t*>(buffer), count);
+    else
+        fromFloat(reinterpret_cast<int32_t*>(buffer), count);
+}
+
+
+chronos::usec DspChain::delay() const
+{
+    const double w = 2 * kPi * 1000. / format_.rate();
+    double max_delay = 0.;
+    for (uint16_t channel = 0; channel < format_.channels(); ++channel)
+    {
+        double delay = 0.;
+        for (const auto& stage : stages_)
+            delay += stage->groupDelay(channel, w);
+        max_delay = std::max(max_delay, delay);
+    }
+    return chronos::usec(static_cast<chronos::usec::rep>(max_delay * 1000000. / format_.rate()));
+}
@@ -0,0 +1,75 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef DSP_CHAIN_HPP
+#define DSP_CHAIN_HPP
+
+#include "common/sample_format.hpp"
+#include "common/time_defs.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+
+/// Configurable DSP chain, applied in place to the PCM data before it is played
+/**
+ * The configuration is a comma separated list of stages, processed in order:
+ *  - <lowpass|highpass|bandpass|notch>[@<channels>]:<freq>[:<Q>] biquad filter
+ *  - <peaking|lowshelf|highshelf>[@<channels>]:<freq>:<gain dB>[:<Q>] biquad filter
+ *  - crossover[@<channels>]:<freq>:<low|high> 4th order Linkwitz-Riley low- or highpass
+ *  - matrix:<row 0>:<row 1>... output channel n is the sum of the input channels, weighted with the "/"
+ *    separated coefficients of row n, e.g. "matrix:0.5/0.5:0.5/0.5" for mono
+ *  - limiter[@<channels>]:<threshold dB>[:<release ms>] peak limiter
+ * with <channels> = <n> or <first>-<last>, default: all channels
+ *
+ * Samples are processed as float. Filters have no processing latency, the group delay
+ * of the chain at 1kHz is reported by delay(), to be compensated by the stream.
+ */
+class DspChain
+{
+public:
+    /// @param format sample format of the PCM data
+    /// @param config the stages, throws SnapException if invalid
+    DspChain(const SampleFormat& format, const std::string& config);
+    ~DspChain();
+
+    /// Throws SnapException if the syntax of @p config is invalid, without knowing the sample format
+    static void validate(const std::string& config);
+
+    /// Process @p frames interleaved frames in place
+    void process(char* buffer, uint32_t frames);
+
+    /// Group delay of the chain at 1kHz, the maximum over all channels
+    chronos::usec delay() const;
+
+    class Stage;
+
+private:
+    template <typename T>
+    void toFloat(const T* samples, size_t count);
+    template <typename T>
+    void fromFloat(T* samples, size_t count) const;
+
+    SampleFormat format_;
+    float scale_;
+    std::vector<std::unique_ptr<Stage>> stages_;
+    std::vector<float> buffer_;
+};
+
+
+#endif
@@ -0,0 +1,325 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef PCM_RING_HPP
+#define PCM_RING_HPP
+
+#include "common/sample_format.hpp"
+#include "common/time_defs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+
+/// Lock-free single producer, single consumer ring of PCM frames
+/**
+ * Frames are stored contiguously in a preallocated buffer. For every write a mark
+ * (frame position => server timestamp) is stored in a side index, so that the
+ * timestamp of any frame can be calculated without per-chunk bookkeeping.
+ * write is called by the producer (decoder) thread, all other functions by the
+ * consumer (player) thread. The consumer functions never block or allocate.
+ * If the ring is full, the producer can evict the oldest frames and resize the ring,
+ * while the consumer doesn't hold a ReadLock.
+ */
+class PcmRing
+{
+public:
+    /// @param format sample format of the frames
+    /// @param capacity number of frames that can be stored
+    /// @param max_marks maximum number of writes that can be stored
+    PcmRing(const SampleFormat& format, uint32_t capacity, size_t max_marks = 2048)
+        : format_(format), frame_size_(format.frameSize()), capacity_(std::max(capacity, 1u)), data_(capacity_ * frame_size_), marks_(max_marks),
+          write_pos_(0), read_pos_(0), marks_write_(0), marks_read_(0), lock_(kUnlocked)
+    {
+    }
+
+    /// Guard of the consumer, while it's held the producer doesn't evict frames or resize the ring
+    class ReadLock
+    {
+    public:
+        explicit ReadLock(PcmRing& ring) : ring_(ring), owns_(ring.tryLockRead())
+        {
+        }
+
+        ~ReadLock()
+        {
+            if (owns_)
+                ring_.unlockRead();
+        }
+
+        ReadLock(const ReadLock&) = delete;
+        ReadLock& operator=(const ReadLock&) = delete;
+
+        /// @return false if the producer is evicting frames or resizing the ring right now
+        bool owns() const
+        {
+            return owns_;
+        }
+
+    private:
+        PcmRing& ring_;
+        bool owns_;
+    };
+
+    /// Consumer: try to lock the ring for reading, never blocks
+    /// @return false if the producer is evicting frames or resizing the ring right now
+    bool tryLockRead()
+    {
+        uint32_t expected = kUnlocked;
+        return lock_.compare_exchange_strong(expected, kReading, std::memory_order_acquire);
+    }
+
+    /// Consumer: unlock the ring after tryLockRead
+    void unlockRead()
+    {
+        lock_.store(kUnlocked, std::memory_order_release);
+    }
+
+    /// Producer: append @p frames frames starting at server time @p start
+    /// @param data the frames, or nullptr to append silence
+    /// @param evict if there is not enough free space, remove the oldest frames, unless the consumer holds a ReadLock
+    /// @return false if there is not enough free space, nothing is written in this case
+    bool write(const char* data, uint32_t frames, const chronos::time_point_clk& start, bool evict = false)
+    {
+        if (!hasSpace(frames) && (!evict || !makeSpace(frames)))
+            return false;
+
+        uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+        uint64_t marks_write = marks_write_.load(std::memory_order_relaxed);
+        size_t offset = write_pos % capacity_;
+        size_t first = std::min<size_t>(frames, capacity_ - offset);
+        if (data != nullptr)
+        {
+            memcpy(data_.data() + offset * frame_size_, data, first * frame_size_);
+            memcpy(data_.data(), data + first * frame_size_, (frames - first) * frame_size_);
+        }
+        else
+        {
+            memset(data_.data() + offset * frame_size_, 0, first * frame_size_);
+            memset(data_.data(), 0, (frames - first) * frame_size_);
+        }
+
+        marks_[marks_write % marks_.size()] = Mark{write_pos, start};
+        marks_write_.store(marks_write + 1, std::memory_order_release);
+        write_pos_.store(write_pos + frames, std::memory_order_release);
+        return true;
+    }
+
+    /// Producer: change the capacity, the newest frames are kept, unless the consumer holds a ReadLock
+    /// @return false if the consumer holds a ReadLock
+    bool resize(uint32_t capacity)
+    {
+        capacity = std::max(capacity, 1u);
+        if (capacity == capacity_)
+            return true;
+        if (!lockWrite())
+            return false;
+
+        uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+        uint64_t read_pos = std::max(read_pos_.load(std::memory_order_relaxed), write_pos - std::min<uint64_t>(write_pos, capacity));
+        std::vector<char> data(static_cast<size_t>(capacity) * frame_size_);
+        // the absolute positions are kept, the frames move to their offset in the new buffer
+        for (uint64_t pos = read_pos; pos < write_pos;)
+        {
+            size_t from = pos % capacity_;
+            size_t to = pos % capacity;
+            size_t frames = std::min<uint64_t>({write_pos - pos, capacity_ - from, capacity - to});
+            memcpy(data.data() + to * frame_size_, data_.data() + from * frame_size_, frames * frame_size_);
+            pos += frames;
+        }
+        data_.swap(data);
+        capacity_ = capacity;
+        read_pos_.store(read_pos, std::memory_order_relaxed);
+        currentMark();
+        unlockWrite();
+        return true;
+    }
+
+    /// @return number of frames that can be stored
+    uint32_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /// @return number of frames that can be read
+    uint32_t available() const
+    {
+        return static_cast<uint32_t>(write_pos_.load(std::memory_order_acquire) - read_pos_.load(std::memory_order_relaxed));
+    }
+
+    /// Consumer: server time of the next frame to be read, requires available() > 0
+    chronos::time_point_clk start()
+    {
+        const Mark& mark = currentMark();
+        return mark.start + framesToDuration(read_pos_.load(std::memory_order_relaxed) - mark.pos);
+    }
+
+    /// Consumer: number of contiguous frames (i.e. with continuous timestamps) that can be read
+    uint32_t segment()
+    {
+        currentMark();
+        uint64_t end = write_pos_.load(std::memory_order_acquire);
+        uint64_t marks_read = marks_read_.load(std::memory_order_relaxed);
+        if (marks_read + 1 < marks_write_.load(std::memory_order_acquire))
+            end = std::min(end, marks_[(marks_read + 1) % marks_.size()].pos);
+        return static_cast<uint32_t>(end - read_pos_.load(std::memory_order_relaxed));
+    }
+
+    /// Consumer: server time right after the last written frame, requires a write
+    chronos::time_point_clk end() const
+    {
+        uint64_t write_pos = write_pos_.load(std::memory_order_acquire);
+        const Mark& mark = marks_[(marks_write_.load(std::memory_order_acquire) - 1) % marks_.size()];
+        return mark.start + framesToDuration(write_pos - mark.pos);
+    }
+
+    /// Consumer: copy @p frames frames, starting @p offset frames after the read position, without consuming them
+    void peek(char* buffer, uint32_t offset, uint32_t frames) const
+    {
+        size_t pos = (read_pos_.load(std::memory_order_relaxed) + offset) % capacity_;
+        size_t first = std::min<size_t>(frames, capacity_ - pos);
+        memcpy(buffer, data_.data() + pos * frame_size_, first * frame_size_);
+        memcpy(buffer + first * frame_size_, data_.data(), (frames - first) * frame_size_);
+    }
+
+    /// Consumer: remove @p frames frames, requires available() >= frames
+    void consume(uint32_t frames)
+    {
+        read_pos_.store(read_pos_.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+        currentMark();
+    }
+
+    /// Consumer: read and remove up to @p frames frames
+    /// @return number of frames read
+    uint32_t read(char* buffer, uint32_t frames)
+    {
+        frames = std::min(frames, available());
+        peek(buffer, 0, frames);
+        consume(frames);
+        return frames;
+    }
+
+    /// Consumer: remove all frames
+    void clear()
+    {
+        read_pos_.store(write_pos_.load(std::memory_order_acquire), std::memory_order_release);
+        currentMark();
+    }
+
+    /// Consumer: remove all frames before position @p pos, as returned by written()
+    void clear(uint64_t pos)
+    {
+        read_pos_.store(std::max(pos, read_pos_.load(std::memory_order_relaxed)), std::memory_order_release);
+        currentMark();
+    }
+
+    /// Total number of frames written
+    uint64_t written() const
+    {
+        return write_pos_.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Mark
+    {
+        uint64_t pos;
+        chronos::time_point_clk start;
+    };
+
+    static constexpr uint32_t kUnlocked = 0;
+    static constexpr uint32_t kReading = 1;
+    static constexpr uint32_t kWriting = 2;
+
+    /// Producer: lock the ring for eviction or resizing
+    /// @return false if the consumer holds a ReadLock
+    bool lockWrite()
+    {
+        uint32_t expected = kUnlocked;
+        return lock_.compare_exchange_strong(expected, kWriting, std::memory_order_acquire);
+    }
+
+    void unlockWrite()
+    {
+        lock_.store(kUnlocked, std::memory_order_release);
+    }
+
+    /// Producer: there is space for @p frames frames and a mark
+    bool hasSpace(uint32_t frames) const
+    {
+        if (capacity_ - (write_pos_.load(std::memory_order_relaxed) - read_pos_.load(std::memory_order_acquire)) < frames)
+            return false;
+        return (marks_write_.load(std::memory_order_relaxed) - marks_read_.load(std::memory_order_acquire) < marks_.size());
+    }
+
+    /// Producer: remove the oldest frames, until there is space for @p frames frames and a mark
+    /// @return false if the frames will never fit, or if the consumer holds a ReadLock
+    bool makeSpace(uint32_t frames)
+    {
+        if ((frames > capacity_) || !lockWrite())
+            return false;
+        uint64_t write_pos = write_pos_.load(std::memory_order_relaxed);
+        while (!hasSpace(frames) && (read_pos_.load(std::memory_order_relaxed) < write_pos))
+        {
+            uint64_t read_pos = read_pos_.load(std::memory_order_relaxed);
+            uint64_t marks_read = marks_read_.load(std::memory_order_relaxed);
+            uint64_t free = capacity_ - (write_pos - read_pos);
+            read_pos += (free < frames) ? (frames - free) : 0;
+            // all marks are used: drop the frames of the oldest one
+            if (marks_write_.load(std::memory_order_relaxed) - marks_read >= marks_.size())
+                read_pos = std::max(read_pos, marks_[(marks_read + 1) % marks_.size()].pos);
+            read_pos_.store(std::min(read_pos, write_pos), std::memory_order_relaxed);
+            currentMark();
+        }
+        unlockWrite();
+        return hasSpace(frames);
+    }
+
+    chronos::nsec framesToDuration(uint64_t frames) const
+    {
+        return chronos::nsec(static_cast<chronos::nsec::rep>(frames * 1000000000 / format_.rate()));
+    }
+
+    /// Consumer: advance to the mark that covers the read position and return it
+    const Mark& currentMark()
+    {
+        uint64_t read_pos = read_pos_.load(std::memory_order_relaxed);
+        uint64_t marks_read = marks_read_.load(std::memory_order_relaxed);
+        uint64_t marks_write = marks_write_.load(std::memory_order_acquire);
+        while ((marks_read + 1 < marks_write) && (marks_[(marks_read + 1) % marks_.size()].pos <= read_pos))
+            ++marks_read;
+        marks_read_.store(marks_read, std::memory_order_release);
+        return marks_[marks_read % marks_.size()];
+    }
+
+    SampleFormat format_;
+    uint32_t frame_size_;
+    uint32_t capacity_;
+    std::vector<char> data_;
+    std::vector<Mark> marks_;
+
+    std::atomic<uint64_t> write_pos_;
+    std::atomic<uint64_t> read_pos_;
+    std::atomic<uint64_t> marks_write_;
+    std::atomic<uint64_t> marks_read_;
+    /// kUnlocked, kReading (consumer) or kWriting (producer evicting or resizing)
+    std::atomic<uint32_t> lock_;
+};
+
+
+#endif
@@ -0,0 +1,168 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef ADAPTIVE_LATENCY_HPP
+#define ADAPTIVE_LATENCY_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+
+
+namespace player
+{
+
+namespace latency
+{
+/// Underflows within this window are counted as a burst
+static constexpr std::chrono::seconds kUnderflowWindow{10};
+/// Number of underflows within kUnderflowWindow that grow the buffer
+static constexpr size_t kUnderflowBurst = 3;
+/// Time without underflows and latency changes before the buffer is shrunk
+static constexpr std::chrono::seconds kStablePeriod{30};
+/// Window for the max. callback interval
+static constexpr std::chrono::seconds kJitterWindow{10};
+} // namespace latency
+
+/// Adapts the size of an output buffer to the network and scheduling conditions
+/**
+ * Bursts of underflows or write callbacks that come close to draining the buffer
+ * grow the latency by 50%, up to a maximum. Once there were no underflows for a
+ * while and the callback jitter fits well into a smaller buffer, the latency is
+ * shrunk step by step back to the configured target.
+ */
+class AdaptiveLatency
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    AdaptiveLatency() : AdaptiveLatency(std::chrono::milliseconds(100))
+    {
+    }
+
+    /// @param target the configured latency, the buffer will not shrink below
+    /// @param max the latency will not grow above, at least @p target
+    explicit AdaptiveLatency(std::chrono::microseconds target, std::chrono::microseconds max = std::chrono::milliseconds(500))
+    {
+        reset(target, max);
+    }
+
+    /// Restart with the latency at @p target
+    void reset(std::chrono::microseconds target, std::chrono::microseconds max = std::chrono::milliseconds(500))
+    {
+        target_ = target;
+        max_ = std::max(max, target);
+        latency_ = target;
+        underflows_.clear();
+        last_change_ = clock::now();
+        last_callback_ = clock::time_point{};
+        window_start_ = last_change_;
+        max_gap_ = std::chrono::microseconds(0);
+        prev_max_gap_ = std::chrono::microseconds(0);
+    }
+
+    /// Report a buffer underflow
+    /// @return true if the latency changed
+    bool underflow(clock::time_point now = clock::now())
+    {
+        underflows_.push_back(now);
+        while (!underflows_.empty() && (now - underflows_.front() > latency::kUnderflowWindow))
+            underflows_.pop_front();
+        last_change_ = now;
+        if (underflows_.size() < latency::kUnderflowBurst)
+            return false;
+        return grow(now);
+    }
+
+    /// Report a write callback of the device
+    /// @return true if the latency changed
+    bool callback(clock::time_point now = clock::now())
+    {
+        if (last_callback_ != clock::time_point{})
+        {
+            auto gap = std::chrono::duration_cast<std::chrono::microseconds>(now - last_callback_);
+            max_gap_ = std::max(max_gap_, gap);
+        }
+        last_callback_ = now;
+        if (now - window_start_ > latency::kJitterWindow)
+        {
+            prev_max_gap_ = max_gap_;
+            max_gap_ = std::chrono::microseconds(0);
+            window_start_ = now;
+        }
+
+        // the buffer was almost drained between two callbacks
+        if (jitter() * 4 > latency_ * 3)
+            return grow(now);
+
+        if ((latency_ <= target_) || (now - last_change_ < latency::kStablePeriod))
+            return false;
+        auto shrunk = std::max(target_, latency_ * 4 / 5);
+        if (jitter() * 2 > shrunk)
+            return false;
+        latency_ = shrunk;
+        last_change_ = now;
+        return true;
+    }
+
+    /// @return the current latency
+    std::chrono::microseconds latency() const
+    {
+        return latency_;
+    }
+
+    /// @return the configured latency
+    std::chrono::microseconds target() const
+    {
+        return target_;
+    }
+
+    /// @return the max. interval between two callbacks within the last one or two jitter windows
+    std::chrono::microseconds jitter() const
+    {
+        return std::max(max_gap_, prev_max_gap_);
+    }
+
+private:
+    bool grow(clock::time_point now)
+    {
+        underflows_.clear();
+        last_change_ = now;
+        if (latency_ >= max_)
+            return false;
+        latency_ = std::min(max_, latency_ * 3 / 2);
+        // don't grow again for the gaps that caused this change
+        max_gap_ = prev_max_gap_ = std::chrono::microseconds(0);
+        window_start_ = now;
+        return true;
+    }
+
+    std::chrono::microseconds target_;
+    std::chrono::microseconds max_;
+    std::chrono::microseconds latency_;
+    std::deque<clock::time_point> underflows_;
+    clock::time_point last_change_;
+    clock::time_point last_callback_;
+    clock::time_point window_start_;
+    std::chrono::microseconds max_gap_;
+    std::chrono::microseconds prev_max_gap_;
+};
+
+} // namespace player
+
+#endif
@@ -41,7 +41,8 @@ static constexpr auto DEFAULT_MIXER = "PCM";
 
 
 AlsaPlayer::AlsaPlayer(boost::asio::io_context& io_context, const ClientSettings::Player& settings, std::shared_ptr<Stream> stream)
-    : Player(io_context, settings, stream), handle_(nullptr), ctl_(nullptr), mixer_(nullptr), elem_(nullptr), sd_(io_context), timer_(io_context)
+    : Player(io_context, settings, stream), handle_(nullptr), ctl_(nullptr), mixer_(nullptr), elem_(nullptr), sd_(io_context), timer_(io_context), mmap_(false),
+      tstamp_clock_(CLOCK_REALTIME)
 {
     if (settings_.mixer.mode == ClientSettings::Mixer::Mode::hardware)
     {
@@ -75,10 +76,12 @@ AlsaPlayer::AlsaPlayer(boost::asio::io_context& io_context, const ClientSettings
         buffer_time_ = std::chrono::milliseconds(std::max(cpt::stoi(params["buffer_time"]), 10));
     if (params.find("fragments") != params.end())
         periods_ = std::max(cpt::stoi(params["fragments"]), 2);
+    if (params.find("mmap") != params.end())
+        mmap_ = (params["mmap"] == "true");
 
     LOG(INFO, LOG_TAG) << "Using " << (buffer_time_.has_value() ? "configured" : "default")
                        << " buffer_time: " << buffer_time_.value_or(BUFFER_TIME).count() / 1000 << " ms, " << (periods_.has_value() ? "configured" : "default")
-                       << " fragments: " << periods_.value_or(PERIODS) << "\n";
+                       << " fragments: " << periods_.value_or(PERIODS) << ", mmap: " << mmap_ << "\n";
 }
 
 
@@ -311,7 +314,12 @@ void AlsaPlayer::initAlsa()
     }
 
     // Set parameters
-    if ((err = snd_pcm_hw_params_set_access(handle_, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+    if (mmap_ && ((err = snd_pcm_hw_params_set_access(handle_, params, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0))
+    {
+        LOG(WARNING, LOG_TAG) << "Can't set mmap interleaved mode: " << snd_strerror(err) << ", using read/write access\n";
+        mmap_ = false;
+    }
+    if (!mmap_ && ((err = snd_pcm_hw_params_set_access(handle_, params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0))
         throw SnapException("Can't set interleaved mode: " + string(snd_strerror(err)));
 
     snd_pcm_format_t snd_pcm_format;
@@ -430,6 +438,13 @@ void AlsaPlayer::initAlsa()
     snd_pcm_sw_params_set_avail_min(handle_, swparams, frames_);
     snd_pcm_sw_params_set_start_threshold(handle_, swparams, frames_);
     //	snd_pcm_sw_params_set_stop_threshold(pcm_handle, swparams, frames_);
+    // timestamp the hardware pointer updates, to get the DAC time from the PCM status
+    if ((err = snd_pcm_sw_params_set_tstamp_mode(handle_, swparams, SND_PCM_TSTAMP_ENABLE)) < 0)
+        LOG(DEBUG, LOG_TAG) << "Can't enable timestamps: " << snd_strerror(err) << "\n";
+    if (snd_pcm_sw_params_set_tstamp_type(handle_, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0)
+        tstamp_clock_ = CLOCK_MONOTONIC;
+    else
+        tstamp_clock_ = CLOCK_REALTIME;
     snd_pcm_sw_params(handle_, swparams);
 
     if (snd_pcm_state(handle_) == SND_PCM_STATE_PREPARED)
@@ -551,11 +566,113 @@ bool AlsaPlayer::getAvailDelay(snd_pcm_sframes_t& avail, snd_pcm_sframes_t& dela
 }
 
 
+bool AlsaPlayer::getAvailDacTime(snd_pcm_sframes_t& avail, chronos::time_point_clk& dac_time)
+{
+    const SampleFormat& format = stream_->getFormat();
+    snd_pcm_status_t* status;
+    snd_pcm_status_alloca(&status);
+    snd_htimestamp_t tstamp{0, 0};
+    int result = snd_pcm_status(handle_, status);
+    if (result == 0)
+        snd_pcm_status_get_htstamp(status, &tstamp);
+
+    snd_pcm_sframes_t delay = (result == 0) ? snd_pcm_status_get_delay(status) : 0;
+    // xruns are handled by getAvailDelay, some plugins don't provide timestamps
+    if ((result < 0) || (snd_pcm_status_get_state(status) == SND_PCM_STATE_XRUN) || (delay < 0) || ((tstamp.tv_sec == 0) && (tstamp.tv_nsec == 0)))
+    {
+        if (!getAvailDelay(avail, delay))
+            return false;
+        dac_time = chronos::clk::now() + chronos::usec(static_cast<chronos::usec::rep>(1000 * static_cast<double>(delay) / format.msRate()));
+        return true;
+    }
+
+    avail = std::min(static_cast<snd_pcm_sframes_t>(snd_pcm_status_get_avail(status)), static_cast<snd_pcm_sframes_t>(snd_pcm_avail_update(handle_)));
+    if (avail < 0)
+        avail = 0;
+    // the delay was valid at the time of the timestamp
+    timespec now;
+    clock_gettime(tstamp_clock_, &now);
+    auto age = std::chrono::seconds(now.tv_sec - tstamp.tv_sec) + std::chrono::nanoseconds(now.tv_nsec - tstamp.tv_nsec);
+    dac_time = chronos::clk::now() - std::chrono::duration_cast<chronos::clk::duration>(age) +
+               std::chrono::duration_cast<chronos::clk::duration>(chronos::nsec(static_cast<chronos::nsec::rep>(1000000 * static_cast<double>(delay) / format.msRate())));
+    return true;
+}
+
+
+bool AlsaPlayer::writeMmap(snd_pcm_uframes_t frames, const chronos::time_point_clk& dac_time)
+{
+    const SampleFormat& format = stream_->getFormat();
+    snd_pcm_uframes_t written = 0;
+    while (written < frames)
+    {
+        const snd_pcm_channel_area_t* areas;
+        snd_pcm_uframes_t offset;
+        snd_pcm_uframes_t size = frames - written;
+        int err = snd_pcm_mmap_begin(handle_, &areas, &offset, &size);
+        if (err == -EPIPE)
+        {
+            onXrun(std::string("while accessing the PCM buffer: ") + snd_strerror(err));
+            snd_pcm_prepare(handle_);
+            return true;
+        }
+        else if (err < 0)
+        {
+            LOG(ERROR, LOG_TAG) << "Can't access the PCM buffer: " << snd_strerror(err) << "\n";
+            snd_pcm_prepare(handle_);
+            return true;
+        }
+        // no space left in the buffer, the next wait will tell
+        if (size == 0)
+            break;
+
+        // interleaved: all channels are in the first area, first and step are in bits
+        char* buffer = static_cast<char*>(areas[0].addr) + (areas[0].first + offset * areas[0].step) / 8;
+        // frames of the previous segments are played first
+        auto delay = std::chrono::duration_cast<chronos::usec>(dac_time - chronos::clk::now()) +
+                     chronos::usec(static_cast<chronos::usec::rep>(1000 * static_cast<double>(written) / format.msRate()));
+        bool has_chunk = stream_->getPlayerChunk(buffer, delay, size);
+        if (has_chunk)
+            processChunk(buffer, size);
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle_, offset, has_chunk ? size : 0);
+        if (!has_chunk)
+        {
+            if (written == 0)
+                return false;
+            // the frames of the previous segments must still be started
+            break;
+        }
+
+        if (committed == -EPIPE)
+        {
+            onXrun(std::string("while writing to PCM: ") + snd_strerror(static_cast<int>(committed)));
+            snd_pcm_prepare(handle_);
+            return true;
+        }
+        else if ((committed < 0) || (static_cast<snd_pcm_uframes_t>(committed) != size))
+        {
+            LOG(ERROR, LOG_TAG) << "ERROR. Can't commit to PCM device: " << snd_strerror(static_cast<int>(committed)) << "\n";
+            uninitAlsa(true);
+            return true;
+        }
+        written += size;
+    }
+
+    // mmap access doesn't start the PCM automatically
+    if (snd_pcm_state(handle_) == SND_PCM_STATE_PREPARED)
+    {
+        int err = snd_pcm_start(handle_);
+        if (err < 0)
+            LOG(DEBUG, LOG_TAG) << "Failed to start PCM: " << snd_strerror(err) << "\n";
+    }
+    return true;
+}
+
+
 void AlsaPlayer::worker()
 {
     snd_pcm_sframes_t pcm;
-    snd_pcm_sframes_t framesDelay;
     snd_pcm_sframes_t framesAvail;
+    chronos::time_point_clk dacTime;
     long lastChunkTick = chronos::getTickCount();
     const SampleFormat& format = stream_->getFormat();
     while (active_)
@@ -581,7 +698,7 @@ void AlsaPlayer::worker()
         int wait_result = snd_pcm_wait(handle_, 100);
         if (wait_result == -EPIPE)
         {
-            LOG(ERROR, LOG_TAG) << "XRUN while waiting for PCM: " << snd_strerror(wait_result) << "\n";
+            onXrun(std::string("while waiting for PCM: ") + snd_strerror(wait_result));
             snd_pcm_prepare(handle_);
         }
         else if (wait_result < 0)
@@ -595,7 +712,7 @@ void AlsaPlayer::worker()
             continue;
         }
 
-        if (!getAvailDelay(framesAvail, framesDelay))
+        if (!getAvailDacTime(framesAvail, dacTime))
         {
             this_thread::sleep_for(10ms);
             snd_pcm_prepare(handle_);
@@ -616,22 +733,25 @@ void AlsaPlayer::worker()
             continue;
         }
 
-        // LOG(TRACE, LOG_TAG) << "res: " << result << ", framesAvail: " << framesAvail << ", delay: " << framesDelay << ", frames: " << frames_ << "\n";
-        chronos::usec delay(static_cast<chronos::usec::rep>(1000 * static_cast<double>(framesDelay) / format.msRate()));
-        // LOG(TRACE, LOG_TAG) << "delay: " << framesDelay << ", delay[ms]: " << delay.count() / 1000 << ", avail: " << framesAvail << "\n";
+        if (mmap_ && writeMmap(framesAvail, dacTime))
+        {
+            lastChunkTick = chronos::getTickCount();
+            continue;
+        }
 
-        if (buffer_.size() < static_cast<size_t>(framesAvail * format.frameSize()))
+        if (!mmap_ && (buffer_.size() < static_cast<size_t>(framesAvail * format.frameSize())))
         {
             LOG(DEBUG, LOG_TAG) << "Resizing buffer from " << buffer_.size() << " to " << framesAvail * format.frameSize() << "\n";
             buffer_.resize(framesAvail * format.frameSize());
         }
-        if (stream_->getPlayerChunk(buffer_.data(), delay, framesAvail))
+        // LOG(TRACE, LOG_TAG) << "delay[ms]: " << (dacTime - chronos::clk::now()).count() / 1000000 << ", avail: " << framesAvail << "\n";
+        if (!mmap_ && stream_->getPlayerChunk(buffer_.data(), std::chrono::duration_cast<chronos::usec>(dacTime - chronos::clk::now()), framesAvail))
         {
             lastChunkTick = chronos::getTickCount();
-            adjustVolume(buffer_.data(), framesAvail);
+            processChunk(buffer_.data(), framesAvail);
             if ((pcm = snd_pcm_writei(handle_, buffer_.data(), framesAvail)) == -EPIPE)
             {
-                LOG(ERROR, LOG_TAG) << "XRUN while writing to PCM: " << snd_strerror(pcm) << "\n";
+                onXrun(std::string("while writing to PCM: ") + snd_strerror(pcm));
                 snd_pcm_prepare(handle_);
             }
             else if (pcm < 0)
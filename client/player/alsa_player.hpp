@@ -58,6 +58,12 @@ private:
     /// @param uninit_mixer free the mixer
     void uninitAlsa(bool uninit_mixer);
     bool getAvailDelay(snd_pcm_sframes_t& avail, snd_pcm_sframes_t& delay);
+    /// Get the available frames and the time when the next written frame will be played
+    /// The delay is taken from the PCM status, together with the timestamp of the hardware pointer update
+    bool getAvailDacTime(snd_pcm_sframes_t& avail, chronos::time_point_clk& dac_time);
+    /// Render up to @p frames frames directly into the mmap'ed ring buffer
+    /// @return false if no chunk is available
+    bool writeMmap(snd_pcm_uframes_t frames, const chronos::time_point_clk& dac_time);
 
     void initMixer();
     void uninitMixer();
@@ -85,6 +91,10 @@ private:
 
     boost::optional<std::chrono::microseconds> buffer_time_;
     boost::optional<uint32_t> periods_;
+    /// use mmap access, i.e. render directly into the device's buffer
+    bool mmap_;
+    /// clock of the PCM status timestamps
+    clockid_t tstamp_clock_;
 };
 
 } // namespace player
@@ -121,7 +121,7 @@ void CoreAudioPlayer::playerCallback(AudioQueueRef queue, AudioQueueBufferRef bu
     else
     {
         lastChunkTick = chronos::getTickCount();
-        adjustVolume(buffer, frames_);
+        processChunk(buffer, frames_);
     }
 
     //    OSStatus status =
@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 
@@ -32,6 +33,8 @@ namespace player
 
 static constexpr auto LOG_TAG = "FilePlayer";
 static constexpr auto kDefaultBuffer = 50ms;
+/// offline mode: audio is collected and written in blocks of this size
+static constexpr size_t kWriteBufferSize = 1024 * 1024;
 
 static constexpr auto kDescription = "Raw PCM file output";
 
@@ -48,12 +51,17 @@ std::vector<PcmDevice> FilePlayer::pcm_list(const std::string& parameter)
 
 
 FilePlayer::FilePlayer(boost::asio::io_context& io_context, const ClientSettings::Player& settings, std::shared_ptr<Stream> stream)
-    : Player(io_context, settings, stream), timer_(io_context), file_(nullptr)
+    : Player(io_context, settings, stream), timer_(io_context), file_(nullptr), offline_(false), duration_(0)
 {
     auto params = utils::string::split_pairs(settings.parameter, ',', '=');
-    string filename;
-    if (params.find("filename") != params.end())
+    // the soundcard is the filename, e.g. for additional outputs
+    string filename = (settings.pcm_device.name != DEFAULT_DEVICE) ? settings.pcm_device.name : "";
+    if (filename.empty() && (params.find("filename") != params.end()))
         filename = params["filename"];
+    if (params.find("offline") != params.end())
+        offline_ = (params["offline"] == "true");
+    if (params.find("duration") != params.end())
+        duration_ = std::chrono::seconds(std::max(cpt::stoi(params["duration"]), 0));
 
     if (filename.empty() || (filename == "stdout"))
     {
@@ -75,6 +83,13 @@ FilePlayer::FilePlayer(boost::asio::io_context& io_context, const ClientSettings
         if (!file_)
             throw SnapException("Error opening file: '" + filename + "', error: " + cpt::to_string(errno));
     }
+
+    if (offline_)
+    {
+        LOG(INFO, LOG_TAG) << "Offline mode, duration: " << duration_.count() << " s\n";
+        stream_->setVirtualClock(true);
+        write_buffer_.reserve(kWriteBufferSize);
+    }
 }
 
 
@@ -87,7 +102,7 @@ FilePlayer::~FilePlayer()
 
 bool FilePlayer::needsThread() const
 {
-    return false;
+    return offline_;
 }
 
 
@@ -104,7 +119,7 @@ void FilePlayer::requestAudio()
     }
     else
     {
-        adjustVolume(static_cast<char*>(buffer_.data()), numFrames);
+        processChunk(static_cast<char*>(buffer_.data()), numFrames);
     }
 
     if (file_)
@@ -133,8 +148,87 @@ void FilePlayer::loop()
 }
 
 
+void FilePlayer::worker()
+{
+    using namespace std::chrono;
+    auto numFrames = static_cast<uint32_t>(stream_->getFormat().msRate() * kDefaultBuffer.count());
+    auto needed = numFrames * stream_->getFormat().frameSize();
+    buffer_.resize(needed);
+    auto max_frames = static_cast<uint64_t>(duration_.count()) * stream_->getFormat().rate();
+    stats_ = OfflineStats{};
+    stats_.start = steady_clock::now();
+
+    while (active_)
+    {
+        auto t0 = steady_clock::now();
+        if (!stream_->waitForChunk(100ms, numFrames))
+        {
+            stats_.wait += steady_clock::now() - t0;
+            continue;
+        }
+        auto t1 = steady_clock::now();
+        bool has_chunk = stream_->getPlayerChunkOrSilence(buffer_.data(), 0ms, numFrames);
+        auto t2 = steady_clock::now();
+        if (has_chunk)
+            processChunk(buffer_.data(), numFrames);
+        auto t3 = steady_clock::now();
+        if (file_)
+        {
+            write_buffer_.insert(write_buffer_.end(), buffer_.begin(), buffer_.begin() + needed);
+            if (write_buffer_.size() + needed > kWriteBufferSize)
+                flush();
+        }
+        auto t4 = steady_clock::now();
+
+        stats_.wait += t1 - t0;
+        stats_.sync += t2 - t1;
+        stats_.dsp += t3 - t2;
+        stats_.write += t4 - t3;
+        stats_.frames += numFrames;
+        if ((max_frames > 0) && (stats_.frames >= max_frames))
+        {
+            LOG(INFO, LOG_TAG) << "Played " << duration_.count() << " s, stopping\n";
+            io_context_.stop();
+            break;
+        }
+    }
+    flush();
+}
+
+
+void FilePlayer::flush()
+{
+    if (!file_ || write_buffer_.empty())
+        return;
+    fwrite(write_buffer_.data(), 1, write_buffer_.size(), file_.get());
+    fflush(file_.get());
+    write_buffer_.clear();
+}
+
+
+void FilePlayer::logStats() const
+{
+    using namespace std::chrono;
+    if ((stats_.frames == 0) || (stream_->getFormat().rate() == 0))
+        return;
+    auto ms = [](nanoseconds duration) { return duration_cast<microseconds>(duration).count() / 1000.; };
+    double audio_s = static_cast<double>(stats_.frames) / stream_->getFormat().rate();
+    double wall_s = duration<double>(steady_clock::now() - stats_.start).count();
+    double busy_s = duration<double>(stats_.sync + stats_.dsp + stats_.write).count();
+    LOG(INFO, LOG_TAG) << "Played " << audio_s << " s in " << wall_s << " s, " << static_cast<uint64_t>(stats_.frames / std::max(wall_s, 1e-9))
+                       << " frames/s, processing: " << audio_s / std::max(busy_s, 1e-9) << "x realtime\n";
+    LOG(INFO, LOG_TAG) << "Stage times [ms] - wait: " << ms(stats_.wait) << ", sync: " << ms(stats_.sync) << ", dsp: " << ms(stats_.dsp)
+                       << ", write: " << ms(stats_.write) << "\n";
+}
+
+
 void FilePlayer::start()
 {
+    if (offline_)
+    {
+        Player::start();
+        return;
+    }
     next_request_ = std::chrono::steady_clock::now();
     loop();
 }
@@ -144,6 +238,11 @@ void FilePlayer::stop()
 {
     LOG(INFO, LOG_TAG) << "Stop\n";
     timer_.cancel();
+    if (offline_ && active_)
+    {
+        Player::stop();
+        logStats();
+    }
 }
 
 } // namespace player
@@ -29,8 +29,13 @@ namespace player
 static constexpr auto FILE = "file";
 
 /// File Player
-/// Used for testing and doesn't even write the received audio to file at the moment,
-/// but just discards it
+/// Writes the received audio as raw PCM to a file, stdout or stderr, or discards it ("null")
+/**
+ * In realtime mode the audio is requested in intervals from a timer.
+ * In offline mode ("offline=true") the player pulls audio on its own thread as soon as it
+ * arrives, the Stream is driven by a virtual clock, and the audio is written with large
+ * buffered writes. On stop it logs the throughput and the time spent per stage.
+ */
 class FilePlayer : public Player
 {
 public:
@@ -44,13 +49,39 @@ public:
     static std::vector<PcmDevice> pcm_list(const std::string& parameter);
 
 protected:
+    /// Timings of the offline mode
+    struct OfflineStats
+    {
+        uint64_t frames = 0;
+        std::chrono::steady_clock::time_point start;
+        /// waiting for audio
+        std::chrono::nanoseconds wait{0};
+        /// Stream::getPlayerChunk: sync, resampling
+        std::chrono::nanoseconds sync{0};
+        /// DSP chain and volume
+        std::chrono::nanoseconds dsp{0};
+        /// writing to the file
+        std::chrono::nanoseconds write{0};
+    };
+
     void requestAudio();
     void loop();
     bool needsThread() const override;
+    void worker() override;
+    /// Write the buffered audio of the offline mode
+    void flush();
+    void logStats() const;
+
     boost::asio::steady_timer timer_;
     std::vector<char> buffer_;
     std::chrono::time_point<std::chrono::steady_clock> next_request_;
     std::shared_ptr<::FILE> file_;
+
+    bool offline_;
+    /// stop after this duration of audio in offline mode, 0 = unlimited
+    std::chrono::seconds duration_;
+    std::vector<char> write_buffer_;
+    OfflineStats stats_;
 };
 
 } // namespace player
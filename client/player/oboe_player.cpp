@@ -158,7 +158,7 @@ oboe::DataCallbackResult OboePlayer::onAudioReady(oboe::AudioStream* /*oboeStrea
     }
     else
     {
-        adjustVolume(static_cast<char*>(audioData), numFrames);
+        processChunk(static_cast<char*>(audioData), numFrames);
     }
 
     return oboe::DataCallbackResult::Continue;
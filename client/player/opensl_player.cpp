@@ -84,7 +84,7 @@ void OpenslPlayer::playerCallback(SLAndroidSimpleBufferQueueItf bq)
     }
     else
     {
-        adjustVolume(buffer[curBuffer], frames_);
+        processChunk(buffer[curBuffer], frames_);
     }
 
     while (active_)
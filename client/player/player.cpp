@@ -36,6 +36,7 @@
 #include "common/snap_exception.hpp"
 #include "common/str_compat.hpp"
 #include "common/utils/string_utils.hpp"
+#include "common/utils/thread_utils.hpp"
 #include "player.hpp"
 
 
@@ -47,8 +48,22 @@ namespace player
 static constexpr auto LOG_TAG = "Player";
 
 Player::Player(boost::asio::io_context& io_context, const ClientSettings::Player& settings, std::shared_ptr<Stream> stream)
-    : io_context_(io_context), active_(false), stream_(stream), settings_(settings), volume_(1.0), muted_(false), volCorrection_(1.0)
+    : io_context_(io_context), active_(false), xruns_(0), stream_(stream), settings_(settings), volume_(1.0), muted_(false), volCorrection_(1.0),
+      volumeRamp_(settings.mixer.ramp_exponential ? VolumeRamp::Shape::exponential : VolumeRamp::Shape::linear)
 {
+    if (!settings_.dsp.empty())
+    {
+        try
+        {
+            dsp_ = std::make_unique<DspChain>(stream_->getFormat(), settings_.dsp);
+            stream_->setProcessingDelay(dsp_->delay());
+            LOG(INFO, LOG_TAG) << "DSP: " << settings_.dsp << ", delay: " << dsp_->delay().count() << " us\n";
+        }
+        catch (const std::exception& e)
+        {
+            LOG(ERROR, LOG_TAG) << "Failed to create DSP chain, playing without DSP: " << e.what() << "\n";
+        }
+    }
     string sharing_mode;
     switch (settings_.sharing_mode)
     {
@@ -105,7 +120,21 @@ void Player::start()
 {
     active_ = true;
     if (needsThread())
-        playerThread_ = thread(&Player::worker, this);
+    {
+        playerThread_ = thread([this]() {
+            try
+            {
+                utils::thread::apply(settings_.thread);
+            }
+            catch (const std::exception& e)
+            {
+                LOG(WARNING, LOG_TAG) << e.what() << "\n";
+            }
+            if (settings_.thread.prefault)
+                utils::thread::prefaultStack();
+            worker();
+        });
+    }
 
     // If hardware mixer is used, send the initial volume to the server, because this is
     // the volume that is configured by the user on his local device, so we shouldn't change it
@@ -128,6 +157,8 @@ void Player::stop()
         active_ = false;
         if (playerThread_.joinable())
             playerThread_.join();
+        if (xruns_ > 0)
+            LOG(INFO, LOG_TAG) << "Player stopped, xruns: " << xruns_ << "\n";
     }
 }
 
@@ -153,6 +184,31 @@ bool Player::getHardwareVolume(double& volume, bool& muted)
 }
 
 
+void Player::onXrun(const std::string& reason)
+{
+    ++xruns_;
+    LOG(ERROR, LOG_TAG) << "XRUN #" << xruns_ << " " << reason << "\n";
+}
+
+
+void Player::notifyLatencyChange(std::chrono::microseconds latency)
+{
+    if (buffer_latency_.exchange(latency.count()) == latency.count())
+        return;
+    stream_->setOutputLatency(latency);
+    if (onLatencyChanged_)
+        onLatencyChanged_(latency);
+}
+
+
+void Player::processChunk(char* buffer, size_t frames)
+{
+    if (dsp_)
+        dsp_->process(buffer, static_cast<uint32_t>(frames));
+    adjustVolume(buffer, frames);
+}
+
+
 void Player::adjustVolume(char* buffer, size_t frames)
 {
     double volume = volCorrection_;
@@ -164,16 +220,9 @@ void Player::adjustVolume(char* buffer, size_t frames)
         volume *= volCorrection_;
     }
 
-    if (volume != 1.0)
-    {
-        const SampleFormat& sampleFormat = stream_->getFormat();
-        if (sampleFormat.sampleSize() == 1)
-            adjustVolume<int8_t>(buffer, frames * sampleFormat.channels(), volume);
-        else if (sampleFormat.sampleSize() == 2)
-            adjustVolume<int16_t>(buffer, frames * sampleFormat.channels(), volume);
-        else if (sampleFormat.sampleSize() == 4)
-            adjustVolume<int32_t>(buffer, frames * sampleFormat.channels(), volume);
-    }
+    const SampleFormat& sampleFormat = stream_->getFormat();
+    volumeRamp_.setGain(volume, static_cast<uint32_t>(settings_.mixer.ramp_time.count() * sampleFormat.rate() / 1000));
+    volumeRamp_.apply(buffer, frames, sampleFormat.channels(), sampleFormat.sampleSize());
 }
 
 
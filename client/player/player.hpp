@@ -20,13 +20,16 @@
 #define PLAYER_HPP
 
 #include "client_settings.hpp"
+#include "dsp_chain.hpp"
 #include "common/aixlog.hpp"
 #include "common/endian.hpp"
 #include "stream.hpp"
+#include "volume_ramp.hpp"
 
 #include <boost/asio.hpp>
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <string>
 #include <thread>
@@ -42,6 +45,7 @@ namespace player
 class Player
 {
     using volume_callback = std::function<void(double volume, bool muted)>;
+    using latency_callback = std::function<void(std::chrono::microseconds latency)>;
 
 public:
     Player(boost::asio::io_context& io_context, const ClientSettings::Player& settings, std::shared_ptr<Stream> stream);
@@ -62,6 +66,21 @@ public:
     {
         onVolumeChanged_ = callback;
     }
+    /// Sets the callback for changes of the output buffer latency
+    void setLatencyCallback(const latency_callback& callback)
+    {
+        onLatencyChanged_ = callback;
+    }
+    /// @return number of xruns (buffer underruns of the device) since start
+    uint32_t xruns() const
+    {
+        return xruns_;
+    }
+    /// @return the effective latency of the output buffer, 0 if the player doesn't adapt it
+    std::chrono::microseconds bufferLatency() const
+    {
+        return std::chrono::microseconds(buffer_latency_);
+    }
 
 protected:
     /// will be run in a thread if needsThread is true
@@ -84,6 +103,11 @@ protected:
     void setVolume_exp(double volume, double base);
 
     void adjustVolume(char* buffer, size_t frames);
+    /// Run the DSP chain and adjust the volume, to be called on every chunk from getPlayerChunk
+    void processChunk(char* buffer, size_t frames);
+
+    /// Count and log an xrun
+    void onXrun(const std::string& reason);
 
     /// Notify the server about hardware volume changes
     /// @param volume the volume in range [0..1]
@@ -94,8 +118,12 @@ protected:
             onVolumeChanged_(volume, muted);
     }
 
+    /// Report a changed output buffer latency to the Stream and the server
+    void notifyLatencyChange(std::chrono::microseconds latency);
+
     boost::asio::io_context& io_context_;
     std::atomic<bool> active_;
+    std::atomic<uint32_t> xruns_;
     std::shared_ptr<Stream> stream_;
     std::thread playerThread_;
     ClientSettings::Player settings_;
@@ -103,15 +131,12 @@ protected:
     bool muted_;
     double volCorrection_;
     volume_callback onVolumeChanged_;
+    latency_callback onLatencyChanged_;
+    std::atomic<std::chrono::microseconds::rep> buffer_latency_{0};
 
 private:
-    template <typename T>
-    void adjustVolume(char* buffer, size_t count, double volume)
-    {
-        T* bufferT = (T*)buffer;
-        for (size_t n = 0; n < count; ++n)
-            bufferT[n] = endian::swap<T>(static_cast<T>(endian::swap<T>(bufferT[n]) * volume));
-    }
+    VolumeRamp volumeRamp_;
+    std::unique_ptr<DspChain> dsp_;
 };
 
 } // namespace player
@@ -251,20 +251,28 @@ void PulsePlayer::subscribeCallback(pa_context* ctx, pa_subscription_event_type_
 }
 
 
+void PulsePlayer::applyLatency(pa_stream* stream)
+{
+    // Only the target length is changed. Pulse stops requesting data until the buffer
+    // has drained to a smaller tlength, so shrinking doesn't drop any audio.
+    bufattr_.tlength = pa_usec_to_bytes(adaptive_latency_.latency().count(), &pa_ss_);
+    pa_operation* op = pa_stream_set_buffer_attr(stream, &bufattr_, nullptr, nullptr);
+    if (op != nullptr)
+        pa_operation_unref(op);
+    notifyLatencyChange(adaptive_latency_.latency());
+}
+
+
 void PulsePlayer::underflowCallback(pa_stream* stream)
 {
-    // We increase the latency by 50% if we get 6 underflows and latency is under 2s
+    // Bursts of underflows increase the latency, see AdaptiveLatency.
     // This is very useful for over the network playback that can't handle low latencies
-    underflows_++;
-    LOG(INFO, LOG_TAG) << "undeflow #" << underflows_ << ", latency: " << latency_.count() / 1000 << " ms\n";
-    if (underflows_ >= 6 && latency_ < 500ms)
+    ++xruns_;
+    LOG(INFO, LOG_TAG) << "underflow #" << xruns_ << ", latency: " << adaptive_latency_.latency().count() / 1000 << " ms\n";
+    if (adaptive_latency_.underflow())
     {
-        latency_ = (latency_ * 3) / 2;
-        bufattr_.maxlength = pa_usec_to_bytes(latency_.count(), &pa_ss_);
-        bufattr_.tlength = pa_usec_to_bytes(latency_.count(), &pa_ss_);
-        pa_stream_set_buffer_attr(stream, &bufattr_, nullptr, nullptr);
-        underflows_ = 0;
-        LOG(INFO, LOG_TAG) << "latency increased to " << latency_.count() / 1000 << " ms\n";
+        LOG(INFO, LOG_TAG) << "latency increased to " << adaptive_latency_.latency().count() / 1000 << " ms\n";
+        applyLatency(stream);
     }
 }
 
@@ -311,6 +319,14 @@ void PulsePlayer::stateCallback(pa_context* ctx)
 
 void PulsePlayer::writeCallback(pa_stream* stream, size_t nbytes)
 {
+    auto previous = adaptive_latency_.latency();
+    if (adaptive_latency_.callback())
+    {
+        LOG(INFO, LOG_TAG) << "latency " << (adaptive_latency_.latency() > previous ? "increased" : "decreased") << " to "
+                           << adaptive_latency_.latency().count() / 1000 << " ms, callback jitter: " << adaptive_latency_.jitter().count() / 1000 << " ms\n";
+        applyLatency(stream);
+    }
+
     pa_usec_t usec;
     int neg;
     pa_stream_get_latency(stream, &usec, &neg);
@@ -325,7 +341,7 @@ void PulsePlayer::writeCallback(pa_stream* stream, size_t nbytes)
     }
     else
     {
-        adjustVolume(static_cast<char*>(buffer_.data()), numFrames);
+        processChunk(static_cast<char*>(buffer_.data()), numFrames);
     }
 
     pa_stream_write(stream, buffer_.data(), nbytes, nullptr, 0LL, PA_SEEK_RELATIVE);
@@ -444,8 +460,11 @@ void PulsePlayer::start()
         },
         this);
 
+    // maxlength leaves room for the adaptive latency to grow without reconnecting the stream
+    auto max_latency = std::max<std::chrono::microseconds>(latency_, 500ms);
+    adaptive_latency_.reset(latency_, max_latency);
     bufattr_.fragsize = pa_usec_to_bytes(latency_.count(), &pa_ss_);
-    bufattr_.maxlength = pa_usec_to_bytes(latency_.count(), &pa_ss_);
+    bufattr_.maxlength = pa_usec_to_bytes(max_latency.count(), &pa_ss_);
     bufattr_.minreq = static_cast<uint32_t>(-1);
     bufattr_.prebuf = static_cast<uint32_t>(-1);
     bufattr_.tlength = pa_usec_to_bytes(latency_.count(), &pa_ss_);
@@ -465,6 +484,7 @@ void PulsePlayer::start()
     }
     if (result < 0)
         throw SnapException("Failed to connect PulseAudio playback stream");
+    notifyLatencyChange(latency_);
 
     Player::start();
 }
@@ -19,6 +19,7 @@
 #ifndef PULSE_PLAYER_HPP
 #define PULSE_PLAYER_HPP
 
+#include "adaptive_latency.hpp"
 #include "player.hpp"
 
 #include <atomic>
@@ -56,6 +57,8 @@ protected:
     void setHardwareVolume(double volume, bool muted) override;
 
     void triggerVolumeUpdate();
+    /// Set the target length of the stream's buffer to the adaptive latency
+    void applyLatency(pa_stream* stream);
 
     void underflowCallback(pa_stream* stream);
     void stateCallback(pa_context* ctx);
@@ -64,8 +67,9 @@ protected:
 
     std::vector<char> buffer_;
 
+    /// configured latency
     std::chrono::microseconds latency_;
-    int underflows_ = 0;
+    AdaptiveLatency adaptive_latency_;
     std::atomic<int> pa_ready_;
 
     pa_buffer_attr bufattr_;
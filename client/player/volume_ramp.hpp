@@ -0,0 +1,200 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef VOLUME_RAMP_HPP
+#define VOLUME_RAMP_HPP
+
+#include "common/endian.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+
+namespace player
+{
+
+/// Applies a gain to interleaved PCM samples in place
+/**
+ * Gain changes are not applied at once, but ramped per frame from the current
+ * to the new gain, to avoid zipper noise. A constant gain is applied in loops
+ * that the compiler can vectorize, with a Q15 fixed-point gain for 16 bit samples.
+ */
+class VolumeRamp
+{
+public:
+    enum class Shape
+    {
+        /// linear in amplitude
+        linear,
+        /// linear in dB, changes from or to 0 start or end at -60dB
+        exponential
+    };
+
+    explicit VolumeRamp(Shape shape = Shape::linear) : shape_(shape), initialized_(false), gain_(1.), target_(1.), step_(0.), remaining_(0)
+    {
+    }
+
+    /// Set the gain to ramp to
+    /// @param gain the new gain
+    /// @param ramp_frames duration of the ramp in frames, 0 to apply the gain immediately
+    void setGain(double gain, uint32_t ramp_frames)
+    {
+        if (initialized_ && (gain == target_))
+            return;
+        target_ = gain;
+        if (!initialized_ || (ramp_frames == 0))
+        {
+            initialized_ = true;
+            gain_ = target_;
+            remaining_ = 0;
+            return;
+        }
+        // a running ramp continues from the current gain
+        remaining_ = ramp_frames;
+        if (shape_ == Shape::exponential)
+        {
+            const double min_gain = 0.001;
+            gain_ = std::max(gain_, min_gain);
+            step_ = std::pow(std::max(target_, min_gain) / gain_, 1. / ramp_frames);
+        }
+        else
+            step_ = (target_ - gain_) / ramp_frames;
+    }
+
+    /// @return the current gain
+    double gain() const
+    {
+        return gain_;
+    }
+
+    /// Apply the gain to @p frames interleaved frames
+    /// @param buffer the samples, modified in place
+    /// @param frames number of frames
+    /// @param channels number of channels per frame
+    /// @param sample_size bytes per sample: 1, 2 or 4
+    void apply(char* buffer, size_t frames, uint16_t channels, uint16_t sample_size)
+    {
+        size_t ramp_frames = std::min(frames, static_cast<size_t>(remaining_));
+        if (ramp_frames > 0)
+        {
+            if (sample_size == 1)
+                applyRamp(reinterpret_cast<int8_t*>(buffer), ramp_frames, channels);
+            else if (sample_size == 2)
+                applyRamp(reinterpret_cast<int16_t*>(buffer), ramp_frames, channels);
+            else if (sample_size == 4)
+                applyRamp(reinterpret_cast<int32_t*>(buffer), ramp_frames, channels);
+            remaining_ -= static_cast<uint32_t>(ramp_frames);
+            if (remaining_ == 0)
+                gain_ = target_;
+            buffer += ramp_frames * channels * sample_size;
+            frames -= ramp_frames;
+        }
+
+        if ((frames == 0) || (gain_ == 1.))
+            return;
+
+        size_t samples = frames * channels;
+        if (sample_size == 1)
+            applyFloat(reinterpret_cast<int8_t*>(buffer), samples, static_cast<float>(gain_));
+        else if (sample_size == 2)
+            applyInt16(reinterpret_cast<int16_t*>(buffer), samples, gain_);
+        else if (sample_size == 4)
+            applyInt32(reinterpret_cast<int32_t*>(buffer), samples, gain_);
+    }
+
+private:
+    template <typename T, typename V>
+    static T clamp(V value)
+    {
+        return static_cast<T>(std::max(static_cast<V>(std::numeric_limits<T>::min()), std::min(value, static_cast<V>(std::numeric_limits<T>::max()))));
+    }
+
+    template <typename T>
+    void applyRamp(T* samples, size_t frames, uint16_t channels)
+    {
+        for (size_t frame = 0; frame < frames; ++frame)
+        {
+            gain_ = (shape_ == Shape::exponential) ? gain_ * step_ : gain_ + step_;
+            for (uint16_t channel = 0; channel < channels; ++channel, ++samples)
+                *samples = endian::swap<T>(clamp<T>(endian::swap<T>(*samples) * gain_));
+        }
+    }
+
+    /// Run @p op on all samples, in blocks of a fixed size that the compiler can vectorize, also with -O2
+    template <typename T, typename Op>
+    static void transform(T* samples, size_t count, Op op)
+    {
+        const size_t block = 16;
+        size_t n = 0;
+        for (; n + block <= count; n += block)
+        {
+            for (size_t i = 0; i < block; ++i)
+                samples[n + i] = op(samples[n + i]);
+        }
+        for (; n < count; ++n)
+            samples[n] = op(samples[n]);
+    }
+
+    template <typename T>
+    static void applyFloat(T* samples, size_t count, float gain)
+    {
+        transform(samples, count, [gain](T sample) { return endian::swap<T>(clamp<T>(endian::swap<T>(sample) * gain)); });
+    }
+
+    /// Q15 gain with 32 bit intermediates for gains <= 1
+    static void applyInt16(int16_t* samples, size_t count, double gain)
+    {
+        if (gain > 1.)
+        {
+            applyFloat(samples, count, static_cast<float>(gain));
+            return;
+        }
+        const auto g = static_cast<int32_t>(std::lround(gain * 32768.));
+        transform(samples, count, [g](int16_t sample) {
+            return endian::swap<int16_t>(static_cast<int16_t>((static_cast<int32_t>(endian::swap<int16_t>(sample)) * g) >> 15));
+        });
+    }
+
+    /// Gains <= 1 can't overflow and are applied in double precision, which is exact for 32 bit samples.
+    /// Larger gains (up to 256 for 24 bit samples in 32 bit containers) use a Q16 gain with 64 bit intermediates and saturation
+    static void applyInt32(int32_t* samples, size_t count, double gain)
+    {
+        if (gain <= 1.)
+        {
+            transform(samples, count, [gain](int32_t sample) { return endian::swap<int32_t>(static_cast<int32_t>(endian::swap<int32_t>(sample) * gain)); });
+            return;
+        }
+        const auto g = static_cast<int64_t>(std::llround(std::min(gain, 256.) * 65536.));
+        transform(samples, count, [g](int32_t sample) {
+            return endian::swap<int32_t>(clamp<int32_t>((static_cast<int64_t>(endian::swap<int32_t>(sample)) * g) >> 16));
+        });
+    }
+
+    Shape shape_;
+    bool initialized_;
+    double gain_;
+    double target_;
+    /// increment (linear) or factor (exponential) per frame
+    double step_;
+    uint32_t remaining_;
+};
+
+} // namespace player
+
+#endif
@@ -375,7 +375,7 @@ void WASAPIPlayer::worker()
         {
             if (available > 0)
             {
-                adjustVolume(queueBuffer.get(), available);
+                processChunk(queueBuffer.get(), available);
                 hr = renderClient->GetBuffer(available, &buffer);
                 CHECK_HR(hr);
                 memcpy(buffer, queueBuffer.get(), bufferSize);
@@ -25,6 +25,7 @@
 
 #include "common/popl.hpp"
 #include "controller.hpp"
+#include "dsp_chain.hpp"
 
 #ifdef HAS_ALSA
 #include "player/alsa_player.hpp"
@@ -44,8 +45,10 @@
 #include "common/snap_exception.hpp"
 #include "common/str_compat.hpp"
 #include "common/utils.hpp"
+#include "common/utils/thread_utils.hpp"
 #include "common/version.hpp"
 #include "metadata.hpp"
+#include "startup_timeline.hpp"
 
 
 using namespace std;
@@ -76,7 +79,7 @@ PcmDevice getPcmDevice(const std::string& player, const std::string& parameter,
         pcm_devices = WASAPIPlayer::pcm_list();
 #endif
     if (player == player::FILE)
-        return FilePlayer::pcm_list(parameter).front();
+        return (soundcard == DEFAULT_DEVICE) ? FilePlayer::pcm_list(parameter).front() : PcmDevice(0, soundcard);
     try
     {
         int soundcardIdx = cpt::stoi(soundcard);
@@ -125,6 +128,8 @@ int main(int argc, char** argv)
 #ifdef MACOS
 #pragma message "Warning: the macOS support is experimental and might not be maintained"
 #endif
+    // the startup timeline is relative to this point
+    StartupTimeline::getInstance();
     int exitcode = EXIT_SUCCESS;
     try
     {
@@ -140,6 +145,8 @@ int main(int argc, char** argv)
         op.add<Value<size_t>>("p", "port", "server port", 1704, &settings.server.port);
         op.add<Value<size_t>>("i", "instance", "instance id when running multiple instances on the same host", 1, &settings.instance);
         op.add<Value<string>>("", "hostID", "unique host id, default is MAC address", "", &settings.host_id);
+        auto outputValue =
+            op.add<Value<string>>("", "output", "additional output <soundcard>, played as separate client with the next instance id. Can be given multiple times");
 
 // PCM device specific
 #if defined(HAS_ALSA) || defined(HAS_PULSE) || defined(HAS_WASAPI)
@@ -149,6 +156,7 @@ int main(int argc, char** argv)
         /*auto latencyValue =*/op.add<Value<int>>("", "latency", "latency of the PCM device", 0, &settings.player.latency);
 #ifdef HAS_SOXR
         auto sample_format = op.add<Value<string>>("", "sampleformat", "resample audio stream to <rate>:<bits>:<channels>", "");
+        auto sync_mode = op.add<Value<string>>("", "syncmode", "soft sync by dropping/duplicating frames or by resampling [drop|resample]", "drop");
 #endif
 
         auto supported_players = Controller::getSupportedPlayerNames();
@@ -173,6 +181,10 @@ int main(int argc, char** argv)
         else
             mixer_mode = op.add<Value<string>>("", "mixer", "software|script|none|?[:<options>]", "software");
 
+        auto volume_ramp = op.add<Value<string>>("", "volumeramp", "duration of volume changes <ms>[:linear|exp], 0 to change immediately", "50:linear");
+
+        op.add<Value<string>>("", "dsp", "DSP chain <stage>[,<stage>]*, \"?\" for help", settings.player.dsp, &settings.player.dsp);
+
         auto metaStderr = op.add<Switch>("e", "mstderr", "send metadata to stderr");
 
 // daemon settings
@@ -182,6 +194,12 @@ int main(int argc, char** argv)
         auto userValue = op.add<Value<string>>("", "user", "the user[:group] to run snapclient as when daemonized");
 #endif
 
+        // scheduling
+        auto realtimeValue = op.add<Value<string>>("", "realtime", "run the player thread with realtime scheduling <fifo|rr>[:<priority>]");
+        auto mlockSwitch = op.add<Switch>("", "mlock", "lock the process memory into RAM");
+        auto playerCpusValue = op.add<Value<string>>("", "playercpus", "CPUs to run the player thread on, e.g. \"3\" or \"2-3\"");
+        auto netCpusValue = op.add<Value<string>>("", "netcpus", "CPUs to run the network and decoder threads on, e.g. \"0,1\"");
+
         // logging
         op.add<Value<string>>("", "logsink", "log sink [null,system,stdout,stderr,file:<filename>]", settings.logging.sink, &settings.logging.sink);
         auto logfilterOption = op.add<Value<string>>(
@@ -348,8 +366,22 @@ int main(int argc, char** argv)
             if ((bits != 0) && (bits != 16) && (bits != 24) && (bits != 32))
                 throw SnapException("sampleformat bits must be 16, 24, 32, * (= same as the source)");
         }
+
+        if (sync_mode->value() == "resample")
+            settings.player.sync_mode = ClientSettings::SyncMode::resample;
+        else if (sync_mode->value() != "drop")
+            throw SnapException("syncmode must be drop or resample");
 #endif
 
+        if (realtimeValue->is_set())
+            utils::thread::parsePolicy(realtimeValue->value(), settings.player.thread);
+        if (playerCpusValue->is_set())
+            settings.player.thread.cpus = utils::thread::parseCpus(playerCpusValue->value());
+        if (netCpusValue->is_set())
+            settings.io_thread.cpus = utils::thread::parseCpus(netCpusValue->value());
+        settings.lock_memory = mlockSwitch->is_set();
+        settings.player.thread.prefault = settings.lock_memory || realtimeValue->is_set();
+
 #if defined(HAS_OBOE) || defined(HAS_WASAPI)
         settings.player.sharing_mode = (sharing_mode->value() == "exclusive") ? ClientSettings::SharingMode::exclusive : ClientSettings::SharingMode::shared;
 #endif
@@ -360,13 +392,15 @@ int main(int argc, char** argv)
             {
                 cout << "Options are a comma separated list of:\n"
                      << " \"filename=<filename>\" - with <filename> = \"stdout\", \"stderr\", \"null\" or a filename\n"
-                     << " \"mode=[w|a]\" - w: write (discarding the content), a: append (keeping the content)\n";
+                     << " \"mode=[w|a]\" - w: write (discarding the content), a: append (keeping the content)\n"
+                     << " \"offline=[true|false]\" - play as fast as audio arrives, driven by a virtual clock, and log per stage timings\n"
+                     << " \"duration=<seconds>\" - offline mode: exit after playing <seconds> of audio, default 0 (unlimited)\n";
             }
 #ifdef HAS_PULSE
             else if (settings.player.player_name == player::PULSE)
             {
                 cout << "Options are a comma separated list of:\n"
-                     << " \"buffer_time=<buffer size [ms]>\" - default 100, min 10\n"
+                     << " \"buffer_time=<buffer size [ms]>\" - default 100, min 10, adapted to underflows at runtime\n"
                      << " \"server=<PulseAudio server>\" - default not-set: use the default server\n"
                      << " \"property=<key>=<value>\" - can be set multiple times, default 'media.role=music'\n";
             }
@@ -376,7 +410,8 @@ int main(int argc, char** argv)
             {
                 cout << "Options are a comma separated list of:\n"
                      << " \"buffer_time=<total buffer size [ms]>\" - default 80, min 10\n"
-                     << " \"fragments=<number of buffers>\" - default 4, min 2\n";
+                     << " \"fragments=<number of buffers>\" - default 4, min 2\n"
+                     << " \"mmap=<true|false>\" - write directly into the device buffer, default false\n";
             }
 #endif
             else
@@ -415,6 +450,27 @@ int main(int argc, char** argv)
         else
             throw SnapException("Mixer mode not supported: " + mode);
 
+        string ramp_shape;
+        settings.player.mixer.ramp_time = std::chrono::milliseconds(cpt::stoi(utils::string::split_left(volume_ramp->value(), ':', ramp_shape)));
+        if (ramp_shape == "exp")
+            settings.player.mixer.ramp_exponential = true;
+        else if (!ramp_shape.empty() && (ramp_shape != "linear"))
+            throw SnapException("volumeramp shape must be linear or exp");
+
+        if (settings.player.dsp == "?")
+        {
+            cout << "DSP chain is a comma separated list of stages, processed in order:\n"
+                 << " * <lowpass|highpass|bandpass|notch>[@<channels>]:<freq>[:<Q>]\n"
+                 << " * <peaking|lowshelf|highshelf>[@<channels>]:<freq>:<gain dB>[:<Q>]\n"
+                 << " * crossover[@<channels>]:<freq>:<low|high> - 4th order Linkwitz-Riley\n"
+                 << " * matrix:<row 0>:<row 1>... - output channel n is the sum of the input channels, weighted with the \"/\" separated coefficients of row n\n"
+                 << " * limiter[@<channels>]:<threshold dB>[:<release ms>]\n"
+                 << "with <channels> = <n> or <first>-<last>, default: all channels\n"
+                 << "e.g. \"matrix:0.5/0.5:0.5/0.5,crossover@0:80:high,crossover@1:80:low,peaking:1000:-3:1.4,limiter:-1\"\n";
+            exit(EXIT_SUCCESS);
+        }
+        DspChain::validate(settings.player.dsp);
+
         boost::asio::io_context io_context;
         // Construct a signal set registered for process termination.
         boost::asio::signal_set signals(io_context, SIGHUP, SIGINT, SIGTERM);
@@ -428,10 +484,35 @@ int main(int argc, char** argv)
 
         LOG(INFO, LOG_TAG) << "Version " << version::code << (!version::rev().empty() ? (", revision " + version::rev(8)) : ("")) << "\n";
 
+        try
+        {
+            if (settings.lock_memory)
+                utils::thread::lockMemory();
+            // the player threads are started from the network thread, don't let them inherit its CPUs
+            if (!settings.io_thread.cpus.empty() && settings.player.thread.cpus.empty())
+                settings.player.thread.cpus = utils::thread::getCpus();
+            utils::thread::apply(settings.io_thread);
+        }
+        catch (const std::exception& e)
+        {
+            LOG(WARNING, LOG_TAG) << e.what() << "\n";
+        }
+
         // Setup metadata handling
         auto meta(metaStderr ? std::make_unique<MetaStderrAdapter>() : std::make_unique<MetadataAdapter>());
-        auto controller = make_shared<Controller>(io_context, settings, std::move(meta));
-        controller->start();
+        std::vector<std::shared_ptr<Controller>> controllers;
+        controllers.push_back(make_shared<Controller>(io_context, settings, std::move(meta)));
+        // additional outputs share the time sync and the decoders with the first one
+        for (size_t n = 0; n < outputValue->count(); ++n)
+        {
+            ClientSettings output = settings;
+            output.instance = settings.instance + n + 1;
+            output.player.pcm_device = getPcmDevice(output.player.player_name, output.player.parameter, outputValue->value(n));
+            LOG(INFO, LOG_TAG) << "Output " << output.instance << ": " << output.player.pcm_device.name << "\n";
+            controllers.push_back(make_shared<Controller>(io_context, output, std::make_unique<MetadataAdapter>()));
+        }
+        for (auto& controller : controllers)
+            controller->start();
 
         int num_threads = 0;
         std::vector<std::thread> threads;
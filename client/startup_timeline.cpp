@@ -0,0 +1,88 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "startup_timeline.hpp"
+#include "common/aixlog.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+static constexpr auto LOG_TAG = "Startup";
+
+
+StartupTimeline::StartupTimeline() : start_(chronos::clk::now())
+{
+    for (auto& event : events_)
+        event = -1;
+}
+
+
+void StartupTimeline::mark(Event event, const chronos::time_point_clk& time)
+{
+    auto& recorded = events_[static_cast<size_t>(event)];
+    if (recorded.load(std::memory_order_relaxed) >= 0)
+        return;
+    chronos::usec::rep expected = -1;
+    auto since_start = std::max<chronos::usec::rep>(std::chrono::duration_cast<chronos::usec>(time - start_).count(), 0);
+    if (!recorded.compare_exchange_strong(expected, since_start))
+        return;
+    LOG(DEBUG, LOG_TAG) << toString(event) << ": " << since_start / 1000. << " ms\n";
+    if (event == Event::first_audio)
+        LOG(INFO, LOG_TAG) << "Time to first audio: " << since_start / 1000 << " ms (" << toString() << ")\n";
+}
+
+
+std::string StartupTimeline::toString(Event event)
+{
+    switch (event)
+    {
+        case Event::connected:
+            return "connected";
+        case Event::hello:
+            return "hello";
+        case Event::time_synced:
+            return "time synced";
+        case Event::codec_header:
+            return "codec header";
+        case Event::first_chunk:
+            return "first chunk";
+        case Event::first_audio:
+            return "first audio";
+        default:
+            return "unknown";
+    }
+}
+
+
+std::string StartupTimeline::toString() const
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    for (size_t n = 0; n < events_.size(); ++n)
+    {
+        auto event = static_cast<Event>(n);
+        auto time = get(event);
+        if (time.count() < 0)
+            continue;
+        if (ss.tellp() > 0)
+            ss << ", ";
+        ss << toString(event) << ": " << time.count() / 1000. << " ms";
+    }
+    return ss.str();
+}
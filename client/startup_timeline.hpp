@@ -0,0 +1,83 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef STARTUP_TIMELINE_HPP
+#define STARTUP_TIMELINE_HPP
+
+#include "common/time_defs.hpp"
+
+#include <array>
+#include <atomic>
+#include <string>
+
+
+/// Timeline of the client's startup, from process start to the first audible frame
+/**
+ * Events can be marked from any thread, only the first occurrence of each event is recorded.
+ * The time to first audio is logged when the first audible frame is marked.
+ */
+class StartupTimeline
+{
+public:
+    enum class Event : uint8_t
+    {
+        /// connected to the server
+        connected = 0,
+        /// ServerSettings received
+        hello,
+        /// time sync converged
+        time_synced,
+        /// codec header received, decoder and player created
+        codec_header,
+        /// first decoded chunk added to the stream
+        first_chunk,
+        /// first frame of audio is audible
+        first_audio,
+        count
+    };
+
+    static StartupTimeline& getInstance()
+    {
+        static StartupTimeline instance;
+        return instance;
+    }
+
+    /// Record @p event at @p time, if not yet recorded
+    void mark(Event event, const chronos::time_point_clk& time = chronos::clk::now());
+
+    /// @return time of @p event since process start, or a negative duration if not yet recorded
+    chronos::usec get(Event event) const
+    {
+        return chronos::usec(events_[static_cast<size_t>(event)].load(std::memory_order_relaxed));
+    }
+
+    /// @return the name of @p event
+    static std::string toString(Event event);
+
+    /// @return the recorded events, e.g. "connected: 12.3 ms, hello: 14.1 ms, ..."
+    std::string toString() const;
+
+private:
+    StartupTimeline();
+
+    chronos::time_point_clk start_;
+    std::array<std::atomic<chronos::usec::rep>, static_cast<size_t>(Event::count)> events_;
+};
+
+
+#endif
@@ -25,10 +25,13 @@
 #include "common/snap_exception.hpp"
 #include "common/str_compat.hpp"
 #include "common/utils/logging.hpp"
+#include "startup_timeline.hpp"
 #include "time_provider.hpp"
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream>
+#include <thread>
 
 
 using namespace std;
@@ -36,10 +39,16 @@ namespace cs = chronos;
 
 static constexpr auto LOG_TAG = "Stream";
 static constexpr auto kCorrectionBegin = 100us;
+/// Capacity of the PCM ring in addition to the server buffer, e.g. for chunks that arrive early
+static constexpr auto kRingHeadroom = 1s;
+/// Max io ratio of the variable-rate resampler, the sync controller stays within +/-0.05%
+static constexpr double kMaxIoRatio = 1.001;
+/// Duration of the soxr transition to a new io ratio
+static constexpr auto kIoRatioSlew = 10ms;
 
 // #define LOG_LATENCIES
 
-Stream::Stream(const SampleFormat& in_format, const SampleFormat& out_format)
+Stream::Stream(const SampleFormat& in_format, const SampleFormat& out_format, ClientSettings::SyncMode sync_mode)
     : in_format_(in_format), median_(0), shortMedian_(0), lastUpdate_(0), playedFrames_(0), correctAfterXFrames_(0), bufferMs_(cs::msec(500)), frame_delta_(0),
       hard_sync_(true)
 {
@@ -64,11 +73,62 @@ Stream::Stream(const SampleFormat& in_format, const SampleFormat& out_format)
     */
     // setRealSampleRate(format_.rate());
     resampler_ = std::make_unique<Resampler>(in_format_, format_);
+    ring_capacity_ = ringCapacity(bufferMs_);
+    ring_ = std::make_unique<PcmRing>(format_, ring_capacity_);
+
+    if (sync_mode == ClientSettings::SyncMode::resample)
+    {
+#ifdef HAS_SOXR
+        if (format_.sampleSize() < 2)
+        {
+            LOG(WARNING, LOG_TAG) << "Resample sync mode not supported for " << format_.toString() << ", dropping frames instead\n";
+        }
+        else
+        {
+            soxr_error_t error;
+            soxr_datatype_t type = (format_.sampleSize() > 2) ? SOXR_INT32_I : SOXR_INT16_I;
+            soxr_io_spec_t iospec = soxr_io_spec(type, type);
+            soxr_quality_spec_t q_spec = soxr_quality_spec(SOXR_HQ, SOXR_VR);
+            // in variable-rate mode, the io rates passed to soxr_create define the max io ratio
+            vr_soxr_ = soxr_create(kMaxIoRatio, 1., format_.channels(), &error, &iospec, &q_spec, nullptr);
+            if (error != nullptr)
+            {
+                LOG(ERROR, LOG_TAG) << "Error soxr_create: " << error << ", dropping frames instead\n";
+                vr_soxr_ = nullptr;
+            }
+            else
+            {
+                LOG(INFO, LOG_TAG) << "Soft sync by resampling\n";
+                resetResampler();
+                // input buffer for 20ms of audio
+                vr_buffer_.resize(format_.frameSize() * static_cast<size_t>(ceil(format_.msRate() * 20)));
+            }
+        }
+#else
+        LOG(WARNING, LOG_TAG) << "Soxr not available, dropping frames for soft sync\n";
+#endif
+    }
+}
+
+
+Stream::~Stream()
+{
+#ifdef HAS_SOXR
+    if (vr_soxr_ != nullptr)
+        soxr_delete(vr_soxr_);
+#endif
 }
 
 
 void Stream::setRealSampleRate(double sampleRate)
 {
+    correction_ppm_ = (format_.rate() / sampleRate - 1.) * 1000000.;
+#ifdef HAS_SOXR
+    // consumed in getNextPlayerChunkResampled, the frame based correction is not used in resample mode
+    io_ratio_ = format_.rate() / sampleRate;
+    if (vr_soxr_ != nullptr)
+        return;
+#endif
     if (sampleRate == format_.rate())
     {
         correctAfterXFrames_ = 0;
@@ -84,15 +144,88 @@ void Stream::setRealSampleRate(double sampleRate)
 void Stream::setBufferLen(size_t bufferLenMs)
 {
     bufferMs_ = cs::msec(bufferLenMs);
+    // the ring is resized by the producer, with the next write
+    ring_capacity_ = ringCapacity(bufferMs_);
+}
+
+
+uint32_t Stream::ringCapacity(const chronos::msec& buffer) const
+{
+    return static_cast<uint32_t>(format_.msRate() * std::chrono::duration_cast<cs::msec>(buffer + kRingHeadroom).count());
+}
+
+
+void Stream::setProcessingDelay(const chronos::usec& delay)
+{
+    processing_delay_ = delay.count();
+}
+
+
+void Stream::setOutputLatency(const chronos::usec& latency)
+{
+    LOG(DEBUG, LOG_TAG) << "Output latency: " << latency.count() / 1000 << " ms\n";
+    output_latency_ = latency.count();
+}
+
+
+chronos::usec Stream::getOutputLatency() const
+{
+    return chronos::usec(output_latency_);
+}
+
+
+void Stream::addSilence(const msg::Silence& silence)
+{
+    cs::time_point_clk start(cs::sec(silence.timestamp.sec) + cs::usec(silence.timestamp.usec));
+    auto age = std::chrono::duration_cast<cs::msec>(TimeProvider::serverNow() - start);
+    if (age > 5s + bufferMs_)
+        return;
+
+    auto frames = static_cast<uint32_t>(silence.getDuration().count() * format_.rate() / 1000000);
+    if (frames > 0)
+        write(nullptr, frames, start);
+}
+
+
+void Stream::write(const char* data, uint32_t frames, const cs::time_point_clk& start)
+{
+    // retried with the next write, if the player is reading right now
+    uint32_t capacity = ring_capacity_.load(std::memory_order_relaxed);
+    if ((capacity != ring_->capacity()) && ring_->resize(capacity))
+        LOG(DEBUG, LOG_TAG) << "Stream buffer resized to " << capacity << " frames\n";
+
+    // a full ring holds stale audio at its front, it's evicted to make space for the new frames
+    if (!ring_->write(data, frames, start, true))
+    {
+        static utils::logging::TimeConditional cond(1s);
+        LOG(WARNING, LOG_TAG) << cond << "Stream buffer full, dropping " << frames << " frames\n";
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+    }
+    wait_cv_.notify_one();
 }
 
 
 void Stream::clearChunks()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    while (!chunks_.empty())
-        chunks_.pop();
+    // the producer holds the lock only for a short eviction or resize
+    while (!ring_->tryLockRead())
+        std::this_thread::yield();
+    ring_->clear();
+    ring_->unlockRead();
     resetBuffers();
+#ifdef HAS_SOXR
+    resetResampler();
+#endif
+}
+
+
+void Stream::flush()
+{
+    flush_pos_.store(ring_->written(), std::memory_order_relaxed);
+    flush_pending_.store(true, std::memory_order_release);
 }
 
 
@@ -106,27 +239,32 @@ void Stream::addChunk(unique_ptr<msg::PcmChunk> chunk)
     auto resampled = resampler_->resample(std::move(chunk));
     if (resampled)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        recent_ = resampled;
-        chunks_.push(resampled);
-
-        std::shared_ptr<msg::PcmChunk> front_;
-        while (chunks_.front_copy(front_))
-        {
-            age = std::chrono::duration_cast<cs::msec>(TimeProvider::serverNow() - front_->start());
-            if ((age > 5s + bufferMs_) && chunks_.try_pop(front_))
-                LOG(TRACE, LOG_TAG) << "Oldest chunk too old: " << age.count() << " ms, removing. Chunks in queue left: " << chunks_.size() << "\n";
-            else
-                break;
-        }
+        write(resampled->payload, resampled->getFrameCount(), resampled->start());
+        StartupTimeline::getInstance().mark(StartupTimeline::Event::first_chunk);
     }
-    // LOG(TRACE, LOG_TAG) << "new chunk: " << chunk->durationMs() << " ms, age: " << age.count() << " ms, Chunks: " << chunks_.size() << "\n";
+    // LOG(TRACE, LOG_TAG) << "new chunk: " << chunk->durationMs() << " ms, age: " << age.count() << " ms, Frames: " << ring_->available() << "\n";
 }
 
 
-bool Stream::waitForChunk(const std::chrono::milliseconds& timeout) const
+bool Stream::waitForChunk(const std::chrono::milliseconds& timeout, uint32_t frames) const
 {
-    return chunks_.wait_for(timeout);
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    return wait_cv_.wait_for(lock, timeout, [this, frames] { return ring_->available() >= std::max(frames, 1u); });
+}
+
+
+void Stream::setVirtualClock(bool enabled)
+{
+    virtual_clock_ = enabled;
+    virtual_step_ = cs::nsec(0);
+}
+
+
+cs::time_point_clk Stream::serverNow() const
+{
+    if (virtual_clock_)
+        return virtual_now_;
+    return TimeProvider::serverNow();
 }
 
 
@@ -138,17 +276,11 @@ void Stream::getSilentPlayerChunk(void* outputBuffer, uint32_t frames) const
 
 cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, uint32_t frames)
 {
-    if (!chunk_ && !chunks_.try_pop(chunk_))
-        throw SnapException("No chunks available, requested frames: " + cpt::to_string(frames));
+    if (ring_->available() < frames)
+        throw SnapException("Not enough frames available, requested frames: " + cpt::to_string(frames) + ", available: " + cpt::to_string(ring_->available()));
 
-    cs::time_point_clk tp = chunk_->start();
-    uint32_t read = 0;
-    while (read < frames)
-    {
-        read += chunk_->readFrames(static_cast<char*>(outputBuffer) + read * format_.frameSize(), frames - read);
-        if ((read < frames) && chunk_->isEndOfChunk() && !chunks_.try_pop(chunk_))
-            throw SnapException("Not enough frames available, requested frames: " + cpt::to_string(frames) + ", available: " + cpt::to_string(read));
-    }
+    cs::time_point_clk tp = ring_->start();
+    ring_->read(static_cast<char*>(outputBuffer), frames);
     return tp;
 }
 
@@ -164,12 +296,12 @@ cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, uint32_t frame
     if (framesCorrection == 0)
         return getNextPlayerChunk(outputBuffer, frames);
 
-    frame_delta_ -= framesCorrection;
-
     uint32_t toRead = frames + framesCorrection;
-    if (toRead * format_.frameSize() > read_buffer_.size())
-        read_buffer_.resize(toRead * format_.frameSize());
-    cs::time_point_clk tp = getNextPlayerChunk(read_buffer_.data(), toRead);
+    if (ring_->available() < toRead)
+        throw SnapException("Not enough frames available, requested frames: " + cpt::to_string(toRead) + ", available: " + cpt::to_string(ring_->available()));
+
+    frame_delta_ -= framesCorrection;
+    cs::time_point_clk tp = ring_->start();
 
     const auto max = framesCorrection < 0 ? frames : toRead;
     // Divide the buffer into one more slice than frames that need to be dropped.
@@ -188,6 +320,7 @@ cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, uint32_t frame
     // LOG(TRACE, LOG_TAG) << "getNextPlayerChunk, frames: " << frames << ", correction: " << framesCorrection << " (" << toRead << "), slices: " << slices
     // << "\n";
 
+    // the slices are copied directly from the ring
     size_t pos = 0;
     for (size_t n = 0; n < slices; ++n)
     {
@@ -200,22 +333,75 @@ cs::time_point_clk Stream::getNextPlayerChunk(void* outputBuffer, uint32_t frame
             // Read one frame less per slice from the input, but write a duplicated frame per slice to the output
             // LOG(TRACE, LOG_TAG) << "duplicate - requested: " << frames << ", read: " << toRead << ", slice: " << n << ", size: " << size << ", out pos: " <<
             // pos << ", source pos: " << pos - n << "\n";
-            memcpy(static_cast<char*>(outputBuffer) + pos * format_.frameSize(), read_buffer_.data() + (pos - n) * format_.frameSize(),
-                   size * format_.frameSize());
+            ring_->peek(static_cast<char*>(outputBuffer) + pos * format_.frameSize(), static_cast<uint32_t>(pos - n), static_cast<uint32_t>(size));
         }
         else
         {
             // Read all input frames, but skip a frame per slice when writing to the output.
             // LOG(TRACE, LOG_TAG) << "remove - requested: " << frames << ", read: " << toRead << ", slice: " << n << ", size: " << size << ", out pos: " << pos
             // - n << ", source pos: " << pos << "\n";
-            memcpy(static_cast<char*>(outputBuffer) + (pos - n) * format_.frameSize(), read_buffer_.data() + pos * format_.frameSize(),
-                   size * format_.frameSize());
+            ring_->peek(static_cast<char*>(outputBuffer) + (pos - n) * format_.frameSize(), static_cast<uint32_t>(pos), static_cast<uint32_t>(size));
         }
         pos += size;
     }
+    ring_->consume(toRead);
+
+    return tp;
+}
+
+
+#ifdef HAS_SOXR
+void Stream::resetResampler()
+{
+    if (vr_soxr_ == nullptr)
+        return;
+    soxr_clear(vr_soxr_);
+    vr_io_ratio_ = io_ratio_;
+    soxr_set_io_ratio(vr_soxr_, vr_io_ratio_, 0);
+}
+
+
+cs::time_point_clk Stream::getNextPlayerChunkResampled(void* outputBuffer, uint32_t frames)
+{
+    if (io_ratio_ != vr_io_ratio_)
+    {
+        vr_io_ratio_ = io_ratio_;
+        soxr_set_io_ratio(vr_soxr_, vr_io_ratio_, static_cast<size_t>(format_.msRate() * cs::msec(kIoRatioSlew).count()));
+    }
 
+    if (ring_->available() == 0)
+        throw SnapException("Not enough frames available, requested frames: " + cpt::to_string(frames) + ", available: 0");
+
+    // The first output frame is delayed by the frames buffered in soxr, relative to the next input frame
+    cs::time_point_clk tp = ring_->start() - cs::nsec(static_cast<cs::nsec::rep>(soxr_delay(vr_soxr_) / format_.nsRate()));
+
+    const uint32_t capacity = static_cast<uint32_t>(vr_buffer_.size() / format_.frameSize());
+    auto* out = static_cast<char*>(outputBuffer);
+    size_t produced = 0;
+    while (produced < frames)
+    {
+        // feed about as many frames as needed for the remaining output, soxr will buffer the rest
+        auto needed = static_cast<uint32_t>(std::ceil((frames - produced) * vr_io_ratio_));
+        uint32_t in_frames = std::min({std::max(needed, 1u), ring_->available(), capacity});
+        if (in_frames == 0)
+            throw SnapException("Not enough frames available, requested frames: " + cpt::to_string(frames) + ", resampled: " + cpt::to_string(produced));
+
+        ring_->peek(vr_buffer_.data(), 0, in_frames);
+        size_t idone = 0;
+        size_t odone = 0;
+        soxr_error_t error =
+            soxr_process(vr_soxr_, vr_buffer_.data(), in_frames, &idone, out + produced * format_.frameSize(), frames - produced, &odone);
+        if (error != nullptr)
+            throw SnapException("Error soxr_process: " + std::string(error));
+        if ((idone == 0) && (odone == 0))
+            throw SnapException("Resampler stalled, requested frames: " + cpt::to_string(frames) + ", resampled: " + cpt::to_string(produced));
+        ring_->consume(static_cast<uint32_t>(idone));
+        produced += odone;
+        frame_delta_ -= static_cast<int>(idone) - static_cast<int>(odone);
+    }
     return tp;
 }
+#endif
 
 
 void Stream::updateBuffers(chronos::usec::rep age)
@@ -234,8 +420,30 @@ void Stream::resetBuffers()
 }
 
 
-bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacTime, uint32_t frames)
+bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& deviceDacTime, uint32_t frames)
 {
+    const cs::usec outputBufferDacTime = deviceDacTime + cs::usec(processing_delay_.load(std::memory_order_relaxed));
+    // the decoder thread is evicting old frames or resizing the ring, play silence instead of waiting
+    PcmRing::ReadLock lock(*ring_);
+    if (!lock.owns())
+        return false;
+    if (flush_pending_.exchange(false, std::memory_order_acquire))
+    {
+        // data of the new stream might already be queued behind the flush position
+        ring_->clear(flush_pos_.load(std::memory_order_relaxed));
+        resetBuffers();
+#ifdef HAS_SOXR
+        resetResampler();
+#endif
+        hard_sync_ = true;
+    }
+    if (virtual_clock_)
+    {
+        virtual_now_ += std::chrono::duration_cast<cs::time_point_clk::duration>(virtual_step_);
+        virtual_step_ = cs::nsec(static_cast<cs::nsec::rep>(frames / format_.nsRate()));
+        if (hard_sync_ && (ring_->available() > 0))
+            virtual_now_ = ring_->start() + bufferMs_ - outputBufferDacTime;
+    }
     if (outputBufferDacTime > bufferMs_)
     {
         LOG(INFO, LOG_TAG) << "outputBufferDacTime > bufferMs: " << cs::duration<cs::msec>(outputBufferDacTime) << " > " << cs::duration<cs::msec>(bufferMs_)
@@ -243,9 +451,8 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
         return false;
     }
 
-    std::lock_guard<std::mutex> lock(mutex_);
     time_t now = time(nullptr);
-    if (!chunk_ && !chunks_.try_pop(chunk_))
+    if (ring_->available() == 0)
     {
         if (now != lastUpdate_)
         {
@@ -257,11 +464,10 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 
 #ifdef LOG_LATENCIES
     // calculate the estimated end to end latency
-    if (recent_)
     {
         cs::nsec req_chunk_duration = cs::nsec(static_cast<cs::nsec::rep>(frames / format_.nsRate()));
-        auto youngest = recent_->end() - req_chunk_duration;
-        cs::msec age = std::chrono::duration_cast<cs::msec>(TimeProvider::serverNow() - youngest + outputBufferDacTime);
+        auto youngest = ring_->end() - req_chunk_duration;
+        cs::msec age = std::chrono::duration_cast<cs::msec>(serverNow() - youngest + outputBufferDacTime);
         latencies_.add(age.count());
     }
 #endif
@@ -277,9 +483,15 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
         if (hard_sync_)
         {
             cs::nsec req_chunk_duration = cs::nsec(static_cast<cs::nsec::rep>(frames / format_.nsRate()));
-            cs::usec age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - chunk_->start()) - bufferMs_ + outputBufferDacTime;
+            cs::usec age = std::chrono::duration_cast<cs::usec>(serverNow() - ring_->start()) - bufferMs_ + outputBufferDacTime;
             // LOG(INFO, LOG_TAG) << "age: " << age.count() / 1000 << ", buffer: " <<
             // std::chrono::duration_cast<chrono::milliseconds>(req_chunk_duration).count() << "\n";
+            // don't start with a time offset that is about to be corrected
+            if (!virtual_clock_ && !TimeProvider::getInstance().converged())
+            {
+                getSilentPlayerChunk(outputBuffer, frames);
+                return true;
+            }
             if (age < -req_chunk_duration)
             {
                 // the oldest chunk (top of the stream) is too young for the buffer
@@ -292,25 +504,17 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
             {
                 if (age.count() > 0)
                 {
-                    LOG(DEBUG, LOG_TAG) << "age > 0: " << age.count() / 1000 << "ms, dropping old chunks\n";
+                    LOG(DEBUG, LOG_TAG) << "age > 0: " << age.count() / 1000 << "ms, dropping old frames\n";
                     // age > 0: the top of the stream is too old. We must fast foward.
-                    // delete the current chunk, it's too old. This will avoid an endless loop if there is no chunk in the queue.
-                    chunk_ = nullptr;
-                    while (chunks_.try_pop(chunk_))
+                    // Skip segment wise, since there might be gaps in the timestamps
+                    while ((age.count() > 0) && (ring_->available() > 0))
                     {
-                        age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - chunk_->start()) - bufferMs_ + outputBufferDacTime;
+                        auto skip = static_cast<uint32_t>(std::ceil(format_.nsRate() * std::chrono::duration_cast<cs::nsec>(age).count()));
+                        ring_->consume(std::min(skip, ring_->segment()));
+                        if (ring_->available() > 0)
+                            age = std::chrono::duration_cast<cs::usec>(serverNow() - ring_->start()) - bufferMs_ + outputBufferDacTime;
                         LOG(DEBUG, LOG_TAG) << "age: " << age.count() / 1000 << ", requested chunk_duration: "
-                                            << std::chrono::duration_cast<std::chrono::milliseconds>(req_chunk_duration).count()
-                                            << ", duration: " << chunk_->duration<std::chrono::milliseconds>().count() << "\n";
-                        // check if the current chunk's end is older than age => can be player
-                        if ((age.count() > 0) && (age < chunk_->duration<cs::usec>()))
-                        {
-                            // fast forward by "age" to get in sync, i.e. age = 0
-                            chunk_->seek(static_cast<uint32_t>(chunk_->format.nsRate() * std::chrono::duration_cast<cs::nsec>(age).count()));
-                            age = 0s;
-                        }
-                        if (age.count() <= 0)
-                            break;
+                                            << std::chrono::duration_cast<std::chrono::milliseconds>(req_chunk_duration).count() << "\n";
                     }
                 }
 
@@ -320,21 +524,36 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
                     // e.g. age = -20ms (=> should be played in 20ms)
                     // and the current chunk duration is 50ms, so we need to play 20ms silence (as we don't have data)
                     // and can play 30ms of the stream
-                    uint32_t silent_frames = static_cast<uint32_t>(-chunk_->format.nsRate() * std::chrono::duration_cast<cs::nsec>(age).count());
+                    uint32_t silent_frames = static_cast<uint32_t>(-format_.nsRate() * std::chrono::duration_cast<cs::nsec>(age).count());
                     bool result = (silent_frames <= frames);
                     silent_frames = std::min(silent_frames, frames);
+                    // start only if the buffered audio covers the device's buffer (at most half of the stream buffer),
+                    // e.g. while a backlog of chunks is still arriving
+                    auto dac_time = std::min<cs::nsec>(outputBufferDacTime, bufferMs_ / 2);
+                    auto dac_frames = static_cast<uint32_t>(format_.nsRate() * std::max<cs::nsec::rep>(dac_time.count(), 0));
+                    if (!virtual_clock_ && (ring_->available() < frames - silent_frames + dac_frames))
+                    {
+                        getSilentPlayerChunk(outputBuffer, frames);
+                        return true;
+                    }
                     if (silent_frames > 0)
                     {
                         LOG(DEBUG, LOG_TAG) << "Silent frames: " << silent_frames << ", frames: " << frames
                                             << ", age: " << std::chrono::duration_cast<cs::usec>(age).count() / 1000. << "\n";
                         getSilentPlayerChunk(outputBuffer, silent_frames);
                     }
-                    getNextPlayerChunk(static_cast<char*>(outputBuffer) + (chunk_->format.frameSize() * silent_frames), frames - silent_frames);
+                    getNextPlayerChunk(static_cast<char*>(outputBuffer) + (format_.frameSize() * silent_frames), frames - silent_frames);
 
                     if (result)
                     {
+                        StartupTimeline::getInstance().mark(StartupTimeline::Event::first_audio,
+                                                            TimeProvider::now() + outputBufferDacTime + cs::nsec(static_cast<cs::nsec::rep>(silent_frames / format_.nsRate())));
                         hard_sync_ = false;
+                        hard_syncs_.fetch_add(1, std::memory_order_relaxed);
                         resetBuffers();
+#ifdef HAS_SOXR
+                        resetResampler();
+#endif
                     }
                     return true;
                 }
@@ -355,8 +574,14 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
             }
         }
 
-        cs::usec age = std::chrono::duration_cast<cs::usec>(TimeProvider::serverNow() - getNextPlayerChunk(outputBuffer, frames, framesCorrection) - bufferMs_ +
-                                                            outputBufferDacTime);
+        cs::time_point_clk tp;
+#ifdef HAS_SOXR
+        if (vr_soxr_ != nullptr)
+            tp = getNextPlayerChunkResampled(outputBuffer, frames);
+        else
+#endif
+            tp = getNextPlayerChunk(outputBuffer, frames, framesCorrection);
+        cs::usec age = std::chrono::duration_cast<cs::usec>(serverNow() - tp - bufferMs_ + outputBufferDacTime);
 
         setRealSampleRate(format_.rate());
         // check if we need a hard sync
@@ -406,6 +631,8 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
         }
 
         updateBuffers(age.count());
+        sync_error_.add(age);
+        correction_sum_.fetch_add(static_cast<int64_t>(correction_ppm_ * 1000.), std::memory_order_relaxed);
 
         // update median_ and shortMedian_ and print sync stats
         if (now != lastUpdate_)
@@ -439,6 +666,20 @@ bool Stream::getPlayerChunk(void* outputBuffer, const cs::usec& outputBufferDacT
 }
 
 
+Stream::SyncStats Stream::getSyncStats()
+{
+    SyncStats stats;
+    // read the correction first, the histogram might count a few more chunks
+    auto correction_sum = correction_sum_.exchange(0, std::memory_order_relaxed);
+    stats.error = sync_error_.take();
+    if (stats.error.count > 0)
+        stats.correction_ppm = static_cast<double>(correction_sum) / 1000. / stats.error.count;
+    stats.hard_syncs = hard_syncs_.load(std::memory_order_relaxed);
+    stats.queued = cs::usec(static_cast<cs::usec::rep>(ring_->available() / format_.usRate()));
+    return stats;
+}
+
+
 bool Stream::getPlayerChunkOrSilence(void* outputBuffer, const chronos::usec& outputBufferDacTime, uint32_t frames)
 {
     bool result = getPlayerChunk(outputBuffer, outputBufferDacTime, frames);
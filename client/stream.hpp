@@ -19,32 +19,44 @@
 #ifndef STREAM_HPP
 #define STREAM_HPP
 
-#include "common/queue.h"
+#include "client_settings.hpp"
 #include "common/sample_format.hpp"
 #include "double_buffer.hpp"
 #include "message/message.hpp"
 #include "message/pcm_chunk.hpp"
+#include "message/silence.hpp"
+#include "pcm_ring.hpp"
 #include "resampler.hpp"
-#include <deque>
+#include "sync_histogram.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <vector>
 #ifdef HAS_SOXR
 #include <soxr.h>
 #endif
 
 /// Time synchronized audio stream
 /**
- * Queue with PCM data.
+ * Lock-free ring with PCM data, filled by the decoder, read by the player.
  * Returns "online" server-time-synchronized PCM data
  */
 class Stream
 {
 public:
-    Stream(const SampleFormat& in_format, const SampleFormat& out_format);
-    virtual ~Stream() = default;
+    Stream(const SampleFormat& in_format, const SampleFormat& out_format, ClientSettings::SyncMode sync_mode = ClientSettings::SyncMode::drop);
+    virtual ~Stream();
 
     /// Adds PCM data to the queue
     void addChunk(std::unique_ptr<msg::PcmChunk> chunk);
+    /// Adds a chunk of silence, as announced by the server's silence marker
+    void addSilence(const msg::Silence& silence);
+    /// Drop all queued PCM data, must be called from the player's thread
     void clearChunks();
+    /// Drop the PCM data that was added so far, on the next call of getPlayerChunk
+    /// Can be called from any thread while no data is added, e.g. while the decoder is stopped
+    void flush();
 
     /// Get PCM data, which will be played out in "outputBufferDacTime" time
     /// frame = (num_channels) * (1 sample in bytes) = (2 channels) * (2 bytes (16 bits) per sample) = 4 bytes (32 bits)
@@ -62,12 +74,48 @@ public:
     /// "Server buffer": playout latency, e.g. 1000ms
     void setBufferLen(size_t bufferLenMs);
 
+    /// Delay of the player's processing (e.g. DSP) after getPlayerChunk, added to the outputBufferDacTime
+    void setProcessingDelay(const chronos::usec& delay);
+
+    /// Size of the player's output buffer, if adapted at runtime. Informational, the DAC time passed to getPlayerChunk already includes it
+    void setOutputLatency(const chronos::usec& latency);
+    /// @return the size of the player's output buffer, 0 if unknown
+    chronos::usec getOutputLatency() const;
+
     const SampleFormat& getFormat() const
     {
         return format_;
     }
 
-    bool waitForChunk(const std::chrono::milliseconds& timeout) const;
+    /// @return the sample format of the added chunks, before resampling
+    const SampleFormat& getInputFormat() const
+    {
+        return in_format_;
+    }
+
+    /// Wait until at least @p frames frames are available
+    bool waitForChunk(const std::chrono::milliseconds& timeout, uint32_t frames = 1) const;
+
+    /// Use a virtual clock instead of the server time, for faster than realtime playback.
+    /// The clock advances with the requested frames and is restarted on hard syncs with the oldest frame being due.
+    /// Must be called before the player requests the first chunk
+    void setVirtualClock(bool enabled);
+
+    /// Sync statistics of the player's thread
+    struct SyncStats
+    {
+        /// absolute sync error of the played chunks
+        SyncHistogram::Percentiles error;
+        /// number of hard syncs since the stream was created
+        uint32_t hard_syncs{0};
+        /// mean playback speed correction [ppm], positive: playing faster to catch up
+        double correction_ppm{0};
+        /// buffered audio
+        chronos::usec queued{0};
+    };
+
+    /// @return the sync statistics since the previous call, can be called from any thread
+    SyncStats getSyncStats();
 
 private:
     /// Request an audio chunk from the front of the stream.
@@ -87,11 +135,31 @@ private:
     /// @return the timepoint when this chunk should be audible
     chronos::time_point_clk getNextPlayerChunk(void* outputBuffer, uint32_t frames, int32_t framesCorrection);
 
+#ifdef HAS_SOXR
+    /// Request an audio chunk from the front of the stream, resampled with the current io ratio
+    /// Used for soft sync in "resample" mode: the playback speed is changed continuously, instead of dropping or duplicating frames
+    /// @param outputBuffer will be filled with the chunk
+    /// @param frames the number of requested frames
+    /// @return the timepoint when this chunk should be audible
+    chronos::time_point_clk getNextPlayerChunkResampled(void* outputBuffer, uint32_t frames);
+    /// Drop the resampler's state, e.g. after a hard sync
+    void resetResampler();
+#endif
+
     /// Request a silent audio chunk
     /// @param outputBuffer will be filled with the chunk
     /// @param frames the number of requested frames
     void getSilentPlayerChunk(void* outputBuffer, uint32_t frames) const;
 
+    /// Append frames to the ring and wake up waitForChunk
+    void write(const char* data, uint32_t frames, const chronos::time_point_clk& start);
+
+    /// @return the server time, or the virtual time if enabled
+    chronos::time_point_clk serverNow() const;
+
+    /// @return capacity of the ring in frames, for the server buffer @p buffer
+    uint32_t ringCapacity(const chronos::msec& buffer) const;
+
     void updateBuffers(chronos::usec::rep age);
     void resetBuffers();
     void setRealSampleRate(double sampleRate);
@@ -99,14 +167,12 @@ private:
     SampleFormat format_;
     SampleFormat in_format_;
 
-    Queue<std::shared_ptr<msg::PcmChunk>> chunks_;
+    std::unique_ptr<PcmRing> ring_;
+    /// capacity of the ring for the current buffer length, applied by the producer
+    std::atomic<uint32_t> ring_capacity_{0};
     DoubleBuffer<chronos::usec::rep> miniBuffer_;
     DoubleBuffer<chronos::usec::rep> shortBuffer_;
     DoubleBuffer<chronos::usec::rep> buffer_;
-    /// current chunk (oldest, to be played)
-    std::shared_ptr<msg::PcmChunk> chunk_;
-    /// most recent chunk (newly queued)
-    std::shared_ptr<msg::PcmChunk> recent_;
     DoubleBuffer<chronos::msec::rep> latencies_;
 
     chronos::usec::rep median_;
@@ -118,12 +184,39 @@ private:
 
     std::unique_ptr<Resampler> resampler_;
 
-    std::vector<char> resample_buffer_;
-    std::vector<char> read_buffer_;
+#ifdef HAS_SOXR
+    /// variable-rate resampler for soft sync, nullptr in "drop" mode
+    soxr_t vr_soxr_{nullptr};
+    /// input frames per output frame, as requested by the sync controller
+    double io_ratio_{1.};
+    /// io ratio currently set in vr_soxr_
+    double vr_io_ratio_{1.};
+    std::vector<char> vr_buffer_;
+#endif
+
     int frame_delta_;
     // int64_t next_us_;
-
-    mutable std::mutex mutex_;
+    std::atomic<chronos::usec::rep> processing_delay_{0};
+    std::atomic<chronos::usec::rep> output_latency_{0};
+    bool virtual_clock_{false};
+    chronos::time_point_clk virtual_now_;
+    /// duration of the last request, the virtual clock advances by it on the next request
+    chronos::nsec virtual_step_{0};
+    /// ring position to flush up to, valid if flush_pending_ is set
+    std::atomic<uint64_t> flush_pos_{0};
+    std::atomic<bool> flush_pending_{false};
+
+    /// sync statistics, written by the player's thread
+    SyncHistogram sync_error_;
+    std::atomic<uint32_t> hard_syncs_{0};
+    /// current playback speed correction [ppm], only accessed by the player's thread
+    double correction_ppm_{0};
+    /// sum of the correction of the played chunks [1/1000 ppm], the number of chunks is the histogram's count
+    std::atomic<int64_t> correction_sum_{0};
+
+    /// only used to wait for data in waitForChunk, never locked by the player's realtime path
+    mutable std::mutex wait_mutex_;
+    mutable std::condition_variable wait_cv_;
 
     bool hard_sync_;
 };
@@ -0,0 +1,116 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef SYNC_HISTOGRAM_HPP
+#define SYNC_HISTOGRAM_HPP
+
+#include "common/time_defs.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+
+/// Upper bounds of the histogram bins [us], 1-2-5 series, the last bin is open
+static constexpr std::array<chronos::usec::rep, 16> kSyncHistogramBounds{
+    {10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000}};
+
+
+/// Histogram of the absolute sync error
+/**
+ * Filled by the player's realtime thread and read from any thread, lock-free.
+ * Percentiles are interpolated linearly within a bin, so they are accurate to about the bin width.
+ */
+class SyncHistogram
+{
+public:
+    struct Percentiles
+    {
+        chronos::usec p50{0};
+        chronos::usec p95{0};
+        chronos::usec p99{0};
+        chronos::usec max{0};
+        /// number of samples
+        uint32_t count{0};
+    };
+
+    SyncHistogram()
+    {
+        for (auto& bin : bins_)
+            bin.store(0, std::memory_order_relaxed);
+    }
+
+    /// Add a sample with sync error @p error
+    void add(const chronos::usec& error)
+    {
+        auto value = std::abs(error.count());
+        size_t n = 0;
+        while ((n < kSyncHistogramBounds.size()) && (value > kSyncHistogramBounds[n]))
+            ++n;
+        bins_[n].fetch_add(1, std::memory_order_relaxed);
+        auto max = max_.load(std::memory_order_relaxed);
+        while ((value > max) && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            ;
+    }
+
+    /// @return the percentiles of the samples added since the previous call, resets the histogram
+    Percentiles take()
+    {
+        std::array<uint32_t, kSyncHistogramBounds.size() + 1> bins;
+        Percentiles result;
+        for (size_t n = 0; n < bins.size(); ++n)
+        {
+            bins[n] = bins_[n].exchange(0, std::memory_order_relaxed);
+            result.count += bins[n];
+        }
+        result.max = chronos::usec(max_.exchange(0, std::memory_order_relaxed));
+        if (result.count == 0)
+            return result;
+
+        auto percentile = [&](uint32_t percent) {
+            // rank of the sample, 1 based
+            uint64_t rank = std::max<uint64_t>((static_cast<uint64_t>(result.count) * percent + 99) / 100, 1);
+            uint64_t below = 0;
+            for (size_t n = 0; n < bins.size(); ++n)
+            {
+                if (below + bins[n] >= rank)
+                {
+                    chronos::usec::rep lower = (n == 0) ? 0 : kSyncHistogramBounds[n - 1];
+                    chronos::usec::rep upper = (n < kSyncHistogramBounds.size()) ? kSyncHistogramBounds[n] : std::max(result.max.count(), lower);
+                    auto value = lower + static_cast<chronos::usec::rep>((upper - lower) * (rank - below) / bins[n]);
+                    return std::min(chronos::usec(value), result.max);
+                }
+                below += bins[n];
+            }
+            return result.max;
+        };
+        result.p50 = percentile(50);
+        result.p95 = percentile(95);
+        result.p99 = percentile(99);
+        return result;
+    }
+
+private:
+    std::array<std::atomic<uint32_t>, kSyncHistogramBounds.size() + 1> bins_;
+    std::atomic<chronos::usec::rep> max_{0};
+};
+
+
+#endif
@@ -19,51 +19,223 @@
 #include "time_provider.hpp"
 #include "common/aixlog.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace std::chrono_literals;
+namespace cs = chronos;
 
 static constexpr auto LOG_TAG = "TimeProvider";
 
-TimeProvider::TimeProvider() : diffToServer_(0)
+/// Samples are dropped if the last time sync is older than this
+static constexpr auto kMaxSyncGap = 60s;
+/// Max number and age of the samples used for the estimation
+static constexpr size_t kMaxSamples = 256;
+static constexpr auto kMaxSampleAge = 10min;
+/// Number of recent samples that define the delay filter
+static constexpr size_t kFilterSamples = 32;
+/// Min number of samples used for the estimation, else the samples with the lowest third of the delays are used
+static constexpr size_t kMinSamples = 5;
+/// Samples with a delay of kDelayScale above the min delay have a quarter of the weight
+static constexpr double kDelayScale = 100000.;
+/// The skew is estimated if the samples span at least this duration
+static constexpr auto kMinSkewSpan = 20s;
+/// Max plausible frequency offset of two clocks [ppb]
+static constexpr int64_t kMaxSkewPpb = 500000;
+/// A sample matches the prediction if it's within max(kMinJitter, 3 * jitter) plus its delay uncertainty
+static constexpr double kMinJitter = 100000.;
+/// The sync interval doubles after kStableSyncs matching samples, and halves on a mismatch
+static constexpr size_t kStableSyncs = 4;
+static constexpr auto kMinSyncInterval = 1s;
+static constexpr auto kMaxSyncInterval = 8s;
+/// The estimation has converged if the standard error of the offset is below this bound [ns]
+static constexpr double kMaxOffsetError = 500000.;
+/// ... or if the samples span at least this duration
+static constexpr auto kMaxConvergeTime = 1s;
+
+
+TimeProvider::TimeProvider()
+    : delayThreshold_(0), minDelay_(0), skewEstimated_(false), jitter_(0.), stableSyncs_(0), syncInterval_(kMinSyncInterval), converged_(false), seq_(0),
+      refLocal_(0), refOffset_(0), skewPpb_(0)
 {
-    diffBuffer_.setSize(200);
 }
 
 
-void TimeProvider::setDiff(const tv& c2s, const tv& s2c)
+void TimeProvider::setDiff(const tv& c2s, const tv& s2c, const cs::time_point_clk& received)
 {
-    //	tv latency = c2s - s2c;
-    //	double diff = (latency.sec * 1000. + latency.usec / 1000.) / 2.;
-    double diff = (static_cast<double>(c2s.sec) / 2. - static_cast<double>(s2c.sec) / 2.) * 1000. +
-                  (static_cast<double>(c2s.usec) / 2. - static_cast<double>(s2c.usec) / 2.) / 1000.;
-    setDiffToServer(diff);
+    cs::nsec::rep c2s_ns = static_cast<cs::nsec::rep>(c2s.sec) * 1000000000 + static_cast<cs::nsec::rep>(c2s.usec) * 1000;
+    cs::nsec::rep s2c_ns = static_cast<cs::nsec::rep>(s2c.sec) * 1000000000 + static_cast<cs::nsec::rep>(s2c.usec) * 1000;
+
+    Sample sample;
+    sample.offset = (c2s_ns - s2c_ns) / 2;
+    sample.delay = std::max<cs::nsec::rep>(c2s_ns + s2c_ns, 0);
+    sample.local = received - cs::nsec(sample.delay / 2);
+
+    /// clear the samples if last update is older than a minute
+    if (!samples_.empty() && (cs::abs(sample.local - samples_.back().local) > kMaxSyncGap))
+    {
+        LOG(INFO, LOG_TAG) << "Last time sync older than a minute. Clearing time buffer\n";
+        samples_.clear();
+        stableSyncs_ = 0;
+        syncInterval_ = kMinSyncInterval;
+        converged_ = false;
+    }
+
+    // Adapt the sync interval: low delay samples that match the prediction confirm the estimation
+    if ((samples_.size() >= kMinSamples) && (sample.delay <= std::max(delayThreshold_, minDelay_ + static_cast<cs::nsec::rep>(kDelayScale))))
+    {
+        // the offset of a sample can be off by half of its delay above the min delay
+        double error = std::abs(static_cast<double>(sample.offset - diffToServer(sample.local)));
+        if (error <= std::max(kMinJitter, 3. * jitter_) + static_cast<double>(std::max<cs::nsec::rep>(sample.delay - minDelay_, 0)) / 2.)
+        {
+            // without a skew estimation the prediction error grows with the interval, so keep syncing at the min interval
+            if ((++stableSyncs_ >= kStableSyncs) && skewEstimated_ && (syncInterval_ < kMaxSyncInterval))
+            {
+                stableSyncs_ = 0;
+                syncInterval_ = std::min<cs::msec>(2 * syncInterval_, kMaxSyncInterval);
+                LOG(DEBUG, LOG_TAG) << "Time sync stable, skew: " << getSkew() << " ppm, jitter: " << jitter_ / 1000. << " us, sync interval: "
+                                    << syncInterval_.count() << " ms\n";
+            }
+        }
+        else
+        {
+            stableSyncs_ = 0;
+            if (syncInterval_ > kMinSyncInterval)
+            {
+                syncInterval_ = std::max<cs::msec>(syncInterval_ / 2, kMinSyncInterval);
+                LOG(DEBUG, LOG_TAG) << "Time sync prediction error: " << error / 1000. << " us, sync interval: " << syncInterval_.count() << " ms\n";
+            }
+        }
+    }
+
+    samples_.push_back(sample);
+    while ((samples_.size() > kMaxSamples) || (samples_.back().local - samples_.front().local > kMaxSampleAge))
+        samples_.pop_front();
+
+    updateModel();
 }
 
 
-void TimeProvider::setDiffToServer(double ms)
+void TimeProvider::updateModel()
 {
-    using namespace std::chrono_literals;
-    auto now = std::chrono::system_clock::now();
-    static auto lastTimeSync = now;
-    auto diff = chronos::abs(now - lastTimeSync);
+    // Min delay filter: the offset error is at most half of the delay asymmetry, so only the samples
+    // with the lowest delays are used, weighted by their delay above the min delay.
+    // The delay statistics are taken from the recent samples, the delays may change over time, e.g.
+    // the initial quick syncs often have lower delays than the syncs of an idle connection.
+    std::vector<cs::nsec::rep> delays;
+    size_t recent = std::min(samples_.size(), kFilterSamples);
+    delays.reserve(recent);
+    for (auto iter = samples_.end() - static_cast<std::ptrdiff_t>(recent); iter != samples_.end(); ++iter)
+        delays.push_back(iter->delay);
+    size_t used = std::min(recent, std::max(kMinSamples, recent / 3));
+    std::nth_element(delays.begin(), delays.begin() + static_cast<std::ptrdiff_t>(used - 1), delays.end());
+    delayThreshold_ = delays[used - 1];
+    minDelay_ = *std::min_element(delays.begin(), delays.begin() + static_cast<std::ptrdiff_t>(used));
 
-    /// clear diffBuffer if last update is older than a minute
-    if (!diffBuffer_.empty() && (diff > 60s))
+    // Weighted linear regression of the offset over the local time: offset = y + skew * (x - xm)
+    // x in seconds relative to the latest sample, y in ns, so the skew is in ns/s = ppb
+    auto ref = samples_.back().local;
+    double sw = 0., swx = 0., swy = 0.;
+    double xmin = std::numeric_limits<double>::max();
+    double xmax = std::numeric_limits<double>::lowest();
+    std::vector<double> weights;
+    weights.reserve(samples_.size());
+    for (const auto& sample : samples_)
     {
-        LOG(INFO, LOG_TAG) << "Last time sync older than a minute. Clearing time buffer\n";
-        diffToServer_ = static_cast<chronos::usec::rep>(ms * 1000);
-        diffBuffer_.clear();
+        double w = 0.;
+        if (sample.delay <= delayThreshold_)
+        {
+            w = 1. / std::pow(1. + static_cast<double>(std::max<cs::nsec::rep>(sample.delay - minDelay_, 0)) / kDelayScale, 2);
+            double x = std::chrono::duration<double>(sample.local - ref).count();
+            sw += w;
+            swx += w * x;
+            swy += w * static_cast<double>(sample.offset);
+            xmin = std::min(xmin, x);
+            xmax = std::max(xmax, x);
+        }
+        weights.push_back(w);
     }
-    lastTimeSync = now;
+    double xm = swx / sw;
+    double ym = swy / sw;
+
+    double sxx = 0., sxy = 0.;
+    for (size_t n = 0; n < samples_.size(); ++n)
+    {
+        double x = std::chrono::duration<double>(samples_[n].local - ref).count() - xm;
+        sxx += weights[n] * x * x;
+        sxy += weights[n] * x * (static_cast<double>(samples_[n].offset) - ym);
+    }
+
+    int64_t skewPpb = 0;
+    skewEstimated_ = (xmax - xmin >= std::chrono::duration<double>(kMinSkewSpan).count()) && (sxx > 0.);
+    if (skewEstimated_)
+        skewPpb = std::max(-kMaxSkewPpb, std::min(kMaxSkewPpb, static_cast<int64_t>(std::llround(sxy / sxx))));
 
-    diffBuffer_.add(static_cast<chronos::usec::rep>(ms * 1000));
-    diffToServer_ = diffBuffer_.median();
-    // LOG(INFO, LOG_TAG) << "setDiffToServer: " << ms << ", diff: " << diffToServer_ / 1000000 << " s, " << (diffToServer_ / 1000) % 1000 << "." <<
-    // diffToServer_ % 1000 << " ms\n";
+    double residuals = 0.;
+    for (size_t n = 0; n < samples_.size(); ++n)
+    {
+        double x = std::chrono::duration<double>(samples_[n].local - ref).count() - xm;
+        double residual = static_cast<double>(samples_[n].offset) - (ym + static_cast<double>(skewPpb) * x);
+        residuals += weights[n] * residual * residual;
+    }
+    jitter_ = std::sqrt(residuals / sw);
+
+    auto refLocal = std::chrono::duration_cast<cs::nsec>(ref.time_since_epoch()).count() + static_cast<cs::nsec::rep>(xm * 1000000000.);
+    publish(refLocal, static_cast<cs::nsec::rep>(ym), skewPpb);
+
+    // set after publishing, so that the player starts with the converged model
+    if (!converged_)
+    {
+        // standard error of the weighted mean offset, with the effective number of samples
+        double sww = 0.;
+        for (double w : weights)
+            sww += w * w;
+        double error = jitter_ / std::sqrt(sw * sw / sww);
+        if (((used >= kMinSamples) && (error <= kMaxOffsetError)) || (samples_.back().local - samples_.front().local >= kMaxConvergeTime))
+        {
+            LOG(INFO, LOG_TAG) << "Time sync converged after " << samples_.size() << " samples, offset error: " << error / 1000. << " us\n";
+            converged_.store(true, std::memory_order_release);
+        }
+    }
 }
 
-/*
-long TimeProvider::getPercentileDiffToServer(size_t percentile)
+
+void TimeProvider::publish(cs::nsec::rep refLocal, cs::nsec::rep refOffset, int64_t skewPpb)
+{
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    refLocal_.store(refLocal, std::memory_order_relaxed);
+    refOffset_.store(refOffset, std::memory_order_relaxed);
+    skewPpb_.store(skewPpb, std::memory_order_relaxed);
+    seq_.store(seq + 2, std::memory_order_release);
+}
+
+
+cs::nsec::rep TimeProvider::diffToServer(const cs::time_point_clk& local) const
+{
+    uint32_t seq;
+    cs::nsec::rep refLocal;
+    cs::nsec::rep refOffset;
+    int64_t skewPpb;
+    do
+    {
+        seq = seq_.load(std::memory_order_acquire);
+        refLocal = refLocal_.load(std::memory_order_relaxed);
+        refOffset = refOffset_.load(std::memory_order_relaxed);
+        skewPpb = skewPpb_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (((seq & 1) != 0) || (seq != seq_.load(std::memory_order_relaxed)));
+
+    double elapsed = static_cast<double>(std::chrono::duration_cast<cs::nsec>(local.time_since_epoch()).count() - refLocal);
+    return refOffset + static_cast<cs::nsec::rep>(elapsed * static_cast<double>(skewPpb) / 1000000000.);
+}
+
+
+double TimeProvider::getSkew() const
 {
-        return diffBuffer.percentile(percentile);
+    return static_cast<double>(skewPpb_.load(std::memory_order_relaxed)) / 1000.;
 }
-*/
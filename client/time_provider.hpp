@@ -20,16 +20,17 @@
 #define TIME_PROVIDER_H
 
 #include "common/time_defs.hpp"
-#include "double_buffer.hpp"
 #include "message/message.hpp"
 #include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <deque>
 
 
 /// Provides local and server time
 /**
- * Stores time difference to the server
- * Returns server's local system time.
+ * Estimates offset and skew of the server's clock from time sync samples
+ * Returns server's local system time, predicted between the syncs.
  * Clients are using the server time to play audio in sync, independent of the client's system time
  */
 class TimeProvider
@@ -41,19 +42,39 @@ public:
         return instance;
     }
 
-    void setDiffToServer(double ms);
-    void setDiff(const tv& c2s, const tv& s2c);
+    /// Add a time sync sample
+    /// @param c2s client to server latency: server's receive time - client's send time
+    /// @param s2c server to client latency: client's receive time - server's send time
+    /// @param received client's receive time of the response
+    void setDiff(const tv& c2s, const tv& s2c, const chronos::time_point_clk& received = now());
 
+    /// @return predicted difference to the server's clock at local time @p local
     template <typename T>
-    inline T getDiffToServer() const
+    inline T getDiffToServer(const chronos::time_point_clk& local = now()) const
     {
-        return std::chrono::duration_cast<T>(chronos::usec(diffToServer_));
+        return std::chrono::duration_cast<T>(chronos::nsec(diffToServer(local)));
     }
 
-    /*	chronos::usec::rep getDiffToServer();
-            chronos::usec::rep getPercentileDiffToServer(size_t percentile);
-            long getDiffToServerMs();
-    */
+    /// @return estimated frequency offset of the server's clock [ppm]
+    double getSkew() const;
+
+    /// @return true if the estimated offset is within the confidence bound, or enough time was spent syncing
+    bool converged() const
+    {
+        return converged_.load(std::memory_order_acquire);
+    }
+
+    /// @return weighted RMS of the time sync residuals, must be called from the thread that calls setDiff
+    chronos::usec getJitter() const
+    {
+        return chronos::usec(static_cast<chronos::usec::rep>(jitter_ / 1000.));
+    }
+
+    /// @return interval for the next time sync, grows while the estimation is stable
+    chronos::msec getSyncInterval() const
+    {
+        return syncInterval_;
+    }
 
     template <typename T>
     static T sinceEpoche(const chronos::time_point_clk& point)
@@ -73,7 +94,8 @@ public:
 
     inline static chronos::time_point_clk serverNow()
     {
-        return chronos::clk::now() + TimeProvider::getInstance().getDiffToServer<chronos::usec>();
+        auto local = chronos::clk::now();
+        return local + TimeProvider::getInstance().getDiffToServer<chronos::usec>(local);
     }
 
 private:
@@ -81,8 +103,39 @@ private:
     TimeProvider(TimeProvider const&);   // Don't Implement
     void operator=(TimeProvider const&); // Don't implement
 
-    DoubleBuffer<chronos::usec::rep> diffBuffer_;
-    std::atomic<chronos::usec::rep> diffToServer_;
+    struct Sample
+    {
+        /// local time of the sample, i.e. the middle of the round trip
+        chronos::time_point_clk local;
+        chronos::nsec::rep offset;
+        chronos::nsec::rep delay;
+    };
+
+    /// Predict the difference to the server at local time @p local, lock-free
+    chronos::nsec::rep diffToServer(const chronos::time_point_clk& local) const;
+    /// Estimate offset and skew from the low delay samples
+    void updateModel();
+    /// Publish the model for diffToServer (seqlock, single writer)
+    void publish(chronos::nsec::rep refLocal, chronos::nsec::rep refOffset, int64_t skewPpb);
+
+    /// time sync samples, only accessed by the thread that calls setDiff
+    std::deque<Sample> samples_;
+    /// max delay of the samples used for the estimation
+    chronos::nsec::rep delayThreshold_;
+    chronos::nsec::rep minDelay_;
+    /// the samples span enough time to estimate the skew
+    bool skewEstimated_;
+    /// weighted RMS of the residuals of the used samples [ns]
+    double jitter_;
+    size_t stableSyncs_;
+    chronos::msec syncInterval_;
+    std::atomic<bool> converged_;
+
+    /// model: diff = refOffset_ + (local - refLocal_) * skewPpb_ / 10^9
+    std::atomic<uint32_t> seq_;
+    std::atomic<chronos::nsec::rep> refLocal_;
+    std::atomic<chronos::nsec::rep> refOffset_;
+    std::atomic<int64_t> skewPpb_;
 };
 
 
@@ -48,6 +48,12 @@ public:
         return get("muted", false);
     }
 
+    /// @return the effective latency of the client's output buffer in ms, 0 if unknown
+    int32_t getBufferLatency()
+    {
+        return get("bufferLatency", 0);
+    }
+
     void setVolume(uint16_t volume)
     {
         msg["volume"] = volume;
@@ -57,6 +63,11 @@ public:
     {
         msg["muted"] = muted;
     }
+
+    void setBufferLatency(int32_t latency_ms)
+    {
+        msg["bufferLatency"] = latency_ms;
+    }
 };
 } // namespace msg
 
@@ -0,0 +1,107 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef CLIENT_STATS_MSG_H
+#define CLIENT_STATS_MSG_H
+
+#include "message.hpp"
+
+
+namespace msg
+{
+
+/**
+ * Sync and performance statistics, sent periodically by the client
+ * Percentiles and durations refer to the report period, counters are cumulative since the audio stream was created.
+ * Fields are only appended, readers ignore trailing fields they don't know.
+ */
+class ClientStats : public BaseMessage
+{
+public:
+    ClientStats()
+        : BaseMessage(message_type::kClientStats), period(0), sync_error_p50(0), sync_error_p95(0), sync_error_p99(0), sync_error_max(0), hard_syncs(0),
+          correction(0), queue_depth(0), xruns(0), decode_time(0), time_jitter(0), time_to_first_audio(0)
+    {
+    }
+
+    ~ClientStats() override = default;
+
+    void read(std::istream& stream) override
+    {
+        readVal(stream, period);
+        readVal(stream, sync_error_p50);
+        readVal(stream, sync_error_p95);
+        readVal(stream, sync_error_p99);
+        readVal(stream, sync_error_max);
+        readVal(stream, hard_syncs);
+        readVal(stream, correction);
+        readVal(stream, queue_depth);
+        readVal(stream, xruns);
+        readVal(stream, decode_time);
+        readVal(stream, time_jitter);
+        readVal(stream, time_to_first_audio);
+    }
+
+    uint32_t getSize() const override
+    {
+        return 12 * sizeof(uint32_t);
+    }
+
+    /// report period [ms]
+    uint32_t period;
+    /// percentiles of the absolute sync error (age of the played frames) [us]
+    uint32_t sync_error_p50;
+    uint32_t sync_error_p95;
+    uint32_t sync_error_p99;
+    uint32_t sync_error_max;
+    /// number of hard syncs (restarts of the playout)
+    uint32_t hard_syncs;
+    /// mean playback speed correction [1/1000 ppm], positive: playing faster to catch up
+    int32_t correction;
+    /// buffered audio [ms]
+    uint32_t queue_depth;
+    /// buffer underruns of the audio device
+    uint32_t xruns;
+    /// time spent decoding [us]
+    uint32_t decode_time;
+    /// jitter of the time sync with the server [us]
+    uint32_t time_jitter;
+    /// time from process start until the first audio was audible [ms], 0 if unknown
+    uint32_t time_to_first_audio;
+
+protected:
+    void doserialize(std::ostream& stream) const override
+    {
+        writeVal(stream, period);
+        writeVal(stream, sync_error_p50);
+        writeVal(stream, sync_error_p95);
+        writeVal(stream, sync_error_p99);
+        writeVal(stream, sync_error_max);
+        writeVal(stream, hard_syncs);
+        writeVal(stream, correction);
+        writeVal(stream, queue_depth);
+        writeVal(stream, xruns);
+        writeVal(stream, decode_time);
+        writeVal(stream, time_jitter);
+        writeVal(stream, time_to_first_audio);
+    }
+};
+} // namespace msg
+
+
+#endif
@@ -20,10 +20,12 @@
 #define MESSAGE_FACTORY_HPP
 
 #include "client_info.hpp"
+#include "client_stats.hpp"
 #include "codec_header.hpp"
 #include "hello.hpp"
 #include "pcm_chunk.hpp"
 #include "server_settings.hpp"
+#include "silence.hpp"
 #include "stream_tags.hpp"
 #include "time.hpp"
 
@@ -84,6 +86,10 @@ static std::unique_ptr<BaseMessage> createMessage(const BaseMessage& base_messag
             return createMessage<PcmChunk>(base_message, buffer);
         case kClientInfo:
             return createMessage<ClientInfo>(base_message, buffer);
+        case kSilence:
+            return createMessage<Silence>(base_message, buffer);
+        case kClientStats:
+            return createMessage<ClientStats>(base_message, buffer);
         default:
             return nullptr;
     }
@@ -62,9 +62,11 @@ enum message_type
     kHello = 5,
     kStreamTags = 6,
     kClientInfo = 7,
+    kSilence = 8,
+    kClientStats = 9,
 
     kFirst = kBase,
-    kLast = kClientInfo
+    kLast = kClientStats
 };
 
 
@@ -79,6 +81,12 @@ struct tv
     }
     tv(timeval tv) : sec(tv.tv_sec), usec(tv.tv_usec){};
     tv(int32_t _sec, int32_t _usec) : sec(_sec), usec(_usec){};
+    tv(const chronos::time_point_clk& tp)
+    {
+        auto us = std::chrono::duration_cast<chronos::usec>(tp.time_since_epoch()).count();
+        sec = static_cast<int32_t>(us / 1000000);
+        usec = static_cast<int32_t>(us % 1000000);
+    }
 
     int32_t sec;
     int32_t usec;
@@ -58,6 +58,18 @@ public:
         return get("muted", false);
     }
 
+    /// UDP port for time sync, 0 if not available
+    uint16_t getTimeSyncPort()
+    {
+        return get("timeSyncPort", static_cast<uint16_t>(0));
+    }
+
+    /// Interval for sending ClientStats in ms, 0 if the server doesn't accept them
+    int32_t getStatsInterval()
+    {
+        return get("statsInterval", 0);
+    }
+
 
 
     void setBufferMs(int32_t bufferMs)
@@ -79,6 +91,16 @@ public:
     {
         msg["muted"] = muted;
     }
+
+    void setTimeSyncPort(uint16_t port)
+    {
+        msg["timeSyncPort"] = port;
+    }
+
+    void setStatsInterval(int32_t interval_ms)
+    {
+        msg["statsInterval"] = interval_ms;
+    }
 };
 } // namespace msg
 
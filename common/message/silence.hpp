@@ -0,0 +1,72 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef SILENCE_MSG_H
+#define SILENCE_MSG_H
+
+#include "message.hpp"
+#include <chrono>
+
+namespace msg
+{
+
+/**
+ * Marker for a stretch of digital silence that has not been sent as PcmChunks
+ * "duration" microseconds of silence, starting at server time "timestamp"
+ */
+class Silence : public BaseMessage
+{
+public:
+    Silence() : BaseMessage(message_type::kSilence), duration(0)
+    {
+    }
+
+    ~Silence() override = default;
+
+    void read(std::istream& stream) override
+    {
+        readVal(stream, timestamp.sec);
+        readVal(stream, timestamp.usec);
+        readVal(stream, duration);
+    }
+
+    uint32_t getSize() const override
+    {
+        return sizeof(tv) + sizeof(uint32_t);
+    }
+
+    std::chrono::microseconds getDuration() const
+    {
+        return std::chrono::microseconds(duration);
+    }
+
+    tv timestamp;
+    uint32_t duration;
+
+protected:
+    void doserialize(std::ostream& stream) const override
+    {
+        writeVal(stream, timestamp.sec);
+        writeVal(stream, timestamp.usec);
+        writeVal(stream, duration);
+    }
+};
+} // namespace msg
+
+
+#endif
@@ -21,10 +21,12 @@
 
 #include "common/time_defs.hpp"
 #include "message.hpp"
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <streambuf>
 #include <vector>
 
@@ -53,16 +55,72 @@ public:
 
     ~WireChunk() override
     {
-        free(payload);
+        if (!owner_)
+            free(payload);
     }
 
     void read(std::istream& stream) override
     {
+        if (owner_)
+            copyPayload(0);
         readVal(stream, timestamp.sec);
         readVal(stream, timestamp.usec);
         readVal(stream, &payload, payloadSize);
     }
 
+    using BaseMessage::deserialize;
+
+    /// Deserialize the chunk without copying the payload
+    /// @param baseMessage the message header
+    /// @param buffer the serialized chunk of size baseMessage.size
+    /// @param owner keeps the buffer alive, as long as the payload points into it
+    void deserialize(const BaseMessage& baseMessage, char* buffer, std::shared_ptr<void> owner)
+    {
+        type = baseMessage.type;
+        id = baseMessage.id;
+        refersTo = baseMessage.refersTo;
+        sent = baseMessage.sent;
+        received = baseMessage.received;
+        size = baseMessage.size;
+        uint32_t header_size = sizeof(tv) + sizeof(uint32_t);
+        if (size < header_size)
+        {
+            resizePayload(0);
+            return;
+        }
+        membuf databuf(buffer, buffer + header_size);
+        std::istream is(&databuf);
+        readVal(is, timestamp.sec);
+        readVal(is, timestamp.usec);
+        uint32_t payload_size;
+        readVal(is, payload_size);
+        if (!owner_)
+            free(payload);
+        payload = buffer + header_size;
+        payloadSize = std::min(payload_size, size - header_size);
+        owner_ = std::move(owner);
+    }
+
+    /// Resize the payload, the content is kept up to the new size
+    void resizePayload(uint32_t size)
+    {
+        if (owner_)
+            copyPayload(size);
+        else
+            payload = static_cast<char*>(realloc(payload, size));
+        payloadSize = size;
+    }
+
+    /// Release the payload, the returned pointer keeps it alive
+    std::shared_ptr<char> releasePayload()
+    {
+        std::shared_ptr<char> result = owner_ ? std::shared_ptr<char>(owner_, payload) : std::shared_ptr<char>(payload, &free);
+        owner_ = nullptr;
+        payload = nullptr;
+        payloadSize = 0;
+        return result;
+    }
+
     uint32_t getSize() const override
     {
         return sizeof(tv) + sizeof(int32_t) + payloadSize;
@@ -90,6 +148,19 @@ protected:
         writeVal(stream, timestamp.usec);
         writeVal(stream, payload, payloadSize);
     }
+
+    /// Copy the shared payload into a malloc'ed buffer of @p size bytes
+    void copyPayload(uint32_t size)
+    {
+        char* data = static_cast<char*>(malloc(size));
+        memcpy(data, payload, std::min(size, payloadSize));
+        payload = data;
+        owner_ = nullptr;
+    }
+
+private:
+    /// owner of the payload, if it points into a shared buffer
+    std::shared_ptr<void> owner_;
 };
 } // namespace msg
 
@@ -21,6 +21,7 @@
 #include "common/snap_exception.hpp"
 
 #include <cmath>
+#include <cstring>
 
 using namespace std;
 
@@ -118,9 +119,14 @@ std::shared_ptr<msg::PcmChunk> Resampler::resample(const msg::PcmChunk& chunk)
         if (in_format_.bits() == 24)
         {
             // sox expects 32 bit input, shift 8 bits left
-            auto* frames = reinterpret_cast<int32_t*>(chunk.payload);
+            // the payload might be unaligned, if it references a receive buffer
             for (size_t n = 0; n < chunk.getSampleCount(); ++n)
-                frames[n] = frames[n] << 8;
+            {
+                int32_t sample;
+                memcpy(&sample, chunk.payload + n * sizeof(int32_t), sizeof(int32_t));
+                sample = sample << 8;
+                memcpy(chunk.payload + n * sizeof(int32_t), &sample, sizeof(int32_t));
+            }
         }
 
         size_t idone;
@@ -46,6 +46,16 @@ public:
     void setFormat(const std::string& format);
     void setFormat(uint32_t rate, uint16_t bits, uint16_t channels);
 
+    bool operator==(const SampleFormat& other) const
+    {
+        return (rate_ == other.rate_) && (bits_ == other.bits_) && (channels_ == other.channels_);
+    }
+
+    bool operator!=(const SampleFormat& other) const
+    {
+        return !(*this == other);
+    }
+
     bool isInitialized() const
     {
         return ((rate_ != 0) || (bits_ != 0) || (channels_ != 0));
@@ -0,0 +1,191 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef THREAD_UTILS_H
+#define THREAD_UTILS_H
+
+#include "common/str_compat.hpp"
+#include "string_utils.hpp"
+#ifdef __linux__
+#include <alloca.h>
+#endif
+#ifndef WINDOWS
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace utils
+{
+namespace thread
+{
+
+/// Scheduling options of a thread
+struct Settings
+{
+    /// "other", "fifo" or "rr"
+    std::string policy{"other"};
+    /// realtime priority [1..99], used for "fifo" and "rr"
+    int priority{0};
+    /// CPUs to run on, empty for all
+    std::vector<int> cpus;
+    /// map the thread's stack when it starts, with realtime scheduling or locked memory
+    bool prefault{false};
+};
+
+
+/// Parse "<fifo|rr|other>[:<priority>]" into @p settings, the default priority is 50
+static void parsePolicy(const std::string& value, Settings& settings)
+{
+    std::string priority;
+    std::string policy = utils::string::split_left(value, ':', priority);
+    if ((policy != "other") && (policy != "fifo") && (policy != "rr"))
+        throw std::invalid_argument("Scheduling policy must be fifo, rr or other: " + policy);
+    settings.policy = policy;
+    settings.priority = (policy == "other") ? 0 : 50;
+    if (!priority.empty() && (policy != "other"))
+        settings.priority = std::max(1, std::min(99, std::stoi(priority)));
+}
+
+
+/// Parse a CPU list like "0,2-3"
+static std::vector<int> parseCpus(const std::string& value)
+{
+    std::vector<int> cpus;
+    for (const auto& range : utils::string::split(value, ','))
+    {
+        if (range.empty())
+            continue;
+        std::string last;
+        int first = std::stoi(utils::string::split_left(range, '-', last));
+        for (int cpu = first; cpu <= (last.empty() ? first : std::stoi(last)); ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+
+/// @return the CPUs the calling thread may run on, empty if unknown
+static std::vector<int> getCpus()
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &cpuset))
+                cpus.push_back(cpu);
+        }
+    }
+#endif
+    return cpus;
+}
+
+
+/// Apply the scheduling @p settings to the calling thread
+/// Throws std::runtime_error if a setting could not be applied, e.g. due to missing privileges
+static void apply(const Settings& settings)
+{
+#ifndef WINDOWS
+    if (settings.policy != "other")
+    {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = settings.priority;
+        int err = pthread_setschedparam(pthread_self(), (settings.policy == "fifo") ? SCHED_FIFO : SCHED_RR, &param);
+        if (err != 0)
+            throw std::runtime_error("Failed to set scheduling policy " + settings.policy + ":" + cpt::to_string(settings.priority) + ": " + strerror(err));
+    }
+    if (!settings.cpus.empty())
+    {
+#ifdef __linux__
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int cpu : settings.cpus)
+            CPU_SET(cpu, &cpuset);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        if (err != 0)
+            throw std::runtime_error(std::string("Failed to set CPU affinity: ") + strerror(err));
+#else
+        throw std::runtime_error("CPU affinity is not supported on this platform");
+#endif
+    }
+#else
+    if ((settings.policy != "other") || !settings.cpus.empty())
+        throw std::runtime_error("Thread scheduling options are not supported on this platform");
+#endif
+}
+
+
+/// Lock all current and future pages of the process into RAM and keep freed heap memory mapped,
+/// so that the audio threads don't page fault
+static void lockMemory()
+{
+#ifndef WINDOWS
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        throw std::runtime_error(std::string("Failed to lock memory: ") + strerror(errno));
+#ifdef __GLIBC__
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+#else
+    throw std::runtime_error("Locking memory is not supported on this platform");
+#endif
+}
+
+
+/// Touch up to 256KiB of the calling thread's stack, so that it is mapped before it's needed
+/// The size is limited by the thread's actual stack size (e.g. 128KiB with musl), minus a margin for the frames in use
+static void prefaultStack()
+{
+#ifdef __linux__
+    static constexpr size_t kMaxSize = 256 * 1024;
+    static constexpr size_t kMargin = 32 * 1024;
+    size_t stack_size = 0;
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0)
+        return;
+    if (pthread_attr_getstacksize(&attr, &stack_size) != 0)
+        stack_size = 0;
+    pthread_attr_destroy(&attr);
+    if (stack_size <= kMargin)
+        return;
+    size_t size = std::min(kMaxSize, stack_size - kMargin);
+    volatile char* stack = static_cast<volatile char*>(alloca(size));
+    for (size_t n = 0; n < size; n += 4096)
+        stack[n] = 0;
+#endif
+}
+
+} // namespace thread
+} // namespace utils
+
+#endif
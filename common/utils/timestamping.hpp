@@ -0,0 +1,332 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef TIMESTAMPING_UTILS_HPP
+#define TIMESTAMPING_UTILS_HPP
+
+#include "common/time_defs.hpp"
+#include <boost/asio.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#ifdef __linux__
+#include <ctime>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+
+namespace utils
+{
+namespace timestamping
+{
+
+/// Kernel software timestamps of sent and received data
+/**
+ * The kernel takes the timestamps when a packet is passed to the NIC driver, or when it's received from the driver,
+ * i.e. they don't include the scheduling and io_context queueing delays of the application.
+ * Only available on Linux, elsewhere the timestamps are taken in user space.
+ */
+
+/// Enable kernel software timestamps on a socket
+/// @param fd the socket
+/// @param tx also enable TX timestamps, they must be read with readTxTimestamps
+/// @return true on success
+inline bool enable(int fd, bool tx)
+{
+#ifdef __linux__
+    uint32_t flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (tx)
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    return (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0);
+#else
+    std::ignore = fd;
+    std::ignore = tx;
+    return false;
+#endif
+}
+
+
+#ifdef __linux__
+/// Map a kernel timestamp (CLOCK_REALTIME) to the steady clock
+inline chronos::time_point_clk toSteady(const timespec& ts)
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    auto age = std::chrono::seconds(now.tv_sec - ts.tv_sec) + std::chrono::nanoseconds(now.tv_nsec - ts.tv_nsec);
+    return chronos::clk::now() - std::chrono::duration_cast<chronos::clk::duration>(age);
+}
+
+
+/// Get the software timestamp from the control messages
+/// @return true if msg contains a timestamp
+inline bool getTimestamp(msghdr& msg, chronos::time_point_clk& timestamp)
+{
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPING))
+        {
+            // ts[0] is the software timestamp, ts[2] the hardware timestamp
+            auto* ts = reinterpret_cast<const timespec*>(CMSG_DATA(cmsg));
+            if ((ts[0].tv_sec == 0) && (ts[0].tv_nsec == 0))
+                return false;
+            timestamp = toSteady(ts[0]);
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+
+/// Read all pending TX timestamps from the socket's error queue
+/// @param fd the socket
+/// @param handler called for every timestamp: void(uint32_t id, const chronos::time_point_clk& timestamp).
+///        For TCP the id is the offset of the last byte of the send call, counted from enabling the timestamps
+template <typename Handler>
+void readTxTimestamps(int fd, Handler&& handler)
+{
+#ifdef __linux__
+    while (true)
+    {
+        char control[512];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+
+        chronos::time_point_clk timestamp;
+        bool has_timestamp = getTimestamp(msg, timestamp);
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            bool recverr = ((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) || ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR));
+            if (!has_timestamp || !recverr)
+                continue;
+            auto* err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+            if ((err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) && (err->ee_info == SCM_TSTAMP_SND))
+                handler(err->ee_data, timestamp);
+        }
+    }
+#else
+    std::ignore = fd;
+    std::ignore = handler;
+#endif
+}
+
+
+#ifdef __linux__
+namespace detail
+{
+
+struct ReadState
+{
+    ReadState(boost::asio::ip::tcp::socket& socket, char* data, size_t size) : socket(socket), data(data), size(size), done(0), has_timestamp(false)
+    {
+    }
+
+    boost::asio::ip::tcp::socket& socket;
+    char* data;
+    size_t size;
+    size_t done;
+    bool has_timestamp;
+    chronos::time_point_clk timestamp;
+};
+
+
+template <typename Executor, typename Handler>
+void readSome(std::shared_ptr<ReadState> state, const Executor& executor, Handler handler)
+{
+    state->socket.async_wait(boost::asio::ip::tcp::socket::wait_read,
+                             boost::asio::bind_executor(executor, [state, executor, handler](const boost::system::error_code& ec) mutable {
+                                 if (ec)
+                                 {
+                                     handler(ec, state->done, chronos::clk::now());
+                                     return;
+                                 }
+                                 while (state->done < state->size)
+                                 {
+                                     iovec iov{state->data + state->done, state->size - state->done};
+                                     char control[256];
+                                     msghdr msg{};
+                                     msg.msg_iov = &iov;
+                                     msg.msg_iovlen = 1;
+                                     msg.msg_control = control;
+                                     msg.msg_controllen = sizeof(control);
+                                     ssize_t count = recvmsg(state->socket.native_handle(), &msg, MSG_DONTWAIT);
+                                     if (count < 0)
+                                     {
+                                         if (errno == EINTR)
+                                             continue;
+                                         if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                                             readSome(state, executor, handler);
+                                         else
+                                             handler(boost::system::error_code(errno, boost::system::system_category()), state->done, chronos::clk::now());
+                                         return;
+                                     }
+                                     if (count == 0)
+                                     {
+                                         handler(boost::asio::error::eof, state->done, chronos::clk::now());
+                                         return;
+                                     }
+                                     // keep the timestamp of the first segment, i.e. the arrival of the message
+                                     if (!state->has_timestamp)
+                                         state->has_timestamp = getTimestamp(msg, state->timestamp);
+                                     state->done += static_cast<size_t>(count);
+                                 }
+                                 handler(boost::system::error_code(), state->done, state->has_timestamp ? state->timestamp : chronos::clk::now());
+                             }));
+}
+
+} // namespace detail
+#endif
+
+
+/// Read exactly @p size bytes from the socket, like boost::asio::async_read, and pass the receive time to the handler
+/// @param socket the socket to read from
+/// @param executor executor (e.g. strand) for the handler
+/// @param data buffer to be filled
+/// @param size number of bytes to read
+/// @param handler void(const boost::system::error_code& ec, std::size_t length, const chronos::time_point_clk& received),
+///        received is the kernel's RX timestamp, if available, else the time when the read completed
+template <typename Executor, typename Handler>
+void async_read(boost::asio::ip::tcp::socket& socket, const Executor& executor, char* data, size_t size, Handler handler)
+{
+#ifdef __linux__
+    detail::readSome(std::make_shared<detail::ReadState>(socket, data, size), executor, std::move(handler));
+#else
+    boost::asio::async_read(socket, boost::asio::buffer(data, size),
+                            boost::asio::bind_executor(executor, [handler](const boost::system::error_code& ec, std::size_t length) mutable {
+                                handler(ec, length, chronos::clk::now());
+                            }));
+#endif
+}
+
+
+/// Read the available data from the socket, at least one byte, like tcp::socket::async_read_some, and pass the receive time to the handler
+/// @param socket the socket to read from
+/// @param executor executor (e.g. strand) for the handler
+/// @param data buffer to be filled
+/// @param size size of the buffer
+/// @param handler void(const boost::system::error_code& ec, std::size_t length, const chronos::time_point_clk& received),
+///        received is the kernel's RX timestamp of the last received segment, if available, else the time when the read completed
+template <typename Executor, typename Handler>
+void async_read_some(boost::asio::ip::tcp::socket& socket, const Executor& executor, char* data, size_t size, Handler handler)
+{
+#ifdef __linux__
+    socket.async_wait(boost::asio::ip::tcp::socket::wait_read,
+                      boost::asio::bind_executor(executor, [&socket, executor, data, size, handler](const boost::system::error_code& ec) mutable {
+                          if (ec)
+                          {
+                              handler(ec, 0, chronos::clk::now());
+                              return;
+                          }
+                          iovec iov{data, size};
+                          char control[256];
+                          msghdr msg{};
+                          msg.msg_iov = &iov;
+                          msg.msg_iovlen = 1;
+                          msg.msg_control = control;
+                          msg.msg_controllen = sizeof(control);
+                          ssize_t count = recvmsg(socket.native_handle(), &msg, MSG_DONTWAIT);
+                          if (count < 0)
+                          {
+                              if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+                                  async_read_some(socket, executor, data, size, std::move(handler));
+                              else
+                                  handler(boost::system::error_code(errno, boost::system::system_category()), 0, chronos::clk::now());
+                              return;
+                          }
+                          if (count == 0)
+                          {
+                              handler(boost::asio::error::eof, 0, chronos::clk::now());
+                              return;
+                          }
+                          chronos::time_point_clk received;
+                          if (!getTimestamp(msg, received))
+                              received = chronos::clk::now();
+                          handler(boost::system::error_code(), static_cast<size_t>(count), received);
+                      }));
+#else
+    socket.async_read_some(boost::asio::buffer(data, size),
+                           boost::asio::bind_executor(executor, [handler](const boost::system::error_code& ec, std::size_t length) mutable {
+                               handler(ec, length, chronos::clk::now());
+                           }));
+#endif
+}
+
+
+/// Receive a datagram, like boost::asio::ip::udp::socket::async_receive_from, and pass the receive time to the handler
+/// @param socket the socket to read from
+/// @param executor executor (e.g. strand) for the handler
+/// @param data buffer to be filled
+/// @param size size of the buffer
+/// @param sender will be set to the sender's endpoint, must stay valid until the handler is called
+/// @param handler void(const boost::system::error_code& ec, std::size_t length, const chronos::time_point_clk& received),
+///        received is the kernel's RX timestamp, if available, else the time when the datagram was received
+template <typename Executor, typename Handler>
+void async_receive_from(boost::asio::ip::udp::socket& socket, const Executor& executor, char* data, size_t size, boost::asio::ip::udp::endpoint& sender,
+                        Handler handler)
+{
+#ifdef __linux__
+    socket.async_wait(boost::asio::ip::udp::socket::wait_read,
+                      boost::asio::bind_executor(executor, [&socket, executor, data, size, &sender, handler](const boost::system::error_code& ec) mutable {
+                          if (ec)
+                          {
+                              handler(ec, 0, chronos::clk::now());
+                              return;
+                          }
+                          iovec iov{data, size};
+                          char control[256];
+                          msghdr msg{};
+                          msg.msg_name = sender.data();
+                          msg.msg_namelen = static_cast<socklen_t>(sender.capacity());
+                          msg.msg_iov = &iov;
+                          msg.msg_iovlen = 1;
+                          msg.msg_control = control;
+                          msg.msg_controllen = sizeof(control);
+                          ssize_t count = recvmsg(socket.native_handle(), &msg, MSG_DONTWAIT);
+                          if (count < 0)
+                          {
+                              if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+                                  async_receive_from(socket, executor, data, size, sender, std::move(handler));
+                              else
+                                  handler(boost::system::error_code(errno, boost::system::system_category()), 0, chronos::clk::now());
+                              return;
+                          }
+                          sender.resize(msg.msg_namelen);
+                          chronos::time_point_clk received;
+                          if (!getTimestamp(msg, received))
+                              received = chronos::clk::now();
+                          handler(boost::system::error_code(), static_cast<size_t>(count), received);
+                      }));
+#else
+    socket.async_receive_from(boost::asio::buffer(data, size), sender,
+                              boost::asio::bind_executor(executor, [handler](const boost::system::error_code& ec, std::size_t length) mutable {
+                                  handler(ec, length, chronos::clk::now());
+                              }));
+#endif
+}
+
+} // namespace timestamping
+} // namespace utils
+
+#endif
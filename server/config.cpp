@@ -116,7 +116,12 @@ void Config::save()
     if (filename_.empty())
         init();
     std::ofstream ofs(filename_.c_str(), std::ofstream::out | std::ofstream::trunc);
-    json clients = {{"ConfigVersion", 2}, {"Groups", getGroups()}};
+    json groups = getGroups();
+    // runtime values of the clients are reported in the status, but not persisted
+    for (auto& group : groups)
+        for (auto& client : group["clients"])
+            client.erase("bufferLatency");
+    json clients = {{"ConfigVersion", 2}, {"Groups", groups}};
     // ofs << std::setw(4) << clients;
     ofs << clients;
     ofs.close();
@@ -212,6 +217,38 @@ json Config::getServerStatus(const json& streams) const
 
 
 
+json Config::getStats() const
+{
+    json clients = json::array();
+    size_t connected = 0;
+    uint32_t worstSyncError = 0;
+    std::string worstClient;
+    uint32_t hardSyncs = 0;
+    uint32_t xruns = 0;
+    for (const auto& group : groups)
+    {
+        for (const auto& client : group->clients)
+        {
+            if (client->stats.reports == 0)
+                continue;
+            clients.push_back({{"id", client->id}, {"connected", client->connected}, {"stats", client->stats.toJson()}});
+            if (!client->connected)
+                continue;
+            ++connected;
+            hardSyncs += client->stats.hardSyncs;
+            xruns += client->stats.xruns;
+            if (worstClient.empty() || (client->stats.syncErrorP99 > worstSyncError))
+            {
+                worstSyncError = client->stats.syncErrorP99;
+                worstClient = client->id;
+            }
+        }
+    }
+    json summary = {{"clients", connected}, {"syncError", {{"p99", worstSyncError}, {"client", worstClient}}}, {"hardSyncs", hardSyncs}, {"xruns", xruns}};
+    return {{"clients", clients}, {"summary", summary}};
+}
+
+
 json Config::getGroups() const
 {
     json result = json::array();
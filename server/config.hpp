@@ -215,9 +215,68 @@ struct Snapserver : public Snapcast
 };
 
 
+/// Sync and performance statistics, as last reported by the client (msg::ClientStats)
+struct ClientStats
+{
+    ClientStats()
+        : reports(0), period(0), syncErrorP50(0), syncErrorP95(0), syncErrorP99(0), syncErrorMax(0), peakSyncError(0), hardSyncs(0), correction(0),
+          queueDepth(0), xruns(0), decodeTime(0), timeJitter(0), timeToFirstAudio(0)
+    {
+        lastUpdate.tv_sec = 0;
+        lastUpdate.tv_usec = 0;
+    }
+
+    json toJson()
+    {
+        json j;
+        j["period"] = period;
+        j["syncError"]["p50"] = syncErrorP50;
+        j["syncError"]["p95"] = syncErrorP95;
+        j["syncError"]["p99"] = syncErrorP99;
+        j["syncError"]["max"] = syncErrorMax;
+        j["syncError"]["peak"] = peakSyncError;
+        j["hardSyncs"] = hardSyncs;
+        j["correction"] = correction;
+        j["queueDepth"] = queueDepth;
+        j["xruns"] = xruns;
+        j["decodeTime"] = decodeTime;
+        j["timeJitter"] = timeJitter;
+        j["timeToFirstAudio"] = timeToFirstAudio;
+        j["lastUpdate"]["sec"] = lastUpdate.tv_sec;
+        j["lastUpdate"]["usec"] = lastUpdate.tv_usec;
+        return j;
+    }
+
+    /// number of received reports, 0 if the client doesn't send stats
+    uint32_t reports;
+    timeval lastUpdate;
+    /// report period [ms]
+    uint32_t period;
+    /// absolute sync error in the last period [us]
+    uint32_t syncErrorP50;
+    uint32_t syncErrorP95;
+    uint32_t syncErrorP99;
+    uint32_t syncErrorMax;
+    /// max sync error since the client connected [us]
+    uint32_t peakSyncError;
+    uint32_t hardSyncs;
+    /// playback speed correction [ppm]
+    double correction;
+    /// buffered audio [ms]
+    uint32_t queueDepth;
+    uint32_t xruns;
+    /// time spent decoding in the last period [us]
+    uint32_t decodeTime;
+    /// jitter of the time sync [us]
+    uint32_t timeJitter;
+    /// [ms], 0 if unknown
+    uint32_t timeToFirstAudio;
+};
+
+
 struct ClientInfo
 {
-    ClientInfo(const std::string& _clientId = "") : id(_clientId), connected(false)
+    ClientInfo(const std::string& _clientId = "") : id(_clientId), connected(false), bufferLatency(0)
     {
         lastSeen.tv_sec = 0;
         lastSeen.tv_usec = 0;
@@ -244,6 +303,7 @@ struct ClientInfo
         j["lastSeen"]["sec"] = lastSeen.tv_sec;
         j["lastSeen"]["usec"] = lastSeen.tv_usec;
         j["connected"] = connected;
+        j["bufferLatency"] = bufferLatency;
         return j;
     }
 
@@ -253,6 +313,10 @@ struct ClientInfo
     ClientConfig config;
     timeval lastSeen;
     bool connected;
+    /// effective latency of the client's output buffer in ms, 0 if unknown, not persisted
+    int32_t bufferLatency;
+    /// runtime statistics, not persisted
+    ClientStats stats;
 };
 
 
@@ -387,6 +451,8 @@ public:
 
     json getGroups() const;
     json getServerStatus(const json& streams) const;
+    /// @return the stats of all clients that report them, and a summary over the connected clients
+    json getStats() const;
 
     void save();
 
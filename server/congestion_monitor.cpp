@@ -0,0 +1,125 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "congestion_monitor.hpp"
+#include "common/aixlog.hpp"
+#include <algorithm>
+
+using namespace std;
+
+static constexpr auto LOG_TAG = "Congestion";
+
+/// weight of a new queue delay sample
+static constexpr double delay_alpha = 0.1;
+/// rates are measured over windows of this duration
+static constexpr auto rate_window = 1s;
+/// number of Time latencies to find the base latency (one per second)
+static constexpr size_t latency_history = 60;
+
+/// thresholds to detect congestion
+static constexpr auto congested_queue = 300ms;
+static constexpr double congested_delay_ms = 250.;
+static constexpr auto congested_latency = 200ms;
+static constexpr double congested_drain_ratio = 0.9;
+
+/// thresholds for a clear link
+static constexpr auto clear_queue = 60ms;
+static constexpr double clear_delay_ms = 50.;
+static constexpr auto clear_latency = 50ms;
+
+/// min time between two switches to a lower rendition
+static constexpr auto step_down_interval = 1s;
+/// time without congestion before switching to a higher rendition
+static constexpr auto step_up_interval = 10s;
+
+
+CongestionMonitor::CongestionMonitor()
+    : queue_delay_ms_(0.), drain_rate_(0.), in_rate_(0.), window_bytes_in_(0), window_bytes_out_(0), window_busy_(0), window_start_(chronos::clk::now()),
+      latency_excess_(0), rendition_(0), congested_(false), last_change_(window_start_), last_congestion_(window_start_)
+{
+}
+
+
+void CongestionMonitor::onEnqueue(size_t bytes, const time_point& now)
+{
+    window_bytes_in_ += bytes;
+    auto window = now - window_start_;
+    if (window < rate_window)
+        return;
+
+    double seconds = chronos::duration<chronos::usec>(window) / 1000000.;
+    in_rate_ = window_bytes_in_ / seconds;
+    // the drain rate is the link throughput while there is something to send
+    if (window_busy_ > window / 2)
+        drain_rate_ = window_bytes_out_ / (window_busy_.count() / 1000000.);
+    else
+        drain_rate_ = 0.;
+    window_bytes_in_ = 0;
+    window_bytes_out_ = 0;
+    window_busy_ = 0us;
+    window_start_ = now;
+}
+
+
+void CongestionMonitor::onWritten(size_t bytes, const time_point& enqueued, const time_point& write_start, const time_point& now)
+{
+    window_bytes_out_ += bytes;
+    window_busy_ += std::chrono::duration_cast<chronos::usec>(now - std::max(write_start, window_start_));
+    double delay_ms = chronos::duration<chronos::usec>(now - enqueued) / 1000.;
+    queue_delay_ms_ += delay_alpha * (delay_ms - queue_delay_ms_);
+}
+
+
+void CongestionMonitor::onTimeLatency(const chronos::usec& latency)
+{
+    latencies_.push_back(latency);
+    if (latencies_.size() > latency_history)
+        latencies_.pop_front();
+    latency_excess_ = latency - *std::min_element(latencies_.begin(), latencies_.end());
+}
+
+
+size_t CongestionMonitor::update(const chronos::msec& queued_audio, size_t renditions, const time_point& now)
+{
+    bool drain_too_slow = (drain_rate_ > 0.) && (drain_rate_ < congested_drain_ratio * in_rate_);
+    congested_ = (queued_audio > congested_queue) || (queue_delay_ms_ > congested_delay_ms) || (latency_excess_ > congested_latency) || drain_too_slow;
+    bool clear = (queued_audio < clear_queue) && (queue_delay_ms_ < clear_delay_ms) && (latency_excess_ < clear_latency) && !drain_too_slow;
+
+    if (congested_)
+        last_congestion_ = now;
+
+    size_t max_rendition = (renditions > 0) ? renditions - 1 : 0;
+    if (rendition_ > max_rendition)
+        rendition_ = max_rendition;
+
+    if (congested_ && (rendition_ < max_rendition) && (now - last_change_ > step_down_interval))
+    {
+        ++rendition_;
+        last_change_ = now;
+        LOG(INFO, LOG_TAG) << "Congestion detected, queued: " << queued_audio.count() << " ms, delay: " << queue_delay_ms_
+                           << " ms, latency increase: " << latency_excess_.count() / 1000 << " ms, drain: " << drain_rate_ << " B/s, in: " << in_rate_
+                           << " B/s, switching to rendition " << rendition_ << "\n";
+    }
+    else if (clear && (rendition_ > 0) && (now - last_change_ > step_up_interval) && (now - last_congestion_ > step_up_interval))
+    {
+        --rendition_;
+        last_change_ = now;
+        LOG(INFO, LOG_TAG) << "Link recovered, switching to rendition " << rendition_ << "\n";
+    }
+    return rendition_;
+}
@@ -0,0 +1,84 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef CONGESTION_MONITOR_HPP
+#define CONGESTION_MONITOR_HPP
+
+#include "common/time_defs.hpp"
+#include <cstddef>
+#include <deque>
+
+
+/// Per session congestion signal
+/**
+ * Tracks the send queue of a StreamSession: the amount of queued audio, the queueing delay
+ * of written messages, the drain rate compared to the incoming rate and the trend of the
+ * client to server latency reported by Time messages.
+ * Based on this, one of the available renditions of the audio stream is selected:
+ * on congestion the next lower bitrate rendition is used, after a quiet period the next higher one.
+ */
+class CongestionMonitor
+{
+public:
+    using time_point = chronos::time_point_clk;
+
+    CongestionMonitor();
+
+    /// A message of @p bytes has been queued at @p now
+    void onEnqueue(size_t bytes, const time_point& now);
+    /// A message of @p bytes, queued at @p enqueued, has been written. The write started at @p write_start
+    void onWritten(size_t bytes, const time_point& enqueued, const time_point& write_start, const time_point& now);
+    /// Client to server latency of a Time message. Includes the clock offset, so only the increase is evaluated.
+    void onTimeLatency(const chronos::usec& latency);
+
+    /// Evaluate the congestion state
+    /// @param queued_audio duration of audio that is queued, but not yet on air
+    /// @param renditions number of available renditions of the stream (1 = no alternatives)
+    /// @return the rendition to use, 0 is the highest quality
+    size_t update(const chronos::msec& queued_audio, size_t renditions, const time_point& now);
+
+    /// the currently selected rendition
+    size_t rendition() const
+    {
+        return rendition_;
+    }
+
+    /// true if the last update detected congestion
+    bool congested() const
+    {
+        return congested_;
+    }
+
+private:
+    double queue_delay_ms_;
+    double drain_rate_;
+    double in_rate_;
+    size_t window_bytes_in_;
+    size_t window_bytes_out_;
+    chronos::usec window_busy_;
+    time_point window_start_;
+    std::deque<chronos::usec> latencies_;
+    chronos::usec latency_excess_;
+    size_t rendition_;
+    bool congested_;
+    time_point last_change_;
+    time_point last_congestion_;
+};
+
+
+#endif
@@ -83,6 +83,14 @@ std::string ControlServer::onMessageReceived(ControlSession* session, const std:
 }
 
 
+std::string ControlServer::getMetrics()
+{
+    if (controlMessageReceiver_ != nullptr)
+        return controlMessageReceiver_->getMetrics();
+    return "";
+}
+
+
 void ControlServer::onNewSession(const shared_ptr<ControlSession>& session)
 {
     std::lock_guard<std::recursive_mutex> mlock(session_mutex_);
@@ -62,6 +62,7 @@ private:
 
     /// Implementation of ControlMessageReceiver
     std::string onMessageReceived(ControlSession* session, const std::string& message) override;
+    std::string getMetrics() override;
     void onNewSession(const std::shared_ptr<ControlSession>& session) override;
     void onNewSession(const std::shared_ptr<StreamSession>& session) override;
 
@@ -41,6 +41,8 @@ class ControlMessageReceiver
 public:
     // TODO: rename, error handling
     virtual std::string onMessageReceived(ControlSession* session, const std::string& message) = 0;
+    /// @return the server's metrics in the Prometheus text format
+    virtual std::string getMetrics() = 0;
     virtual void onNewSession(const std::shared_ptr<ControlSession>& session) = 0;
     virtual void onNewSession(const std::shared_ptr<StreamSession>& session) = 0;
 };
@@ -230,6 +230,18 @@ void ControlSessionHttp::handle_request(http::request<Body, http::basic_fields<A
         return send(std::move(res));
     }
 
+    // metrics of the connected clients
+    if ((req.method() == http::verb::get) && (req.target() == "/metrics"))
+    {
+        http::response<http::string_body> res{http::status::ok, req.version()};
+        res.set(http::field::server, HTTP_SERVER_NAME);
+        res.set(http::field::content_type, "text/plain; version=0.0.4");
+        res.keep_alive(req.keep_alive());
+        res.body() = message_receiver_->getMetrics();
+        res.prepare_payload();
+        return send(std::move(res));
+    }
+
     // Request path must be absolute and not contain "..".
     if (req.target().empty() || req.target()[0] != '/' || req.target().find("..") != beast::string_view::npos)
         return send(bad_request("Illegal request-target"));
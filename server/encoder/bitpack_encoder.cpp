@@ -0,0 +1,219 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "bitpack_encoder.hpp"
+#include "common/aixlog.hpp"
+#include "common/endian.hpp"
+#include "common/snap_exception.hpp"
+#include "common/str_compat.hpp"
+#include <memory>
+
+
+namespace encoder
+{
+
+#define ID_BITPACK 0x4250434B
+
+static constexpr auto LOG_TAG = "BitpackEnc";
+
+/// Worst case residual width: 32 bit sample, 2nd order prediction, zigzag
+static constexpr size_t max_residual_bits = 35;
+static constexpr size_t num_orders = 3;
+
+namespace
+{
+template <typename T>
+void assign(void* pointer, T val)
+{
+    T* p = (T*)pointer;
+    *p = val;
+}
+
+inline uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline uint8_t bitWidth(uint64_t value)
+{
+    uint8_t width = 0;
+    while (value != 0)
+    {
+        ++width;
+        value >>= 1;
+    }
+    return width;
+}
+} // namespace
+
+
+BitpackEncoder::BitpackEncoder(const std::string& codecOptions) : Encoder(codecOptions), block_size_(0)
+{
+    headerChunk_.reset(new msg::CodecHeader("bitpack"));
+}
+
+
+std::string BitpackEncoder::getAvailableOptions() const
+{
+    return "block size in frames: [16..4096]";
+}
+
+
+std::string BitpackEncoder::getDefaultOptions() const
+{
+    return "64";
+}
+
+
+std::string BitpackEncoder::name() const
+{
+    return "bitpack";
+}
+
+
+void BitpackEncoder::initEncoder()
+{
+    int block_size;
+    try
+    {
+        block_size = cpt::stoi(codecOptions_);
+    }
+    catch (...)
+    {
+        throw SnapException("Invalid block size: \"" + codecOptions_ + "\"");
+    }
+    if ((block_size < 16) || (block_size > 4096))
+        throw SnapException("Block size must be in [16..4096]");
+    block_size_ = static_cast<uint16_t>(block_size);
+
+    if ((sampleFormat_.sampleSize() != 1) && (sampleFormat_.sampleSize() != 2) && (sampleFormat_.sampleSize() != 4))
+        throw SnapException("Unsupported sample size: " + cpt::to_string(sampleFormat_.sampleSize()));
+
+    residuals_.resize(num_orders * block_size_);
+    LOG(INFO, LOG_TAG) << "Init - block size: " << block_size_ << "\n";
+
+    // bitpack pseudo header: 4 byte ID, 4 byte rate, 2 byte bits, 2 byte channels, 2 byte block size
+    headerChunk_->payloadSize = 14;
+    headerChunk_->payload = static_cast<char*>(realloc(headerChunk_->payload, headerChunk_->payloadSize));
+    char* payload = headerChunk_->payload;
+    assign(payload, SWAP_32(ID_BITPACK));
+    assign(payload + 4, SWAP_32(sampleFormat_.rate()));
+    assign(payload + 8, SWAP_16(sampleFormat_.bits()));
+    assign(payload + 10, SWAP_16(sampleFormat_.channels()));
+    assign(payload + 12, SWAP_16(block_size_));
+}
+
+
+template <typename T>
+void BitpackEncoder::encodeBlocks(const T* samples, uint32_t frames, msg::PcmChunk& out)
+{
+    const uint16_t channels = sampleFormat_.channels();
+    const size_t blocks = (frames + block_size_ - 1) / block_size_;
+    const size_t max_block_bytes = 1 + (block_size_ * max_residual_bits + 7) / 8;
+    out.payload = static_cast<char*>(realloc(out.payload, 4 + blocks * channels * max_block_bytes));
+    assign(out.payload, SWAP_32(frames));
+    auto* dst = reinterpret_cast<uint8_t*>(out.payload + 4);
+
+    // prediction history, reset for every chunk, so that chunks are independent
+    std::vector<int64_t> hist1(channels, 0);
+    std::vector<int64_t> hist2(channels, 0);
+
+    for (uint32_t block_start = 0; block_start < frames; block_start += block_size_)
+    {
+        const uint32_t n = std::min<uint32_t>(block_size_, frames - block_start);
+        for (uint16_t c = 0; c < channels; ++c)
+        {
+            const T* in = samples + static_cast<size_t>(block_start) * channels + c;
+            uint64_t* r0 = residuals_.data();
+            uint64_t* r1 = r0 + block_size_;
+            uint64_t* r2 = r1 + block_size_;
+            uint64_t mask[num_orders] = {0, 0, 0};
+            int64_t x1 = hist1[c];
+            int64_t x2 = hist2[c];
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                int64_t x = in[static_cast<size_t>(i) * channels];
+                r0[i] = zigzag(x);
+                r1[i] = zigzag(x - x1);
+                r2[i] = zigzag(x - 2 * x1 + x2);
+                mask[0] |= r0[i];
+                mask[1] |= r1[i];
+                mask[2] |= r2[i];
+                x2 = x1;
+                x1 = x;
+            }
+            hist1[c] = x1;
+            hist2[c] = x2;
+
+            uint8_t order = 0;
+            uint8_t width = bitWidth(mask[0]);
+            for (uint8_t o = 1; o < num_orders; ++o)
+            {
+                uint8_t w = bitWidth(mask[o]);
+                if (w < width)
+                {
+                    width = w;
+                    order = o;
+                }
+            }
+
+            // block header: 2 bit predictor order, 6 bit residual width
+            *dst++ = static_cast<uint8_t>((order << 6) | width);
+            if (width == 0)
+                continue;
+
+            const uint64_t* residuals = residuals_.data() + order * block_size_;
+            uint64_t acc = 0;
+            uint8_t bits = 0;
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                acc |= residuals[i] << bits;
+                bits += width;
+                while (bits >= 8)
+                {
+                    *dst++ = static_cast<uint8_t>(acc);
+                    acc >>= 8;
+                    bits -= 8;
+                }
+            }
+            if (bits > 0)
+                *dst++ = static_cast<uint8_t>(acc);
+        }
+    }
+
+    out.payloadSize = static_cast<uint32_t>(reinterpret_cast<char*>(dst) - out.payload);
+}
+
+
+void BitpackEncoder::encode(const msg::PcmChunk& chunk)
+{
+    auto bitpackChunk = std::make_shared<msg::PcmChunk>(chunk.format, 0);
+    bitpackChunk->timestamp = chunk.timestamp;
+    uint32_t frames = chunk.getFrameCount();
+
+    if (sampleFormat_.sampleSize() == 1)
+        encodeBlocks(reinterpret_cast<const int8_t*>(chunk.payload), frames, *bitpackChunk);
+    else if (sampleFormat_.sampleSize() == 2)
+        encodeBlocks(reinterpret_cast<const int16_t*>(chunk.payload), frames, *bitpackChunk);
+    else
+        encodeBlocks(reinterpret_cast<const int32_t*>(chunk.payload), frames, *bitpackChunk);
+
+    encoded_callback_(*this, bitpackChunk, chunk.durationMs());
+}
+
+} // namespace encoder
@@ -0,0 +1,56 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef BITPACK_ENCODER_HPP
+#define BITPACK_ENCODER_HPP
+#include "encoder.hpp"
+#include <vector>
+
+
+namespace encoder
+{
+
+/// Lightweight lossless encoder
+/**
+ * Every chunk is split into blocks of "block size" frames. For each block and channel
+ * a fixed linear predictor (order 0..2) is chosen and the zigzag coded residuals are
+ * packed with the smallest bit width that fits all residuals of the block.
+ * Every chunk can be decoded independently.
+ */
+class BitpackEncoder : public Encoder
+{
+public:
+    BitpackEncoder(const std::string& codecOptions = "");
+    void encode(const msg::PcmChunk& chunk) override;
+    std::string getAvailableOptions() const override;
+    std::string getDefaultOptions() const override;
+    std::string name() const override;
+
+protected:
+    void initEncoder() override;
+
+    template <typename T>
+    void encodeBlocks(const T* samples, uint32_t frames, msg::PcmChunk& out);
+
+    uint16_t block_size_;
+    std::vector<uint64_t> residuals_;
+};
+
+} // namespace encoder
+
+#endif
@@ -19,9 +19,11 @@
 #ifndef ENCODER_HPP
 #define ENCODER_HPP
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "common/sample_format.hpp"
 #include "message/codec_header.hpp"
@@ -30,6 +32,22 @@
 namespace encoder
 {
 
+/// Encoded chunk with alternative encodings of the same audio
+/**
+ * The renditions are decodable with the same codec header and can be sent instead
+ * of the chunk, e.g. lower bitrates for clients on congested links.
+ */
+class RenditionChunk : public msg::PcmChunk
+{
+public:
+    RenditionChunk(const SampleFormat& sampleFormat, uint32_t ms) : msg::PcmChunk(sampleFormat, ms)
+    {
+    }
+
+    /// alternative encodings, ordered by decreasing bitrate
+    std::vector<std::shared_ptr<msg::PcmChunk>> renditions;
+};
+
 /// Abstract Encoder class
 /**
  * Stream encoder. PCM chunks are fed into the encoder.
@@ -72,6 +90,12 @@ public:
         return "";
     }
 
+    /// Max. duration of the audio that the encoder holds back before passing it to the callback
+    virtual std::chrono::nanoseconds getLatency() const
+    {
+        return std::chrono::nanoseconds(0);
+    }
+
     /// Header information needed to decode the data
     virtual std::shared_ptr<msg::CodecHeader> getHeader() const
     {
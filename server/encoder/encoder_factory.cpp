@@ -17,6 +17,7 @@
 ***/
 
 #include "encoder_factory.hpp"
+#include "bitpack_encoder.hpp"
 #include "null_encoder.hpp"
 #include "pcm_encoder.hpp"
 #if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBIS_ENC)
@@ -51,6 +52,8 @@ std::unique_ptr<Encoder> EncoderFactory::createEncoder(const std::string& codecS
         return std::make_unique<PcmEncoder>(codecOptions);
     else if (codec == "null")
         return std::make_unique<NullEncoder>(codecOptions);
+    else if (codec == "bitpack")
+        return std::make_unique<BitpackEncoder>(codecOptions);
 #if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBIS_ENC)
     else if (codec == "ogg")
         return std::make_unique<OggEncoder>(codecOptions);
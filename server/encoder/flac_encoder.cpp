@@ -21,6 +21,7 @@
 #include "common/aixlog.hpp"
 #include "common/snap_exception.hpp"
 #include "common/str_compat.hpp"
+#include "common/utils/string_utils.hpp"
 #include "flac_encoder.hpp"
 
 using namespace std;
@@ -30,7 +31,175 @@ namespace encoder
 
 static constexpr auto LOG_TAG = "FlacEnc";
 
-FlacEncoder::FlacEncoder(const std::string& codecOptions) : Encoder(codecOptions), encoder_(nullptr), pcmBufferSize_(0), encodedSamples_(0), flacChunk_(nullptr)
+/// max number of frames in flight per worker thread
+static constexpr size_t max_frames_per_worker = 2;
+
+namespace
+{
+
+uint8_t crc8(const FLAC__byte* data, size_t len)
+{
+    uint8_t crc = 0;
+    for (size_t n = 0; n < len; ++n)
+    {
+        crc ^= data[n];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1));
+    }
+    return crc;
+}
+
+
+uint16_t crc16(const FLAC__byte* data, size_t len)
+{
+    static const auto table = []() {
+        std::vector<uint16_t> table(256);
+        for (uint16_t n = 0; n < 256; ++n)
+        {
+            uint16_t crc = static_cast<uint16_t>(n << 8);
+            for (int bit = 0; bit < 8; ++bit)
+                crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1));
+            table[n] = crc;
+        }
+        return table;
+    }();
+
+    uint16_t crc = 0;
+    for (size_t n = 0; n < len; ++n)
+        crc = static_cast<uint16_t>((crc << 8) ^ table[(crc >> 8) ^ data[n]]);
+    return crc;
+}
+
+
+/// Replace the frame number in a FLAC frame and update header CRC-8 and frame CRC-16
+std::vector<FLAC__byte> setFrameNumber(const std::vector<FLAC__byte>& frame, uint64_t frame_number)
+{
+    // header: 4 bytes sync/blocksize/rate/channels, UTF-8 like coded frame number,
+    // optional 1 or 2 bytes block size, optional 1 or 2 bytes sample rate, CRC-8
+    if (frame.size() < 8)
+        throw SnapException("FLAC frame too small");
+    size_t num_len = 1;
+    for (FLAC__byte mask = 0x80; (frame[4] & mask) != 0; mask >>= 1)
+        ++num_len;
+    if (num_len > 1)
+        --num_len;
+    size_t extra = 0;
+    uint8_t block_code = frame[2] >> 4;
+    uint8_t rate_code = frame[2] & 0x0f;
+    if (block_code == 6)
+        extra += 1;
+    else if (block_code == 7)
+        extra += 2;
+    if (rate_code == 12)
+        extra += 1;
+    else if ((rate_code == 13) || (rate_code == 14))
+        extra += 2;
+    size_t header_end = 4 + num_len + extra; // position of the CRC-8
+    if (frame.size() < header_end + 3)
+        throw SnapException("Invalid FLAC frame");
+
+    std::vector<FLAC__byte> result;
+    result.reserve(frame.size() + 6);
+    result.insert(result.end(), frame.begin(), frame.begin() + 4);
+
+    // fixed blocksize streams use 31 bit frame numbers
+    frame_number &= 0x7fffffff;
+    if (frame_number < 0x80)
+    {
+        result.push_back(static_cast<FLAC__byte>(frame_number));
+    }
+    else
+    {
+        size_t bytes = 2;
+        while ((bytes < 6) && (frame_number >= (uint64_t(1) << (5 * bytes + 1))))
+            ++bytes;
+        result.push_back(static_cast<FLAC__byte>((0xff00 >> bytes) | (frame_number >> (6 * (bytes - 1)))));
+        for (size_t n = bytes - 1; n > 0; --n)
+            result.push_back(static_cast<FLAC__byte>(0x80 | ((frame_number >> (6 * (n - 1))) & 0x3f)));
+    }
+
+    result.insert(result.end(), frame.begin() + 4 + num_len, frame.begin() + header_end);
+    result.push_back(crc8(result.data(), result.size()));
+    result.insert(result.end(), frame.begin() + header_end + 1, frame.end() - 2);
+    uint16_t crc = crc16(result.data(), result.size());
+    result.push_back(static_cast<FLAC__byte>(crc >> 8));
+    result.push_back(static_cast<FLAC__byte>(crc & 0xff));
+    return result;
+}
+
+} // namespace
+
+
+namespace callback
+{
+FLAC__StreamEncoderWriteStatus frame_write_callback(const FLAC__StreamEncoder* /*encoder*/, const FLAC__byte buffer[], size_t bytes, unsigned samples,
+                                                    unsigned /*current_frame*/, void* client_data)
+{
+    // skip the stream header, only the encoded frame is needed
+    if (samples == 0)
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+    auto* frame = static_cast<std::vector<FLAC__byte>*>(client_data);
+    frame->insert(frame->end(), buffer, buffer + bytes);
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+} // namespace callback
+
+
+FlacFrameWorker::FlacFrameWorker(std::function<void(FLAC__StreamEncoder*)> configure) : configure_(std::move(configure))
+{
+    if ((encoder_ = FLAC__stream_encoder_new()) == nullptr)
+        throw SnapException("error allocating encoder");
+
+    thread_ = std::thread([this]() {
+        while (true)
+        {
+            auto job = jobs_.pop();
+            if (!job)
+                break;
+            job();
+        }
+    });
+}
+
+
+FlacFrameWorker::~FlacFrameWorker()
+{
+    jobs_.push(nullptr);
+    thread_.join();
+    FLAC__stream_encoder_delete(encoder_);
+}
+
+
+std::future<std::vector<FLAC__byte>> FlacFrameWorker::encode(std::vector<FLAC__int32> samples, uint32_t frames, uint64_t frame_number)
+{
+    auto task = std::make_shared<std::packaged_task<std::vector<FLAC__byte>()>>(
+        [this, samples = std::move(samples), frames, frame_number]() { return encodeFrame(samples, frames, frame_number); });
+    auto result = task->get_future();
+    jobs_.push([task]() { (*task)(); });
+    return result;
+}
+
+
+std::vector<FLAC__byte> FlacFrameWorker::encodeFrame(const std::vector<FLAC__int32>& samples, uint32_t frames, uint64_t frame_number)
+{
+    // libFLAC holds back the last block until more samples arrive or the encoder is finished,
+    // so every frame is encoded by a freshly initialized encoder. finish() resets the settings.
+    frame_.clear();
+    configure_(encoder_);
+    auto init_status = FLAC__stream_encoder_init_stream(encoder_, callback::frame_write_callback, nullptr, nullptr, nullptr, &frame_);
+    if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+        throw SnapException("ERROR: initializing encoder: " + string(FLAC__StreamEncoderInitStatusString[init_status]));
+    bool ok = (FLAC__stream_encoder_process_interleaved(encoder_, samples.data(), frames) != 0);
+    ok &= (FLAC__stream_encoder_finish(encoder_) != 0);
+    if (!ok)
+        throw SnapException("Failed to encode FLAC frame");
+    return setFrameNumber(frame_, frame_number);
+}
+
+
+FlacEncoder::FlacEncoder(const std::string& codecOptions)
+    : Encoder(codecOptions), encoder_(nullptr), pcmBufferSize_(0), encodedSamples_(0), flacChunk_(nullptr), compression_level_(2), block_size_(0),
+      frame_number_(0)
 {
     headerChunk_.reset(new msg::CodecHeader("flac"));
     pcmBuffer_ = static_cast<FLAC__int32*>(malloc(pcmBufferSize_ * sizeof(FLAC__int32)));
@@ -39,6 +208,7 @@ FlacEncoder::FlacEncoder(const std::string& codecOptions) : Encoder(codecOptions
 
 FlacEncoder::~FlacEncoder()
 {
+    workers_.clear();
     if (encoder_ != nullptr)
     {
         FLAC__stream_encoder_finish(encoder_);
@@ -53,7 +223,7 @@ FlacEncoder::~FlacEncoder()
 
 std::string FlacEncoder::getAvailableOptions() const
 {
-    return "compression level: [0..8]";
+    return "compression level: [0..8][,THREADS:[1..16]]";
 }
 
 
@@ -69,14 +239,18 @@ std::string FlacEncoder::name() const
 }
 
 
-void FlacEncoder::encode(const msg::PcmChunk& chunk)
+std::chrono::nanoseconds FlacEncoder::getLatency() const
 {
-    if (flacChunk_ == nullptr)
-        flacChunk_ = make_shared<msg::PcmChunk>(chunk.format, 0);
+    // libFLAC encodes a block as soon as one more sample is available, the workers hold frames in flight
+    uint64_t frames = workers_.empty() ? block_size_ + 1 : block_size_ * (workers_.size() * max_frames_per_worker + 1);
+    return std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(frames * 1000000000 / sampleFormat_.rate()));
+}
+
 
+int FlacEncoder::toFlacSamples(const msg::PcmChunk& chunk)
+{
     int samples = chunk.getSampleCount();
-    int frames = chunk.getFrameCount();
-    // LOG(TRACE, LOG_TAG) << "payload: " << chunk.payloadSize << "\tframes: " << frames << "\tsamples: " << samples
+    // LOG(TRACE, LOG_TAG) << "payload: " << chunk.payloadSize << "\tframes: " << chunk.getFrameCount() << "\tsamples: " << samples
     //                     << "\tduration: " << chunk.duration<chronos::msec>().count() << ", format: " << chunk.format.toString() << "\n";
 
     if (pcmBufferSize_ < samples)
@@ -119,9 +293,61 @@ void FlacEncoder::encode(const msg::PcmChunk& chunk)
                 pcmBuffer_[i] = buffer[i];
         }
     }
+    return samples;
+}
 
 
-    FLAC__stream_encoder_process_interleaved(encoder_, pcmBuffer_, frames);
+void FlacEncoder::encodeParallel(int samples)
+{
+    pending_.insert(pending_.end(), pcmBuffer_, pcmBuffer_ + samples);
+
+    // hand complete blocks round robin to the workers
+    const size_t block_samples = static_cast<size_t>(block_size_) * sampleFormat_.channels();
+    size_t offset = 0;
+    while (pending_.size() - offset >= block_samples)
+    {
+        std::vector<FLAC__int32> block(pending_.begin() + offset, pending_.begin() + offset + block_samples);
+        auto& worker = workers_[frame_number_ % workers_.size()];
+        frames_.push_back(worker->encode(std::move(block), block_size_, frame_number_));
+        ++frame_number_;
+        offset += block_samples;
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + offset);
+
+    // collect finished frames in stream order, block if the workers fall behind
+    while (!frames_.empty())
+    {
+        auto& front = frames_.front();
+        if ((frames_.size() <= workers_.size() * max_frames_per_worker) && (front.wait_for(std::chrono::seconds(0)) != std::future_status::ready))
+            break;
+        try
+        {
+            auto frame = front.get();
+            flacChunk_->payload = static_cast<char*>(realloc(flacChunk_->payload, flacChunk_->payloadSize + frame.size()));
+            memcpy(flacChunk_->payload + flacChunk_->payloadSize, frame.data(), frame.size());
+            flacChunk_->payloadSize += static_cast<uint32_t>(frame.size());
+            encodedSamples_ += block_size_;
+        }
+        catch (const std::exception& e)
+        {
+            // the frame is dropped and not counted, so that the chunk's duration matches its payload
+            LOG(ERROR, LOG_TAG) << "Failed to encode frame, dropping " << block_size_ << " samples: " << e.what() << "\n";
+        }
+        frames_.pop_front();
+    }
+}
+
+
+void FlacEncoder::encode(const msg::PcmChunk& chunk)
+{
+    if (flacChunk_ == nullptr)
+        flacChunk_ = make_shared<msg::PcmChunk>(chunk.format, 0);
+
+    int samples = toFlacSamples(chunk);
+    if (workers_.empty())
+        FLAC__stream_encoder_process_interleaved(encoder_, pcmBuffer_, chunk.getFrameCount());
+    else
+        encodeParallel(samples);
 
     if (encodedSamples_ > 0)
     {
@@ -164,23 +390,59 @@ FLAC__StreamEncoderWriteStatus write_callback(const FLAC__StreamEncoder* encoder
 }
 } // namespace callback
 
+
+void FlacEncoder::configure(FLAC__StreamEncoder* encoder, bool verify) const
+{
+    FLAC__bool ok = 1;
+    ok &= FLAC__stream_encoder_set_verify(encoder, verify ? 1 : 0);
+    // compression levels (0-8):
+    // https://xiph.org/flac/api/group__flac__stream__encoder.html#gae49cf32f5256cb47eecd33779493ac85
+    // latency:
+    // 0-2: 1152 frames, ~26.1224ms
+    // 3-8: 4096 frames, ~92.8798ms
+    ok &= FLAC__stream_encoder_set_compression_level(encoder, compression_level_);
+    ok &= FLAC__stream_encoder_set_blocksize(encoder, block_size_);
+    ok &= FLAC__stream_encoder_set_channels(encoder, sampleFormat_.channels());
+    ok &= FLAC__stream_encoder_set_bits_per_sample(encoder, sampleFormat_.bits());
+    ok &= FLAC__stream_encoder_set_sample_rate(encoder, sampleFormat_.rate());
+
+    if (ok == 0)
+        throw SnapException("error setting up encoder");
+}
+
+
 void FlacEncoder::initEncoder()
 {
-    int compression_level(2);
+    size_t threads = 1;
+    auto options = utils::string::split(codecOptions_, ',');
     try
     {
-        compression_level = cpt::stoi(codecOptions_);
+        compression_level_ = cpt::stoi(options.front());
+        for (size_t n = 1; n < options.size(); ++n)
+        {
+            auto kv = utils::string::split(options[n], ':');
+            if ((kv.size() == 2) && (kv.front() == "THREADS"))
+                threads = cpt::stoul(kv.back());
+            else
+                throw SnapException("unknown option");
+        }
     }
     catch (...)
     {
         throw SnapException("Invalid codec option: \"" + codecOptions_ + "\"");
     }
-    if ((compression_level < 0) || (compression_level > 8))
+    if ((compression_level_ < 0) || (compression_level_ > 8))
     {
         throw SnapException("compression level has to be between 0 and 8");
     }
+    if ((threads < 1) || (threads > 16))
+    {
+        throw SnapException("threads has to be between 1 and 16");
+    }
+    // libFLAC's default block size for the compression level
+    block_size_ = (compression_level_ <= 2) ? 1152 : 4096;
 
-    LOG(INFO, LOG_TAG) << "Init - compression level: " << compression_level << "\n";
+    LOG(INFO, LOG_TAG) << "Init - compression level: " << compression_level_ << ", threads: " << threads << "\n";
 
     FLAC__bool ok = 1;
     FLAC__StreamEncoderInitStatus init_status;
@@ -190,19 +452,7 @@ void FlacEncoder::initEncoder()
     if ((encoder_ = FLAC__stream_encoder_new()) == nullptr)
         throw SnapException("error allocating encoder");
 
-    ok &= FLAC__stream_encoder_set_verify(encoder_, 1);
-    // compression levels (0-8):
-    // https://xiph.org/flac/api/group__flac__stream__encoder.html#gae49cf32f5256cb47eecd33779493ac85
-    // latency:
-    // 0-2: 1152 frames, ~26.1224ms
-    // 3-8: 4096 frames, ~92.8798ms
-    ok &= FLAC__stream_encoder_set_compression_level(encoder_, compression_level);
-    ok &= FLAC__stream_encoder_set_channels(encoder_, sampleFormat_.channels());
-    ok &= FLAC__stream_encoder_set_bits_per_sample(encoder_, sampleFormat_.bits());
-    ok &= FLAC__stream_encoder_set_sample_rate(encoder_, sampleFormat_.rate());
-
-    if (ok == 0)
-        throw SnapException("error setting up encoder");
+    configure(encoder_, true);
 
     // now add some metadata; we'll add some tags and a padding block
     if ((metadata_[0] = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT)) == nullptr ||
@@ -223,6 +473,14 @@ void FlacEncoder::initEncoder()
     init_status = FLAC__stream_encoder_init_stream(encoder_, callback::write_callback, nullptr, nullptr, nullptr, this);
     if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
         throw SnapException("ERROR: initializing encoder: " + string(FLAC__StreamEncoderInitStatusString[init_status]));
+
+    // With more than one thread, the stream encoder above is only used for the stream header.
+    // Frames are independent and are encoded concurrently, without verification.
+    if (threads > 1)
+    {
+        for (size_t n = 0; n < threads; ++n)
+            workers_.push_back(std::make_unique<FlacFrameWorker>([this](FLAC__StreamEncoder* encoder) { configure(encoder, false); }));
+    }
 }
 
 } // namespace encoder
@@ -18,10 +18,16 @@
 
 #ifndef FLAC_ENCODER_HPP
 #define FLAC_ENCODER_HPP
+#include "common/queue.h"
 #include "encoder.hpp"
+#include <deque>
+#include <functional>
+#include <future>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <thread>
+#include <vector>
 
 #include "FLAC/metadata.h"
 #include "FLAC/stream_encoder.h"
@@ -29,6 +35,31 @@
 namespace encoder
 {
 
+/// Encodes FLAC frames on a dedicated thread
+/**
+ * Every frame is encoded by a private libFLAC encoder instance, that is re-initialized per frame.
+ * The frame number in the frame header is patched to the position in the stream.
+ */
+class FlacFrameWorker
+{
+public:
+    FlacFrameWorker(std::function<void(FLAC__StreamEncoder*)> configure);
+    ~FlacFrameWorker();
+
+    /// encode @p frames interleaved frames as FLAC frame number @p frame_number
+    std::future<std::vector<FLAC__byte>> encode(std::vector<FLAC__int32> samples, uint32_t frames, uint64_t frame_number);
+
+private:
+    std::vector<FLAC__byte> encodeFrame(const std::vector<FLAC__int32>& samples, uint32_t frames, uint64_t frame_number);
+
+    std::function<void(FLAC__StreamEncoder*)> configure_;
+    FLAC__StreamEncoder* encoder_;
+    std::vector<FLAC__byte> frame_;
+    Queue<std::function<void()>> jobs_;
+    std::thread thread_;
+};
+
+
 class FlacEncoder : public Encoder
 {
 public:
@@ -38,12 +69,19 @@ public:
     std::string getAvailableOptions() const override;
     std::string getDefaultOptions() const override;
     std::string name() const override;
+    std::chrono::nanoseconds getLatency() const override;
 
     FLAC__StreamEncoderWriteStatus write_callback(const FLAC__StreamEncoder* encoder, const FLAC__byte buffer[], size_t bytes, unsigned samples,
                                                   unsigned current_frame);
 
 protected:
     void initEncoder() override;
+    /// apply the encoder settings, shared by the stream encoder and the frame workers
+    void configure(FLAC__StreamEncoder* encoder, bool verify) const;
+    /// convert the chunk's samples to FLAC__int32 into pcmBuffer_
+    int toFlacSamples(const msg::PcmChunk& chunk);
+    /// dispatch complete blocks to the frame workers and collect finished frames in order
+    void encodeParallel(int samples);
 
     FLAC__StreamEncoder* encoder_;
     FLAC__StreamMetadata* metadata_[2];
@@ -53,6 +91,13 @@ protected:
 
     size_t encodedSamples_;
     std::shared_ptr<msg::PcmChunk> flacChunk_;
+
+    int compression_level_;
+    uint32_t block_size_;
+    std::vector<std::unique_ptr<FlacFrameWorker>> workers_;
+    std::vector<FLAC__int32> pending_;
+    std::deque<std::future<std::vector<FLAC__byte>>> frames_;
+    uint64_t frame_number_;
 };
 
 } // namespace encoder
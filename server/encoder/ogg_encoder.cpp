@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 
@@ -66,6 +67,15 @@ std::string OggEncoder::name() const
 }
 
 
+std::chrono::nanoseconds OggEncoder::getLatency() const
+{
+    // vorbis holds back the current long block and needs the next one for the overlap
+    long blocksize = vorbis_info_blocksize(const_cast<vorbis_info*>(&vi_), 1);
+    uint64_t frames = 2 * static_cast<uint64_t>(std::max(blocksize, 0L));
+    return std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(frames * 1000000000 / sampleFormat_.rate()));
+}
+
+
 void OggEncoder::encode(const msg::PcmChunk& chunk)
 {
     double res = 0;
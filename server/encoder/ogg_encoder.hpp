@@ -35,6 +35,7 @@ public:
     std::string getAvailableOptions() const override;
     std::string getDefaultOptions() const override;
     std::string name() const override;
+    std::chrono::nanoseconds getLatency() const override;
 
 protected:
     void initEncoder() override;
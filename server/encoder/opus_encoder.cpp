@@ -56,12 +56,15 @@ OpusEncoder::~OpusEncoder()
 {
     if (enc_ != nullptr)
         opus_encoder_destroy(enc_);
+    for (auto* enc : renditions_)
+        opus_encoder_destroy(enc);
 }
 
 
 std::string OpusEncoder::getAvailableOptions() const
 {
-    return "BITRATE:[" + cpt::to_string(const_min_bitrate) + " - " + cpt::to_string(const_max_bitrate) + "|MAX|AUTO],COMPLEXITY:[1-10]";
+    return "BITRATE:[" + cpt::to_string(const_min_bitrate) + " - " + cpt::to_string(const_max_bitrate) +
+           "|MAX|AUTO],COMPLEXITY:[1-10],RENDITIONS:[<bitrate>[|<bitrate>]*] (lower bitrates for congested clients)";
 }
 
 
@@ -77,6 +80,17 @@ std::string OpusEncoder::name() const
 }
 
 
+std::chrono::nanoseconds OpusEncoder::getLatency() const
+{
+    // the remainder buffer, plus the codec's lookahead
+    opus_int32 lookahead = 0;
+    if (enc_ != nullptr)
+        opus_encoder_ctl(enc_, OPUS_GET_LOOKAHEAD(&lookahead));
+    uint64_t frames = remainder_max_size_ / sampleFormat_.frameSize() + static_cast<uint64_t>(std::max(lookahead, 0));
+    return std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(frames * 1000000000 / sampleFormat_.rate()));
+}
+
+
 void OpusEncoder::initEncoder()
 {
     // Opus is quite restrictive in sample rate and bit depth
@@ -94,8 +108,28 @@ void OpusEncoder::initEncoder()
 
     opus_int32 bitrate = 192000;
     opus_int32 complexity = 10;
+    std::vector<opus_int32> rendition_bitrates;
+
+    auto parse_bitrate = [](const std::string& value) -> opus_int32 {
+        if (value == "MAX")
+            return OPUS_BITRATE_MAX;
+        else if (value == "AUTO")
+            return OPUS_AUTO;
+        try
+        {
+            opus_int32 bitrate = cpt::stoi(value);
+            if ((bitrate < const_min_bitrate) || (bitrate > const_max_bitrate))
+                throw SnapException("Opus bitrate must be between " + cpt::to_string(const_min_bitrate) + " and " + cpt::to_string(const_max_bitrate));
+            return bitrate;
+        }
+        catch (const std::invalid_argument&)
+        {
+            throw SnapException("Opus error parsing bitrate (must be between " + cpt::to_string(const_min_bitrate) + " and " +
+                                cpt::to_string(const_max_bitrate) + "): " + value);
+        }
+    };
 
-    // parse options: bitrate and complexity
+    // parse options: bitrate, complexity and renditions
     auto options = utils::string::split(codecOptions_, ',');
     for (const auto& option : options)
     {
@@ -104,25 +138,12 @@ void OpusEncoder::initEncoder()
         {
             if (kv.front() == "BITRATE")
             {
-                if (kv.back() == "MAX")
-                    bitrate = OPUS_BITRATE_MAX;
-                else if (kv.back() == "AUTO")
-                    bitrate = OPUS_AUTO;
-                else
-                {
-                    try
-                    {
-                        bitrate = cpt::stoi(kv.back());
-                        if ((bitrate < const_min_bitrate) || (bitrate > const_max_bitrate))
-                            throw SnapException("Opus bitrate must be between " + cpt::to_string(const_min_bitrate) + " and " +
-                                                cpt::to_string(const_max_bitrate));
-                    }
-                    catch (const std::invalid_argument&)
-                    {
-                        throw SnapException("Opus error parsing bitrate (must be between " + cpt::to_string(const_min_bitrate) + " and " +
-                                            cpt::to_string(const_max_bitrate) + "): " + kv.back());
-                    }
-                }
+                bitrate = parse_bitrate(kv.back());
+            }
+            else if (kv.front() == "RENDITIONS")
+            {
+                for (const auto& value : utils::string::split(kv.back(), '|'))
+                    rendition_bitrates.push_back(parse_bitrate(value));
             }
             else if (kv.front() == "COMPLEXITY")
             {
@@ -144,17 +165,27 @@ void OpusEncoder::initEncoder()
             throw SnapException("Opus error parsing options: " + codecOptions_);
     }
 
-    LOG(INFO, LOG_TAG) << "Init - bitrate: " << bitrate << " bps, complexity: " << complexity << "\n";
+    LOG(INFO, LOG_TAG) << "Init - bitrate: " << bitrate << " bps, complexity: " << complexity << ", renditions: " << rendition_bitrates.size() << "\n";
 
-    int error;
-    enc_ = opus_encoder_create(sampleFormat_.rate(), sampleFormat_.channels(), OPUS_APPLICATION_RESTRICTED_LOWDELAY, &error);
-    if (error != 0)
-    {
-        throw SnapException("Failed to initialize Opus encoder: " + std::string(opus_strerror(error)));
-    }
+    auto create_encoder = [this, complexity, &rendition_bitrates](opus_int32 bitrate) {
+        int error;
+        auto* enc = opus_encoder_create(sampleFormat_.rate(), sampleFormat_.channels(), OPUS_APPLICATION_RESTRICTED_LOWDELAY, &error);
+        if (error != 0)
+        {
+            throw SnapException("Failed to initialize Opus encoder: " + std::string(opus_strerror(error)));
+        }
+
+        opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate));
+        opus_encoder_ctl(enc, OPUS_SET_COMPLEXITY(complexity));
+        // Switching between encoders must not depend on the previous frame's state
+        if (!rendition_bitrates.empty())
+            opus_encoder_ctl(enc, OPUS_SET_PREDICTION_DISABLED(1));
+        return enc;
+    };
 
-    opus_encoder_ctl(enc_, OPUS_SET_BITRATE(bitrate));
-    opus_encoder_ctl(enc_, OPUS_SET_COMPLEXITY(complexity));
+    enc_ = create_encoder(bitrate);
+    for (auto rendition_bitrate : rendition_bitrates)
+        renditions_.push_back(create_encoder(rendition_bitrate));
 
     // create some opus pseudo header to let the decoder know about the sample format
     headerChunk_->payloadSize = 12;
@@ -235,6 +266,23 @@ void OpusEncoder::encode(const msg::PcmChunk& chunk)
 
 
 void OpusEncoder::encode(const SampleFormat& format, const char* data, size_t size)
+{
+    int samples_per_channel = size / format.frameSize();
+    auto opusChunk = encodeFrame(enc_, format, data, size);
+    if (!opusChunk)
+        return;
+
+    // a rendition that failed to encode is replaced by the full bitrate chunk
+    for (auto* enc : renditions_)
+    {
+        auto rendition = encodeFrame(enc, format, data, size);
+        std::static_pointer_cast<RenditionChunk>(opusChunk)->renditions.push_back(rendition ? rendition : opusChunk);
+    }
+    encoded_callback_(*this, opusChunk, static_cast<double>(samples_per_channel) / sampleFormat_.msRate());
+}
+
+
+std::shared_ptr<msg::PcmChunk> OpusEncoder::encodeFrame(::OpusEncoder* enc, const SampleFormat& format, const char* data, size_t size)
 {
     // void* buffer;
     // LOG(INFO, LOG_TAG) << "frames: " << chunk->readFrames(buffer, std::chrono::milliseconds(10)) << "\n";
@@ -242,23 +290,26 @@ void OpusEncoder::encode(const SampleFormat& format, const char* data, size_t si
     if (encoded_.size() < size)
         encoded_.resize(size);
 
-    opus_int32 len = opus_encode(enc_, (opus_int16*)data, samples_per_channel, encoded_.data(), size);
+    opus_int32 len = opus_encode(enc, (opus_int16*)data, samples_per_channel, encoded_.data(), size);
     LOG(TRACE, LOG_TAG) << "Encode " << samples_per_channel << " frames, size " << size << " bytes, encoded: " << len << " bytes" << '\n';
 
     if (len > 0)
     {
         // copy encoded data to chunk
-        auto opusChunk = make_shared<msg::PcmChunk>(format, 0);
+        std::shared_ptr<msg::PcmChunk> opusChunk;
+        if (!renditions_.empty() && (enc == enc_))
+            opusChunk = make_shared<RenditionChunk>(format, 0);
+        else
+            opusChunk = make_shared<msg::PcmChunk>(format, 0);
         opusChunk->payloadSize = len;
         opusChunk->payload = static_cast<char*>(realloc(opusChunk->payload, opusChunk->payloadSize));
         memcpy(opusChunk->payload, encoded_.data(), len);
-        encoded_callback_(*this, opusChunk, static_cast<double>(samples_per_channel) / sampleFormat_.msRate());
-    }
-    else
-    {
-        LOG(ERROR, LOG_TAG) << "Failed to encode chunk: " << opus_strerror(len) << ", samples / channel: " << samples_per_channel << ", bytes:  " << size
-                            << '\n';
+        return opusChunk;
     }
+
+    LOG(ERROR, LOG_TAG) << "Failed to encode chunk: " << opus_strerror(len) << ", samples / channel: " << samples_per_channel << ", bytes:  " << size
+                        << '\n';
+    return nullptr;
 }
 
 } // namespace encoder
@@ -37,11 +37,17 @@ public:
     std::string getAvailableOptions() const override;
     std::string getDefaultOptions() const override;
     std::string name() const override;
+    std::chrono::nanoseconds getLatency() const override;
 
 protected:
     void encode(const SampleFormat& format, const char* data, size_t size);
     void initEncoder() override;
+    /// encode a frame with @p enc, returns nullptr on failure
+    std::shared_ptr<msg::PcmChunk> encodeFrame(::OpusEncoder* enc, const SampleFormat& format, const char* data, size_t size);
+
     ::OpusEncoder* enc_;
+    /// lower bitrate encoders for congested clients
+    std::vector<::OpusEncoder*> renditions_;
     std::vector<unsigned char> encoded_;
     std::unique_ptr<msg::PcmChunk> remainder_;
     size_t remainder_max_size_;
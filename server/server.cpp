@@ -20,10 +20,13 @@
 #include "common/aixlog.hpp"
 #include "config.hpp"
 #include "message/client_info.hpp"
+#include "message/client_stats.hpp"
 #include "message/hello.hpp"
 #include "message/stream_tags.hpp"
 #include "message/time.hpp"
 #include "stream_session_tcp.hpp"
+#include <algorithm>
+#include <functional>
 #include <iostream>
 
 using namespace std;
@@ -32,6 +35,8 @@ using namespace streamreader;
 using json = nlohmann::json;
 
 static constexpr auto LOG_TAG = "Server";
+/// Interval for the clients to report their sync and performance statistics
+static constexpr std::chrono::milliseconds kClientStatsInterval = std::chrono::seconds(10);
 
 Server::Server(boost::asio::io_context& io_context, const ServerSettings& serverSettings)
     : io_context_(io_context), config_timer_(io_context), settings_(serverSettings)
@@ -94,6 +99,12 @@ void Server::onChunkEncoded(const PcmStream* pcmStream, std::shared_ptr<msg::Pcm
 }
 
 
+void Server::onSilence(const PcmStream* pcmStream, std::shared_ptr<msg::Silence> silence)
+{
+    streamServer_->onSilence(pcmStream, pcmStream == streamManager_->getDefaultStream().get(), silence);
+}
+
+
 void Server::onResync(const PcmStream* pcmStream, double ms)
 {
     LOG(INFO, LOG_TAG) << "onResync (" << pcmStream->getName() << "): " << ms << " ms\n";
@@ -206,6 +217,7 @@ void Server::processRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::ent
                 {
                     auto serverSettings = make_shared<msg::ServerSettings>();
                     serverSettings->setBufferMs(settings_.stream.bufferMs);
+                    serverSettings->setTimeSyncPort(static_cast<uint16_t>(settings_.stream.timeSyncPort));
                     serverSettings->setVolume(clientInfo->config.volume.percent);
                     GroupPtr group = Config::instance().getGroupFromClient(clientInfo);
                     serverSettings->setMuted(clientInfo->config.volume.muted || group->muted);
@@ -257,6 +269,7 @@ void Server::processRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::ent
                     {
                         auto serverSettings = make_shared<msg::ServerSettings>();
                         serverSettings->setBufferMs(settings_.stream.bufferMs);
+                        serverSettings->setTimeSyncPort(static_cast<uint16_t>(settings_.stream.timeSyncPort));
                         serverSettings->setVolume(client->config.volume.percent);
                         GroupPtr group = Config::instance().getGroupFromClient(client);
                         serverSettings->setMuted(client->config.volume.muted || group->muted);
@@ -289,8 +302,7 @@ void Server::processRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::ent
                     if (session && (session->pcmStream() != stream))
                     {
                         session->send(stream->getMeta());
-                        session->send(stream->getHeader());
-                        session->setPcmStream(stream);
+                        streamServer_->startStream(*session, stream);
                     }
                 }
 
@@ -344,8 +356,7 @@ void Server::processRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::ent
                     if (session && stream && (session->pcmStream() != stream))
                     {
                         session->send(stream->getMeta());
-                        session->send(stream->getHeader());
-                        session->setPcmStream(stream);
+                        streamServer_->startStream(*session, stream);
                     }
                 }
 
@@ -382,6 +393,14 @@ void Server::processRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::ent
                 // clang-format on
                 result["server"] = Config::instance().getServerStatus(streamManager_->toJson());
             }
+            else if (request->method() == "Server.GetStats")
+            {
+                // clang-format off
+                // Request:      {"id":1,"jsonrpc":"2.0","method":"Server.GetStats"}
+                // Response:     {"id":1,"jsonrpc":"2.0","result":{"clients":[{"connected":true,"id":"00:21:6a:7d:74:fc","stats":{"correction":-12.5,"decodeTime":1834,"hardSyncs":1,"lastUpdate":{"sec":1488025696,"usec":611255},"period":10000,"queueDepth":982,"syncError":{"max":412,"p50":48,"p95":160,"p99":290,"peak":1210},"timeJitter":96,"timeToFirstAudio":105,"xruns":0}}],"summary":{"clients":1,"hardSyncs":1,"syncError":{"client":"00:21:6a:7d:74:fc","p99":290},"xruns":0}}}
+                // clang-format on
+                result = Config::instance().getStats();
+            }
             else if (request->method() == "Server.DeleteClient")
             {
                 // clang-format off
@@ -458,7 +477,10 @@ void Server::processRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::ent
 
                 // Find stream
                 string streamId = request->params().get("id");
+                PcmStreamPtr stream = streamManager_->getStream(streamId);
                 streamManager_->removeStream(streamId);
+                if (stream)
+                    streamServer_->removeStream(stream.get());
                 // Setup response
                 result["id"] = streamId;
             }
@@ -483,6 +505,65 @@ void Server::processRequest(const jsonrpcpp::request_ptr request, jsonrpcpp::ent
 }
 
 
+std::string Server::getMetrics()
+{
+    // label values must escape backslash, double quote and line feed
+    auto label = [](const std::string& value) {
+        std::string result;
+        for (char c : value)
+        {
+            if ((c == '\\') || (c == '"'))
+                result.push_back('\\');
+            if (c == '\n')
+                result.append("\\n");
+            else
+                result.push_back(c);
+        }
+        return result;
+    };
+
+    std::vector<ClientInfoPtr> clients;
+    for (const auto& group : Config::instance().groups)
+    {
+        for (const auto& client : group->clients)
+        {
+            if (client->connected && (client->stats.reports > 0))
+                clients.push_back(client);
+        }
+    }
+
+    std::stringstream ss;
+    auto metric = [&](const std::string& name, const std::string& type, const std::string& help, const std::function<double(const ClientStats&)>& value) {
+        ss << "# HELP " << name << " " << help << "\n";
+        ss << "# TYPE " << name << " " << type << "\n";
+        for (const auto& client : clients)
+            ss << name << "{client=\"" << label(client->id) << "\"} " << value(client->stats) << "\n";
+    };
+
+    ss << "# HELP snapclient_sync_error_seconds Absolute sync error of the played audio in the last report period\n";
+    ss << "# TYPE snapclient_sync_error_seconds gauge\n";
+    for (const auto& client : clients)
+    {
+        const ClientStats& stats = client->stats;
+        std::string id = label(client->id);
+        ss << "snapclient_sync_error_seconds{client=\"" << id << "\",quantile=\"0.5\"} " << stats.syncErrorP50 / 1000000. << "\n";
+        ss << "snapclient_sync_error_seconds{client=\"" << id << "\",quantile=\"0.95\"} " << stats.syncErrorP95 / 1000000. << "\n";
+        ss << "snapclient_sync_error_seconds{client=\"" << id << "\",quantile=\"0.99\"} " << stats.syncErrorP99 / 1000000. << "\n";
+        ss << "snapclient_sync_error_seconds{client=\"" << id << "\",quantile=\"1\"} " << stats.syncErrorMax / 1000000. << "\n";
+    }
+    metric("snapclient_hard_syncs_total", "counter", "Hard syncs (restarts of the playout)", [](const ClientStats& stats) { return stats.hardSyncs; });
+    metric("snapclient_correction_ppm", "gauge", "Playback speed correction, positive: playing faster", [](const ClientStats& stats) { return stats.correction; });
+    metric("snapclient_queue_depth_seconds", "gauge", "Buffered audio", [](const ClientStats& stats) { return stats.queueDepth / 1000.; });
+    metric("snapclient_xruns_total", "counter", "Buffer underruns of the audio device", [](const ClientStats& stats) { return stats.xruns; });
+    metric("snapclient_decode_load_ratio", "gauge", "Time spent decoding per report period",
+           [](const ClientStats& stats) { return (stats.period > 0) ? stats.decodeTime / (stats.period * 1000.) : 0.; });
+    metric("snapclient_time_jitter_seconds", "gauge", "Jitter of the time sync with the server", [](const ClientStats& stats) { return stats.timeJitter / 1000000.; });
+    metric("snapclient_time_to_first_audio_seconds", "gauge", "Time from the client's start until the first audio was audible",
+           [](const ClientStats& stats) { return stats.timeToFirstAudio / 1000.; });
+    return ss.str();
+}
+
+
 std::string Server::onMessageReceived(ControlSession* controlSession, const std::string& message)
 {
     // LOG(DEBUG, LOG_TAG) << "onMessageReceived: " << message << "\n";
@@ -565,6 +646,7 @@ void Server::onMessageReceived(StreamSession* streamSession, const msg::BaseMess
         timeMsg->latency = timeMsg->received - timeMsg->sent;
         // LOG(INFO, LOG_TAG) << "Latency sec: " << timeMsg.latency.sec << ", usec: " << timeMsg.latency.usec << ", refers to: " << timeMsg.refersTo << "\n";
         streamSession->send(timeMsg);
+        streamSession->onTimeLatency(chronos::usec(static_cast<chronos::usec::rep>(timeMsg->latency.sec) * 1000000 + timeMsg->latency.usec));
 
         // refresh streamSession state
         ClientInfoPtr client = Config::instance().getClientInfo(streamSession->clientId);
@@ -585,12 +667,48 @@ void Server::onMessageReceived(StreamSession* streamSession, const msg::BaseMess
         msg::ClientInfo infoMsg;
         infoMsg.deserialize(baseMessage, buffer);
 
+        if (infoMsg.getBufferLatency() != clientInfo->bufferLatency)
+        {
+            LOG(DEBUG, LOG_TAG) << "Client " << streamSession->clientId << " buffer latency: " << infoMsg.getBufferLatency() << " ms\n";
+            clientInfo->bufferLatency = infoMsg.getBufferLatency();
+        }
+        // ClientInfo is also sent for buffer latency changes, don't notify about unchanged volumes
+        if ((clientInfo->config.volume.percent == infoMsg.getVolume()) && (clientInfo->config.volume.muted == infoMsg.isMuted()))
+            return;
         clientInfo->config.volume.percent = infoMsg.getVolume();
         clientInfo->config.volume.muted = infoMsg.isMuted();
         jsonrpcpp::notification_ptr notification = make_shared<jsonrpcpp::Notification>(
             "Client.OnVolumeChanged", jsonrpcpp::Parameter("id", streamSession->clientId, "volume", clientInfo->config.volume.toJson()));
         controlServer_->send(notification->to_json().dump());
     }
+    else if (baseMessage.type == message_type::kClientStats)
+    {
+        ClientInfoPtr clientInfo = Config::instance().getClientInfo(streamSession->clientId);
+        if (clientInfo == nullptr)
+            return;
+        msg::ClientStats statsMsg;
+        statsMsg.deserialize(baseMessage, buffer);
+
+        ClientStats& stats = clientInfo->stats;
+        ++stats.reports;
+        chronos::systemtimeofday(&stats.lastUpdate);
+        stats.period = statsMsg.period;
+        stats.syncErrorP50 = statsMsg.sync_error_p50;
+        stats.syncErrorP95 = statsMsg.sync_error_p95;
+        stats.syncErrorP99 = statsMsg.sync_error_p99;
+        stats.syncErrorMax = statsMsg.sync_error_max;
+        stats.peakSyncError = std::max(stats.peakSyncError, statsMsg.sync_error_max);
+        stats.hardSyncs = statsMsg.hard_syncs;
+        stats.correction = statsMsg.correction / 1000.;
+        stats.queueDepth = statsMsg.queue_depth;
+        stats.xruns = statsMsg.xruns;
+        stats.decodeTime = statsMsg.decode_time;
+        stats.timeJitter = statsMsg.time_jitter;
+        stats.timeToFirstAudio = statsMsg.time_to_first_audio;
+        LOG(DEBUG, LOG_TAG) << "Stats from " << streamSession->clientId << ", sync error p50: " << stats.syncErrorP50 << " us, p99: " << stats.syncErrorP99
+                            << " us, max: " << stats.syncErrorMax << " us, hard syncs: " << stats.hardSyncs << ", correction: " << stats.correction
+                            << " ppm, queued: " << stats.queueDepth << " ms, xruns: " << stats.xruns << "\n";
+    }
     else if (baseMessage.type == message_type::kHello)
     {
         msg::Hello helloMsg;
@@ -616,6 +734,8 @@ void Server::onMessageReceived(StreamSession* streamSession, const msg::BaseMess
         serverSettings->setMuted(client->config.volume.muted || group->muted);
         serverSettings->setLatency(client->config.latency);
         serverSettings->setBufferMs(settings_.stream.bufferMs);
+        serverSettings->setTimeSyncPort(static_cast<uint16_t>(settings_.stream.timeSyncPort));
+        serverSettings->setStatsInterval(static_cast<int32_t>(kClientStatsInterval.count()));
         serverSettings->refersTo = helloMsg.id;
         streamSession->send(serverSettings);
 
@@ -629,6 +749,7 @@ void Server::onMessageReceived(StreamSession* streamSession, const msg::BaseMess
         client->snapclient.protocolVersion = helloMsg.getProtocolVersion();
         client->config.instance = helloMsg.getInstance();
         client->connected = true;
+        client->stats = ClientStats();
         chronos::systemtimeofday(&client->lastSeen);
 
         // Assign and update stream
@@ -644,10 +765,8 @@ void Server::onMessageReceived(StreamSession* streamSession, const msg::BaseMess
 
         LOG(DEBUG, LOG_TAG) << "Sending meta data to " << streamSession->clientId << "\n";
         streamSession->send(stream->getMeta());
-        streamSession->setPcmStream(stream);
-        auto headerChunk = stream->getHeader();
         LOG(DEBUG, LOG_TAG) << "Sending codec header to " << streamSession->clientId << "\n";
-        streamSession->send(headerChunk);
+        streamServer_->startStream(*streamSession, stream);
 
         if (newGroup)
         {
@@ -720,6 +839,16 @@ void Server::start()
         streamManager_->start();
         controlServer_->start();
         streamServer_->start();
+
+        if (settings_.stream.timeSyncPort != 0)
+        {
+            // time requests on the UDP port feed the congestion monitor of the client's stream session
+            auto latency_handler = [this](const boost::asio::ip::address& address, const chronos::usec& latency) {
+                streamServer_->onTimeLatency(address, latency);
+            };
+            timeServer_ = std::make_unique<TimeServer>(io_context_, settings_.stream, latency_handler);
+            timeServer_->start();
+        }
     }
     catch (const std::exception& e)
     {
@@ -732,6 +861,12 @@ void Server::start()
 
 void Server::stop()
 {
+    if (timeServer_)
+    {
+        timeServer_->stop();
+        timeServer_ = nullptr;
+    }
+
     if (streamManager_)
     {
         streamManager_->stop();
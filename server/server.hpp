@@ -37,6 +37,7 @@
 #include "stream_server.hpp"
 #include "stream_session.hpp"
 #include "streamreader/stream_manager.hpp"
+#include "time_server.hpp"
 
 using namespace streamreader;
 
@@ -68,6 +69,7 @@ private:
 
     /// Implementation of ControllMessageReceiver
     std::string onMessageReceived(ControlSession* controlSession, const std::string& message) override;
+    std::string getMetrics() override;
     void onNewSession(const std::shared_ptr<ControlSession>& session) override
     {
         std::ignore = session;
@@ -79,6 +81,7 @@ private:
     void onStateChanged(const PcmStream* pcmStream, ReaderState state) override;
     void onChunkRead(const PcmStream* pcmStream, const msg::PcmChunk& chunk) override;
     void onChunkEncoded(const PcmStream* pcmStream, std::shared_ptr<msg::PcmChunk> chunk, double duration) override;
+    void onSilence(const PcmStream* pcmStream, std::shared_ptr<msg::Silence> silence) override;
     void onResync(const PcmStream* pcmStream, double ms) override;
 
 private:
@@ -97,6 +100,7 @@ private:
     std::unique_ptr<ControlServer> controlServer_;
     std::unique_ptr<StreamServer> streamServer_;
     std::unique_ptr<StreamManager> streamManager_;
+    std::unique_ptr<TimeServer> timeServer_;
 };
 
 
@@ -19,6 +19,7 @@
 #ifndef SERVER_SETTINGS_HPP
 #define SERVER_SETTINGS_HPP
 
+#include "common/utils/thread_utils.hpp"
 #include <string>
 #include <vector>
 
@@ -27,6 +28,10 @@ struct ServerSettings
     struct Server
     {
         int threads{-1};
+        /// scheduling of the server threads, which read the streams
+        utils::thread::Settings thread;
+        /// lock the process memory into RAM
+        bool lock_memory{false};
         std::string pid_file{"/var/run/snapserver/pid"};
         std::string user{"snapserver"};
         std::string group{""};
@@ -51,6 +56,7 @@ struct ServerSettings
     struct Stream
     {
         size_t port{1704};
+        size_t timeSyncPort{1704};
         std::vector<std::string> sources;
         std::string codec{"flac"};
         int32_t bufferMs{1000};
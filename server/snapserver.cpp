@@ -28,6 +28,7 @@
 #include "common/snap_exception.hpp"
 #include "common/time_defs.hpp"
 #include "common/utils/string_utils.hpp"
+#include "common/utils/thread_utils.hpp"
 #include "common/version.hpp"
 #include "encoder/encoder_factory.hpp"
 #include "message/message.hpp"
@@ -73,6 +74,9 @@ int main(int argc, char* argv[])
 
         // server settings
         conf.add<Value<int>>("", "server.threads", "number of server threads", settings.server.threads, &settings.server.threads);
+        auto realtimeValue = conf.add<Value<string>>("", "server.realtime", "scheduling policy of the server threads <fifo|rr|other>[:<priority>]", "other");
+        auto cpusValue = conf.add<Value<string>>("", "server.cpus", "CPUs to run the server threads on, e.g. \"0-1\", empty for all", "");
+        conf.add<Value<bool>>("", "server.mlock", "lock the process memory into RAM", settings.server.lock_memory, &settings.server.lock_memory);
         conf.add<Value<string>>("", "server.pidfile", "pid file when running as daemon", settings.server.pid_file, &settings.server.pid_file);
         conf.add<Value<string>>("", "server.user", "the user to run as when daemonized", settings.server.user, &settings.server.user);
         conf.add<Implicit<string>>("", "server.group", "the group to run as when daemonized", settings.server.group, &settings.server.group);
@@ -95,6 +99,8 @@ int main(int argc, char* argv[])
         auto stream_bind_to_address = conf.add<Value<string>>("", "stream.bind_to_address", "address for the server to listen on",
                                                               settings.stream.bind_to_address.front(), &settings.stream.bind_to_address[0]);
         conf.add<Value<size_t>>("", "stream.port", "which port the server should listen on", settings.stream.port, &settings.stream.port);
+        conf.add<Value<size_t>>("", "stream.time_sync_port", "UDP port for time sync, 0 to sync over the stream connection", settings.stream.timeSyncPort,
+                                &settings.stream.timeSyncPort);
         // deprecated: stream.stream, use stream.source instead
         auto streamValue = conf.add<Value<string>>("", "stream.stream", "Deprecated: use stream.source", pcmSource, &pcmSource);
         auto sourceValue = conf.add<Value<string>>(
@@ -102,7 +108,7 @@ int main(int argc, char* argv[])
             &pcmSource);
 
         conf.add<Value<string>>("", "stream.sampleformat", "Default sample format", settings.stream.sampleFormat, &settings.stream.sampleFormat);
-        conf.add<Value<string>>("", "stream.codec", "Default transport codec\n(flac|ogg|opus|pcm)[:options]\nType codec:? to get codec specific options",
+        conf.add<Value<string>>("", "stream.codec", "Default transport codec\n(flac|ogg|opus|pcm|bitpack)[:options]\nType codec:? to get codec specific options",
                                 settings.stream.codec, &settings.stream.codec);
         // deprecated: stream_buffer, use chunk_ms instead
         conf.add<Value<size_t>>("", "stream.stream_buffer", "Default stream read chunk size [ms], deprecated, use stream.chunk_ms instead",
@@ -313,9 +319,39 @@ int main(int argc, char* argv[])
             io_context.stop();
         });
 
+        utils::thread::parsePolicy(realtimeValue->value(), settings.server.thread);
+        settings.server.thread.cpus = utils::thread::parseCpus(cpusValue->value());
+        auto apply_thread_settings = [&settings]() {
+            try
+            {
+                utils::thread::apply(settings.server.thread);
+            }
+            catch (const std::exception& e)
+            {
+                LOG(WARNING, LOG_TAG) << e.what() << "\n";
+            }
+        };
+        if (settings.server.lock_memory)
+        {
+            try
+            {
+                utils::thread::lockMemory();
+            }
+            catch (const std::exception& e)
+            {
+                LOG(WARNING, LOG_TAG) << e.what() << "\n";
+            }
+        }
+
         std::vector<std::thread> threads;
         for (int n = 0; n < settings.server.threads; ++n)
-            threads.emplace_back([&] { io_context.run(); });
+        {
+            threads.emplace_back([&] {
+                apply_thread_settings();
+                io_context.run();
+            });
+        }
+        apply_thread_settings();
 
         io_context.run();
 
@@ -19,6 +19,7 @@
 #include "stream_server.hpp"
 #include "common/aixlog.hpp"
 #include "config.hpp"
+#include "encoder/encoder.hpp"
 #include "message/client_info.hpp"
 #include "message/hello.hpp"
 #include "message/stream_tags.hpp"
@@ -32,6 +33,17 @@ using namespace streamreader;
 using json = nlohmann::json;
 
 static constexpr auto LOG_TAG = "StreamServer";
+/// Backlog chunks are only sent if they are due for playback at least this far in the future, to cover transfer and decoding
+static constexpr auto kBacklogMargin = 50ms;
+
+
+/// @return @p address with IPv4-mapped IPv6 addresses converted to IPv4, as seen by an IPv4 and an IPv6 socket
+static boost::asio::ip::address unmapped(const boost::asio::ip::address& address)
+{
+    if (address.is_v6() && address.to_v6().is_v4_mapped())
+        return boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6());
+    return address;
+}
 
 StreamServer::StreamServer(boost::asio::io_context& io_context, const ServerSettings& serverSettings, StreamMessageReceiver* messageReceiver)
     : io_context_(io_context), config_timer_(io_context), settings_(serverSettings), messageReceiver_(messageReceiver)
@@ -86,7 +98,77 @@ void StreamServer::onChunkEncoded(const PcmStream* pcmStream, bool isDefaultStre
 {
     // LOG(TRACE, LOG_TAG) << "onChunkRead (" << pcmStream->getName() << "): " << duration << "ms\n";
     shared_const_buffer buffer(*chunk);
+    auto renditionChunk = std::dynamic_pointer_cast<encoder::RenditionChunk>(chunk);
+    if (renditionChunk)
+    {
+        for (const auto& rendition : renditionChunk->renditions)
+        {
+            rendition->timestamp = chunk->timestamp;
+            buffer.addRendition(*rendition);
+        }
+    }
+
+    send(pcmStream, isDefaultStream, buffer, chunk->start());
+}
+
+
+void StreamServer::onSilence(const PcmStream* pcmStream, bool isDefaultStream, std::shared_ptr<msg::Silence> silence)
+{
+    shared_const_buffer buffer(*silence);
+    chronos::time_point_clk start(chronos::sec(silence->timestamp.sec) + chronos::usec(silence->timestamp.usec));
+    send(pcmStream, isDefaultStream, buffer, start);
+}
+
+
+bool StreamServer::isMuted(const StreamSession& session) const
+{
+    if (settings_.stream.sendAudioToMutedClients)
+        return false;
+    GroupPtr group = Config::instance().getGroupFromClient(session.clientId);
+    if (!group)
+        return false;
+    if (group->muted)
+        return true;
+    std::lock_guard<std::recursive_mutex> lock(clientMutex_);
+    ClientInfoPtr client = group->getClient(session.clientId);
+    return (client && client->config.volume.muted);
+}
+
+
+void StreamServer::startStream(StreamSession& session, const PcmStreamPtr& pcmStream)
+{
+    std::lock_guard<std::mutex> lock(backlogMutex_);
+    session.setPcmStream(pcmStream);
+    auto header = pcmStream->getHeader();
+    session.send(header);
+    if (isMuted(session))
+        return;
+
+    auto iter = backlog_.find(pcmStream.get());
+    if ((iter == backlog_.end()) || (iter->second.header != header))
+        return;
+    auto due = chronos::clk::now() - std::chrono::milliseconds(settings_.stream.bufferMs) + kBacklogMargin;
+    size_t sent = 0;
+    for (const auto& entry : iter->second.chunks)
+    {
+        if (entry.first < due)
+            continue;
+        session.send(entry.second);
+        ++sent;
+    }
+    LOG(DEBUG, LOG_TAG) << "Sent " << sent << " backlog chunks to " << session.clientId << "\n";
+}
+
+
+void StreamServer::removeStream(const PcmStream* pcmStream)
+{
+    std::lock_guard<std::mutex> lock(backlogMutex_);
+    backlog_.erase(pcmStream);
+}
+
 
+void StreamServer::send(const PcmStream* pcmStream, bool isDefaultStream, const shared_const_buffer& buffer, const chronos::time_point_clk& timestamp)
+{
     // make a copy of the sessions to avoid that a session get's deleted
     std::vector<std::shared_ptr<StreamSession>> sessions;
     {
@@ -96,26 +178,23 @@ void StreamServer::onChunkEncoded(const PcmStream* pcmStream, bool isDefaultStre
                 sessions.push_back(s);
     }
 
+    std::lock_guard<std::mutex> lock(backlogMutex_);
+    auto& backlog = backlog_[pcmStream];
+    auto header = pcmStream->getHeader();
+    if (backlog.header != header)
+    {
+        // the stream was restarted with a new encoder, don't mix up chunks of different headers
+        backlog.chunks.clear();
+        backlog.header = header;
+    }
+    while (!backlog.chunks.empty() && (timestamp - backlog.chunks.front().first > std::chrono::milliseconds(settings_.stream.bufferMs)))
+        backlog.chunks.pop_front();
+    backlog.chunks.emplace_back(timestamp, buffer);
+
     for (const auto& session : sessions)
     {
-        if (!settings_.stream.sendAudioToMutedClients)
-        {
-            GroupPtr group = Config::instance().getGroupFromClient(session->clientId);
-            if (group)
-            {
-                if (group->muted)
-                {
-                    continue;
-                }
-                else
-                {
-                    std::lock_guard<std::recursive_mutex> lock(clientMutex_);
-                    ClientInfoPtr client = group->getClient(session->clientId);
-                    if (client && client->config.volume.muted)
-                        continue;
-                }
-            }
-        }
+        if (isMuted(*session))
+            continue;
 
         if (!session->pcmStream() && isDefaultStream) //->getName() == "default")
             session->send(buffer);
@@ -183,6 +262,23 @@ session_ptr StreamServer::getStreamSession(const std::string& clientId) const
 }
 
 
+void StreamServer::onTimeLatency(const boost::asio::ip::address& address, const chronos::usec& latency)
+{
+    auto client = unmapped(address);
+    std::lock_guard<std::recursive_mutex> mlock(sessionsMutex_);
+    for (const auto& session : sessions_)
+    {
+        auto s = session.lock();
+        if (!s)
+            continue;
+        boost::system::error_code ec;
+        auto ip = boost::asio::ip::make_address(s->getIP(), ec);
+        if (!ec && (unmapped(ip) == client))
+            s->onTimeLatency(latency);
+    }
+}
+
+
 void StreamServer::startAccept()
 {
     auto accept_handler = [this](error_code ec, tcp::socket socket) {
@@ -20,6 +20,8 @@
 #define STREAM_SERVER_HPP
 
 #include <boost/asio.hpp>
+#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -66,11 +68,25 @@ public:
     void addSession(const std::shared_ptr<StreamSession>& session);
     void onMetaChanged(const PcmStream* pcmStream, std::shared_ptr<msg::StreamTags> meta);
     void onChunkEncoded(const PcmStream* pcmStream, bool isDefaultStream, std::shared_ptr<msg::PcmChunk> chunk, double duration);
+    void onSilence(const PcmStream* pcmStream, bool isDefaultStream, std::shared_ptr<msg::Silence> silence);
+    /// Switch the session to @p pcmStream and send the codec header, followed by the recent audio that is not yet due for playback.
+    /// The client can start playing right away, instead of waiting for a full buffer of new chunks.
+    void startStream(StreamSession& session, const PcmStreamPtr& pcmStream);
+    /// Drop the recent audio of @p pcmStream, before the stream is removed
+    void removeStream(const PcmStream* pcmStream);
 
     session_ptr getStreamSession(const std::string& clientId) const;
     session_ptr getStreamSession(StreamSession* session) const;
 
+    /// Forward the latency of a time request on the UDP time sync port to the sessions of the client host @p address.
+    /// Instances on the same host share the network path, so they all get the latency.
+    void onTimeLatency(const boost::asio::ip::address& address, const chronos::usec& latency);
+
 private:
+    /// Keep @p buffer in the backlog of @p pcmStream and send it to all unmuted sessions that are listening to pcmStream
+    void send(const PcmStream* pcmStream, bool isDefaultStream, const shared_const_buffer& buffer, const chronos::time_point_clk& timestamp);
+    /// @return true if no audio should be sent to the session's client
+    bool isMuted(const StreamSession& session) const;
     void startAccept();
     void handleAccept(tcp::socket socket);
     void cleanup();
@@ -89,6 +105,17 @@ private:
     ServerSettings settings_;
     Queue<std::shared_ptr<msg::BaseMessage>> messages_;
     StreamMessageReceiver* messageReceiver_;
+
+    /// the last buffer duration of audio of a stream, with the server time of the chunks
+    struct Backlog
+    {
+        /// codec header the chunks are encoded with, the backlog is cleared when it changes
+        std::shared_ptr<msg::CodecHeader> header;
+        std::deque<std::pair<chronos::time_point_clk, shared_const_buffer>> chunks;
+    };
+    std::map<const PcmStream*, Backlog> backlog_;
+    /// serializes sending audio and starting streams, to keep the order of the chunks
+    std::mutex backlogMutex_;
 };
 
 
@@ -51,9 +51,31 @@ const PcmStreamPtr StreamSession::pcmStream() const
 void StreamSession::send_next()
 {
     auto& buffer = messages_.front();
+    if (buffer.message().is_pcm_chunk)
+    {
+        // audio queued behind this chunk, i.e. the backlog if this one is sent now
+        chronos::msec queued(0);
+        for (auto it = messages_.rbegin(); it != messages_.rend(); ++it)
+        {
+            if (it->message().is_pcm_chunk)
+            {
+                queued = std::chrono::duration_cast<chronos::msec>(it->message().rec_time - buffer.message().rec_time);
+                break;
+            }
+        }
+        // switch renditions only at chunk boundaries, which are always Opus frame boundaries
+        buffer.selectRendition(congestion_.update(queued, buffer.renditions(), chronos::clk::now()));
+    }
+    else if (buffer.message().type == message_type::kTime)
+    {
+        // the reply might have been queued behind audio chunks, stamp it right before sending
+        buffer.setSent(tv());
+    }
     buffer.on_air = true;
-    strand_.post([this, self = shared_from_this(), buffer]() {
-        sendAsync(buffer, [this](boost::system::error_code ec, std::size_t length) {
+    auto write_start = chronos::clk::now();
+    strand_.post([this, self = shared_from_this(), buffer, write_start]() {
+        sendAsync(buffer, [this, buffer, write_start](boost::system::error_code ec, std::size_t length) {
+            congestion_.onWritten(length, buffer.enqueued, write_start, chronos::clk::now());
             messages_.pop_front();
             if (ec)
             {
@@ -83,6 +105,8 @@ void StreamSession::send(shared_const_buffer const_buf)
                         messages_.end());
 
         messages_.push_back(const_buf);
+        messages_.back().enqueued = chronos::clk::now();
+        congestion_.onEnqueue(const_buf.size(), messages_.back().enqueued);
 
         if (messages_.size() > 1)
         {
@@ -99,7 +123,6 @@ void StreamSession::send(msg::message_ptr message)
     if (!message)
         return;
 
-    // TODO: better set the timestamp in send_next for more accurate time sync
     send(shared_const_buffer(*message));
 }
 
@@ -108,3 +131,9 @@ void StreamSession::setBufferMs(size_t bufferMs)
 {
     bufferMs_ = bufferMs;
 }
+
+
+void StreamSession::onTimeLatency(const chronos::usec& latency)
+{
+    strand_.post([this, self = shared_from_this(), latency]() { congestion_.onTimeLatency(latency); });
+}
@@ -20,11 +20,13 @@
 #define STREAM_SESSION_HPP
 
 #include "common/queue.h"
+#include "congestion_monitor.hpp"
 #include "message/message.hpp"
 #include "streamreader/stream_manager.hpp"
 #include <atomic>
 #include <boost/asio.hpp>
 #include <condition_variable>
+#include <cstring>
 #include <deque>
 #include <memory>
 #include <set>
@@ -54,13 +56,15 @@ class shared_const_buffer
     struct Message
     {
         std::vector<char> data;
+        /// alternative encodings of a PCM chunk, ordered by decreasing bitrate
+        std::vector<std::vector<char>> renditions;
         bool is_pcm_chunk;
         uint16_t type;
         chronos::time_point_clk rec_time;
     };
 
 public:
-    shared_const_buffer(msg::BaseMessage& message) : on_air(false)
+    shared_const_buffer(msg::BaseMessage& message) : on_air(false), rendition_(0)
     {
         tv t;
         message.sent = t;
@@ -96,11 +100,50 @@ public:
         return *message_;
     }
 
+    /// Add an alternative encoding of the message. Must be called before the buffer is shared.
+    void addRendition(msg::BaseMessage& message)
+    {
+        std::ostringstream oss;
+        message.serialize(oss);
+        std::string s = oss.str();
+        message_->renditions.emplace_back(s.begin(), s.end());
+    }
+
+    /// number of available encodings, including the message itself
+    size_t renditions() const
+    {
+        return message_->renditions.size() + 1;
+    }
+
+    /// Select the encoding to be sent, 0 is the message itself
+    void selectRendition(size_t rendition)
+    {
+        rendition_ = std::min(rendition, message_->renditions.size());
+        buffer_ = boost::asio::buffer((rendition_ == 0) ? message_->data : message_->renditions[rendition_ - 1]);
+    }
+
+    size_t size() const
+    {
+        return buffer_.size();
+    }
+
+    /// Update the "sent" timestamp of the serialized message, i.e. of the first encoding.
+    /// Used for time messages, that must be stamped right before they are written to the socket
+    void setSent(const tv& sent)
+    {
+        uint32_t sec = SWAP_32(static_cast<uint32_t>(sent.sec));
+        uint32_t usec = SWAP_32(static_cast<uint32_t>(sent.usec));
+        memcpy(message_->data.data() + 3 * sizeof(uint16_t), &sec, sizeof(sec));
+        memcpy(message_->data.data() + 3 * sizeof(uint16_t) + sizeof(sec), &usec, sizeof(usec));
+    }
+
     bool on_air;
+    chronos::time_point_clk enqueued;
 
 private:
     std::shared_ptr<Message> message_;
     boost::asio::const_buffer buffer_;
+    size_t rendition_;
 };
 
 
@@ -142,6 +185,9 @@ public:
     /// Max playout latency. No need to send PCM data that is older than bufferMs
     void setBufferMs(size_t bufferMs);
 
+    /// Client to server latency of a Time message, feeds the congestion signal
+    void onTimeLatency(const chronos::usec& latency);
+
     std::string clientId;
 
     void setPcmStream(streamreader::PcmStreamPtr pcmStream);
@@ -158,6 +204,7 @@ protected:
     streamreader::PcmStreamPtr pcmStream_;
     boost::asio::io_context::strand strand_;
     std::deque<shared_const_buffer> messages_;
+    CongestionMonitor congestion_;
 };
 
 
@@ -19,6 +19,7 @@
 #include "stream_session_tcp.hpp"
 
 #include "common/aixlog.hpp"
+#include "common/utils/timestamping.hpp"
 #include "message/pcm_chunk.hpp"
 #include <iostream>
 
@@ -32,6 +33,8 @@ static constexpr auto LOG_TAG = "StreamSessionTCP";
 StreamSessionTcp::StreamSessionTcp(boost::asio::io_context& ioc, StreamMessageReceiver* receiver, tcp::socket&& socket)
     : StreamSession(ioc, receiver), socket_(std::move(socket))
 {
+    if (!utils::timestamping::enable(socket_.native_handle(), false))
+        LOG(DEBUG, LOG_TAG) << "Kernel timestamps not available\n";
 }
 
 
@@ -80,36 +83,37 @@ std::string StreamSessionTcp::getIP()
 
 void StreamSessionTcp::read_next()
 {
-    boost::asio::async_read(socket_, boost::asio::buffer(buffer_, base_msg_size_),
-                            boost::asio::bind_executor(strand_, [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length) mutable {
-                                if (ec)
-                                {
-                                    LOG(ERROR, LOG_TAG) << "Error reading message header of length " << length << ": " << ec.message() << "\n";
-                                    messageReceiver_->onDisconnect(this);
-                                    return;
-                                }
-
-                                baseMessage_.deserialize(buffer_.data());
-                                LOG(DEBUG, LOG_TAG) << "getNextMessage: " << baseMessage_.type << ", size: " << baseMessage_.size << ", id: " << baseMessage_.id
-                                                    << ", refers: " << baseMessage_.refersTo << "\n";
-                                if (baseMessage_.type > message_type::kLast)
-                                {
-                                    LOG(ERROR, LOG_TAG) << "unknown message type received: " << baseMessage_.type << ", size: " << baseMessage_.size << "\n";
-                                    messageReceiver_->onDisconnect(this);
-                                    return;
-                                }
-                                else if (baseMessage_.size > msg::max_size)
-                                {
-                                    LOG(ERROR, LOG_TAG) << "received message of type " << baseMessage_.type << " to large: " << baseMessage_.size << "\n";
-                                    messageReceiver_->onDisconnect(this);
-                                    return;
-                                }
-
-                                if (baseMessage_.size > buffer_.size())
-                                    buffer_.resize(baseMessage_.size);
-
-                                boost::asio::async_read(
-                                    socket_, boost::asio::buffer(buffer_, baseMessage_.size),
+    utils::timestamping::async_read(
+        socket_, strand_, buffer_.data(), base_msg_size_,
+        [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length, const chronos::time_point_clk& received) mutable {
+            if (ec)
+            {
+                LOG(ERROR, LOG_TAG) << "Error reading message header of length " << length << ": " << ec.message() << "\n";
+                messageReceiver_->onDisconnect(this);
+                return;
+            }
+
+            baseMessage_.deserialize(buffer_.data());
+            baseMessage_.received = received;
+            LOG(DEBUG, LOG_TAG) << "getNextMessage: " << baseMessage_.type << ", size: " << baseMessage_.size << ", id: " << baseMessage_.id
+                                << ", refers: " << baseMessage_.refersTo << "\n";
+            if (baseMessage_.type > message_type::kLast)
+            {
+                LOG(ERROR, LOG_TAG) << "unknown message type received: " << baseMessage_.type << ", size: " << baseMessage_.size << "\n";
+                messageReceiver_->onDisconnect(this);
+                return;
+            }
+            else if (baseMessage_.size > msg::max_size)
+            {
+                LOG(ERROR, LOG_TAG) << "received message of type " << baseMessage_.type << " to large: " << baseMessage_.size << "\n";
+                messageReceiver_->onDisconnect(this);
+                return;
+            }
+
+            if (baseMessage_.size > buffer_.size())
+                buffer_.resize(baseMessage_.size);
+
+            boost::asio::async_read(socket_, boost::asio::buffer(buffer_, baseMessage_.size),
                                     boost::asio::bind_executor(strand_, [this, self](boost::system::error_code ec, std::size_t length) mutable {
                                         if (ec)
                                         {
@@ -118,13 +122,11 @@ void StreamSessionTcp::read_next()
                                             return;
                                         }
 
-                                        tv t;
-                                        baseMessage_.received = t;
                                         if (messageReceiver_ != nullptr)
                                             messageReceiver_->onMessageReceived(this, baseMessage_, buffer_.data());
                                         read_next();
                                     }));
-                            }));
+        });
 }
 
 
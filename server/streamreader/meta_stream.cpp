@@ -178,6 +178,13 @@ void MetaStream::onChunkEncoded(const PcmStream* pcmStream, std::shared_ptr<msg:
 }
 
 
+void MetaStream::onSilence(const PcmStream* pcmStream, std::shared_ptr<msg::Silence> silence)
+{
+    std::ignore = pcmStream;
+    std::ignore = silence;
+}
+
+
 void MetaStream::onResync(const PcmStream* pcmStream, double ms)
 {
     LOG(DEBUG, LOG_TAG) << "onResync: " << pcmStream->getName() << ", duration: " << ms << " ms\n";
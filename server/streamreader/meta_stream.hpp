@@ -49,6 +49,7 @@ protected:
     void onStateChanged(const PcmStream* pcmStream, ReaderState state) override;
     void onChunkRead(const PcmStream* pcmStream, const msg::PcmChunk& chunk) override;
     void onChunkEncoded(const PcmStream* pcmStream, std::shared_ptr<msg::PcmChunk> chunk, double duration) override;
+    void onSilence(const PcmStream* pcmStream, std::shared_ptr<msg::Silence> silence) override;
     void onResync(const PcmStream* pcmStream, double ms) override;
 
 protected:
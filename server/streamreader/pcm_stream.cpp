@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <cstring>
 #include <fcntl.h>
 #include <memory>
 #include <sys/stat.h>
@@ -34,9 +35,34 @@ namespace streamreader
 
 static constexpr auto LOG_TAG = "PcmStream";
 
+/// Silence markers are sent every kSilenceMarkerDuration during suppressed silence
+static constexpr auto kSilenceMarkerDuration = std::chrono::milliseconds(200);
+
+namespace
+{
+/// @return true if the chunk contains only zero samples
+bool isDigitalSilence(const msg::PcmChunk& chunk)
+{
+    const char* data = chunk.payload;
+    size_t size = chunk.payloadSize;
+    uint64_t bits = 0;
+    // or-reduce in 64 bit words, so that the loop can be vectorized
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), data += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        bits |= word;
+    }
+    for (; size > 0; --size, ++data)
+        bits |= static_cast<unsigned char>(*data);
+    return bits == 0;
+}
+} // namespace
+
 
 PcmStream::PcmStream(PcmListener* pcmListener, boost::asio::io_context& ioc, const StreamUri& uri)
-    : active_(false), pcmListeners_{pcmListener}, uri_(uri), chunk_ms_(20), state_(ReaderState::kIdle), ioc_(ioc)
+    : active_(false), pcmListeners_{pcmListener}, uri_(uri), chunk_ms_(20), dtx_hangover_(0), silence_(0), suppressed_(0), state_(ReaderState::kIdle),
+      ioc_(ioc)
 {
     encoder::EncoderFactory encoderFactory;
     if (uri_.query.find(kUriCodec) == uri_.query.end())
@@ -55,6 +81,9 @@ PcmStream::PcmStream(PcmListener* pcmListener, boost::asio::io_context& ioc, con
     if (uri_.query.find(kUriChunkMs) != uri_.query.end())
         chunk_ms_ = cpt::stoul(uri_.query[kUriChunkMs]);
 
+    if (uri_.query.find(kUriDtxMs) != uri_.query.end())
+        dtx_hangover_ = std::chrono::milliseconds(cpt::stoul(uri_.query[kUriDtxMs]));
+
     setMeta(json());
 }
 
@@ -65,7 +94,7 @@ PcmStream::~PcmStream()
 }
 
 
-std::shared_ptr<msg::CodecHeader> PcmStream::getHeader()
+std::shared_ptr<msg::CodecHeader> PcmStream::getHeader() const
 {
     return encoder_->getHeader();
 }
@@ -107,6 +136,19 @@ void PcmStream::start()
                         << "\n";
     encoder_->init([this](const encoder::Encoder& encoder, std::shared_ptr<msg::PcmChunk> chunk, double duration) { chunkEncoded(encoder, chunk, duration); },
                    sampleFormat_);
+
+    // Audio that the encoder holds back when suppression starts would be sent after the silence marker.
+    // The hangover must cover it, plus the chunk that starts the suppression.
+    if (dtx_hangover_.count() > 0)
+    {
+        auto min_hangover = std::chrono::ceil<std::chrono::milliseconds>(encoder_->getLatency()) + std::chrono::milliseconds(chunk_ms_);
+        if (dtx_hangover_ < min_hangover)
+        {
+            LOG(WARNING, LOG_TAG) << "dtx_ms (" << dtx_hangover_.count() << ") is shorter than the latency of the " << getCodec() << " encoder, using "
+                                  << min_hangover.count() << " ms\n";
+            dtx_hangover_ = min_hangover;
+        }
+    }
     active_ = true;
 }
 
@@ -168,10 +210,68 @@ void PcmStream::chunkRead(const msg::PcmChunk& chunk)
         if (listener != nullptr)
             listener->onChunkRead(this, chunk);
     }
+
+    if (dtx_hangover_.count() > 0)
+    {
+        // the stream time has been reset, e.g. after a reconnect: don't hold back silence of the old timeline
+        if ((suppressed_.count() > 0) && (tvSilenceStart_ + suppressed_ != tvEncodedChunk_))
+            flushSilence();
+
+        if (isDigitalSilence(chunk))
+        {
+            auto duration = chunk.duration<std::chrono::nanoseconds>();
+            silence_ += duration;
+            // keep encoding during the hangover, so that the encoder's internal buffer
+            // is flushed and contains nothing but silence when suppression starts
+            if (silence_ > dtx_hangover_)
+            {
+                if (silence_ - duration <= dtx_hangover_)
+                    LOG(DEBUG, LOG_TAG) << "Suppressing silence on stream: " << name_ << "\n";
+                // the suppressed chunk occupies the timeline just like an encoded chunk would do
+                if (suppressed_.count() == 0)
+                    tvSilenceStart_ = tvEncodedChunk_;
+                suppressed_ += duration;
+                tvEncodedChunk_ += duration;
+                if (suppressed_ >= kSilenceMarkerDuration)
+                    flushSilence();
+                return;
+            }
+        }
+        else
+        {
+            if (silence_ > dtx_hangover_)
+            {
+                LOG(DEBUG, LOG_TAG) << "Audio resumed on stream: " << name_ << "\n";
+                flushSilence();
+            }
+            silence_ = std::chrono::nanoseconds(0);
+        }
+    }
     encoder_->encode(chunk);
 }
 
 
+void PcmStream::flushSilence()
+{
+    if (suppressed_.count() == 0)
+        return;
+
+    auto silence = std::make_shared<msg::Silence>();
+    auto microsecs = std::chrono::duration_cast<std::chrono::microseconds>(tvSilenceStart_.time_since_epoch()).count();
+    silence->timestamp.sec = microsecs / 1000000;
+    silence->timestamp.usec = microsecs % 1000000;
+    silence->duration = std::chrono::duration_cast<std::chrono::microseconds>(suppressed_).count();
+    tvSilenceStart_ += suppressed_;
+    suppressed_ = std::chrono::nanoseconds(0);
+
+    for (auto* listener : pcmListeners_)
+    {
+        if (listener != nullptr)
+            listener->onSilence(this, silence);
+    }
+}
+
+
 void PcmStream::resync(const std::chrono::nanoseconds& duration)
 {
     for (auto* listener : pcmListeners_)
@@ -23,6 +23,7 @@
 #include "common/sample_format.hpp"
 #include "encoder/encoder.hpp"
 #include "message/codec_header.hpp"
+#include "message/silence.hpp"
 #include "message/stream_tags.hpp"
 #include "stream_uri.hpp"
 #include <atomic>
@@ -70,6 +71,7 @@ static constexpr auto kUriCodec = "codec";
 static constexpr auto kUriName = "name";
 static constexpr auto kUriSampleFormat = "sampleformat";
 static constexpr auto kUriChunkMs = "chunk_ms";
+static constexpr auto kUriDtxMs = "dtx_ms";
 
 
 /// Callback interface for users of PcmStream
@@ -83,6 +85,8 @@ public:
     virtual void onStateChanged(const PcmStream* pcmStream, ReaderState state) = 0;
     virtual void onChunkRead(const PcmStream* pcmStream, const msg::PcmChunk& chunk) = 0;
     virtual void onChunkEncoded(const PcmStream* pcmStream, std::shared_ptr<msg::PcmChunk> chunk, double duration) = 0;
+    /// Silence has been suppressed instead of being encoded (see "dtx_ms")
+    virtual void onSilence(const PcmStream* pcmStream, std::shared_ptr<msg::Silence> silence) = 0;
     virtual void onResync(const PcmStream* pcmStream, double ms) = 0;
 };
 
@@ -103,7 +107,7 @@ public:
     virtual void start();
     virtual void stop();
 
-    virtual std::shared_ptr<msg::CodecHeader> getHeader();
+    virtual std::shared_ptr<msg::CodecHeader> getHeader() const;
 
     virtual const StreamUri& getUri() const;
     virtual const std::string& getName() const;
@@ -126,12 +130,21 @@ protected:
     void chunkRead(const msg::PcmChunk& chunk);
     void resync(const std::chrono::nanoseconds& duration);
     void chunkEncoded(const encoder::Encoder& encoder, std::shared_ptr<msg::PcmChunk> chunk, double duration);
+    /// Send the suppressed silence as msg::Silence marker
+    void flushSilence();
 
     std::chrono::time_point<std::chrono::steady_clock> tvEncodedChunk_;
     std::vector<PcmListener*> pcmListeners_;
     StreamUri uri_;
     SampleFormat sampleFormat_;
     size_t chunk_ms_;
+    /// duration of digital silence after which encoding is suspended, 0 = disabled
+    std::chrono::milliseconds dtx_hangover_;
+    /// duration of the current stretch of digital silence
+    std::chrono::nanoseconds silence_;
+    /// suppressed silence that has not been sent yet, starting at tvSilenceStart_
+    std::chrono::nanoseconds suppressed_;
+    std::chrono::time_point<std::chrono::steady_clock> tvSilenceStart_;
     std::unique_ptr<encoder::Encoder> encoder_;
     std::string name_;
     ReaderState state_;
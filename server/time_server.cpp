@@ -0,0 +1,122 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "time_server.hpp"
+#include "common/aixlog.hpp"
+#include "common/utils/timestamping.hpp"
+#include "message/time.hpp"
+#include <sstream>
+
+using namespace std;
+
+static constexpr auto LOG_TAG = "TimeServer";
+
+
+TimeServer::TimeServer(boost::asio::io_context& io_context, const ServerSettings::Stream& settings, TimeLatencyHandler latency_handler)
+    : io_context_(io_context), settings_(settings), latency_handler_(std::move(latency_handler))
+{
+}
+
+
+TimeServer::~TimeServer()
+{
+    stop();
+}
+
+
+void TimeServer::start()
+{
+    for (const auto& address : settings_.bind_to_address)
+    {
+        try
+        {
+            LOG(INFO, LOG_TAG) << "Creating time sync socket for address: " << address << ", port: " << settings_.timeSyncPort << "\n";
+            auto socket = make_unique<Socket>(io_context_, udp::endpoint(boost::asio::ip::address::from_string(address), settings_.timeSyncPort));
+            if (!utils::timestamping::enable(socket->socket.native_handle(), false))
+                LOG(DEBUG, LOG_TAG) << "Kernel timestamps not available\n";
+            receive(*socket);
+            sockets_.push_back(std::move(socket));
+        }
+        catch (const boost::system::system_error& e)
+        {
+            LOG(ERROR, LOG_TAG) << "error creating UDP socket: " << e.what() << ", code: " << e.code() << "\n";
+        }
+    }
+}
+
+
+void TimeServer::stop()
+{
+    for (auto& socket : sockets_)
+    {
+        boost::system::error_code ec;
+        socket->socket.close(ec);
+    }
+    sockets_.clear();
+}
+
+
+void TimeServer::receive(Socket& socket)
+{
+    utils::timestamping::async_receive_from(socket.socket, socket.strand, socket.buffer.data(), socket.buffer.size(), socket.sender,
+                                            [this, &socket](const boost::system::error_code& ec, std::size_t length, const chronos::time_point_clk& received) {
+                                                if ((ec == boost::asio::error::operation_aborted) || !socket.socket.is_open())
+                                                    return;
+                                                // errors are transient, e.g. connection refused after an ICMP port unreachable
+                                                if (ec)
+                                                    LOG(ERROR, LOG_TAG) << "Error receiving time request: " << ec.message() << "\n";
+                                                else
+                                                    onReceived(socket, length, received);
+                                                receive(socket);
+                                            });
+}
+
+
+void TimeServer::onReceived(Socket& socket, size_t length, const tv& received)
+{
+    msg::BaseMessage base;
+    if (length < base.getSize())
+        return;
+    base.deserialize(socket.buffer.data());
+    msg::Time request;
+    if ((base.type != message_type::kTime) || (base.size != request.getSize()) || (length != base.getSize() + base.size))
+    {
+        LOG(DEBUG, LOG_TAG) << "Invalid time request from " << socket.sender.address().to_string() << "\n";
+        return;
+    }
+
+    base.received = received;
+    request.deserialize(base, socket.buffer.data() + base.getSize());
+    // same as a time request on the stream connection, the reply is as large as the request
+    msg::Time reply;
+    reply.id = request.id;
+    reply.refersTo = request.id;
+    reply.latency = request.received - request.sent;
+    reply.sent = tv();
+    std::ostringstream oss;
+    reply.serialize(oss);
+    std::string data = oss.str();
+
+    boost::system::error_code ec;
+    socket.socket.send_to(boost::asio::buffer(data), socket.sender, 0, ec);
+    if (ec)
+        LOG(DEBUG, LOG_TAG) << "Error sending time reply to " << socket.sender.address().to_string() << ": " << ec.message() << "\n";
+
+    if (latency_handler_)
+        latency_handler_(socket.sender.address(), chronos::usec(static_cast<chronos::usec::rep>(reply.latency.sec) * 1000000 + reply.latency.usec));
+}
@@ -0,0 +1,74 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2020  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef TIME_SERVER_HPP
+#define TIME_SERVER_HPP
+
+#include "message/message.hpp"
+#include "server_settings.hpp"
+#include <array>
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using boost::asio::ip::udp;
+
+/// Called with the sender address and the client to server latency of every valid time request
+using TimeLatencyHandler = std::function<void(const boost::asio::ip::address& address, const chronos::usec& latency)>;
+
+
+/// UDP time sync service
+/**
+ * Answers Time messages on a UDP port, next to the TCP stream port.
+ * Time sync over UDP doesn't wait behind queued audio chunks (head-of-line blocking).
+ * Requests and replies have the same size and format as on the stream connection.
+ */
+class TimeServer
+{
+public:
+    TimeServer(boost::asio::io_context& io_context, const ServerSettings::Stream& settings, TimeLatencyHandler latency_handler);
+    virtual ~TimeServer();
+
+    void start();
+    void stop();
+
+private:
+    struct Socket
+    {
+        Socket(boost::asio::io_context& io_context, const udp::endpoint& endpoint) : socket(io_context, endpoint), strand(io_context)
+        {
+        }
+
+        udp::socket socket;
+        boost::asio::io_context::strand strand;
+        udp::endpoint sender;
+        std::array<char, 128> buffer;
+    };
+
+    void receive(Socket& socket);
+    void onReceived(Socket& socket, size_t length, const tv& received);
+
+    boost::asio::io_context& io_context_;
+    ServerSettings::Stream settings_;
+    TimeLatencyHandler latency_handler_;
+    std::vector<std::unique_ptr<Socket>> sockets_;
+};
+
+
+#endif
@@ -0,0 +1,615 @@
+/***
+    This file is part of snapcast
+    Copyright (C) 2014-2021  Johannes Pohl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+
+#include "client/decoder/bitpack_decoder.hpp"
+#include "client/decoder/pcm_decoder.hpp"
+#include "client/double_buffer.hpp"
+#include "client/player/volume_ramp.hpp"
+#if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBIS_ENC) && !defined(HAS_TREMOR)
+#include "client/decoder/ogg_decoder.hpp"
+#endif
+#if defined(HAS_FLAC)
+#include "client/decoder/flac_decoder.hpp"
+#endif
+#if defined(HAS_OPUS)
+#include "client/decoder/opus_decoder.hpp"
+#endif
+#include "common/aixlog.hpp"
+#include "common/json.hpp"
+#include "common/popl.hpp"
+#include "common/snap_exception.hpp"
+#include "common/str_compat.hpp"
+#include "common/utils/string_utils.hpp"
+#include "common/version.hpp"
+#include "server/encoder/encoder_factory.hpp"
+#ifdef HAS_SOXR
+#include <soxr.h>
+#endif
+
+/**
+ * Encoder/decoder benchmark
+ *
+ * Every codec is driven with reference PCM (synthetic or a raw file) for every combination of
+ * sample format and chunk size. Results are written as JSON, to track regressions across
+ * releases and to compare different architectures.
+ */
+
+using namespace std;
+using namespace popl;
+using json = nlohmann::json;
+
+
+namespace
+{
+
+std::atomic<size_t> alloc_count{0};
+
+} // namespace
+
+// Count heap allocations. On glibc all of malloc/calloc/realloc are counted (this includes
+// operator new and the malloc'ed message payloads), elsewhere only operator new is counted.
+#if defined(__GLIBC__)
+extern "C"
+{
+    extern void* __libc_malloc(size_t size);
+    extern void* __libc_calloc(size_t num, size_t size);
+    extern void* __libc_realloc(void* ptr, size_t size);
+
+    void* malloc(size_t size) noexcept
+    {
+        ++alloc_count;
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t num, size_t size) noexcept
+    {
+        ++alloc_count;
+        return __libc_calloc(num, size);
+    }
+
+    void* realloc(void* ptr, size_t size) noexcept
+    {
+        ++alloc_count;
+        return __libc_realloc(ptr, size);
+    }
+}
+#else
+void* operator new(size_t size)
+{
+    ++alloc_count;
+    void* p = std::malloc(size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+#endif
+
+
+namespace
+{
+
+using bench_clock = std::chrono::steady_clock;
+
+/// Measurements of a single encode or decode pass
+struct Measurement
+{
+    std::vector<double> latency_us;
+    double total_s = 0.;
+    size_t allocations = 0;
+    size_t bytes_in = 0;
+    size_t bytes_out = 0;
+
+    template <typename Func>
+    void measure(Func&& func)
+    {
+        size_t allocs = allocations_now();
+        auto start = bench_clock::now();
+        func();
+        auto end = bench_clock::now();
+        allocations += allocations_now() - allocs;
+        double us = std::chrono::duration<double, std::micro>(end - start).count();
+        latency_us.push_back(us);
+        total_s += us / 1000000.;
+    }
+
+    json toJson(double audio_s, size_t pcm_bytes)
+    {
+        json j;
+        j["calls"] = latency_us.size();
+        j["mb_per_s"] = (total_s > 0.) ? (static_cast<double>(pcm_bytes) / 1000000.) / total_s : 0.;
+        j["realtime_factor"] = (total_s > 0.) ? audio_s / total_s : 0.;
+        j["allocs_per_chunk"] = latency_us.empty() ? 0. : static_cast<double>(allocations) / latency_us.size();
+        j["bytes_in"] = bytes_in;
+        j["bytes_out"] = bytes_out;
+        std::sort(latency_us.begin(), latency_us.end());
+        auto percentile = [this](double p) {
+            if (latency_us.empty())
+                return 0.;
+            size_t idx = std::min(latency_us.size() - 1, static_cast<size_t>(p / 100. * latency_us.size()));
+            return latency_us[idx];
+        };
+        j["latency_us"] = {{"p50", percentile(50)}, {"p90", percentile(90)}, {"p99", percentile(99)}, {"max", percentile(100)}};
+        return j;
+    }
+
+private:
+    static size_t allocations_now()
+    {
+        return alloc_count.load(std::memory_order_relaxed);
+    }
+};
+
+
+std::unique_ptr<decoder::Decoder> createDecoder(const std::string& codec)
+{
+    if (codec == "pcm")
+        return std::make_unique<decoder::PcmDecoder>();
+    else if (codec == "bitpack")
+        return std::make_unique<decoder::BitpackDecoder>();
+#if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBIS_ENC) && !defined(HAS_TREMOR)
+    else if (codec == "ogg")
+        return std::make_unique<decoder::OggDecoder>();
+#endif
+#if defined(HAS_FLAC)
+    else if (codec == "flac")
+        return std::make_unique<decoder::FlacDecoder>();
+#endif
+#if defined(HAS_OPUS)
+    else if (codec == "opus")
+        return std::make_unique<decoder::OpusDecoder>();
+#endif
+    return nullptr;
+}
+
+
+/// Synthetic reference signal: a few partials with slowly changing amplitude plus some noise
+std::vector<char> generatePcm(const SampleFormat& format, double seconds)
+{
+    size_t frames = static_cast<size_t>(format.rate() * seconds);
+    std::vector<char> pcm(frames * format.frameSize());
+    double full_scale = std::pow(2., format.bits() - 1) - 1.;
+    uint32_t lcg = 12345;
+    for (size_t n = 0; n < frames; ++n)
+    {
+        double t = static_cast<double>(n) / format.rate();
+        for (size_t c = 0; c < format.channels(); ++c)
+        {
+            double env = 0.5 + 0.3 * std::sin(2. * M_PI * 0.25 * t + c);
+            double v = 0.5 * std::sin(2. * M_PI * 220. * t + c) + 0.25 * std::sin(2. * M_PI * 554.37 * t) + 0.1 * std::sin(2. * M_PI * 1760. * t + 0.5 * c);
+            lcg = lcg * 1664525u + 1013904223u;
+            double noise = (static_cast<double>(lcg >> 8) / static_cast<double>(1 << 24) - 0.5) * 0.002;
+            auto sample = static_cast<int32_t>((env * v + noise) * full_scale);
+            size_t idx = n * format.channels() + c;
+            if (format.sampleSize() == 1)
+                reinterpret_cast<int8_t*>(pcm.data())[idx] = static_cast<int8_t>(sample);
+            else if (format.sampleSize() == 2)
+                reinterpret_cast<int16_t*>(pcm.data())[idx] = static_cast<int16_t>(sample);
+            else
+                reinterpret_cast<int32_t*>(pcm.data())[idx] = sample;
+        }
+    }
+    return pcm;
+}
+
+
+json benchmark(const std::string& codec, const SampleFormat& format, uint32_t chunk_ms, const std::vector<char>& pcm)
+{
+    json result;
+    result["codec"] = codec;
+    result["sampleformat"] = format.toString();
+    result["chunk_ms"] = chunk_ms;
+
+    encoder::EncoderFactory encoderFactory;
+    std::unique_ptr<encoder::Encoder> encoder;
+    std::vector<std::shared_ptr<msg::PcmChunk>> encoded;
+    try
+    {
+        encoder = encoderFactory.createEncoder(codec);
+        encoder->init([&encoded](const encoder::Encoder& /*encoder*/, std::shared_ptr<msg::PcmChunk> chunk, double /*duration*/) { encoded.push_back(chunk); },
+                      format);
+    }
+    catch (const std::exception& e)
+    {
+        result["error"] = e.what();
+        return result;
+    }
+
+    // encode
+    Measurement enc;
+    const size_t chunk_bytes = (format.rate() * chunk_ms / 1000) * format.frameSize();
+    size_t encoded_bytes = 0;
+    for (size_t pos = 0; pos + chunk_bytes <= pcm.size(); pos += chunk_bytes)
+    {
+        msg::PcmChunk chunk(format, chunk_ms);
+        memcpy(chunk.payload, pcm.data() + pos, chunk_bytes);
+        size_t before = encoded.size();
+        enc.measure([&]() { encoder->encode(chunk); });
+        enc.bytes_in += chunk_bytes;
+        for (size_t n = before; n < encoded.size(); ++n)
+            encoded_bytes += encoded[n]->payloadSize;
+    }
+    enc.bytes_out = encoded_bytes;
+
+    const double audio_s = static_cast<double>(enc.bytes_in) / format.frameSize() / format.rate();
+    result["audio_s"] = audio_s;
+    result["ratio"] = (enc.bytes_in > 0) ? static_cast<double>(encoded_bytes) / enc.bytes_in : 0.;
+    result["encoder"] = enc.toJson(audio_s, enc.bytes_in);
+
+    // decode
+    auto decoder = createDecoder(codec.substr(0, codec.find(':')));
+    if (!decoder)
+        return result;
+
+    Measurement dec;
+    try
+    {
+        auto header = encoder->getHeader();
+        msg::CodecHeader codec_header(header->codec, header->payloadSize);
+        memcpy(codec_header.payload, header->payload, header->payloadSize);
+        decoder->setHeader(&codec_header);
+        for (const auto& chunk : encoded)
+        {
+            msg::PcmChunk copy(*chunk);
+            bool ok = true;
+            dec.measure([&]() { ok = decoder->decode(&copy); });
+            if (!ok)
+                throw SnapException("failed to decode chunk");
+            dec.bytes_in += chunk->payloadSize;
+            dec.bytes_out += copy.payloadSize;
+        }
+        result["decoder"] = dec.toJson(audio_s, enc.bytes_in);
+    }
+    catch (const std::exception& e)
+    {
+        result["decoder"] = {{"error", e.what()}};
+    }
+    return result;
+}
+
+
+/// Sliding window median, as done by the client's sync for every played chunk
+json benchmarkStatistics(size_t window)
+{
+    const size_t iterations = 20000;
+    std::mt19937 rng(window);
+    std::normal_distribution<double> dist(0., 1000.);
+    std::vector<int64_t> values(iterations);
+    for (auto& value : values)
+        value = static_cast<int64_t>(dist(rng));
+
+    // sliding window with O(1) median
+    DoubleBuffer<int64_t> buffer(window);
+    int64_t sum = 0;
+    auto start = bench_clock::now();
+    for (auto value : values)
+    {
+        buffer.add(value);
+        sum += buffer.median();
+    }
+    double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / iterations;
+
+    // reference: copy and sort the window for every median
+    std::deque<int64_t> window_values;
+    int64_t sum_sort = 0;
+    start = bench_clock::now();
+    for (auto value : values)
+    {
+        window_values.push_back(value);
+        if (window_values.size() > window)
+            window_values.pop_front();
+        std::deque<int64_t> tmp(window_values.begin(), window_values.end());
+        std::sort(tmp.begin(), tmp.end());
+        sum_sort += tmp[tmp.size() / 2];
+    }
+    double ns_sort = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / iterations;
+
+    json result;
+    result["window"] = window;
+    result["ns_per_median"] = ns;
+    result["sort_ns_per_median"] = ns_sort;
+    if (sum != sum_sort)
+        result["error"] = "median mismatch";
+    return result;
+}
+
+
+/// Software volume, as applied by the client's player for every played chunk
+json benchmarkVolume(const SampleFormat& format, uint32_t period_ms, const std::vector<char>& pcm)
+{
+    json result;
+    result["sampleformat"] = format.toString();
+    result["period_ms"] = period_ms;
+
+    const size_t period = format.rate() * period_ms / 1000;
+    const size_t periods = pcm.size() / format.frameSize() / period;
+    std::vector<char> buffer(pcm);
+    auto run = [&](const std::function<void(char*, size_t)>& apply) {
+        auto start = bench_clock::now();
+        for (size_t n = 0; n < periods; ++n)
+            apply(buffer.data() + n * period * format.frameSize(), n);
+        return std::chrono::duration<double>(bench_clock::now() - start).count();
+    };
+
+    // reference: scalar loop with a double gain, as before the volume ramp
+    double seconds_scalar = run([&](char* data, size_t /*n*/) {
+        const size_t samples = period * format.channels();
+        if (format.sampleSize() == 2)
+        {
+            auto* samples16 = reinterpret_cast<int16_t*>(data);
+            for (size_t i = 0; i < samples; ++i)
+                samples16[i] = static_cast<int16_t>(samples16[i] * 0.7);
+        }
+        else if (format.sampleSize() == 4)
+        {
+            auto* samples32 = reinterpret_cast<int32_t*>(data);
+            for (size_t i = 0; i < samples; ++i)
+                samples32[i] = static_cast<int32_t>(samples32[i] * 0.7);
+        }
+    });
+
+    player::VolumeRamp ramp;
+    ramp.setGain(0.7, 0);
+    double seconds_constant = run([&](char* data, size_t /*n*/) { ramp.apply(data, period, format.channels(), format.sampleSize()); });
+
+    // change the volume every period, i.e. always ramping
+    double seconds_ramp = run([&](char* data, size_t n) {
+        ramp.setGain((n % 2 == 0) ? 0.5 : 0.7, static_cast<uint32_t>(period));
+        ramp.apply(data, period, format.channels(), format.sampleSize());
+    });
+
+    double audio_s = static_cast<double>(periods * period) / format.rate();
+    result["scalar_cpu_percent"] = 100. * seconds_scalar / audio_s;
+    result["constant_cpu_percent"] = 100. * seconds_constant / audio_s;
+    result["ramp_cpu_percent"] = 100. * seconds_ramp / audio_s;
+    return result;
+}
+
+
+#ifdef HAS_SOXR
+/// Variable-rate resampling, as done by the client's "resample" sync mode for every played chunk
+json benchmarkSoftSync(const SampleFormat& format, uint32_t period_ms, const std::vector<char>& pcm)
+{
+    json result;
+    result["sampleformat"] = format.toString();
+    result["period_ms"] = period_ms;
+    if (format.sampleSize() < 2)
+    {
+        result["error"] = "unsupported sample format";
+        return result;
+    }
+
+    soxr_error_t error;
+    soxr_datatype_t type = (format.sampleSize() > 2) ? SOXR_INT32_I : SOXR_INT16_I;
+    soxr_io_spec_t iospec = soxr_io_spec(type, type);
+    soxr_quality_spec_t q_spec = soxr_quality_spec(SOXR_HQ, SOXR_VR);
+    soxr_t soxr = soxr_create(1.001, 1., format.channels(), &error, &iospec, &q_spec, nullptr);
+    if (error != nullptr)
+    {
+        result["error"] = error;
+        return result;
+    }
+
+    const size_t period = format.rate() * period_ms / 1000;
+    const size_t total = pcm.size() / format.frameSize();
+    std::vector<char> out(period * format.frameSize());
+    size_t pos = 0;
+    size_t periods = 0;
+    double ratio = 1.;
+    auto start = bench_clock::now();
+    while (pos + 2 * period < total)
+    {
+        // alternate between the sync controller's extremes once per second
+        double new_ratio = ((periods * period_ms / 1000) % 2 == 0) ? 1.0005 : 0.9995;
+        if (new_ratio != ratio)
+        {
+            ratio = new_ratio;
+            soxr_set_io_ratio(soxr, ratio, period);
+        }
+        size_t produced = 0;
+        while (produced < period)
+        {
+            size_t idone = 0;
+            size_t odone = 0;
+            auto in_frames = static_cast<size_t>(std::ceil((period - produced) * ratio));
+            error = soxr_process(soxr, pcm.data() + pos * format.frameSize(), in_frames, &idone, out.data() + produced * format.frameSize(), period - produced,
+                                 &odone);
+            if ((error != nullptr) || ((idone == 0) && (odone == 0)))
+                break;
+            pos += idone;
+            produced += odone;
+        }
+        if (error != nullptr)
+            break;
+        ++periods;
+    }
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    soxr_delete(soxr);
+
+    if (error != nullptr)
+    {
+        result["error"] = error;
+        return result;
+    }
+    double audio_s = static_cast<double>(periods * period) / format.rate();
+    result["us_per_period"] = (periods > 0) ? 1000000. * seconds / periods : 0.;
+    result["realtime_factor"] = (seconds > 0.) ? audio_s / seconds : 0.;
+    result["cpu_percent"] = (audio_s > 0.) ? 100. * seconds / audio_s : 0.;
+    return result;
+}
+#endif
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        std::vector<std::string> codecs{"pcm", "bitpack"};
+#if defined(HAS_FLAC)
+        codecs.emplace_back("flac");
+#endif
+#if defined(HAS_OGG) && defined(HAS_VORBIS) && defined(HAS_VORBIS_ENC)
+        codecs.emplace_back("ogg");
+#endif
+#if defined(HAS_OPUS)
+        codecs.emplace_back("opus");
+#endif
+        std::string codecs_str;
+        for (const auto& codec : codecs)
+            codecs_str += (codecs_str.empty() ? "" : "|") + codec;
+
+        OptionParser op("Allowed options");
+        auto helpSwitch = op.add<Switch>("", "help", "produce help message");
+        auto codecValue = op.add<Value<string>>("c", "codec", "codec[:options], can be passed multiple times (" + codecs_str + ")");
+        auto formatValue = op.add<Value<string>>("s", "sampleformat", "comma separated list of <rate>:<bits>:<channels>", "44100:16:2,48000:16:2,48000:24:2");
+        auto chunkValue = op.add<Value<string>>("", "chunk_ms", "comma separated list of chunk sizes [ms]", "10,20,50");
+        auto durationValue = op.add<Value<double>>("d", "duration", "duration of the reference signal [s]", 10.);
+        auto inputValue = op.add<Value<string>>("i", "input", "raw PCM input file, used instead of the synthetic signal (needs a single sampleformat)");
+        auto outputValue = op.add<Value<string>>("o", "output", "write JSON results to this file instead of stdout");
+        auto statisticsSwitch = op.add<Switch>("", "statistics", "also benchmark the client's sliding window median");
+        auto volumeSwitch = op.add<Switch>("", "volume", "also benchmark the client's software volume");
+#ifdef HAS_SOXR
+        auto softsyncSwitch = op.add<Switch>("", "softsync", "also benchmark the client's variable-rate resampling (syncmode \"resample\")");
+#endif
+        op.parse(argc, argv);
+
+        if (helpSwitch->is_set())
+        {
+            cout << op << "\n";
+            return EXIT_SUCCESS;
+        }
+
+        AixLog::Log::init<AixLog::SinkCerr>(AixLog::Severity::warning);
+
+        auto formats = utils::string::split(formatValue->value(), ',');
+        if (inputValue->is_set() && (formats.size() != 1))
+            throw SnapException("a single sampleformat is needed for raw input");
+
+        if (codecValue->is_set())
+        {
+            codecs.clear();
+            for (size_t n = 0; n < codecValue->count(); ++n)
+                codecs.push_back(codecValue->value(n));
+        }
+
+        json results = json::array();
+        json volume = json::array();
+#ifdef HAS_SOXR
+        json softsync = json::array();
+#endif
+        for (const auto& format_str : formats)
+        {
+            SampleFormat format(format_str);
+            std::vector<char> pcm;
+            if (inputValue->is_set())
+            {
+                std::ifstream ifs(inputValue->value(), std::ios::binary);
+                if (!ifs)
+                    throw SnapException("failed to open input: " + inputValue->value());
+                pcm.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+            }
+            else
+            {
+                pcm = generatePcm(format, durationValue->value());
+            }
+
+            for (const auto& chunk_ms : utils::string::split(chunkValue->value(), ','))
+            {
+                for (const auto& codec : codecs)
+                {
+                    cerr << "Benchmarking " << codec << ", " << format.toString() << ", " << chunk_ms << " ms\n";
+                    results.push_back(benchmark(codec, format, cpt::stoul(chunk_ms), pcm));
+                }
+                if (volumeSwitch->is_set())
+                {
+                    cerr << "Benchmarking volume, " << format.toString() << ", " << chunk_ms << " ms\n";
+                    volume.push_back(benchmarkVolume(format, cpt::stoul(chunk_ms), pcm));
+                }
+#ifdef HAS_SOXR
+                if (softsyncSwitch->is_set())
+                {
+                    cerr << "Benchmarking soft sync, " << format.toString() << ", " << chunk_ms << " ms\n";
+                    softsync.push_back(benchmarkSoftSync(format, cpt::stoul(chunk_ms), pcm));
+                }
+#endif
+            }
+        }
+
+        json j;
+        j["version"] = version::code;
+        j["revision"] = version::rev(8);
+#if defined(__aarch64__)
+        j["arch"] = "aarch64";
+#elif defined(__arm__)
+        j["arch"] = "arm";
+#elif defined(__x86_64__)
+        j["arch"] = "x86_64";
+#elif defined(__i386__)
+        j["arch"] = "x86";
+#else
+        j["arch"] = "unknown";
+#endif
+        j["results"] = results;
+        if (statisticsSwitch->is_set())
+        {
+            json statistics = json::array();
+            for (size_t window : {20, 100, 200, 500})
+                statistics.push_back(benchmarkStatistics(window));
+            j["statistics"] = statistics;
+        }
+        if (volumeSwitch->is_set())
+            j["volume"] = volume;
+#ifdef HAS_SOXR
+        if (softsyncSwitch->is_set())
+            j["softsync"] = softsync;
+#endif
+
+        if (outputValue->is_set())
+        {
+            std::ofstream ofs(outputValue->value());
+            ofs << std::setw(4) << j << "\n";
+        }
+        else
+            cout << std::setw(4) << j << "\n";
+    }
+    catch (const std::exception& e)
+    {
+        cerr << "Exception: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
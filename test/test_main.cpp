@@ -18,9 +18,26 @@
 
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
+#include "client/buffer_pool.hpp"
+#include "client/decoder/bitpack_decoder.hpp"
+#include "client/decoder_worker.hpp"
+#include "client/double_buffer.hpp"
+#include "client/dsp_chain.hpp"
+#include "client/pcm_ring.hpp"
+#include "client/sync_histogram.hpp"
+#include "client/player/adaptive_latency.hpp"
+#include "client/player/volume_ramp.hpp"
+#include "client/time_provider.hpp"
 #include "common/aixlog.hpp"
+#include "common/message/factory.hpp"
 #include "common/utils/string_utils.hpp"
+#include "common/utils/thread_utils.hpp"
+#include "server/congestion_monitor.hpp"
+#include "server/encoder/bitpack_encoder.hpp"
+#include "server/streamreader/pcm_stream.hpp"
 #include "server/streamreader/stream_uri.hpp"
+#include <cmath>
+#include <random>
 
 using namespace std;
 
@@ -32,6 +49,22 @@ TEST_CASE("String utils")
 }
 
 
+TEST_CASE("Thread settings")
+{
+    using namespace utils::thread;
+    REQUIRE(parseCpus("0,2-3") == std::vector<int>{0, 2, 3});
+    REQUIRE(parseCpus("").empty());
+
+    Settings settings;
+    parsePolicy("fifo:80", settings);
+    REQUIRE(settings.policy == "fifo");
+    REQUIRE(settings.priority == 80);
+    parsePolicy("rr", settings);
+    REQUIRE(settings.priority == 50);
+    REQUIRE_THROWS(parsePolicy("idle", settings));
+}
+
+
 TEST_CASE("Uri")
 {
     AixLog::Log::init<AixLog::SinkCout>(AixLog::Severity::debug);
@@ -102,3 +135,722 @@ TEST_CASE("Uri")
     REQUIRE(uri.query["bitrate"] == "320");
     REQUIRE(uri.query["killall"] == "false");
 }
+
+
+TEST_CASE("Bitpack codec")
+{
+    auto roundtrip = [](const SampleFormat& format, const std::vector<int32_t>& samples) {
+        msg::PcmChunk chunk(format, 0);
+        chunk.payloadSize = static_cast<uint32_t>(samples.size() * format.sampleSize());
+        chunk.payload = static_cast<char*>(realloc(chunk.payload, chunk.payloadSize));
+        for (size_t n = 0; n < samples.size(); ++n)
+        {
+            if (format.sampleSize() == 2)
+                reinterpret_cast<int16_t*>(chunk.payload)[n] = static_cast<int16_t>(samples[n]);
+            else
+                reinterpret_cast<int32_t*>(chunk.payload)[n] = samples[n];
+        }
+
+        encoder::BitpackEncoder encoder("32");
+        std::shared_ptr<msg::PcmChunk> encoded;
+        encoder.init([&encoded](const encoder::Encoder&, std::shared_ptr<msg::PcmChunk> chunk, double) { encoded = chunk; }, format);
+
+        decoder::BitpackDecoder decoder;
+        REQUIRE(decoder.setHeader(encoder.getHeader().get()).toString() == format.toString());
+        encoder.encode(chunk);
+        REQUIRE(encoded != nullptr);
+        uint32_t encoded_size = encoded->payloadSize;
+        REQUIRE(decoder.decode(encoded.get()));
+        REQUIRE(encoded->payloadSize == chunk.payloadSize);
+        REQUIRE(memcmp(encoded->payload, chunk.payload, chunk.payloadSize) == 0);
+        return encoded_size;
+    };
+
+    // 20ms of a stereo sine, not a multiple of the block size
+    SampleFormat format("44100:16:2");
+    std::vector<int32_t> samples;
+    for (size_t n = 0; n < 882; ++n)
+    {
+        samples.push_back(static_cast<int32_t>(20000 * sin(n * 0.05)));
+        samples.push_back(static_cast<int32_t>(-15000 * sin(n * 0.03)));
+    }
+    REQUIRE(roundtrip(format, samples) < samples.size() * format.sampleSize() * 6 / 10);
+
+    // full scale alternating 32 bit samples need the maximum residual width
+    format.setFormat(48000, 32, 1);
+    samples.clear();
+    for (size_t n = 0; n < 100; ++n)
+        samples.push_back((n % 2 == 0) ? std::numeric_limits<int32_t>::max() : std::numeric_limits<int32_t>::min());
+    roundtrip(format, samples);
+
+    // silence
+    format.setFormat(48000, 24, 2);
+    samples.assign(960, 0);
+    REQUIRE(roundtrip(format, samples) < 100);
+
+    // a frame count that would wrap when rounded up to whole blocks
+    encoder::BitpackEncoder encoder("32");
+    encoder.init([](const encoder::Encoder&, std::shared_ptr<msg::PcmChunk>, double) {}, format);
+    decoder::BitpackDecoder decoder;
+    decoder.setHeader(encoder.getHeader().get());
+    msg::PcmChunk hostile(format, 0);
+    hostile.payloadSize = 16;
+    hostile.payload = static_cast<char*>(realloc(hostile.payload, hostile.payloadSize));
+    memset(hostile.payload, 0xff, hostile.payloadSize);
+    REQUIRE_FALSE(decoder.decode(&hostile));
+}
+
+
+TEST_CASE("Congestion monitor")
+{
+    using namespace std::chrono_literals;
+    CongestionMonitor monitor;
+    auto now = chronos::clk::now();
+
+    // a quiet link stays on the best rendition
+    for (int n = 0; n < 100; ++n)
+    {
+        now += 20ms;
+        monitor.onEnqueue(500, now);
+        monitor.onWritten(500, now, now, now + 1ms);
+        REQUIRE(monitor.update(20ms, 3, now) == 0);
+    }
+    REQUIRE(!monitor.congested());
+
+    // growing backlog: step down, at most once per second, not below the lowest rendition
+    for (int n = 0; n < 200; ++n)
+    {
+        now += 20ms;
+        monitor.update(500ms, 3, now);
+    }
+    REQUIRE(monitor.congested());
+    REQUIRE(monitor.rendition() == 2);
+
+    // the rendition is limited to the available ones
+    REQUIRE(monitor.update(500ms, 2, now) == 1);
+
+    // recovery needs a quiet period, then steps up one by one
+    monitor.update(0ms, 3, now);
+    REQUIRE(monitor.rendition() == 1);
+    for (int n = 0; n < 600; ++n)
+    {
+        now += 20ms;
+        monitor.onEnqueue(500, now);
+        monitor.onWritten(500, now, now, now + 1ms);
+        monitor.update(20ms, 3, now);
+    }
+    REQUIRE(monitor.rendition() == 0);
+}
+
+
+TEST_CASE("Silence message")
+{
+    msg::Silence silence;
+    silence.timestamp = tv(1234, 567890);
+    silence.duration = 200000;
+
+    std::ostringstream oss;
+    silence.serialize(oss);
+    std::string data = oss.str();
+
+    msg::BaseMessage base;
+    base.deserialize(&data[0]);
+    REQUIRE(base.type == message_type::kSilence);
+    REQUIRE(base.size == silence.getSize());
+
+    auto message = msg::message_cast<msg::Silence>(msg::factory::createMessage(base, &data[base.getSize()]));
+    REQUIRE(message != nullptr);
+    REQUIRE(message->timestamp.sec == 1234);
+    REQUIRE(message->timestamp.usec == 567890);
+    REQUIRE(message->getDuration() == std::chrono::milliseconds(200));
+}
+
+
+namespace
+{
+/// Passes the PCM through, but holds back blocks of 4096 frames, like FLAC with a compression level above 2
+class BlockEncoder : public encoder::Encoder
+{
+public:
+    static constexpr uint32_t kBlockSize = 4096;
+
+    void encode(const msg::PcmChunk& chunk) override
+    {
+        buffer_.insert(buffer_.end(), chunk.payload, chunk.payload + chunk.payloadSize);
+        // like libFLAC, a block is encoded as soon as one more sample is available
+        size_t block_bytes = kBlockSize * sampleFormat_.frameSize();
+        size_t bytes = 0;
+        while (buffer_.size() > bytes + block_bytes)
+            bytes += block_bytes;
+        if (bytes == 0)
+            return;
+        auto encoded = std::make_shared<msg::PcmChunk>(sampleFormat_, 0);
+        encoded->resizePayload(static_cast<uint32_t>(bytes));
+        memcpy(encoded->payload, buffer_.data(), bytes);
+        buffer_.erase(buffer_.begin(), buffer_.begin() + static_cast<std::ptrdiff_t>(bytes));
+        encoded_callback_(*this, encoded, static_cast<double>(bytes / sampleFormat_.frameSize()) / sampleFormat_.msRate());
+    }
+
+    std::string name() const override
+    {
+        return "block";
+    }
+
+    std::chrono::nanoseconds getLatency() const override
+    {
+        return std::chrono::nanoseconds((kBlockSize + 1) * 1000000000ull / sampleFormat_.rate());
+    }
+
+protected:
+    void initEncoder() override
+    {
+    }
+
+    std::vector<char> buffer_;
+};
+
+
+class DtxStream : public streamreader::PcmStream
+{
+public:
+    DtxStream(streamreader::PcmListener* listener, boost::asio::io_context& ioc, const streamreader::StreamUri& uri) : PcmStream(listener, ioc, uri)
+    {
+        encoder_ = std::make_unique<BlockEncoder>();
+    }
+
+    void start(const std::chrono::steady_clock::time_point& start)
+    {
+        PcmStream::start();
+        tvEncodedChunk_ = start;
+    }
+
+    std::chrono::milliseconds hangover() const
+    {
+        return dtx_hangover_;
+    }
+
+    using PcmStream::chunkRead;
+};
+
+
+class DtxListener : public streamreader::PcmListener
+{
+public:
+    void onMetaChanged(const streamreader::PcmStream* /*pcmStream*/) override
+    {
+    }
+    void onStateChanged(const streamreader::PcmStream* /*pcmStream*/, streamreader::ReaderState /*state*/) override
+    {
+    }
+    void onChunkRead(const streamreader::PcmStream* /*pcmStream*/, const msg::PcmChunk& /*chunk*/) override
+    {
+    }
+    void onChunkEncoded(const streamreader::PcmStream* /*pcmStream*/, std::shared_ptr<msg::PcmChunk> chunk, double /*duration*/) override
+    {
+        chunks.push_back(chunk);
+    }
+    void onSilence(const streamreader::PcmStream* /*pcmStream*/, std::shared_ptr<msg::Silence> silence) override
+    {
+        silences.push_back(silence);
+    }
+    void onResync(const streamreader::PcmStream* /*pcmStream*/, double /*ms*/) override
+    {
+    }
+
+    std::vector<std::shared_ptr<msg::PcmChunk>> chunks;
+    std::vector<std::shared_ptr<msg::Silence>> silences;
+};
+} // namespace
+
+
+TEST_CASE("Silence suppression")
+{
+    // dtx_ms is shorter than the encoder's block
+    boost::asio::io_context ioc;
+    DtxListener listener;
+    DtxStream stream(&listener, ioc, streamreader::StreamUri("pipe:///tmp/snapfifo?name=test&codec=pcm&sampleformat=48000:16:1&chunk_ms=20&dtx_ms=20"));
+    std::chrono::steady_clock::time_point t0(std::chrono::seconds(100));
+    stream.start(t0);
+    REQUIRE(stream.hangover() >= std::chrono::milliseconds(86 + 20));
+
+    // audio, silence, audio: every audio frame carries its position in the input
+    SampleFormat format("48000:16:1");
+    uint32_t pos = 0;
+    for (size_t n = 0; n < 70; ++n)
+    {
+        msg::PcmChunk chunk(format, 20);
+        auto* samples = reinterpret_cast<int16_t*>(chunk.payload);
+        bool silent = (n >= 20) && (n < 50);
+        for (uint32_t i = 0; i < chunk.getFrameCount(); ++i, ++pos)
+            samples[i] = silent ? 0 : static_cast<int16_t>(pos % 32000 + 1);
+        stream.chunkRead(chunk);
+    }
+    REQUIRE(!listener.silences.empty());
+
+    auto toFrames = [&t0](const tv& timestamp) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::seconds(timestamp.sec) + std::chrono::microseconds(timestamp.usec) -
+                                                                        t0.time_since_epoch());
+        return static_cast<int64_t>(std::llround(us.count() * 48. / 1000.));
+    };
+
+    // the held back audio must be played at its position, not after the silence
+    size_t audio_frames = 0;
+    for (const auto& chunk : listener.chunks)
+    {
+        int64_t start = toFrames(chunk->timestamp);
+        auto* samples = reinterpret_cast<int16_t*>(chunk->payload);
+        for (uint32_t i = 0; i < chunk->payloadSize / format.frameSize(); ++i)
+        {
+            if (samples[i] == 0)
+                continue;
+            ++audio_frames;
+            REQUIRE(samples[i] == static_cast<int16_t>((start + i) % 32000 + 1));
+            for (const auto& silence : listener.silences)
+            {
+                int64_t silence_start = toFrames(silence->timestamp);
+                REQUIRE(((start + i < silence_start) || (start + i >= silence_start + silence->duration * 48 / 1000)));
+            }
+        }
+    }
+    // everything but the tail in the encoder's block
+    REQUIRE(audio_frames > 40 * 960 - BlockEncoder::kBlockSize - 1);
+}
+
+
+TEST_CASE("Client stats")
+{
+    SyncHistogram histogram;
+    for (int n = 1; n <= 100; ++n)
+        histogram.add(chronos::usec((n % 2 == 0) ? n : -n));
+    auto percentiles = histogram.take();
+    REQUIRE(percentiles.count == 100);
+    REQUIRE(percentiles.p50 == chronos::usec(50));
+    REQUIRE(percentiles.p95 == chronos::usec(95));
+    REQUIRE(percentiles.p99 == chronos::usec(99));
+    REQUIRE(percentiles.max == chronos::usec(100));
+    REQUIRE(histogram.take().count == 0);
+
+    msg::ClientStats stats;
+    stats.period = 10000;
+    stats.sync_error_p99 = static_cast<uint32_t>(percentiles.p99.count());
+    stats.hard_syncs = 2;
+    stats.correction = -12500;
+    stats.time_to_first_audio = 95;
+
+    std::ostringstream oss;
+    stats.serialize(oss);
+    std::string data = oss.str();
+
+    msg::BaseMessage base;
+    base.deserialize(&data[0]);
+    REQUIRE(base.type == message_type::kClientStats);
+    REQUIRE(base.size == stats.getSize());
+
+    auto message = msg::message_cast<msg::ClientStats>(msg::factory::createMessage(base, &data[base.getSize()]));
+    REQUIRE(message != nullptr);
+    REQUIRE(message->period == 10000);
+    REQUIRE(message->sync_error_p99 == 99);
+    REQUIRE(message->hard_syncs == 2);
+    REQUIRE(message->correction == -12500);
+    REQUIRE(message->time_to_first_audio == 95);
+}
+
+
+TEST_CASE("Wire chunk view")
+{
+    msg::WireChunk chunk(4);
+    chunk.timestamp = tv(12, 345);
+    memcpy(chunk.payload, "abcd", 4);
+    std::ostringstream oss;
+    chunk.serialize(oss);
+    std::string data = oss.str();
+
+    auto pool = std::make_shared<BufferPool>(2);
+    auto buffer = pool->get(data.size());
+    memcpy(buffer->data(), data.data(), data.size());
+    auto* raw = buffer.get();
+
+    msg::BaseMessage base;
+    base.deserialize(buffer->data());
+    auto view = std::make_unique<msg::PcmChunk>();
+    view->deserialize(base, buffer->data() + base.getSize(), buffer);
+    buffer.reset();
+    REQUIRE(view->timestamp.sec == 12);
+    REQUIRE(view->payloadSize == 4);
+    // the payload is not copied
+    REQUIRE(view->payload == raw->data() + base.getSize() + 12);
+    REQUIRE(pool->size() == 0);
+
+    // resizing copies the payload out of the shared buffer
+    view->resizePayload(6);
+    REQUIRE(std::string(view->payload, 4) == "abcd");
+    REQUIRE(pool->size() == 1);
+    REQUIRE(pool->get(1).get() == raw);
+}
+
+
+TEST_CASE("PCM ring")
+{
+    using namespace std::chrono_literals;
+    SampleFormat format("1000:16:1");
+    PcmRing ring(format, 100, 4);
+    chronos::time_point_clk t0(10s);
+
+    std::vector<int16_t> in(60);
+    for (size_t n = 0; n < in.size(); ++n)
+        in[n] = static_cast<int16_t>(n);
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 60, t0));
+    // not enough space
+    REQUIRE(!ring.write(reinterpret_cast<char*>(in.data()), 50, t0));
+    REQUIRE(ring.available() == 60);
+    REQUIRE(ring.start() == t0);
+
+    std::vector<int16_t> out(60);
+    REQUIRE(ring.read(reinterpret_cast<char*>(out.data()), 50) == 50);
+    REQUIRE(out[49] == 49);
+    REQUIRE(ring.start() == t0 + 50ms);
+
+    // wrap around, with a gap of 1s in the timestamps
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 60, t0 + 1s));
+    REQUIRE(ring.available() == 70);
+    REQUIRE(ring.segment() == 10);
+    ring.consume(10);
+    REQUIRE(ring.start() == t0 + 1s);
+    REQUIRE(ring.end() == t0 + 1s + 60ms);
+
+    // peek across the wrap around without consuming
+    ring.peek(reinterpret_cast<char*>(out.data()), 30, 30);
+    REQUIRE(out[0] == 30);
+    REQUIRE(out[29] == 59);
+    REQUIRE(ring.available() == 60);
+
+    // silence
+    ring.clear();
+    REQUIRE(ring.available() == 0);
+    REQUIRE(ring.write(nullptr, 20, t0 + 2s));
+    REQUIRE(ring.read(reinterpret_cast<char*>(out.data()), 30) == 20);
+    REQUIRE(out[19] == 0);
+
+    // flush up to a position, newer frames are kept
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 10, t0 + 3s));
+    uint64_t pos = ring.written();
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 20, t0 + 4s));
+    ring.clear(pos);
+    REQUIRE(ring.available() == 20);
+    REQUIRE(ring.start() == t0 + 4s);
+
+    // a full ring evicts the oldest frames, but not while the consumer is reading
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 60, t0 + 5s));
+    {
+        PcmRing::ReadLock lock(ring);
+        REQUIRE(lock.owns());
+        REQUIRE(!ring.write(reinterpret_cast<char*>(in.data()), 40, t0 + 6s, true));
+        REQUIRE(!ring.resize(200));
+    }
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 40, t0 + 6s, true));
+    REQUIRE(ring.available() == 100);
+    REQUIRE(ring.start() == t0 + 5s);
+    REQUIRE(ring.segment() == 60);
+    // frames that don't fit at all are dropped
+    REQUIRE(!ring.write(nullptr, 101, t0 + 7s, true));
+
+    // shrinking keeps the newest frames and their timestamps
+    REQUIRE(ring.resize(30));
+    REQUIRE(ring.capacity() == 30);
+    REQUIRE(ring.available() == 30);
+    REQUIRE(ring.start() == t0 + 6s + 10ms);
+    REQUIRE(ring.read(reinterpret_cast<char*>(out.data()), 30) == 30);
+    REQUIRE(out[0] == 10);
+    REQUIRE(out[29] == 39);
+
+    // growing keeps all frames
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 25, t0 + 8s));
+    REQUIRE(ring.resize(100));
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()) + 25 * sizeof(int16_t), 35, t0 + 8s + 25ms));
+    REQUIRE(ring.available() == 60);
+    REQUIRE(ring.read(reinterpret_cast<char*>(out.data()), 60) == 60);
+    for (size_t n = 0; n < out.size(); ++n)
+        REQUIRE(out[n] == static_cast<int16_t>(n));
+
+    // evicting frees marks, too
+    for (size_t n = 0; n < 3; ++n)
+        REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 1, t0 + 9s + n * 1s));
+    // the mark of the consumed frames is still in use
+    REQUIRE(!ring.write(reinterpret_cast<char*>(in.data()), 1, t0 + 12s));
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 1, t0 + 12s, true));
+    REQUIRE(ring.available() == 4);
+    REQUIRE(ring.start() == t0 + 9s);
+    REQUIRE(ring.write(reinterpret_cast<char*>(in.data()), 1, t0 + 13s, true));
+    REQUIRE(ring.available() == 4);
+    REQUIRE(ring.start() == t0 + 10s);
+}
+
+
+TEST_CASE("Volume ramp")
+{
+    player::VolumeRamp ramp;
+    // the first gain is applied immediately
+    ramp.setGain(0.5, 4);
+    std::vector<int16_t> samples(8, 1000);
+    ramp.apply(reinterpret_cast<char*>(samples.data()), 4, 2, 2);
+    REQUIRE(samples[0] == 500);
+    REQUIRE(samples[7] == 500);
+
+    // ramp down to 0 within 4 frames, per frame for all channels
+    ramp.setGain(0., 4);
+    std::vector<int16_t> ramped(12, 1000);
+    ramp.apply(reinterpret_cast<char*>(ramped.data()), 6, 2, 2);
+    REQUIRE(ramped[0] == ramped[1]);
+    REQUIRE(ramped[0] < 500);
+    REQUIRE(ramped[2] < ramped[0]);
+    REQUIRE(ramped[7] == 0);
+    REQUIRE(ramped[11] == 0);
+    REQUIRE(ramp.gain() == 0.);
+
+    // 24 bit in 32 bit container, gain of 256 with saturation
+    ramp.setGain(256., 0);
+    std::vector<int32_t> wide{1000, -1000, 1 << 24, -(1 << 24)};
+    ramp.apply(reinterpret_cast<char*>(wide.data()), 2, 2, 4);
+    REQUIRE(wide[0] == 256000);
+    REQUIRE(wide[1] == -256000);
+    REQUIRE(wide[2] == std::numeric_limits<int32_t>::max());
+    REQUIRE(wide[3] == std::numeric_limits<int32_t>::min());
+}
+
+TEST_CASE("Adaptive latency")
+{
+    using namespace std::chrono_literals;
+    auto now = player::AdaptiveLatency::clock::now();
+    player::AdaptiveLatency latency(100ms);
+    auto callbacks = [&](std::chrono::milliseconds duration, std::chrono::milliseconds interval) {
+        bool changed = false;
+        for (auto end = now + duration; now < end; now += interval)
+            changed |= latency.callback(now);
+        return changed;
+    };
+
+    // a burst of underflows grows the buffer by 50%
+    REQUIRE(!latency.underflow(now));
+    REQUIRE(!latency.underflow(now + 1s));
+    REQUIRE(latency.underflow(now + 2s));
+    REQUIRE(latency.latency() == 150ms);
+    now += 2s;
+
+    // shrink back to the target in steps, after stable periods
+    REQUIRE(!callbacks(29s, 20ms));
+    REQUIRE(callbacks(2s, 20ms));
+    REQUIRE(latency.latency() == 120ms);
+    callbacks(31s, 20ms);
+    REQUIRE(latency.latency() == 100ms);
+    REQUIRE(!callbacks(60s, 20ms));
+
+    // a callback gap that almost drains the buffer grows it, up to the max
+    REQUIRE(latency.callback(now + 90ms));
+    REQUIRE(latency.latency() == 150ms);
+    for (size_t n = 0; n < 20; ++n)
+        latency.underflow(now + 90ms);
+    REQUIRE(latency.latency() == 500ms);
+}
+
+TEST_CASE("DSP chain")
+{
+    SampleFormat format("48000:16:2");
+    std::vector<int16_t> samples(2 * 4800);
+    auto sine = [&](double freq) {
+        for (size_t n = 0; n < samples.size() / 2; ++n)
+            samples[2 * n] = samples[2 * n + 1] = static_cast<int16_t>(10000 * sin(2 * M_PI * freq * n / 48000.));
+    };
+    auto peak = [&](size_t channel) {
+        int16_t max = 0;
+        // skip the settling time
+        for (size_t n = 2400; n < samples.size() / 2; ++n)
+            max = std::max<int16_t>(max, static_cast<int16_t>(std::abs(samples[2 * n + channel])));
+        return max;
+    };
+
+    // crossover: the highpass on channel 0 removes 50Hz, the lowpass on channel 1 keeps it
+    DspChain crossover(format, "crossover@0:1000:high,crossover@1:1000:low");
+    sine(50);
+    crossover.process(reinterpret_cast<char*>(samples.data()), 4800);
+    REQUIRE(peak(0) < 100);
+    REQUIRE(peak(1) > 9900);
+    REQUIRE(crossover.delay() > chronos::usec(0));
+
+    // peaking filter at the center frequency
+    DspChain eq(format, "peaking:1000:-6:1");
+    sine(1000);
+    eq.process(reinterpret_cast<char*>(samples.data()), 4800);
+    REQUIRE(std::abs(peak(0) - 5012) < 50);
+
+    // mono and limiter
+    DspChain mono(format, "matrix:0.5/0.5:0.5/0.5,limiter:-20");
+    for (size_t n = 0; n < samples.size() / 2; ++n)
+    {
+        samples[2 * n] = 20000;
+        samples[2 * n + 1] = 0;
+    }
+    mono.process(reinterpret_cast<char*>(samples.data()), 4800);
+    REQUIRE(samples[0] == samples[1]);
+    REQUIRE(std::abs(samples[0] - 3276) <= 1);
+    REQUIRE(mono.delay() == chronos::usec(0));
+
+    // the output is rounded to nearest, 0.6 * n is never exactly halfway
+    DspChain attenuate(format, "matrix:0.6/0:0/0.6");
+    for (size_t n = 0; n < samples.size() / 2; ++n)
+        samples[2 * n] = samples[2 * n + 1] = static_cast<int16_t>(static_cast<int>(n) - 2400);
+    attenuate.process(reinterpret_cast<char*>(samples.data()), 4800);
+    bool rounded = true;
+    for (size_t n = 0; n < samples.size() / 2; ++n)
+        rounded &= (samples[2 * n] == std::lround(0.6 * (static_cast<int>(n) - 2400)));
+    REQUIRE(rounded);
+
+    REQUIRE_THROWS(DspChain::validate("reverb:10"));
+    REQUIRE_NOTHROW(DspChain::validate("lowpass:30000"));
+    REQUIRE_NOTHROW(DspChain(SampleFormat("96000:16:2"), "lowpass:30000"));
+    REQUIRE_THROWS(DspChain(format, "lowpass:30000"));
+    REQUIRE_THROWS(DspChain::validate("lowpass:-1"));
+    REQUIRE_THROWS(DspChain::validate("matrix@1:0.5/0.5:0.5/0.5"));
+    REQUIRE_THROWS(DspChain::validate("matrix:1/0:0/1/0"));
+    REQUIRE_THROWS(DspChain(format, "matrix:1/0/0:0/1/0:0/0/1"));
+    REQUIRE_NOTHROW(DspChain::validate("lowpass@2-3:80,limiter:-1:100"));
+}
+
+
+TEST_CASE("Decoder worker")
+{
+    SampleFormat format("48000:16:2");
+    msg::PcmChunk pcm(format, 20);
+    memset(pcm.payload, 0x10, pcm.payloadSize);
+    encoder::BitpackEncoder encoder("32");
+    std::shared_ptr<msg::PcmChunk> encoded;
+    encoder.init([&encoded](const encoder::Encoder&, std::shared_ptr<msg::PcmChunk> chunk, double) { encoded = chunk; }, format);
+    encoder.encode(pcm);
+    REQUIRE(encoded != nullptr);
+    auto decoder = std::make_unique<decoder::BitpackDecoder>();
+    decoder->setHeader(encoder.getHeader().get());
+
+    // the chunks are due after the test, so the history keeps them
+    const auto start = TimeProvider::serverNow() + 2s;
+    auto toTv = [](const chronos::time_point_clk& time) {
+        auto us = std::chrono::duration_cast<chronos::usec>(time.time_since_epoch()).count();
+        return tv(static_cast<int32_t>(us / 1000000), static_cast<int32_t>(us % 1000000));
+    };
+    auto chunk = [&](const chronos::time_point_clk& time) {
+        auto wire = std::make_unique<msg::PcmChunk>(*encoded);
+        wire->timestamp = toTv(time);
+        return wire;
+    };
+    auto silence = [&](const chronos::time_point_clk& time) {
+        auto marker = std::make_unique<msg::Silence>();
+        marker->timestamp = toTv(time);
+        marker->duration = 20000;
+        return marker;
+    };
+    // @return true if exactly @p frames frames were added to @p stream
+    auto holds = [](const Stream& stream, uint32_t frames) { return stream.waitForChunk(1s, frames) && !stream.waitForChunk(50ms, frames + 1); };
+
+    auto first = std::make_shared<Stream>(format, format);
+    auto second = std::make_shared<Stream>(format, format);
+    DecoderWorker worker;
+    worker.start(std::move(decoder), format, first);
+    for (size_t n = 0; n < 10; ++n)
+        worker.push(chunk(start + n * 20ms));
+    worker.push(silence(start + 200ms));
+    REQUIRE(holds(*first, 11 * 960));
+
+    // join: the backlog of the second output's connection is copies, the second stream gets the decoded history
+    worker.addStream(second);
+    for (size_t n = 0; n < 10; ++n)
+        worker.push(chunk(start + n * 20ms));
+    worker.push(silence(start + 200ms));
+    REQUIRE(holds(*second, 11 * 960));
+    REQUIRE(holds(*first, 11 * 960));
+
+    // copies of new chunks are rejected, both streams get each chunk once
+    for (size_t n = 11; n < 15; ++n)
+    {
+        worker.push(chunk(start + n * 20ms));
+        worker.push(chunk(start + n * 20ms));
+    }
+    REQUIRE(holds(*first, 15 * 960));
+    REQUIRE(holds(*second, 15 * 960));
+
+    // the server's source restarts and the timestamps go back, the chunks are new and not copies
+    for (size_t n = 0; n < 5; ++n)
+    {
+        worker.push(chunk(start + 5ms + n * 20ms));
+        worker.push(chunk(start + 5ms + n * 20ms));
+    }
+    REQUIRE(holds(*first, 20 * 960));
+    REQUIRE(holds(*second, 20 * 960));
+    worker.stop();
+}
+
+
+TEST_CASE("DoubleBuffer")
+{
+    DoubleBuffer<int64_t> buffer(50);
+    std::deque<int64_t> reference;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int64_t> dist(-1000, 1000);
+    for (size_t n = 0; n < 1000; ++n)
+    {
+        auto value = dist(rng);
+        buffer.add(value);
+        reference.push_back(value);
+        if (reference.size() > 50)
+            reference.pop_front();
+
+        std::vector<int64_t> sorted(reference.begin(), reference.end());
+        std::sort(sorted.begin(), sorted.end());
+        REQUIRE(buffer.size() == reference.size());
+        REQUIRE(buffer.median() == sorted[sorted.size() / 2]);
+        REQUIRE(buffer.percentile(90) == sorted[(size_t)((sorted.size() - 1) * 0.9f)]);
+    }
+    REQUIRE(buffer.full());
+
+    buffer.setSize(10);
+    REQUIRE(buffer.size() == 10);
+    REQUIRE(buffer.getBuffer().front() == reference[40]);
+    buffer.clear();
+    REQUIRE(buffer.median() == 0);
+}
+
+
+TEST_CASE("TimeProvider")
+{
+    using namespace std::chrono;
+    // server clock: 5s ahead, running 40ppm faster. Wi-Fi like delays with spikes
+    auto offset = [](const chronos::time_point_clk& local) {
+        return 5000000000 + duration_cast<nanoseconds>(local.time_since_epoch() - 1000s).count() * 40 / 1000000;
+    };
+    auto toTv = [](int64_t ns) { return tv(static_cast<int32_t>(ns / 1000000000), static_cast<int32_t>((ns % 1000000000) / 1000)); };
+    std::mt19937 rng(42);
+    std::exponential_distribution<double> jitter(1. / 2000000.);
+    std::uniform_int_distribution<int> spike(0, 9);
+
+    auto& time_provider = TimeProvider::getInstance();
+    REQUIRE(!time_provider.converged());
+    chronos::time_point_clk local(1000s);
+    size_t syncs = 0;
+    while (local < chronos::time_point_clk(1000s + 10min))
+    {
+        int64_t d1 = 500000 + static_cast<int64_t>(jitter(rng)) + ((spike(rng) == 0) ? 50000000 : 0);
+        int64_t d2 = 500000 + static_cast<int64_t>(jitter(rng));
+        auto received = local + nanoseconds(d1 + d2);
+        time_provider.setDiff(toTv(offset(local) + d1), toTv(-offset(local) + d2), received);
+        local = received + time_provider.getSyncInterval();
+        ++syncs;
+    }
+
+    REQUIRE(time_provider.converged());
+    REQUIRE(time_provider.getSyncInterval() > 1s);
+    REQUIRE(syncs < 600);
+    REQUIRE(std::abs(time_provider.getSkew() - 40.) < 2.);
+    // prediction between the syncs, well below the 2ms mean delay jitter
+    for (auto ahead : {0s, 4s, 8s})
+    {
+        auto error = time_provider.getDiffToServer<nanoseconds>(local + ahead).count() - offset(local + ahead);
+        REQUIRE(std::abs(error) < 500000);
+    }
+}